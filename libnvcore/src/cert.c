@@ -138,6 +138,7 @@ void pki_passport_destroy(passport_t *passport)
 	X509_free(passport->certificate);
 	X509_free(passport->cacert);
 	X509_STORE_free(passport->cacert_store);
+	free(passport->network);
 	free(passport);
 }
 
@@ -31,6 +31,7 @@ typedef struct passport {
 	EVP_PKEY *keyring;
 	X509_STORE *cacert_store;
 	X509 *cacert;
+	char *network;		/* named in the handshake if set, see krypt_set_servername() */
 } passport_t;
 
 char *cert_cname(X509 *);
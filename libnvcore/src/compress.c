@@ -0,0 +1,239 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Compression of the ethernet frames carried in the tunnel.
+ *
+ * Most of the traffic crossing a virtual network is already encrypted
+ * or compressed by the applications, so every frame can't go through
+ * the compressor blindly. The flows are hashed into a small direct
+ * mapped table that keeps an average of the ratio achieved; a flow
+ * that doesn't compress well is sent raw for COMPRESS_BYPASS frames,
+ * then sampled again.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "compress.h"
+#include "logger.h"
+
+uint8_t compress_supported()
+{
+#ifdef HAVE_LZ4
+	return COMPRESS_LZ4;
+#else
+	return COMPRESS_NONE;
+#endif
+}
+
+compress_t *compress_new(uint8_t method)
+{
+	compress_t *compress;
+
+	if (method != COMPRESS_LZ4 || compress_supported() != COMPRESS_LZ4) {
+		jlog(L_WARNING, "compression method %i not supported", method);
+		return NULL;
+	}
+
+	compress = calloc(1, sizeof(compress_t));
+	if (compress == NULL) {
+		return NULL;
+	}
+
+	compress->method = method;
+#ifdef HAVE_LZ4
+	compress->state = malloc(LZ4_sizeofState());
+	compress->buf_size = COMPRESS_HDR_LEN + LZ4_compressBound(COMPRESS_FRAME_MAX);
+	compress->buf = malloc(compress->buf_size);
+#endif
+	if (compress->state == NULL || compress->buf == NULL) {
+		compress_free(compress);
+		return NULL;
+	}
+
+	return compress;
+}
+
+void compress_free(compress_t *compress)
+{
+	if (compress == NULL) {
+		return;
+	}
+
+	free(compress->state);
+	free(compress->buf);
+	free(compress);
+}
+
+/* FNV-1a over the addresses, ethertype and, for IPv4, the protocol
+ * and transport ports of the frame. */
+static uint32_t compress_flow_key(const uint8_t *frame, size_t len)
+{
+	uint32_t key = 2166136261u;
+	size_t i, ihl;
+	uint8_t proto;
+
+	if (len >= 34 && frame[12] == 0x08 && frame[13] == 0x00) {
+
+		ihl = (frame[14] & 0x0f) * 4;
+		proto = frame[23];
+
+		if ((proto == 6 || proto == 17) && len >= 14 + ihl + 4) {
+			for (i = 14 + ihl; i < 14 + ihl + 4; i++)
+				key = (key ^ frame[i]) * 16777619u;
+		}
+		key = (key ^ proto) * 16777619u;
+
+		/* source and destination addresses */
+		for (i = 26; i < 34; i++)
+			key = (key ^ frame[i]) * 16777619u;
+	}
+
+	for (i = 0; i < 14 && i < len; i++)
+		key = (key ^ frame[i]) * 16777619u;
+
+	return key;
+}
+
+/* Compress a frame into compress->buf. Returns the compressed length,
+ * or 0 if the frame must be sent raw. */
+size_t compress_frame(compress_t *compress, const uint8_t *frame, size_t len)
+{
+	struct compress_flow *flow;
+	uint32_t key;
+	uint32_t ratio;
+	int zlen = 0;
+
+	compress->stats.frames++;
+	compress->stats.bytes_in += len;
+
+	if (len < COMPRESS_FRAME_MIN || len > COMPRESS_FRAME_MAX) {
+		goto raw;
+	}
+
+	key = compress_flow_key(frame, len);
+	flow = &compress->flow[key & (COMPRESS_FLOWS - 1)];
+
+	if (flow->key != key) {
+		flow->key = key;
+		flow->ratio = 0;
+		flow->bypass = 0;
+	}
+
+	if (flow->bypass > 0) {
+		flow->bypass--;
+		goto raw;
+	}
+
+#ifdef HAVE_LZ4
+	zlen = LZ4_compress_fast_extState(compress->state, (const char *)frame,
+			(char *)compress->buf + COMPRESS_HDR_LEN, len,
+			compress->buf_size - COMPRESS_HDR_LEN, 1);
+#endif
+	if (zlen <= 0 || (size_t)zlen + COMPRESS_HDR_LEN >= len) {
+		ratio = 256;
+	} else {
+		ratio = ((zlen + COMPRESS_HDR_LEN) << 8) / len;
+	}
+
+	/* the first sample of a flow seeds the average */
+	if (flow->ratio == 0)
+		flow->ratio = ratio;
+	else
+		flow->ratio = (flow->ratio * 7 + ratio) / 8;
+
+	if (flow->ratio > COMPRESS_RATIO_MAX) {
+		flow->ratio = 0;
+		flow->bypass = COMPRESS_BYPASS;
+	}
+
+	if (ratio >= 256) {
+		goto raw;
+	}
+
+	compress->buf[0] = len >> 8;
+	compress->buf[1] = len & 0xff;
+
+	compress->stats.compressed++;
+	compress->stats.bytes_out += zlen + COMPRESS_HDR_LEN;
+
+	return zlen + COMPRESS_HDR_LEN;
+
+raw:
+	compress->stats.bypassed++;
+	compress->stats.bytes_out += len;
+
+	return 0;
+}
+
+/* Decompress a frame into a newly allocated buffer. The decoder keeps
+ * no state, compress may be NULL for frames that arrive before the
+ * local side has enabled compression. */
+int decompress_frame(compress_t *compress, const uint8_t *data, size_t len,
+			uint8_t **frame, size_t *frame_len)
+{
+	size_t orig_len;
+	int ret = -1;
+
+	if (len <= COMPRESS_HDR_LEN) {
+		return -1;
+	}
+
+	orig_len = (data[0] << 8) | data[1];
+	if (orig_len == 0) {
+		return -1;
+	}
+
+	*frame = malloc(orig_len);
+	if (*frame == NULL) {
+		return -1;
+	}
+
+#ifdef HAVE_LZ4
+	ret = LZ4_decompress_safe((const char *)data + COMPRESS_HDR_LEN, (char *)*frame,
+			len - COMPRESS_HDR_LEN, orig_len);
+#endif
+	if (ret < 0 || (size_t)ret != orig_len) {
+		free(*frame);
+		*frame = NULL;
+		return -1;
+	}
+
+	*frame_len = orig_len;
+	if (compress)
+		compress->stats.decompressed++;
+
+	return 0;
+}
+
+void compress_stats_log(compress_t *compress, const char *name)
+{
+	struct compress_stats *s;
+
+	if (compress == NULL) {
+		return;
+	}
+
+	s = &compress->stats;
+	jlog(L_NOTICE, "%s compression: %llu frames, %llu compressed, %llu bypassed, "
+		"%llu decompressed, %llu -> %llu bytes", name,
+		(unsigned long long)s->frames, (unsigned long long)s->compressed,
+		(unsigned long long)s->bypassed, (unsigned long long)s->decompressed,
+		(unsigned long long)s->bytes_in, (unsigned long long)s->bytes_out);
+}
@@ -0,0 +1,66 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Compression methods, as carried in the Netinfo exchange */
+#define COMPRESS_NONE		0
+#define COMPRESS_LZ4		1
+
+#define COMPRESS_FRAME_MIN	128	/* smaller frames always travel raw */
+#define COMPRESS_FRAME_MAX	65535
+#define COMPRESS_HDR_LEN	2	/* original frame length, big endian */
+
+#define COMPRESS_FLOWS		256	/* direct mapped, power of two */
+#define COMPRESS_RATIO_MAX	230	/* out/in * 256 above which a flow is bypassed */
+#define COMPRESS_BYPASS		64	/* frames a bypassed flow sends raw before re-sampling */
+
+struct compress_stats {
+	uint64_t frames;		/* ethernet frames seen on transmit */
+	uint64_t compressed;		/* frames sent compressed */
+	uint64_t bypassed;		/* frames sent raw */
+	uint64_t decompressed;		/* frames received compressed */
+	uint64_t bytes_in;		/* raw bytes of the frames seen on transmit */
+	uint64_t bytes_out;		/* bytes of those frames handed to the encoder */
+};
+
+struct compress_flow {
+	uint32_t key;
+	uint16_t ratio;			/* EWMA of out/in * 256 */
+	uint16_t bypass;		/* frames left before the next sample */
+};
+
+typedef struct compress {
+	uint8_t method;
+	void *state;			/* compressor scratch state */
+	uint8_t *buf;			/* compressed frame */
+	size_t buf_size;
+	struct compress_flow flow[COMPRESS_FLOWS];
+	struct compress_stats stats;
+} compress_t;
+
+uint8_t compress_supported();
+compress_t *compress_new(uint8_t method);
+void compress_free(compress_t *compress);
+size_t compress_frame(compress_t *compress, const uint8_t *frame, size_t len);
+int decompress_frame(compress_t *compress, const uint8_t *data, size_t len,
+			uint8_t **frame, size_t *frame_len);
+void compress_stats_log(compress_t *compress, const char *name);
+
+#endif /* COMPRESS_H */
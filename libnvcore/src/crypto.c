@@ -25,13 +25,56 @@
 #include <openssl/conf.h>
 #include <openssl/engine.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 
+#include <pthread.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#endif
+
 #include "crypto.h"
 #include "logger.h"
 
 static int s_server_auth_session_id_context = 2;
 
+/* Tickets are sealed with this key, servers sharing it resume each
+ * other's sessions. Random unless krypt_set_ticket_key() is called. */
+static uint8_t krypt_ticket_key[KRYPT_TICKET_KEY_LEN];
+
+/* Sessions a client resumes on its next connection, by server name */
+static struct {
+	char name[64];
+	uint8_t protocol;
+	SSL_SESSION *session;
+} krypt_sessions[KRYPT_SESSION_CACHE];
+static pthread_mutex_t krypt_sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* DTLS cookies are a HMAC of the client address with this secret */
+static uint8_t krypt_cookie_secret[KRYPT_COOKIE_SECRET_LEN];
+
+/* Answers the ClientHello of the unknown addresses with a stateless
+ * HelloVerifyRequest. Once a client echoes a valid cookie, the SSL
+ * object goes on with the handshake in the next DTLS server connection,
+ * see krypt_secure_connection(). Driven by the netbus thread only. */
+static struct {
+	SSL_CTX *ctx;
+	SSL *ssl;
+	BIO *internal_bio;
+	BIO *network_bio;
+	uint8_t ready;			// a valid cookie was received
+	uint8_t peer[32];		// address of the client being checked
+	size_t peer_len;
+} krypt_listener;
+
 static DH *get_dh_1024() {
 
 	static unsigned char dh1024_p[]={
@@ -111,6 +154,80 @@ static long post_handshake_check(krypt_t *krypt)
 	return 0;
 }
 
+/* Offer the session last negotiated with this server name */
+static void krypt_resume(krypt_t *kconn, const char *name)
+{
+	int i;
+
+	pthread_mutex_lock(&krypt_sessions_lock);
+	for (i = 0; i < KRYPT_SESSION_CACHE; i++) {
+		if (krypt_sessions[i].session != NULL &&
+		    krypt_sessions[i].protocol == kconn->protocol &&
+		    strcmp(krypt_sessions[i].name, name) == 0) {
+			SSL_set_session(kconn->ssl, krypt_sessions[i].session);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&krypt_sessions_lock);
+}
+
+/* Keep the session of an authenticated server, replacing the previous
+ * one of the same name or the oldest entry */
+static void krypt_save_session(krypt_t *kconn)
+{
+	const char *name;
+	X509 *cert;
+	int i, slot = 0;
+
+	name = SSL_get_servername(kconn->ssl, TLSEXT_NAMETYPE_host_name);
+	if (name == NULL || strlen(name) >= sizeof(krypt_sessions[0].name))
+		return;
+
+	/* an ADH session authenticates nobody */
+	if ((cert = SSL_get_peer_certificate(kconn->ssl)) == NULL)
+		return;
+	X509_free(cert);
+
+	pthread_mutex_lock(&krypt_sessions_lock);
+	for (i = 0; i < KRYPT_SESSION_CACHE; i++) {
+		if (krypt_sessions[i].session == NULL ||
+		    (krypt_sessions[i].protocol == kconn->protocol &&
+		     strcmp(krypt_sessions[i].name, name) == 0)) {
+			slot = i;
+			break;
+		}
+	}
+	if (i == KRYPT_SESSION_CACHE) {
+		SSL_SESSION_free(krypt_sessions[0].session);
+		memmove(&krypt_sessions[0], &krypt_sessions[1],
+			sizeof(krypt_sessions[0]) * (KRYPT_SESSION_CACHE - 1));
+		krypt_sessions[KRYPT_SESSION_CACHE - 1].session = NULL;
+		slot = KRYPT_SESSION_CACHE - 1;
+	}
+
+	if (krypt_sessions[slot].session != NULL)
+		SSL_SESSION_free(krypt_sessions[slot].session);
+	strcpy(krypt_sessions[slot].name, name);
+	krypt_sessions[slot].protocol = kconn->protocol;
+	krypt_sessions[slot].session = SSL_get1_session(kconn->ssl);
+	pthread_mutex_unlock(&krypt_sessions_lock);
+}
+
+int krypt_set_ticket_key(const uint8_t *key, size_t len)
+{
+	if (len != KRYPT_TICKET_KEY_LEN)
+		return -1;
+
+	memcpy(krypt_ticket_key, key, KRYPT_TICKET_KEY_LEN);
+	return 0;
+}
+
+/* The key is handed over to the process that replaces this one */
+void krypt_get_ticket_key(uint8_t *key)
+{
+	memcpy(key, krypt_ticket_key, KRYPT_TICKET_KEY_LEN);
+}
+
 static int verify_callback(int ok, X509_STORE_CTX *store)
 {
 	(void)(store); /* unused */
@@ -140,7 +257,8 @@ int krypt_set_rsa(krypt_t *kconn)
 		return 0;
 	}
 
-	SSL_set_cipher_list(kconn->ssl, "AES256-SHA");
+	// AES-GCM first, the kernel can take over the TLS 1.2 GCM records
+	SSL_set_cipher_list(kconn->ssl, "AES128-GCM-SHA256:AES256-SHA");
 
 	// Load the trusted certificate store into our SSL object
 	X509_STORE_add_cert(SSL_CTX_get_cert_store(kconn->ctx), kconn->passport->cacert);
@@ -170,6 +288,86 @@ void krypt_add_passport(krypt_t *kconn, passport_t *passport)
 	kconn->passport = passport;
 }
 
+/* The server picks the passport of the network named by the client in
+ * the server name extension and completes a single RSA handshake.
+ * Without the extension, or for an unknown network, it stays ADH and
+ * the client is stepped up by renegotiation as before. */
+static int servername_callback(SSL *ssl, int *ad, void *arg)
+{
+	krypt_t *kconn = arg;
+	passport_t *passport;
+	const char *name;
+
+	(void)(ad); /* unused */
+
+	name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	if (name == NULL || kconn->passport_lookup == NULL)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	passport = kconn->passport_lookup(name);
+	if (passport == NULL) {
+		jlog(L_NOTICE, "no network named %s, fall back to step up", name);
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+
+	kconn->passport = passport;
+	krypt_set_rsa(kconn);
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+void krypt_set_passport_lookup(krypt_t *kconn, passport_t *(*lookup)(const char *))
+{
+	kconn->passport_lookup = lookup;
+}
+
+/* Name the network of our certificate in the server name extension so
+ * the server can authenticate us in the first handshake. ADH stays in
+ * the cipher list for servers that don't know the extension, they step
+ * the connection up to RSA by renegotiation. */
+int krypt_set_servername(krypt_t *kconn)
+{
+	node_info_t *node_info = NULL;
+	const char *name;
+	char *cn = NULL;
+	int ret = -1;
+
+	if (kconn->passport == NULL || kconn->conn_type != KRYPT_CLIENT)
+		return -1;
+
+	/* a switch names the network it trunks, its certificate doesn't */
+	if (kconn->passport->network != NULL) {
+		name = kconn->passport->network;
+	} else {
+		if ((cn = cert_cname(kconn->passport->certificate)) == NULL)
+			return -1;
+
+		if ((node_info = cn2node_info(cn)) == NULL)
+			goto out;
+
+		if (node_info->v == 1)
+			name = node_info->network_id;
+		else
+			name = node_info->network_uuid;
+	}
+
+	if (SSL_set_tlsext_host_name(kconn->ssl, name) != 1) {
+		jlog(L_WARNING, "unable to set the server name");
+		goto out;
+	}
+
+	/* a reconnection skips the RSA exchange */
+	krypt_resume(kconn, name);
+
+	SSL_set_cipher_list(kconn->ssl, "AES128-GCM-SHA256:AES256-SHA:ADH");
+	ret = 0;
+
+out:
+	node_info_destroy(node_info);
+	free(cn);
+	return ret;
+}
+
 void krypt_set_renegotiate(krypt_t *kconn)
 {
 	if (kconn->conn_type == KRYPT_SERVER) {
@@ -185,6 +383,184 @@ void krypt_print_cipher(krypt_t *kconn)
 	jlog(L_NOTICE, "cipher: %s", SSL_get_cipher_name(kconn->ssl));
 }
 
+#if defined(__linux__) && defined(TLS_1_2_VERSION)
+/* TLS 1.2 PRF (RFC 5246 section 5) */
+static void tls12_prf(const EVP_MD *md, const uint8_t *secret, int secret_len,
+			const char *label, const uint8_t *seed, int seed_len,
+			uint8_t *out, int out_len)
+{
+	uint8_t a[EVP_MAX_MD_SIZE];
+	uint8_t block[EVP_MAX_MD_SIZE];
+	uint8_t buf[EVP_MAX_MD_SIZE + 128];
+	unsigned int a_len, block_len;
+	int label_len, n;
+
+	label_len = strlen(label);
+	memcpy(buf + EVP_MAX_MD_SIZE, label, label_len);
+	memcpy(buf + EVP_MAX_MD_SIZE + label_len, seed, seed_len);
+
+	// A(1) = HMAC(secret, label + seed)
+	HMAC(md, secret, secret_len, buf + EVP_MAX_MD_SIZE, label_len + seed_len, a, &a_len);
+
+	while (out_len > 0) {
+		// HMAC(secret, A(i) + label + seed)
+		memcpy(buf + EVP_MAX_MD_SIZE - a_len, a, a_len);
+		HMAC(md, secret, secret_len, buf + EVP_MAX_MD_SIZE - a_len,
+			a_len + label_len + seed_len, block, &block_len);
+
+		n = out_len < (int)block_len ? out_len : (int)block_len;
+		memcpy(out, block, n);
+		out += n;
+		out_len -= n;
+
+		// A(i+1) = HMAC(secret, A(i))
+		memcpy(block, a, a_len);
+		HMAC(md, secret, secret_len, block, a_len, a, &a_len);
+	}
+}
+
+static int ktls_set_crypto_info(int fd, int direction, const uint8_t *key,
+			const uint8_t *salt, const uint8_t *seq)
+{
+	struct tls12_crypto_info_aes_gcm_128 info;
+
+	memset(&info, 0, sizeof(info));
+	info.info.version = TLS_1_2_VERSION;
+	info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+	memcpy(info.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	memcpy(info.salt, salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	// explicit nonce of the records we send, must only be unique
+	memcpy(info.iv, seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	return setsockopt(fd, SOL_TLS, direction, &info, sizeof(info));
+}
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/* The record sequence numbers of a TLS connection, which OpenSSL 1.1
+ * doesn't expose: counted from the record headers going each way, they
+ * restart after a ChangeCipherSpec. */
+static void krypt_record_callback(int write_p, int version, int content_type,
+		const void *buf, size_t len, SSL *ssl, void *arg)
+{
+	krypt_t *kconn = arg;
+	int dir = write_p ? 1 : 0;
+
+	(void)version;
+	(void)ssl;
+
+	if (content_type != SSL3_RT_HEADER || len < 1)
+		return;
+
+	if (kconn->record_ccs & (1 << dir))
+		kconn->record_seq[dir]++;
+
+	if (((const uint8_t *)buf)[0] == SSL3_RT_CHANGE_CIPHER_SPEC) {
+		kconn->record_ccs |= 1 << dir;
+		kconn->record_seq[dir] = 0;
+	}
+}
+#endif
+
+/* Hand the record layer of a TLS 1.2 AES128-GCM connection over to the
+ * kernel once the handshake is done; the socket then carries plaintext
+ * to and from user space. The receive side is only offloaded if no
+ * record is left in the BIO pair. Returns the directions offloaded, 0
+ * if the kernel can't take the connection and the user space path
+ * stays in place. */
+int krypt_ktls_enable(krypt_t *kconn, int fd)
+{
+#if defined(__linux__) && defined(TLS_1_2_VERSION)
+	SSL_SESSION *session;
+	const SSL_CIPHER *cipher;
+	uint8_t seed[2 * SSL3_RANDOM_SIZE];
+	uint8_t key_block[2 * 16 + 2 * 4];	// client key, server key, client salt, server salt
+	uint8_t master_key[SSL_MAX_MASTER_KEY_LENGTH];
+	uint8_t tx_seq[8], rx_seq[8];
+	uint8_t *tx_key, *rx_key, *tx_salt, *rx_salt;
+	int master_key_len;
+	int i;
+
+	kconn->ktls = 0;
+
+	if (kconn->status != KRYPT_SECURE || SSL_version(kconn->ssl) != TLS1_2_VERSION)
+		return 0;
+
+	cipher = SSL_get_current_cipher(kconn->ssl);
+	if (cipher == NULL || (SSL_CIPHER_get_id(cipher) & 0xffff) != 0x009c)	// TLS_RSA_WITH_AES_128_GCM_SHA256
+		return 0;
+
+	// user space still has encrypted data to send
+	if (kconn->buf_encrypt_data_size > 0 || BIO_ctrl_pending(kconn->network_bio) > 0)
+		return 0;
+
+	session = SSL_get_session(kconn->ssl);
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	master_key_len = session->master_key_length;
+	memcpy(master_key, session->master_key, master_key_len);
+	memcpy(seed, kconn->ssl->s3->server_random, SSL3_RANDOM_SIZE);
+	memcpy(seed + SSL3_RANDOM_SIZE, kconn->ssl->s3->client_random, SSL3_RANDOM_SIZE);
+	memcpy(tx_seq, kconn->ssl->s3->write_sequence, 8);
+	memcpy(rx_seq, kconn->ssl->s3->read_sequence, 8);
+#else
+	master_key_len = SSL_SESSION_get_master_key(session, master_key, sizeof(master_key));
+	SSL_get_server_random(kconn->ssl, seed, SSL3_RANDOM_SIZE);
+	SSL_get_client_random(kconn->ssl, seed + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+	// the record layer is opaque, see krypt_record_callback()
+	for (i = 0; i < 8; i++) {
+		tx_seq[i] = kconn->record_seq[1] >> (56 - 8 * i);
+		rx_seq[i] = kconn->record_seq[0] >> (56 - 8 * i);
+	}
+#endif
+
+	tls12_prf(EVP_sha256(), master_key, master_key_len, "key expansion",
+		seed, sizeof(seed), key_block, sizeof(key_block));
+	OPENSSL_cleanse(master_key, sizeof(master_key));
+
+	if (kconn->conn_type == KRYPT_CLIENT) {
+		tx_key = key_block;
+		rx_key = key_block + 16;
+		tx_salt = key_block + 32;
+		rx_salt = key_block + 36;
+	} else {
+		tx_key = key_block + 16;
+		rx_key = key_block;
+		tx_salt = key_block + 36;
+		rx_salt = key_block + 32;
+	}
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+		jlog(L_DEBUG, "kernel TLS unavailable: %s", strerror(errno));
+		goto out;
+	}
+
+	if (ktls_set_crypto_info(fd, TLS_TX, tx_key, tx_salt, tx_seq) < 0) {
+		// the ULP is attached but idle, records keep going through SSL
+		jlog(L_DEBUG, "kernel TLS transmit failed: %s", strerror(errno));
+		goto out;
+	}
+	kconn->ktls |= KRYPT_KTLS_TX;
+
+	if (SSL_pending(kconn->ssl) == 0 && BIO_ctrl_pending(kconn->internal_bio) == 0 &&
+		ktls_set_crypto_info(fd, TLS_RX, rx_key, rx_salt, rx_seq) == 0)
+		kconn->ktls |= KRYPT_KTLS_RX;
+
+	jlog(L_NOTICE, "kernel TLS enabled:%s%s",
+		kconn->ktls & KRYPT_KTLS_TX ? " tx" : "",
+		kconn->ktls & KRYPT_KTLS_RX ? " rx" : "");
+out:
+	OPENSSL_cleanse(key_block, sizeof(key_block));
+	return kconn->ktls;
+#else
+	(void)(kconn); /* unused */
+	(void)(fd); /* unused */
+
+	return 0;
+#endif
+}
+
 int krypt_do_handshake(krypt_t *kconn, uint8_t *buf, size_t buf_data_size)
 {
 	int ret = 0;
@@ -209,6 +585,11 @@ int krypt_do_handshake(krypt_t *kconn, uint8_t *buf, size_t buf_data_size)
 		post_handshake_check(kconn);
 		kconn->status = KRYPT_SECURE;
 		status = 0;
+
+		if (SSL_session_reused(kconn->ssl))
+			jlog(L_NOTICE, "session resumed");
+		else if (kconn->conn_type == KRYPT_CLIENT)
+			krypt_save_session(kconn);
 	}
 	else if (ret == 0) {
 		// Error
@@ -233,6 +614,174 @@ int krypt_do_handshake(krypt_t *kconn, uint8_t *buf, size_t buf_data_size)
 	return status;
 }
 
+static int krypt_cookie(uint8_t *cookie, unsigned int *cookie_len)
+{
+	if (HMAC(EVP_sha256(), krypt_cookie_secret, KRYPT_COOKIE_SECRET_LEN,
+		krypt_listener.peer, krypt_listener.peer_len, cookie, cookie_len) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int cookie_generate_callback(SSL *ssl, unsigned char *cookie, unsigned int *cookie_len)
+{
+	(void)(ssl); /* unused */
+
+	return krypt_cookie(cookie, cookie_len);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static int cookie_verify_callback(SSL *ssl, const unsigned char *cookie, unsigned int cookie_len)
+#else
+static int cookie_verify_callback(SSL *ssl, unsigned char *cookie, unsigned int cookie_len)
+#endif
+{
+	uint8_t expected[EVP_MAX_MD_SIZE];
+	unsigned int expected_len;
+
+	(void)(ssl); /* unused */
+
+	if (krypt_cookie(expected, &expected_len) == 0 || cookie_len != expected_len)
+		return 0;
+
+	return CRYPTO_memcmp(cookie, expected, expected_len) == 0;
+}
+
+static void krypt_listener_free()
+{
+	SSL_free(krypt_listener.ssl);	// frees the internal BIO
+	BIO_free(krypt_listener.network_bio);
+	SSL_CTX_free(krypt_listener.ctx);
+
+	krypt_listener.ssl = NULL;
+	krypt_listener.network_bio = NULL;
+	krypt_listener.internal_bio = NULL;
+	krypt_listener.ctx = NULL;
+	krypt_listener.ready = 0;
+}
+
+static int krypt_listener_new()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	krypt_listener.ctx = SSL_CTX_new(DTLS_method());
+#else
+	krypt_listener.ctx = SSL_CTX_new(DTLSv1_method());
+#endif
+	if (krypt_listener.ctx == NULL) {
+		jlog(L_ERROR, "unable to create the DTLS listener context");
+		ssl_error_stack();
+		return -1;
+	}
+
+	SSL_CTX_set_cookie_generate_cb(krypt_listener.ctx, cookie_generate_callback);
+	SSL_CTX_set_cookie_verify_cb(krypt_listener.ctx, cookie_verify_callback);
+
+	BIO_new_bio_pair(&krypt_listener.internal_bio, 0, &krypt_listener.network_bio, 0);
+
+	krypt_listener.ssl = SSL_new(krypt_listener.ctx);
+	if (krypt_listener.ssl == NULL) {
+		krypt_listener_free();
+		return -1;
+	}
+
+	SSL_set_bio(krypt_listener.ssl, krypt_listener.internal_bio, krypt_listener.internal_bio);
+	SSL_set_options(krypt_listener.ssl, SSL_OP_COOKIE_EXCHANGE | SSL_OP_NO_QUERY_MTU);
+	SSL_set_mtu(krypt_listener.ssl, KRYPT_DTLS_MTU);
+	SSL_set_accept_state(krypt_listener.ssl);
+
+	return 0;
+}
+
+/* Check the first datagram of an unknown client before anything is
+ * allocated for it. Returns 1 when it is a ClientHello carrying a valid
+ * cookie, otherwise the HelloVerifyRequest to send back, if any, is in
+ * reply, at most KRYPT_HELLO_VERIFY_MAX bytes. */
+int krypt_dtls_listen(const void *peer, size_t peer_len, const uint8_t *buf, size_t buf_data_size,
+			uint8_t *reply, size_t *reply_len)
+{
+	uint8_t drain[256];
+	int nbyte;
+	int ret;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	BIO_ADDR *client;
+#else
+	uint8_t client[128];	// left alone, the BIO pair has no peer address
+#endif
+
+	*reply_len = 0;
+
+	// the client that had a valid cookie went away before its connection
+	if (krypt_listener.ready)
+		krypt_listener_free();
+
+	if (krypt_listener.ssl == NULL && krypt_listener_new() < 0)
+		return -1;
+
+	if (peer_len > sizeof(krypt_listener.peer))
+		return -1;
+	memcpy(krypt_listener.peer, peer, peer_len);
+	krypt_listener.peer_len = peer_len;
+
+	if (BIO_write(krypt_listener.network_bio, buf, buf_data_size) != (int)buf_data_size) {
+		krypt_listener_free();
+		return -1;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	client = BIO_ADDR_new();
+	ret = DTLSv1_listen(krypt_listener.ssl, client);
+	BIO_ADDR_free(client);
+#else
+	ret = DTLSv1_listen(krypt_listener.ssl, client);
+#endif
+
+	nbyte = BIO_read(krypt_listener.network_bio, reply, KRYPT_HELLO_VERIFY_MAX);
+	if (nbyte > 0)
+		*reply_len = nbyte;
+
+	if (ret == 1) {
+		krypt_listener.ready = 1;
+		return 1;
+	}
+
+	if (ret < 0) {
+		ERR_clear_error();
+		krypt_listener_free();
+		return 0;
+	}
+
+	// not a ClientHello, don't let it in front of the next datagram
+	while (BIO_read(krypt_listener.internal_bio, drain, sizeof(drain)) > 0)
+		;
+
+	return 0;
+}
+
+/* Nothing retransmits a lost DTLS handshake flight but the SSL timer,
+ * call it periodically while the handshake is in progress. Returns 1
+ * when a flight waits in buf_encrypt to be sent again. */
+int krypt_dtls_timeout(krypt_t *kconn)
+{
+	int nbyte;
+
+	if (kconn->status != KRYPT_HANDSHAKE) {
+		return 0;
+	}
+
+	if (DTLSv1_handle_timeout(kconn->ssl) <= 0) {
+		return 0;
+	}
+
+	nbyte = BIO_read(kconn->network_bio, kconn->buf_encrypt, kconn->buf_encrypt_size);
+	if (nbyte <= 0) {
+		return 0;
+	}
+
+	kconn->buf_encrypt_data_size = nbyte;
+
+	return 1;
+}
+
 int krypt_push_encrypted_data(krypt_t *kconn, uint8_t *buf, size_t buf_data_size)
 {
 	int nbyte;
@@ -323,10 +872,35 @@ int krypt_encrypt_buf(krypt_t *kconn, uint8_t *buf, size_t buf_data_size)
 
 int krypt_secure_connection(krypt_t *kconn, uint8_t protocol, uint8_t conn_type, uint8_t security_level)
 {
+	uint8_t listened = 0;
+
 	switch (protocol) {
 
 		case KRYPT_TLS:
-			kconn->ctx = SSL_CTX_new(TLSv1_method());
+			// negotiate up to TLS 1.2, peers limited to TLS 1.0 still connect.
+			// TLS 1.3 has no renegotiation to step up from ADH, its sessions
+			// are only known after the handshake and kTLS wants 1.2 keys.
+			kconn->ctx = SSL_CTX_new(SSLv23_method());
+			if (kconn->ctx != NULL) {
+				SSL_CTX_set_options(kconn->ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+				SSL_CTX_set_max_proto_version(kconn->ctx, TLS1_2_VERSION);
+#endif
+			}
+			break;
+
+		case KRYPT_DTLS:
+			// the client whose cookie was just verified
+			if (conn_type == KRYPT_SERVER && krypt_listener.ready) {
+				kconn->ctx = krypt_listener.ctx;
+				listened = 1;
+				break;
+			}
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+			kconn->ctx = SSL_CTX_new(DTLS_method());
+#else
+			kconn->ctx = SSL_CTX_new(DTLSv1_method());
+#endif
 			break;
 
 		default:
@@ -340,18 +914,52 @@ int krypt_secure_connection(krypt_t *kconn, uint8_t protocol, uint8_t conn_type,
 		return -1;
 	}
 
-	// Create the BIO pair
-	BIO_new_bio_pair(&kconn->internal_bio, 0, &kconn->network_bio, 0);
-
-	// Create the SSL object
-	kconn->ssl = SSL_new(kconn->ctx);
+	kconn->protocol = protocol;
+
+	// a session resumed on another server of the pair must decrypt there
+	if (conn_type == KRYPT_SERVER)
+		SSL_CTX_set_tlsext_ticket_keys(kconn->ctx, krypt_ticket_key, KRYPT_TICKET_KEY_LEN);
+
+	if (listened) {
+		// the ClientHello waits in the SSL object, its cookie was checked
+		kconn->internal_bio = krypt_listener.internal_bio;
+		kconn->network_bio = krypt_listener.network_bio;
+		kconn->ssl = krypt_listener.ssl;
+		SSL_clear_options(kconn->ssl, SSL_OP_COOKIE_EXCHANGE);
+
+		krypt_listener.ssl = NULL;
+		krypt_listener.network_bio = NULL;
+		krypt_listener.internal_bio = NULL;
+		krypt_listener.ctx = NULL;
+		krypt_listener.ready = 0;
+	} else {
+		// Create the BIO pair
+		BIO_new_bio_pair(&kconn->internal_bio, 0, &kconn->network_bio, 0);
+
+		// Create the SSL object
+		kconn->ssl = SSL_new(kconn->ctx);
+	}
 
 	if (security_level == KRYPT_ADH)
 		krypt_set_adh(kconn);
 
-	SSL_set_bio(kconn->ssl, kconn->internal_bio, kconn->internal_bio);
+	if (!listened)
+		SSL_set_bio(kconn->ssl, kconn->internal_bio, kconn->internal_bio);
 	SSL_set_mode(kconn->ssl, SSL_MODE_AUTO_RETRY);
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (protocol == KRYPT_TLS) {
+		SSL_set_msg_callback(kconn->ssl, krypt_record_callback);
+		SSL_set_msg_callback_arg(kconn->ssl, kconn);
+	}
+#endif
+
+	// the BIO pair can't tell the path MTU, records must fit in a datagram
+	if (protocol == KRYPT_DTLS) {
+		SSL_set_options(kconn->ssl, SSL_OP_NO_QUERY_MTU);
+		SSL_set_mtu(kconn->ssl, KRYPT_DTLS_MTU);
+	}
+
 	if (security_level == KRYPT_RSA)
 		krypt_set_rsa(kconn);
 
@@ -360,7 +968,14 @@ int krypt_secure_connection(krypt_t *kconn, uint8_t protocol, uint8_t conn_type,
 
 		case KRYPT_SERVER:
 			jlog(L_NOTICE, "connection type server");
-			SSL_set_accept_state(kconn->ssl);
+			// the listener is already past the HelloVerifyRequest
+			if (!listened)
+				SSL_set_accept_state(kconn->ssl);
+
+			if (kconn->passport_lookup != NULL) {
+				SSL_CTX_set_tlsext_servername_callback(kconn->ctx, servername_callback);
+				SSL_CTX_set_tlsext_servername_arg(kconn->ctx, kconn);
+			}
 
 			break;
 
@@ -382,6 +997,15 @@ int krypt_secure_connection(krypt_t *kconn, uint8_t protocol, uint8_t conn_type,
 
 void krypt_fini()
 {
+	int i;
+
+	for (i = 0; i < KRYPT_SESSION_CACHE; i++) {
+		SSL_SESSION_free(krypt_sessions[i].session);
+		krypt_sessions[i].session = NULL;
+	}
+
+	krypt_listener_free();
+
 	CONF_modules_free();
 	CONF_modules_finish();
 	CONF_modules_unload(1);
@@ -400,6 +1024,16 @@ int krypt_init()
 	SSL_load_error_strings();
 	OpenSSL_add_all_algorithms();
 
+	if (RAND_bytes(krypt_ticket_key, KRYPT_TICKET_KEY_LEN) != 1) {
+		jlog(L_ERROR, "unable to generate the ticket key");
+		return -1;
+	}
+
+	if (RAND_bytes(krypt_cookie_secret, KRYPT_COOKIE_SECRET_LEN) != 1) {
+		jlog(L_ERROR, "unable to generate the cookie secret");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -22,7 +22,9 @@
 #include "cert.h"
 
 #define KRYPT_TLS	0x1	// Transport Layer Security { NET_TCP, NET_UDT }
-#define KRYPT_DTLS	0x2	// Datagram Transport Layer Security { unused }
+#define KRYPT_DTLS	0x2	// Datagram Transport Layer Security { NET_DTLS }
+
+#define KRYPT_DTLS_MTU	1400	// Largest DTLS datagram, leaves room for IPv6 and an outer tunnel
 
 #define KRYPT_CLIENT	0x1	// Connection type Client
 #define KRYPT_SERVER	0x2	// Connection type Server
@@ -35,6 +37,14 @@
 #define KRYPT_ADH	0x1	// Basic security level ADH
 #define KRYPT_RSA	0x2	// Maximum security level RSA
 
+#define KRYPT_KTLS_TX	0x1	// Records sent are encrypted by the kernel
+#define KRYPT_KTLS_RX	0x2	// Records received are decrypted by the kernel
+
+#define KRYPT_TICKET_KEY_LEN	48	// Session ticket name, HMAC and AES keys
+#define KRYPT_SESSION_CACHE	4	// Sessions a client keeps to resume
+#define KRYPT_COOKIE_SECRET_LEN	32	// HMAC key of the DTLS cookies
+#define KRYPT_HELLO_VERIFY_MAX	256	// HelloVerifyRequest datagram
+
 typedef struct krypt {
 
 	SSL *ssl;			// SSL Connection
@@ -46,11 +56,16 @@ typedef struct krypt {
 	BIO *network_bio;		// BIO is a I/O abstraction provided by openSSL
 
 	passport_t *passport;		// Certificate and key used to negotiate RSA
+	passport_t *(*passport_lookup)(const char *);	// Server, passport of the network named by the client
 	char client_cn[256];		// Client certificate commonName
 
 	uint8_t security_level;		// Security level negotiated { ADH, RSA }
 	uint8_t status;			// Status { NOINIT, HANDSHAKE, SECURE, FAIL }
 	uint8_t conn_type;
+	uint8_t protocol;		// Protocol { TLS, DTLS }
+	uint8_t ktls;			// Directions offloaded to the kernel { KTLS_TX, KTLS_RX }
+	uint64_t record_seq[2];		// Next TLS record sequence number { read, write }
+	uint8_t record_ccs;		// ChangeCipherSpec seen, bit per direction
 
 	uint8_t *buf_decrypt;		// Decrypted data
 	size_t buf_decrypt_size;	// Buffer size in memory
@@ -71,7 +86,15 @@ int krypt_decrypt_buf(krypt_t *kconn);
 int krypt_do_handshake(krypt_t *kconn, uint8_t *buf, size_t buf_data_size);
 int krypt_secure_connection(krypt_t *kconn, uint8_t protocol, uint8_t state, uint8_t security_level);
 void krypt_add_passport(krypt_t *kconn, passport_t *passport);
+void krypt_set_passport_lookup(krypt_t *kconn, passport_t *(*lookup)(const char *));
+int krypt_set_servername(krypt_t *kconn);
 void krypt_print_cipher(krypt_t *kconn);
+int krypt_ktls_enable(krypt_t *kconn, int fd);
+int krypt_dtls_timeout(krypt_t *kconn);
+int krypt_dtls_listen(const void *peer, size_t peer_len, const uint8_t *buf, size_t buf_data_size,
+			uint8_t *reply, size_t *reply_len);
+int krypt_set_ticket_key(const uint8_t *key, size_t len);
+void krypt_get_ticket_key(uint8_t *key);
 
 void krypt_fini();
 int krypt_init();
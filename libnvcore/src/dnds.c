@@ -130,6 +130,87 @@ int DNDSMessage_get_pdu(DNDSMessage_t *msg, pdu_PR *pdu)
 	return DNDS_success;
 }
 
+int DNDSTemplate_new(DNDSTemplate_t **tpl, pdu_PR pdu, dnop_PR operation)
+{
+	*tpl = calloc(1, sizeof(DNDSTemplate_t));
+	if (*tpl == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	if (DNDSMessage_new(&(*tpl)->msg) != DNDS_success) {
+		free(*tpl);
+		*tpl = NULL;
+		return DNDS_alloc_failed;
+	}
+
+	DNDSMessage_set_channel((*tpl)->msg, 0);
+	DNDSMessage_set_pdu((*tpl)->msg, pdu);
+
+	if (pdu == pdu_PR_dnm) {
+		DNMessage_set_seqNumber((*tpl)->msg, 1);
+		DNMessage_set_ackNumber((*tpl)->msg, 0);
+		DNMessage_set_operation((*tpl)->msg, operation);
+	}
+
+	return DNDS_success;
+}
+
+static int DNDSTemplate_serialize(const void *buf, size_t size, void *ext_ptr)
+{
+	DNDSTemplate_t *tpl = ext_ptr;
+	uint8_t *der;
+
+	der = realloc(tpl->der, tpl->der_size + size);
+	if (der == NULL) {
+		return -1;
+	}
+
+	memcpy(der + tpl->der_size, buf, size);
+	tpl->der = der;
+	tpl->der_size += size;
+
+	return 0;
+}
+
+/* Keep the DER image of the message as it is now, for a reply that
+ * never changes. */
+int DNDSTemplate_encode(DNDSTemplate_t *tpl)
+{
+	asn_enc_rval_t ec;
+
+	free(tpl->der);
+	tpl->der = NULL;
+	tpl->der_size = 0;
+
+	ec = der_encode(&asn_DEF_DNDSMessage, tpl->msg, DNDSTemplate_serialize, tpl);
+	if (ec.encoded == -1) {
+		free(tpl->der);
+		tpl->der = NULL;
+		tpl->der_size = 0;
+		return DNDS_conversion_failed;
+	}
+
+	return DNDS_success;
+}
+
+int DNDSTemplate_del(DNDSTemplate_t *tpl)
+{
+	if (tpl == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	// the frame belongs to the caller
+	if (tpl->msg->pdu.present == pdu_PR_ethernet) {
+		DNDSMessage_set_ethernet(tpl->msg, NULL, 0);
+	}
+
+	DNDSMessage_del(tpl->msg);
+	free(tpl->der);
+	free(tpl);
+
+	return DNDS_success;
+}
+
 int DNDSMessage_set_ethernet(DNDSMessage_t *msg, uint8_t *frame, size_t length)
 {
 	msg->pdu.choice.ethernet.buf = frame;
@@ -146,6 +227,112 @@ int DNDSMessage_get_ethernet(DNDSMessage_t *msg, uint8_t **frame, size_t *length
 	return 0;
 }
 
+/* Read a BER tag and definite length, the single byte tags of the
+ * DNDSMessage encoding only. Returns 1, 0 if more data is needed, or
+ * -1 if the encoding is not one we can skip over. */
+static int ber_peek_tl(const uint8_t *buf, size_t len, uint8_t *tag, size_t *hdr_len, size_t *val_len)
+{
+	size_t n, i;
+
+	if (len < 2)
+		return 0;
+
+	*tag = buf[0];
+	if ((*tag & 0x1f) == 0x1f)
+		return -1;
+
+	if (buf[1] < 0x80) {
+		*hdr_len = 2;
+		*val_len = buf[1];
+		return 1;
+	}
+
+	/* indefinite or oversized length */
+	n = buf[1] & 0x7f;
+	if (n == 0 || n > 3)
+		return -1;
+
+	if (len < 2 + n)
+		return 0;
+
+	*val_len = 0;
+	for (i = 0; i < n; i++)
+		*val_len = (*val_len << 8) | buf[2 + i];
+	*hdr_len = 2 + n;
+
+	return 1;
+}
+
+/* Locate the frame of an encoded ethernet DNDSMessage without decoding
+ * it, so it can be relayed as is:
+ *   30 L { 80 L version, 81 01 channel, A2 L { 82 L 00 frame } }
+ * Returns 1 with the message length, its channel and the position of
+ * the frame, 0 if more data is needed, -1 for any other message. */
+int DNDSMessage_peek_ethernet(const uint8_t *buf, size_t len, size_t *msg_len,
+				uint8_t *channel, size_t *frame_offset, size_t *frame_len)
+{
+	uint8_t tag;
+	size_t hdr, val, off, end;
+	int ret;
+
+	if ((ret = ber_peek_tl(buf, len, &tag, &hdr, &val)) != 1)
+		return ret;
+	if (tag != 0x30 || val > DNDS_PEEK_MAX)
+		return -1;
+	end = hdr + val;
+	off = hdr;
+
+	/* version */
+	if (off >= len)
+		return 0;
+	if ((ret = ber_peek_tl(buf + off, len - off, &tag, &hdr, &val)) != 1)
+		return ret;
+	if (tag != 0x80)
+		return -1;
+	off += hdr + val;
+
+	/* channel, 0..127 fits in one byte */
+	if (off >= len)
+		return 0;
+	if ((ret = ber_peek_tl(buf + off, len - off, &tag, &hdr, &val)) != 1)
+		return ret;
+	if (tag != 0x81 || val != 1)
+		return -1;
+	if (off + hdr >= len)
+		return 0;
+	*channel = buf[off + hdr];
+	off += hdr + val;
+
+	/* pdu, the CHOICE is explicitly tagged */
+	if (off >= len)
+		return 0;
+	if ((ret = ber_peek_tl(buf + off, len - off, &tag, &hdr, &val)) != 1)
+		return ret;
+	if (tag != 0xA2 || off + hdr + val != end)
+		return -1;
+	off += hdr;
+
+	/* ethernet, a primitive BIT STRING with no unused bits */
+	if (off >= len)
+		return 0;
+	if ((ret = ber_peek_tl(buf + off, len - off, &tag, &hdr, &val)) != 1)
+		return ret;
+	if (tag != 0x82 || val == 0 || off + hdr + val != end)
+		return -1;
+	off += hdr;
+
+	if (len < end)
+		return 0;
+	if (buf[off] != 0)
+		return -1;
+
+	*msg_len = end;
+	*frame_offset = off + 1;
+	*frame_len = val - 1;
+
+	return 1;
+}
+
 // DNMessage
 int DNMessage_set_seqNumber(DNDSMessage_t *msg, uint32_t seqNumber)
 {
@@ -1003,6 +1190,118 @@ int NetinfoRequest_get_macAddr(DNDSMessage_t *msg, uint8_t *macAddr)
 	return DNDS_success;
 }
 
+int NetinfoRequest_set_compression(DNDSMessage_t *msg, uint8_t compression)
+{
+	if (msg == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoRequest) {
+		return DNDS_invalid_op;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.netinfoRequest.compression = (long *)calloc(1, sizeof(long));
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoRequest.compression == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	*msg->pdu.choice.dnm.dnop.choice.netinfoRequest.compression = compression;
+
+	return DNDS_success;
+}
+
+int NetinfoRequest_get_compression(DNDSMessage_t *msg, uint8_t *compression)
+{
+	if (msg == NULL || compression == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoRequest) {
+		return DNDS_invalid_op;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoRequest.compression == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	*compression = *msg->pdu.choice.dnm.dnop.choice.netinfoRequest.compression;
+
+	return DNDS_success;
+}
+
+int NetinfoRequest_set_ipAddress(DNDSMessage_t *msg, char *ipAddress)
+{
+	OCTET_STRING_t *addr;
+
+	if (msg == NULL || ipAddress == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoRequest) {
+		return DNDS_invalid_op;
+	}
+
+	addr = (OCTET_STRING_t *)calloc(1, sizeof(OCTET_STRING_t));
+	if (addr == NULL) {
+		return DNDS_alloc_failed;
+	}
+	msg->pdu.choice.dnm.dnop.choice.netinfoRequest.ipAddress = addr;
+
+	addr->buf = (uint8_t *)calloc(1, sizeof(struct in_addr));
+	if (addr->buf == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	if (inet_pton(AF_INET, ipAddress, addr->buf) != 1) {
+		return DNDS_conversion_failed;
+	}
+
+	addr->size = sizeof(struct in_addr);
+
+	return DNDS_success;
+}
+
+int NetinfoRequest_get_ipAddress(DNDSMessage_t *msg, char *ipAddress)
+{
+	OCTET_STRING_t *addr;
+
+	if (msg == NULL || ipAddress == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoRequest) {
+		return DNDS_invalid_op;
+	}
+
+	addr = msg->pdu.choice.dnm.dnop.choice.netinfoRequest.ipAddress;
+	if (addr == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	if (addr->size != sizeof(struct in_addr) ||
+	    inet_ntop(AF_INET, addr->buf, ipAddress, INET_ADDRSTRLEN) == NULL) {
+		return DNDS_conversion_failed;
+	}
+
+	return DNDS_success;
+}
+
 // NetinfoResponse
 int NetinfoResponse_set_ipAddress(DNDSMessage_t *msg, char *ipAddress)
 {
@@ -1148,6 +1447,100 @@ int NetinfoResponse_get_result(DNDSMessage_t *msg, e_DNDSResult *result)
 	return DNDS_success;
 }
 
+int NetinfoResponse_set_compression(DNDSMessage_t *msg, uint8_t compression)
+{
+	if (msg == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoResponse) {
+		return DNDS_invalid_op;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.netinfoResponse.compression = (long *)calloc(1, sizeof(long));
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoResponse.compression == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	*msg->pdu.choice.dnm.dnop.choice.netinfoResponse.compression = compression;
+
+	return DNDS_success;
+}
+
+int NetinfoResponse_get_compression(DNDSMessage_t *msg, uint8_t *compression)
+{
+	if (msg == NULL || compression == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoResponse) {
+		return DNDS_invalid_op;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoResponse.compression == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	*compression = *msg->pdu.choice.dnm.dnop.choice.netinfoResponse.compression;
+
+	return DNDS_success;
+}
+
+int NetinfoResponse_set_dataPort(DNDSMessage_t *msg, uint16_t dataPort)
+{
+	if (msg == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoResponse) {
+		return DNDS_invalid_op;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.netinfoResponse.dataPort = (long *)calloc(1, sizeof(long));
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoResponse.dataPort == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	*msg->pdu.choice.dnm.dnop.choice.netinfoResponse.dataPort = dataPort;
+
+	return DNDS_success;
+}
+
+int NetinfoResponse_get_dataPort(DNDSMessage_t *msg, uint16_t *dataPort)
+{
+	if (msg == NULL || dataPort == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_netinfoResponse) {
+		return DNDS_invalid_op;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.choice.netinfoResponse.dataPort == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	*dataPort = *msg->pdu.choice.dnm.dnop.choice.netinfoResponse.dataPort;
+
+	return DNDS_success;
+}
+
 // ProvRequest
 int ProvRequest_set_provCode(DNDSMessage_t *msg, char *provCode, size_t length)
 {
@@ -1368,6 +1761,86 @@ int ProvResponse_set_ipAddress(DNDSMessage_t *msg, char *ipAddress)
 }
 
 
+int ProvResponse_set_switchAddress(DNDSMessage_t *msg, char *switchAddress, size_t length)
+{
+	if (msg == NULL || switchAddress == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_provResponse) {
+		return DNDS_invalid_op;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress = (PrintableString_t *)calloc(1, sizeof(PrintableString_t));
+	if (msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress->buf = (uint8_t *)strdup(switchAddress);
+	msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress->size = length;
+
+	return DNDS_success;
+}
+
+int ProvResponse_get_switchAddress(DNDSMessage_t *msg, char **switchAddress, size_t *length)
+{
+	if (msg == NULL || switchAddress == NULL || length == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_provResponse) {
+		return DNDS_invalid_op;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	*switchAddress = (char *)msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress->buf;
+	*length = msg->pdu.choice.dnm.dnop.choice.provResponse.switchAddress->size;
+
+	return DNDS_success;
+}
+
+int ProvResponse_set_switchPort(DNDSMessage_t *msg, uint16_t switchPort)
+{
+	if (msg == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_provResponse) {
+		return DNDS_invalid_op;
+	}
+
+	msg->pdu.choice.dnm.dnop.choice.provResponse.switchPort = (long *)calloc(1, sizeof(long));
+	if (msg->pdu.choice.dnm.dnop.choice.provResponse.switchPort == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	*msg->pdu.choice.dnm.dnop.choice.provResponse.switchPort = switchPort;
+
+	return DNDS_success;
+}
+
+int ProvResponse_get_switchPort(DNDSMessage_t *msg, uint16_t *switchPort)
+{
+	if (msg == NULL || switchPort == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_provResponse) {
+		return DNDS_invalid_op;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.choice.provResponse.switchPort == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	*switchPort = *msg->pdu.choice.dnm.dnop.choice.provResponse.switchPort;
+
+	return DNDS_success;
+}
+
 // P2pRequest
 int P2pRequest_set_macAddrDst(DNDSMessage_t *msg, uint8_t *macAddrDst)
 {
@@ -1534,6 +2007,71 @@ int P2pRequest_get_side(DNDSMessage_t *msg, e_P2pSide *side)
 	return DNDS_success;
 }
 
+int P2pRequest_set_ipLocalDst(DNDSMessage_t *msg, char *ipLocalDst)
+{
+	OCTET_STRING_t *addr;
+
+	if (msg == NULL || ipLocalDst == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_p2pRequest) {
+		return DNDS_invalid_op;
+	}
+
+	addr = (OCTET_STRING_t *)calloc(1, sizeof(OCTET_STRING_t));
+	if (addr == NULL) {
+		return DNDS_alloc_failed;
+	}
+	msg->pdu.choice.dnm.dnop.choice.p2pRequest.ipLocalDst = addr;
+
+	addr->buf = (uint8_t *)calloc(1, sizeof(struct in_addr));
+	if (addr->buf == NULL) {
+		return DNDS_alloc_failed;
+	}
+
+	if (inet_pton(AF_INET, ipLocalDst, addr->buf) != 1) {
+		return DNDS_conversion_failed;
+	}
+
+	addr->size = sizeof(struct in_addr);
+
+	return DNDS_success;
+}
+
+int P2pRequest_get_ipLocalDst(DNDSMessage_t *msg, char *ipLocalDst)
+{
+	OCTET_STRING_t *addr;
+
+	if (msg == NULL || ipLocalDst == NULL) {
+		return DNDS_invalid_param;
+	}
+
+	if (msg->pdu.present != pdu_PR_dnm) {
+		return DNDS_invalid_pdu;
+	}
+
+	if (msg->pdu.choice.dnm.dnop.present != dnop_PR_p2pRequest) {
+		return DNDS_invalid_op;
+	}
+
+	addr = msg->pdu.choice.dnm.dnop.choice.p2pRequest.ipLocalDst;
+	if (addr == NULL) {
+		return DNDS_value_not_present;
+	}
+
+	if (addr->size != sizeof(struct in_addr) ||
+	    inet_ntop(AF_INET, addr->buf, ipLocalDst, INET_ADDRSTRLEN) == NULL) {
+		return DNDS_conversion_failed;
+	}
+
+	return DNDS_success;
+}
+
 // P2pResponse
 int P2pResponse_set_macAddrDst(DNDSMessage_t *msg, uint8_t *macAddrDst)
 {
@@ -3268,6 +3806,11 @@ void P2pRequest_printf(DNDSMessage_t *msg)
 	e_P2pSide side;
 	P2pRequest_get_side(msg, &side);
 	printf("P2pRequest> side: %i :: %s\n", side, P2pSide_str(side));
+
+	char ipLocalDst[INET_ADDRSTRLEN];
+	if (P2pRequest_get_ipLocalDst(msg, ipLocalDst) == DNDS_success) {
+		printf("P2pRequest> ipLocalDst: %s\n", ipLocalDst);
+	}
 }
 
 void P2pResponse_printf(DNDSMessage_t *msg)
@@ -3334,6 +3877,16 @@ void NetinfoRequest_printf(DNDSMessage_t *msg)
 	NetinfoRequest_get_macAddr(msg, macAddr);
 	printf("NetinfoRequest> macAddr: %x:%x:%x:%x:%x:%x\n", macAddr[0],macAddr[1],macAddr[2],
 								macAddr[3],macAddr[4],macAddr[5]);
+
+	uint8_t compression;
+	if (NetinfoRequest_get_compression(msg, &compression) == DNDS_success) {
+		printf("NetinfoRequest> compression: %i\n", compression);
+	}
+
+	char ipAddress[INET_ADDRSTRLEN];
+	if (NetinfoRequest_get_ipAddress(msg, ipAddress) == DNDS_success) {
+		printf("NetinfoRequest> ipAddress: %s\n", ipAddress);
+	}
 }
 
 void NetinfoResponse_printf(DNDSMessage_t *msg)
@@ -3349,6 +3902,16 @@ void NetinfoResponse_printf(DNDSMessage_t *msg)
 	e_DNDSResult result;
 	NetinfoResponse_get_result(msg, &result);
 	printf("NetinfoResponse> result: %i :: %s\n", result, DNDSResult_str(result));
+
+	uint8_t compression;
+	if (NetinfoResponse_get_compression(msg, &compression) == DNDS_success) {
+		printf("NetinfoResponse> compression: %i\n", compression);
+	}
+
+	uint16_t dataPort;
+	if (NetinfoResponse_get_dataPort(msg, &dataPort) == DNDS_success) {
+		printf("NetinfoResponse> dataPort: %i\n", dataPort);
+	}
 }
 
 void SearchRequest_printf(DNDSMessage_t *msg)
@@ -22,6 +22,9 @@
 #define ETHER_ADDR_LEN	6
 #endif
 
+/* largest encoded ethernet message DNDSMessage_peek_ethernet() waits for */
+#define DNDS_PEEK_MAX	(65535 + 32)
+
 #ifndef INET_ADDRSTRLEN
 #define INET_ADDRSTRLEN 16
 #endif
@@ -39,6 +42,15 @@ typedef enum DNDS_retcode {
 
 } DNDS_retcode_t;
 
+/* A message built once and sent many times. The fields that vary are
+ * patched in msg before each send, a reply that never changes is sent
+ * from its DER image. */
+typedef struct DNDSTemplate {
+	DNDSMessage_t *msg;
+	uint8_t *der;		/* set by DNDSTemplate_encode() */
+	size_t der_size;
+} DNDSTemplate_t;
+
 // DNDS API functions
 char *DNDSResult_str(e_DNDSResult result);
 char *DNDS_strerror(DNDS_retcode_t retcode);
@@ -52,9 +64,16 @@ int DNDSMessage_get_channel(DNDSMessage_t *msg, uint8_t *channel);
 int DNDSMessage_set_pdu(DNDSMessage_t *msg, pdu_PR pdu);
 int DNDSMessage_get_pdu(DNDSMessage_t *msg, pdu_PR *pdu);
 
+// DNDSTemplate
+int DNDSTemplate_new(DNDSTemplate_t **tpl, pdu_PR pdu, dnop_PR operation);
+int DNDSTemplate_encode(DNDSTemplate_t *tpl);
+int DNDSTemplate_del(DNDSTemplate_t *tpl);
+
 // ethernet
 int DNDSMessage_set_ethernet(DNDSMessage_t *msg, uint8_t *frame, size_t length);
 int DNDSMessage_get_ethernet(DNDSMessage_t *msg, uint8_t **frame, size_t *length);
+int DNDSMessage_peek_ethernet(const uint8_t *buf, size_t len, size_t *msg_len,
+				uint8_t *channel, size_t *frame_offset, size_t *frame_len);
 
 // DNMessage
 int DNMessage_set_seqNumber(DNDSMessage_t *msg, uint32_t seqNumber);
@@ -151,6 +170,10 @@ int NetinfoRequest_set_ipLocal(DNDSMessage_t *msg, char *ipLocal);
 int NetinfoRequest_get_ipLocal(DNDSMessage_t *msg, char *ipLocal);
 int NetinfoRequest_set_macAddr(DNDSMessage_t *msg, uint8_t *macAddr);
 int NetinfoRequest_get_macAddr(DNDSMessage_t *msg, uint8_t *macAddr);
+int NetinfoRequest_set_compression(DNDSMessage_t *msg, uint8_t compression);
+int NetinfoRequest_get_compression(DNDSMessage_t *msg, uint8_t *compression);
+int NetinfoRequest_set_ipAddress(DNDSMessage_t *msg, char *ipAddress);
+int NetinfoRequest_get_ipAddress(DNDSMessage_t *msg, char *ipAddress);
 
 // NetinfoResponse
 int NetinfoResponse_set_ipAddress(DNDSMessage_t *msg, char *ipAddress);
@@ -159,6 +182,10 @@ int NetinfoResponse_set_netmask(DNDSMessage_t *msg, char *netmask);
 int NetinfoResponse_get_netmask(DNDSMessage_t *msg, char *netmask);
 int NetinfoResponse_set_result(DNDSMessage_t *msg, e_DNDSResult result);
 int NetinfoResponse_get_result(DNDSMessage_t *msg, e_DNDSResult *result);
+int NetinfoResponse_set_compression(DNDSMessage_t *msg, uint8_t compression);
+int NetinfoResponse_get_compression(DNDSMessage_t *msg, uint8_t *compression);
+int NetinfoResponse_set_dataPort(DNDSMessage_t *msg, uint16_t dataPort);
+int NetinfoResponse_get_dataPort(DNDSMessage_t *msg, uint16_t *dataPort);
 
 // ProvRequest
 int ProvRequest_set_provCode(DNDSMessage_t *msg, char *provCode, size_t length);
@@ -171,6 +198,10 @@ int ProvResponse_set_trustedCert(DNDSMessage_t *msg, uint8_t *trustedCert, size_
 int ProvResponse_get_trustedCert(DNDSMessage_t *msg, uint8_t **trustedCert, size_t *length);
 int ProvResponse_get_ipAddress(DNDSMessage_t *msg, char *ipAddress);
 int ProvResponse_set_ipAddress(DNDSMessage_t *msg, char *ipAddress);
+int ProvResponse_set_switchAddress(DNDSMessage_t *msg, char *switchAddress, size_t length);
+int ProvResponse_get_switchAddress(DNDSMessage_t *msg, char **switchAddress, size_t *length);
+int ProvResponse_set_switchPort(DNDSMessage_t *msg, uint16_t switchPort);
+int ProvResponse_get_switchPort(DNDSMessage_t *msg, uint16_t *switchPort);
 
 // P2pRequest
 int P2pRequest_set_macAddrDst(DNDSMessage_t *msg, uint8_t *macAddrDst);
@@ -181,6 +212,8 @@ int P2pRequest_set_port(DNDSMessage_t *msg, uint32_t port);
 int P2pRequest_get_port(DNDSMessage_t *msg, uint32_t *port);
 int P2pRequest_set_side(DNDSMessage_t *msg, e_P2pSide side);
 int P2pRequest_get_side(DNDSMessage_t *msg, e_P2pSide *side);
+int P2pRequest_set_ipLocalDst(DNDSMessage_t *msg, char *ipLocalDst);
+int P2pRequest_get_ipLocalDst(DNDSMessage_t *msg, char *ipLocalDst);
 
 // P2pResponse
 int P2pResponse_set_macAddrDst(DNDSMessage_t *msg, uint8_t *macAddrDst);
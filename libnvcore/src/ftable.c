@@ -73,6 +73,18 @@ void *ftable_find(ftable_t *ftable, uint8_t *mac)
 	return jsw_hfind(ftable, mac);
 }
 
+// issued for a burst of frames, then ftable_prefetch_chain() for the
+// same burst, before their ftable_find()
+void ftable_prefetch(ftable_t *ftable, uint8_t *mac)
+{
+	jsw_hprefetch(ftable, mac);
+}
+
+void ftable_prefetch_chain(ftable_t *ftable, uint8_t *mac)
+{
+	jsw_hprefetch_chain(ftable, mac);
+}
+
 int ftable_insert(ftable_t *ftable, uint8_t *mac, void *item)
 {
 	return jsw_hinsert(ftable, mac, item);
@@ -161,6 +161,38 @@ void *jsw_hfind ( jsw_hash_t *htab, void *key )
   return NULL;
 }
 
+/*
+  Start loading the bucket of the selected key. Issued
+  for a whole batch of keys before jsw_hprefetch_chain()
+  on the same batch, which reads the bucket
+*/
+void jsw_hprefetch ( jsw_hash_t *htab, void *key )
+{
+  unsigned h = htab->hash ( key ) % htab->capacity;
+
+#if defined ( __GNUC__ )
+  __builtin_prefetch ( &htab->table[h] );
+#else
+  (void)h;
+#endif
+}
+
+/*
+  Start loading the head of the chain of the selected
+  key, so a later jsw_hfind() finds it in cache
+*/
+void jsw_hprefetch_chain ( jsw_hash_t *htab, void *key )
+{
+  jsw_head_t *head = htab->table[htab->hash ( key ) % htab->capacity];
+
+#if defined ( __GNUC__ )
+  if ( head != NULL )
+    __builtin_prefetch ( head );
+#else
+  (void)head;
+#endif
+}
+
 /*
   Insert an item with the selected key
 
@@ -75,6 +75,16 @@ void         jsw_hdelete ( jsw_hash_t *htab );
 */
 void        *jsw_hfind ( jsw_hash_t *htab, void *key );
 
+/*
+  Start loading the bucket of the selected key
+*/
+void         jsw_hprefetch ( jsw_hash_t *htab, void *key );
+
+/*
+  Start loading the head of the chain of the selected key
+*/
+void         jsw_hprefetch_chain ( jsw_hash_t *htab, void *key );
+
 /*
   Insert an item with the selected key
 
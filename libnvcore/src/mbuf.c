@@ -97,6 +97,27 @@ int mbuf_del(mbuf_t **mbuf_head, mbuf_t *mbuf)
 	return 0;
 }
 
+// unlink the first mbuf, release it with mbuf_free()
+mbuf_t *mbuf_pop(mbuf_t **mbuf_head)
+{
+	mbuf_t *mbuf = *mbuf_head;
+
+	if (mbuf == NULL)
+		return NULL;
+
+	if (mbuf->next != NULL) {
+		mbuf->next->prev = mbuf->prev;
+		mbuf->next->count = mbuf->count - 1;
+	}
+	*mbuf_head = mbuf->next;
+
+	mbuf->next = NULL;
+	mbuf->prev = mbuf;
+	mbuf->count = 1;
+
+	return mbuf;
+}
+
 void mbuf_free(mbuf_t **mbuf)
 {
 	while (*mbuf != NULL)
@@ -42,6 +42,7 @@ void mbuf_free(mbuf_t **mbuf);
 int mbuf_count(mbuf_t *mbuf_head);
 int mbuf_add(mbuf_t **, mbuf_t *);
 int mbuf_del(mbuf_t **, mbuf_t *);
+mbuf_t *mbuf_pop(mbuf_t **);
 mbuf_t *mbuf_new(const void *buf, size_t data_size, uint8_t mem_type, void (*free)(void *));
 
 #endif
@@ -20,12 +20,12 @@
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <pthread.h>
 
 #include "dnds.h"
 #include "logger.h"
 #include "netbus.h"
 #include "tcp.h"
+#include "udp.h"
 #include "udt.h"
 
 #include <stdio.h>
@@ -86,12 +86,153 @@ int net_get_local_ip(char *ip_local, int len)
     return 0;
 }
 
+// connections with messages waiting in their channels
+static netc_t *net_pending_head = NULL;
+static netc_t *net_pending_tail = NULL;
+
+static void net_pending_add(netc_t *netc)
+{
+	if (netc->pending)
+		return;
+
+	netc->pending = 1;
+	netc->pending_next = NULL;
+	netc->pending_prev = net_pending_tail;
+
+	if (net_pending_tail)
+		net_pending_tail->pending_next = netc;
+	else
+		net_pending_head = netc;
+	net_pending_tail = netc;
+}
+
+static void net_pending_del(netc_t *netc)
+{
+	if (!netc->pending)
+		return;
+
+	if (netc->pending_prev)
+		netc->pending_prev->pending_next = netc->pending_next;
+	else
+		net_pending_head = netc->pending_next;
+
+	if (netc->pending_next)
+		netc->pending_next->pending_prev = netc->pending_prev;
+	else
+		net_pending_tail = netc->pending_prev;
+
+	netc->pending = 0;
+	netc->pending_next = NULL;
+	netc->pending_prev = NULL;
+}
+
+/* Between net_batch_begin() and net_batch_end() the records for the
+ * stream connections are gathered, each connection is then written
+ * once. Only used by the thread that pokes the buses. */
+static int net_batching = 0;
+static netc_t *net_batch_head = NULL;
+
+static void net_batch_add(netc_t *netc)
+{
+	if (netc->batched)
+		return;
+
+	netc->batched = 1;
+	netc->batch_prev = NULL;
+	netc->batch_next = net_batch_head;
+	if (net_batch_head)
+		net_batch_head->batch_prev = netc;
+	net_batch_head = netc;
+}
+
+static void net_batch_del(netc_t *netc)
+{
+	if (!netc->batched)
+		return;
+
+	if (netc->batch_prev)
+		netc->batch_prev->batch_next = netc->batch_next;
+	else
+		net_batch_head = netc->batch_next;
+
+	if (netc->batch_next)
+		netc->batch_next->batch_prev = netc->batch_prev;
+
+	netc->batched = 0;
+	netc->batch_next = NULL;
+	netc->batch_prev = NULL;
+}
+
+// returns -1 if the transport failed, the connection may be gone already
+static int net_batch_flush(netc_t *netc)
+{
+	size_t size;
+
+	size = netc->buf_batch_data_size;
+	netc->buf_batch_data_size = 0;
+	if (size == 0)
+		return 0;
+
+	return netc->peer->send(netc->peer, netc->buf_batch, size);
+}
+
+// every write to the transport goes through here to keep the records in order
+static int net_send_out(netc_t *netc, uint8_t *buf, size_t size)
+{
+	if (!net_batching || netc->protocol == NET_PROTO_DTLS)
+		return netc->peer->send(netc->peer, buf, size);
+
+	if (netc->buf_batch_data_size + size > NET_BATCH_MAX) {
+		net_batch_del(netc);
+		if (net_batch_flush(netc) == -1)
+			return -1;
+		if (size > NET_BATCH_MAX)
+			return netc->peer->send(netc->peer, buf, size);
+	}
+
+	if (netc->buf_batch == NULL) {
+		netc->buf_batch = malloc(NET_BATCH_MAX);
+		if (netc->buf_batch == NULL)
+			return netc->peer->send(netc->peer, buf, size);
+	}
+
+	memcpy(netc->buf_batch + netc->buf_batch_data_size, buf, size);
+	netc->buf_batch_data_size += size;
+	net_batch_add(netc);
+
+	return size;
+}
+
+void net_batch_begin()
+{
+	net_batching++;
+}
+
+void net_batch_end()
+{
+	netc_t *netc;
+
+	if (--net_batching > 0)
+		return;
+
+	// a failed connection is released, and unlinked, by the flush
+	while ((netc = net_batch_head) != NULL) {
+		net_batch_del(netc);
+		net_batch_flush(netc);
+	}
+}
+
 static void net_connection_free(netc_t *netc)
 {
+	int i;
+
 	if (netc == NULL) {
 		return;
 	}
 
+	net_pending_del(netc);
+	net_batch_del(netc);
+
 	if (netc->kconn != NULL) {
 
 		if (netc->kconn->ssl) {
@@ -112,11 +253,16 @@ static void net_connection_free(netc_t *netc)
 		free(netc->kconn);
 	}
 
-	DNDSMessage_del(netc->msg_dec);
+	compress_free(netc->compress);
+	if (netc->arena == NULL)
+		DNDSMessage_del(netc->msg_dec);
 	free(netc->buf_in);
 	free(netc->buf_enc);
+	free(netc->buf_batch);
 	mbuf_free(&netc->queue_msg);
-	mbuf_free(&netc->queue_out);
+	asn_arena_destroy(netc->arena);
+	for (i = 0; i < NET_CHANNELS; i++)
+		mbuf_free(&netc->queue_chan[i]);
 	netc->ext_ptr = NULL;
 	free(netc);
 }
@@ -163,7 +309,6 @@ static netc_t *net_connection_new(uint8_t security_level)
 	netc->buf_in_data_size = 0;
 
 	netc->queue_msg = NULL;
-	netc->queue_out = NULL;
 
 	return netc;
 }
@@ -174,7 +319,7 @@ static void net_do_krypt(netc_t *netc)
 	ssize_t nbyte;
 
 	if (netc->kconn->buf_encrypt_data_size > 0) {
-		nbyte = netc->peer->send(netc->peer, netc->kconn->buf_encrypt, netc->kconn->buf_encrypt_data_size);
+		nbyte = net_send_out(netc, netc->kconn->buf_encrypt, netc->kconn->buf_encrypt_data_size);
 		if (nbyte == -1) {
 			return;
 		}
@@ -184,30 +329,71 @@ static void net_do_krypt(netc_t *netc)
 	}
 }
 
+static uint8_t net_krypt_protocol(netc_t *netc)
+{
+	if (netc->protocol == NET_PROTO_DTLS)
+		return KRYPT_DTLS;
+
+	return KRYPT_TLS;
+}
+
+// retransmit the DTLS handshake flights that were lost
+static void net_on_tick(peer_t *peer)
+{
+	netc_t *netc = NULL;
+
+	netc = peer->ext_ptr;
+	if (netc == NULL || netc->security_level == NET_UNSECURE) {
+		return;
+	}
+
+	if (krypt_dtls_timeout(netc->kconn) > 0)
+		net_do_krypt(netc);
+}
+
+#ifdef __linux__
+// no socket nor SSL object for a client until it returns our cookie
+static int net_on_hello(peer_t *peer, struct sockaddr_in *addr,
+			uint8_t *buf, size_t buf_data_size, uint8_t *reply, size_t *reply_len)
+{
+	(void)(peer); /* unused */
+
+	return krypt_dtls_listen(addr, sizeof(struct sockaddr_in), buf, buf_data_size,
+			reply, reply_len);
+}
+#endif
+
 // queue fully decoded DNDS messages
+// the messages decoded in an arena are released by asn_arena_reset()
+static void net_arena_msg_del(void *msg)
+{
+	(void)msg;
+}
+
 static void net_queue_msg(netc_t *netc, DNDSMessage_t *msg)
 {
 	mbuf_t *mbuf;
 
 	// the size doesn't matter, mbuf reference the message only,
 	// the external free function is used to release the DNDS message
-	mbuf = mbuf_new((const void *)msg, 0, MBUF_BYREF, (void (*)(void *))DNDSMessage_del);
+	if (netc->arena)
+		mbuf = mbuf_new((const void *)msg, 0, MBUF_BYREF, net_arena_msg_del);
+	else
+		mbuf = mbuf_new((const void *)msg, 0, MBUF_BYREF, (void (*)(void *))DNDSMessage_del);
 	mbuf_add(&netc->queue_msg, mbuf);
 
 	netc->msg_dec = NULL;
 }
 
-// queue data ready to be sent
-static void net_queue_out(netc_t *netc, uint8_t *buf, size_t data_size)
-{
-	mbuf_t *mbuf;
-	mbuf = mbuf_new((const void *)buf, data_size, MBUF_BYVAL, NULL);
-	mbuf_add(&netc->queue_out, mbuf);
-}
-
 // serialize data coming from the low-level network layer
 static void serialize_buf_in(netc_t *netc, const void *buf, size_t data_size)
 {
+	// keep the unconsumed data at the start of the buffer
+	if (netc->buf_in_offset > 0) {
+		memmove(netc->buf_in, netc->buf_in + netc->buf_in_offset, netc->buf_in_data_size);
+		netc->buf_in_offset = 0;
+	}
+
 	if (netc->buf_in_data_size + data_size > netc->buf_in_size) {
 		netc->buf_in_size = (netc->buf_in_size + data_size) * 2;
 		netc->buf_in = realloc(netc->buf_in, netc->buf_in_size);
@@ -234,49 +420,249 @@ static int serialize_buf_enc(const void *buf, size_t data_size, void *ext_ptr)
 	return 0;
 }
 
-static int net_flush_queue_out(netc_t *netc)
+/* Encrypt an encoded message and hand it to the transport. Returns -1
+ * if the transport failed, the connection may be gone already. */
+static int net_transmit(netc_t *netc, uint8_t *buf, size_t data_size)
 {
-	ssize_t nbyte = 0;
+	size_t size;
+	int nbyte = 0;
+	int ret = 0;
 
-	peer_t *peer = NULL;
-	mbuf_t *mbuf_itr = NULL;
+	// the kernel encrypts the records
+	if (netc->security_level == NET_UNSECURE
+		|| netc->kconn->ktls & KRYPT_KTLS_TX) {
+		return net_send_out(netc, buf, data_size);
+	}
 
-	peer = (peer_t *)netc->peer;
-	mbuf_itr = netc->queue_out;
+	do {
+		ret = krypt_encrypt_buf(netc->kconn, buf, data_size);
+		size = netc->kconn->buf_encrypt_data_size;
+		netc->kconn->buf_encrypt_data_size = 0;
+		if (ret == -2) { data_size = 0; }
 
-	while (mbuf_itr != NULL) {
-		nbyte = peer->send(peer, mbuf_itr->ext_buf, mbuf_itr->ext_size);
-		if (nbyte == -1) {
+		if (size > 0) {
+			nbyte = net_send_out(netc, netc->kconn->buf_encrypt, size);
+			if (nbyte == -1)
+				return -1;
+		}
+	} while (ret < 0); /* SSL BIO buffer is full ! flush it, and write again */
+
+	return nbyte;
+}
+
+// control first, then the small frames by NET_SMALL_WEIGHT to one bulk frame
+static int net_next_channel(netc_t *netc)
+{
+	if (netc->queue_chan[NET_CHANNEL_CONTROL] != NULL)
+		return NET_CHANNEL_CONTROL;
+
+	if (netc->queue_chan[NET_CHANNEL_SMALL] != NULL
+		&& (netc->queue_chan[NET_CHANNEL_BULK] == NULL || netc->small_run < NET_SMALL_WEIGHT)) {
+		netc->small_run++;
+		return NET_CHANNEL_SMALL;
+	}
+
+	if (netc->queue_chan[NET_CHANNEL_BULK] != NULL) {
+		netc->small_run = 0;
+		return NET_CHANNEL_BULK;
+	}
+
+	return -1;
+}
+
+/* Send the waiting messages while the transport has room, the records
+ * are encrypted in the order they leave so the priority is decided as
+ * late as possible. Returns -1 if the connection failed, it may be
+ * gone already. */
+static int net_flush_channels(netc_t *netc)
+{
+	mbuf_t *mbuf;
+	peer_t *peer;
+	int channel;
+	int ret = 0;
+
+	peer = netc->peer;
+	net_pending_del(netc);
+
+	while ((channel = net_next_channel(netc)) != -1) {
+
+		if (channel != NET_CHANNEL_CONTROL && peer->pending
+			&& peer->pending(peer) > NET_TRANSPORT_QUEUE) {
+			net_pending_add(netc);
 			break;
 		}
-		mbuf_itr = mbuf_itr->next;
+
+		mbuf = mbuf_pop(&netc->queue_chan[channel]);
+		netc->queue_chan_size[channel] -= mbuf->ext_size;
+
+		ret = net_transmit(netc, mbuf->ext_buf, mbuf->ext_size);
+		mbuf_free(&mbuf);
+		if (ret == -1) {
+			return -1;
+		}
 	}
 
-	mbuf_free(&netc->queue_out);
-	return nbyte;
+	return ret;
+}
+
+/* Peers that predate the channels send every frame on the control
+ * channel, the frames are never allowed to overtake the operations. */
+static int net_ethernet_channel(uint8_t channel, size_t frame_size)
+{
+	if (channel == NET_CHANNEL_CONTROL)
+		return net_frame_channel(frame_size);
+	if (channel >= NET_CHANNELS)
+		return NET_CHANNEL_BULK;
+
+	return channel;
+}
+
+static int net_msg_channel(DNDSMessage_t *msg)
+{
+	uint8_t channel = NET_CHANNEL_CONTROL;
+
+	if (msg->pdu.present == pdu_PR_dnm)
+		return NET_CHANNEL_CONTROL;
+
+	DNDSMessage_get_channel(msg, &channel);
+	if (msg->pdu.present == pdu_PR_ethernet)
+		return net_ethernet_channel(channel, msg->pdu.choice.ethernet.size);
+	if (channel == NET_CHANNEL_CONTROL || channel >= NET_CHANNELS)
+		return NET_CHANNEL_BULK;
+
+	return channel;
+}
+
+// queue an encoded message in its channel and send what the transport can take
+static int net_enqueue(netc_t *netc, const uint8_t *buf, size_t data_size, int channel)
+{
+	mbuf_t *mbuf;
+	peer_t *peer = netc->peer;
+
+	// nothing waiting and room in the transport, no need to queue it
+	if (netc->pending == 0
+		&& netc->queue_chan[NET_CHANNEL_CONTROL] == NULL
+		&& netc->queue_chan[NET_CHANNEL_SMALL] == NULL
+		&& netc->queue_chan[NET_CHANNEL_BULK] == NULL
+		&& (channel == NET_CHANNEL_CONTROL || peer->pending == NULL
+			|| peer->pending(peer) <= NET_TRANSPORT_QUEUE)) {
+		return net_transmit(netc, (uint8_t *)buf, data_size);
+	}
+
+	if (channel != NET_CHANNEL_CONTROL
+		&& netc->queue_chan_size[channel] + data_size > NET_CHANNEL_QUEUE) {
+		return 0;	// the transport can't keep up, drop the frame
+	}
+
+	mbuf = mbuf_new((const void *)buf, data_size, MBUF_BYVAL, NULL);
+	mbuf_add(&netc->queue_chan[channel], mbuf);
+	netc->queue_chan_size[channel] += data_size;
+
+	return net_flush_channels(netc);
+}
+
+static void net_consume_buf_in(netc_t *netc, size_t consumed)
+{
+	// decrease the data size according to the consumed bytes
+	netc->buf_in_data_size -= consumed;
+
+	// move the start of the data
+	if (netc->buf_in_data_size == 0)
+		netc->buf_in_offset = 0;
+	else
+		netc->buf_in_offset += consumed;
+}
+
+/* Hand the complete ethernet messages at the head of the input to the
+ * relay. Returns 0 when they are all relayed or more data is needed,
+ * -1 when the next message must be decoded. */
+static int net_relay_msg(netc_t *netc)
+{
+	uint8_t *buf;
+	uint8_t channel;
+	size_t msg_len, frame_offset, frame_len;
+	int ret;
+
+	while (netc->buf_in_data_size) {
+
+		buf = netc->buf_in + netc->buf_in_offset;
+		ret = DNDSMessage_peek_ethernet(buf, netc->buf_in_data_size,
+				&msg_len, &channel, &frame_offset, &frame_len);
+
+		if (ret == 0)
+			return 0;
+		if (ret == -1 || netc->on_relay(netc, buf, msg_len, buf + frame_offset, frame_len) == -1)
+			return -1;
+
+		net_consume_buf_in(netc, msg_len);
+	}
+
+	return 0;
+}
+
+// turn a compressedEthernet PDU back into the ethernet frame
+static int net_decompress_msg(netc_t *netc, DNDSMessage_t *msg)
+{
+	BIT_STRING_t *bits;
+	uint8_t *frame;
+	size_t frame_len;
+
+	bits = &msg->pdu.choice.compressedEthernet;
+	if (decompress_frame(netc->compress, bits->buf, bits->size, &frame, &frame_len) == -1) {
+		return -1;
+	}
+
+	// the decoded message must lie entirely in the arena
+	if (netc->arena) {
+		bits->buf = asn_arena_malloc(netc->arena, frame_len);
+		if (bits->buf != NULL)
+			memcpy(bits->buf, frame, frame_len);
+		free(frame);
+		frame = bits->buf;
+		if (frame == NULL)
+			return -1;
+	}
+	else {
+		// both alternatives are BIT STRING sharing the same storage
+		free(bits->buf);
+	}
+
+	msg->pdu.present = pdu_PR_ethernet;
+	msg->pdu.choice.ethernet.buf = frame;
+	msg->pdu.choice.ethernet.size = frame_len;
+	msg->pdu.choice.ethernet.bits_unused = 0;
+
+	return 0;
 }
 
 static int net_decode_msg(netc_t *netc)
 {
 	asn_dec_rval_t dec;
+	asn_arena_t *arena_prev;
+	int ret;
 
-	if (netc->buf_in_data_size == 0)
-		return 0;
+	// the messages of the previous input are all processed
+	if (netc->arena && netc->msg_dec == NULL && netc->queue_msg == NULL)
+		asn_arena_reset(netc->arena);
 
-	do {
+	while (netc->buf_in_data_size) {
+
+		// nothing is half decoded, try the relay first
+		if (netc->on_relay && netc->msg_dec == NULL) {
+			net_batch_begin();
+			ret = net_relay_msg(netc);
+			net_batch_end();
+			if (ret == 0)
+				return 0;
+		}
+
+		arena_prev = asn_arena_use(netc->arena);
 		dec = ber_decode(0, &asn_DEF_DNDSMessage,
 			(void **)&netc->msg_dec, netc->buf_in + netc->buf_in_offset, netc->buf_in_data_size);
+		asn_arena_use(arena_prev);
 
 		if (dec.code == RC_WMORE) {
-			// decrease the data size according to the consumed bytes
-			netc->buf_in_data_size -= dec.consumed;
-
-			// move the start of the data
-			if (netc->buf_in_data_size == 0)
-				netc->buf_in_offset = 0;
-			else
-				netc->buf_in_offset += dec.consumed;
-
+			net_consume_buf_in(netc, dec.consumed);
 			return 0;
 		}
 		else if (dec.code == RC_FAIL) {
@@ -287,22 +673,21 @@ static int net_decode_msg(netc_t *netc)
 
 			return -1;
 		}
-		else if (dec.code == RC_OK) {
 
-			// queue the fully decoded message
+		// queue the fully decoded message
+		if (netc->msg_dec->pdu.present == pdu_PR_compressedEthernet
+				&& net_decompress_msg(netc, netc->msg_dec) == -1) {
+			jlog(L_NOTICE, "dropping a compressed frame that failed to decompress");
+			if (netc->arena == NULL)
+				DNDSMessage_del(netc->msg_dec);
+			netc->msg_dec = NULL;
+		}
+		else {
 			net_queue_msg(netc, netc->msg_dec);
-
-			// decrease the data size according to the consumed bytes
-			netc->buf_in_data_size -= dec.consumed;
-
-			// move the start of the data
-			if (netc->buf_in_data_size == 0)
-				netc->buf_in_offset = 0;
-			else
-				netc->buf_in_offset += dec.consumed;
 		}
 
-	} while (dec.code == RC_OK && netc->buf_in_data_size);
+		net_consume_buf_in(netc, dec.consumed);
+	}
 
 	// RC_OK
 	return 0;
@@ -326,6 +711,10 @@ static void net_on_input(peer_t *peer)
 		net_do_krypt(netc);
 		if (ret == 0) {				// handshake successfull
 
+			// let the kernel handle the records from now on
+			if (netc->protocol == NET_PROTO_TCP)
+				krypt_ktls_enable(netc->kconn, peer->socket);
+
 			netc->on_secure(netc);		// inform upper-layer
 
 			// Handle the fact that we can receive handshake data
@@ -352,6 +741,13 @@ static void net_on_input(peer_t *peer)
 	}
 
 	if (netc->security_level > NET_UNSECURE
+			&& netc->kconn->status == KRYPT_SECURE
+			&& netc->kconn->ktls & KRYPT_KTLS_RX) {
+
+		// already decrypted by the kernel
+		serialize_buf_in(netc, peer->buffer, peer->buffer_data_len);
+	}
+	else if (netc->security_level > NET_UNSECURE
 			&& netc->kconn->status == KRYPT_SECURE) {
 
 		int peek = 0; // buffer to hold the byte we are peeking at
@@ -395,8 +791,10 @@ static void net_on_input(peer_t *peer)
 			&& netc->kconn->status == KRYPT_SECURE) {
 
 		/* Catch server renegotiation */
-		krypt_decrypt_buf(netc->kconn);
-		net_do_krypt(netc);
+		if (!(netc->kconn->ktls & KRYPT_KTLS_RX)) {
+			krypt_decrypt_buf(netc->kconn);
+			net_do_krypt(netc);
+		}
 
 		if (mbuf_count(netc->queue_msg) > 0)
 			netc->on_input(netc);
@@ -457,8 +855,10 @@ static void net_on_connect(peer_t *peer)
 			krypt_security_level = KRYPT_RSA;
 
 		new_netc->kconn->passport = netc->kconn->passport;
+		new_netc->passport_lookup = netc->passport_lookup;
+		krypt_set_passport_lookup(new_netc->kconn, netc->passport_lookup);
 
-		krypt_secure_connection(new_netc->kconn, KRYPT_TLS, KRYPT_SERVER, krypt_security_level);
+		krypt_secure_connection(new_netc->kconn, net_krypt_protocol(new_netc), KRYPT_SERVER, krypt_security_level);
 	}
 
 	new_netc->on_connect(new_netc);
@@ -466,6 +866,116 @@ static void net_on_connect(peer_t *peer)
 		new_netc->on_secure(new_netc);
 }
 
+/* MTU of the underlay path used by the connection */
+int net_get_mtu(netc_t *netc)
+{
+	int mtu = -1;
+
+	if (netc == NULL || netc->peer == NULL)
+		return NET_MTU_DEFAULT;
+
+	switch (netc->protocol) {
+	case NET_PROTO_UDT:
+		mtu = udtbus_get_mss(netc->peer);
+		break;
+#ifdef __linux__
+	case NET_PROTO_TCP: {
+		socklen_t len = sizeof(mtu);
+		if (getsockopt(netc->peer->socket, IPPROTO_IP, IP_MTU, &mtu, &len) < 0)
+			mtu = -1;
+		break;
+	}
+#endif
+	}
+
+	if (mtu <= 0)
+		mtu = NET_MTU_DEFAULT;
+
+	return mtu;
+}
+
+/* Largest inner packet that travels in a single underlay packet, the
+ * MTU to set on the tap interface. It never goes below NET_MTU_MIN so
+ * IPv6 keeps working, the transport splits what doesn't fit. */
+int net_get_tunnel_mtu(netc_t *netc)
+{
+	int mtu;
+
+	mtu = net_get_mtu(netc) - NET_FRAME_OVERHEAD;
+	if (netc && netc->protocol == NET_PROTO_TCP)
+		mtu -= NET_TCP_OVERHEAD;
+	else
+		mtu -= NET_UDT_OVERHEAD;
+
+	if (mtu < NET_MTU_MIN)
+		mtu = NET_MTU_MIN;
+
+	return mtu;
+}
+
+/* Compress the ethernet frames sent on this connection, the method
+ * must have been agreed by the peer during the Netinfo exchange. */
+int net_set_compression(netc_t *netc, uint8_t method)
+{
+	compress_free(netc->compress);
+	netc->compress = NULL;
+
+	if (method == COMPRESS_NONE) {
+		return 0;
+	}
+
+	netc->compress = compress_new(method);
+	if (netc->compress == NULL) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Let the clients name their network during the handshake, the
+ * server then authenticates them without stepping up from ADH. */
+void net_set_passport_lookup(netc_t *netc, passport_t *(*lookup)(const char *))
+{
+	netc->passport_lookup = lookup;
+}
+
+/* Decode the messages of this connection in an arena, before the first
+ * message is received. The messages passed to on_input() are valid
+ * until it returns and must not be kept. */
+int net_set_arena(netc_t *netc)
+{
+	if (netc->arena != NULL)
+		return 0;
+
+	if (netc->msg_dec != NULL || netc->queue_msg != NULL)
+		return -1;
+
+	netc->arena = asn_arena_new(NET_ARENA_CHUNK);
+	if (netc->arena == NULL) {
+		jlog(L_WARNING, "unable to allocate the decoding arena");
+		return -1;
+	}
+
+	return 0;
+}
+
+void net_set_relay(netc_t *netc, int (*on_relay)(netc_t *, const uint8_t *, size_t, uint8_t *, size_t))
+{
+	netc->on_relay = on_relay;
+}
+
+/* Datagram connections have no end of stream, the peer is dropped
+ * after `timeout' seconds without a datagram, 0 waits forever. New
+ * connections wait UDPBUS_TIMEOUT seconds, the upper layer turns it
+ * off when it ties the connection to another one. */
+void net_set_timeout(netc_t *netc, int timeout)
+{
+#ifdef __linux__
+	if (netc->protocol == NET_PROTO_DTLS && netc->peer)
+		udpbus_set_timeout(netc->peer, timeout);
+#endif
+}
+
 void net_step_up(netc_t *netc)
 {
 	if (netc->conn_type == NET_SERVER) {	// Server send HelloRequest
@@ -483,10 +993,29 @@ void net_step_up(netc_t *netc)
 int net_send_msg(netc_t *netc, DNDSMessage_t *msg)
 {
 	asn_enc_rval_t ec;
-	size_t nbyte;
-	int ret = 0;
+	size_t data_size;
+	BIT_STRING_t frame;
+	size_t zlen = 0;
+
+	if (netc->compress && msg->pdu.present == pdu_PR_ethernet) {
+		frame = msg->pdu.choice.ethernet;
+		zlen = compress_frame(netc->compress, frame.buf, frame.size);
+		if (zlen > 0) {
+			msg->pdu.present = pdu_PR_compressedEthernet;
+			msg->pdu.choice.compressedEthernet.buf = netc->compress->buf;
+			msg->pdu.choice.compressedEthernet.size = zlen;
+			msg->pdu.choice.compressedEthernet.bits_unused = 0;
+		}
+	}
 
 	ec = der_encode(&asn_DEF_DNDSMessage, msg, serialize_buf_enc, netc);
+
+	// the same message may be forwarded to other connections, restore it
+	if (zlen > 0) {
+		msg->pdu.present = pdu_PR_ethernet;
+		msg->pdu.choice.ethernet = frame;
+	}
+
 	if (ec.encoded == -1) {
 		netc->buf_enc_data_size = 0;	// mark the buffer as empty
 		jlog(L_ERROR, "DER encoder failed at field '%s'", ec.failed_type->name);
@@ -500,25 +1029,56 @@ int net_send_msg(netc_t *netc, DNDSMessage_t *msg)
 		return -1;
 	}
 
-	if (netc->security_level > NET_UNSECURE
-		&& netc->kconn->status == KRYPT_SECURE) {
+	data_size = netc->buf_enc_data_size;
+	netc->buf_enc_data_size = 0; // mark buffer as empty
 
-		do {
+	return net_enqueue(netc, netc->buf_enc, data_size, net_msg_channel(msg));
+}
 
-			ret = krypt_encrypt_buf(netc->kconn, netc->buf_enc, netc->buf_enc_data_size);
-			net_queue_out(netc, netc->kconn->buf_encrypt, netc->kconn->buf_encrypt_data_size);
-			netc->kconn->buf_encrypt_data_size = 0;
-			if (ret == -2) { netc->buf_enc_data_size = 0; }
-		} while (ret < 0); /* SSL BIO buffer is full ! flush it, and write again */
+/* Send a message already encoded, by a peer or by DNDSTemplate_encode().
+ * The frames keep their channel and are sent without compression, the
+ * other messages go on the control channel. */
+int net_send_raw(netc_t *netc, const uint8_t *msg, size_t msg_len)
+{
+	uint8_t channel;
+	size_t peek_len, frame_offset, frame_len;
 
+	if (netc->security_level > NET_UNSECURE
+		&& netc->kconn->status != KRYPT_SECURE) {
+
+		jlog(L_ERROR, "the network connection is not yet secure");
+		return -1;
 	}
-	else {
-		net_queue_out(netc, netc->buf_enc, netc->buf_enc_data_size);
+
+	if (DNDSMessage_peek_ethernet(msg, msg_len, &peek_len, &channel, &frame_offset, &frame_len) == 1
+		&& peek_len == msg_len) {
+		return net_enqueue(netc, msg, msg_len, net_ethernet_channel(channel, frame_len));
 	}
-	netc->buf_enc_data_size = 0; // mark buffer as empty
-	nbyte = net_flush_queue_out(netc);
 
-	return nbyte;
+	return net_enqueue(netc, msg, msg_len, NET_CHANNEL_CONTROL);
+}
+
+/* Called by the thread that pokes the buses, resume the connections
+ * whose transport was full. */
+void net_flush_pending()
+{
+	netc_t *netc;
+	int count = 0;
+
+	for (netc = net_pending_head; netc != NULL; netc = netc->pending_next)
+		count++;
+
+	// a connection still full goes back at the tail
+	while (count-- > 0 && (netc = net_pending_head) != NULL)
+		net_flush_channels(netc);
+}
+
+uint8_t net_frame_channel(size_t frame_size)
+{
+	if (frame_size <= NET_SMALL_FRAME)
+		return NET_CHANNEL_SMALL;
+
+	return NET_CHANNEL_BULK;
 }
 
 void net_disconnect(netc_t *netc)
@@ -541,6 +1101,57 @@ void net_disconnect(netc_t *netc)
 	net_connection_free(netc);
 }
 
+/* Listening sockets handed over by the process this one replaces,
+ * net_server() takes them instead of binding the port again */
+static struct {
+	uint8_t protocol;
+	char port[8];
+	int fd;
+} net_inherited[NET_INHERIT_MAX];
+static int net_inherited_count = 0;
+
+int net_inherit(uint8_t protocol, const char *port, int fd)
+{
+	if (net_inherited_count == NET_INHERIT_MAX)
+		return -1;
+
+	net_inherited[net_inherited_count].protocol = protocol;
+	snprintf(net_inherited[net_inherited_count].port,
+		sizeof(net_inherited[0].port), "%s", port);
+	net_inherited[net_inherited_count].fd = fd;
+	net_inherited_count++;
+
+	return 0;
+}
+
+static int net_inherited_take(uint8_t protocol, const char *port)
+{
+	int fd, i;
+
+	for (i = 0; i < net_inherited_count; i++) {
+		if (net_inherited[i].protocol == protocol &&
+		    strcmp(net_inherited[i].port, port) == 0) {
+			fd = net_inherited[i].fd;
+			net_inherited[i] = net_inherited[--net_inherited_count];
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+/* The OS socket of a server, to hand it over */
+int net_server_socket(netc_t *netc)
+{
+	if (netc == NULL || netc->conn_type != NET_SERVER || netc->peer == NULL)
+		return -1;
+
+	if (netc->protocol == NET_PROTO_UDT)
+		return netc->peer->fd;
+
+	return netc->peer->socket;
+}
+
 void netbus_tcp_init()
 {
 #ifdef __linux__
@@ -548,6 +1159,31 @@ void netbus_tcp_init()
 #endif
 }
 
+int netbus_tcp_poke()
+{
+#ifdef __linux__
+	return tcpbus_ion_poke();
+#else
+	return 0;
+#endif
+}
+
+void netbus_udp_init()
+{
+#ifdef __linux__
+	udpbus_init();
+#endif
+}
+
+int netbus_udp_poke()
+{
+#ifdef __linux__
+	return udpbus_poke();
+#else
+	return 0;
+#endif
+}
+
 int netbus_init()
 {
 	return udtbus_init();
@@ -555,19 +1191,20 @@ int netbus_init()
 
 void netbus_fini()
 {
+	/* not taken by any server */
+	while (net_inherited_count > 0)
+		close(net_inherited[--net_inherited_count].fd);
+
 	udtbus_fini();
 }
 
-netc_t *net_client(const char *listen_addr,
-			const char *port,
-			uint8_t protocol,
+static netc_t *net_client_new(uint8_t protocol,
 			uint8_t security_level,
 			passport_t *passport,
 			void (*on_disconnect)(netc_t *),
 			void (*on_input)(netc_t *),
 			void (*on_secure)(netc_t *))
 {
-	int ret = 0;
 	netc_t *netc = NULL;
 
 	netc = net_connection_new(security_level);
@@ -585,12 +1222,79 @@ netc_t *net_client(const char *listen_addr,
 	if (security_level > NET_UNSECURE)
 		krypt_add_passport(netc->kconn, passport);
 
+	return netc;
+}
+
+// start the handshake once the peer is connected
+static netc_t *net_client_secure(netc_t *netc)
+{
+	int ret = 0;
+
+	netc->peer->ext_ptr = netc;
+
+	if (netc->security_level > NET_UNSECURE) {
+
+		// FIXME net and krypt should share constants
+		int krypt_security_level;
+		if (netc->security_level == NET_SECURE_ADH)
+			krypt_security_level = KRYPT_ADH;
+		else
+			krypt_security_level = KRYPT_RSA;
+
+		ret = krypt_secure_connection(netc->kconn, net_krypt_protocol(netc), KRYPT_CLIENT, krypt_security_level);
+		if (ret < 0) {
+			jlog(L_NOTICE, "securing client connection failed");
+			netc->peer->ext_ptr = NULL;
+			netc->peer->disconnect(netc->peer);
+			net_connection_free(netc);
+			return NULL;
+		}
+
+		// authenticate in the first handshake, see krypt_set_servername()
+		if (krypt_security_level == KRYPT_RSA && krypt_set_servername(netc->kconn) < 0)
+			jlog(L_NOTICE, "no server name, the server will step up the connection");
+
+		krypt_do_handshake(netc->kconn, NULL, 0);
+		net_do_krypt(netc);
+	}
+
+	return netc;
+}
+
+netc_t *net_client(const char *listen_addr,
+			const char *port,
+			uint8_t protocol,
+			uint8_t security_level,
+			passport_t *passport,
+			void (*on_disconnect)(netc_t *),
+			void (*on_input)(netc_t *),
+			void (*on_secure)(netc_t *))
+{
+	netc_t *netc = NULL;
+
+	netc = net_client_new(protocol, security_level, passport,
+		on_disconnect, on_input, on_secure);
+	if (netc == NULL) {
+	        return NULL;
+	}
+
 	switch (protocol) {
 #ifdef __linux__
 		case NET_PROTO_TCP:
 			netc->peer = tcpbus_client(listen_addr, port,
 				net_on_disconnect, net_on_input);
 			break;
+
+		case NET_PROTO_DTLS:
+			if (security_level == NET_UNSECURE) {
+				jlog(L_NOTICE, "net> DTLS connections must be secure");
+				break;
+			}
+			netc->peer = udpbus_client(listen_addr, port,
+				net_on_disconnect, net_on_input);
+			if (netc->peer)
+				udpbus_set_tick(netc->peer, net_on_tick);
+			break;
 #endif
 		case NET_PROTO_UDT:
 			netc->peer = udtbus_client(listen_addr, port,
@@ -609,30 +1313,37 @@ netc_t *net_client(const char *listen_addr,
 		return NULL;
 	}
 
-	netc->peer->ext_ptr = netc;
-
-	if (security_level > NET_UNSECURE) {
+	return net_client_secure(netc);
+}
 
-		// FIXME net and krypt should share constants
-		int krypt_security_level;
-		if (netc->security_level == NET_SECURE_ADH)
-			krypt_security_level = KRYPT_ADH;
-		else
-			krypt_security_level = KRYPT_RSA;
+#ifdef __linux__
+/* A TCP client on a socket the caller connected without blocking, the
+ * socket belongs to the netbus from now on, even if NULL is returned */
+netc_t *net_client_socket(int socket,
+			uint8_t security_level,
+			passport_t *passport,
+			void (*on_disconnect)(netc_t *),
+			void (*on_input)(netc_t *),
+			void (*on_secure)(netc_t *))
+{
+	netc_t *netc = NULL;
 
-		ret = krypt_secure_connection(netc->kconn, KRYPT_TLS, KRYPT_CLIENT, krypt_security_level);
-		if (ret < 0) {
-			jlog(L_NOTICE, "securing client connection failed");
-			net_connection_free(netc);
-			return NULL;
-		}
+	netc = net_client_new(NET_PROTO_TCP, security_level, passport,
+		on_disconnect, on_input, on_secure);
+	if (netc == NULL) {
+		close(socket);
+		return NULL;
+	}
 
-		krypt_do_handshake(netc->kconn, NULL, 0);
-		net_do_krypt(netc);
+	netc->peer = tcpbus_client_socket(socket, net_on_disconnect, net_on_input);
+	if (netc->peer == NULL) {
+		net_connection_free(netc);
+		return NULL;
 	}
 
-	return netc;
+	return net_client_secure(netc);
 }
+#endif
 
 netc_t *net_server(const char *listen_addr,
 		const char *port,
@@ -645,6 +1356,7 @@ netc_t *net_server(const char *listen_addr,
 		void (*on_secure)(netc_t *))
 {
 	netc_t *netc = NULL;
+	int fd;
 
 	netc = net_connection_new(security_level);
 	if (netc == NULL) {
@@ -652,6 +1364,10 @@ netc_t *net_server(const char *listen_addr,
 		return NULL;
 	}
 
+	fd = net_inherited_take(protocol, port);
+	if (fd >= 0)
+		jlog(L_NOTICE, "server on port %s inherited", port);
+
 	netc->on_secure = on_secure;
 	netc->on_connect = on_connect;
 	netc->on_disconnect = on_disconnect;
@@ -669,13 +1385,27 @@ netc_t *net_server(const char *listen_addr,
 		case NET_PROTO_TCP:
 			netc->peer = tcpbus_server(listen_addr, port,
 				net_on_connect, net_on_disconnect,
-				net_on_input, netc);
+				net_on_input, netc, fd);
+			break;
+
+		case NET_PROTO_DTLS:
+			if (security_level == NET_UNSECURE) {
+				jlog(L_NOTICE, "DTLS servers must be secure");
+				break;
+			}
+			netc->peer = udpbus_server(listen_addr, port,
+				net_on_connect, net_on_disconnect,
+				net_on_input, netc, fd);
+			if (netc->peer) {
+				udpbus_set_tick(netc->peer, net_on_tick);
+				udpbus_set_hello(netc->peer, net_on_hello);
+			}
 			break;
 #endif
 		case NET_PROTO_UDT:
 			netc->peer = udtbus_server(listen_addr, port,
 				net_on_connect, net_on_disconnect,
-				net_on_input, netc);
+				net_on_input, netc, fd);
 			break;
 
 		default:
@@ -719,7 +1449,8 @@ void net_p2p_on_connect(peer_t *peer)
 		ret = krypt_secure_connection(netc->kconn, KRYPT_TLS, kconn_type, KRYPT_RSA);
 		if (ret < 0) {
 			jlog(L_NOTICE, "securing client connection failed");
-			net_connection_free(netc);
+			// the upper layer forgets the link
+			net_disconnect(netc);
 			return;
 		}
 
@@ -732,8 +1463,11 @@ void net_p2p_on_connect(peer_t *peer)
 	return;
 }
 
-void net_p2p(const char *listen_addr,
+/* Returns -1 if the link can't be attempted, none of the callbacks
+ * is then called. A failed attempt ends in on_disconnect(). */
+int net_p2p(const char *listen_addr,
 		const char *dest_addr,
+		const char *dest_local,
 		const char *port,
 		uint8_t protocol,
 		uint8_t security_level,
@@ -745,20 +1479,21 @@ void net_p2p(const char *listen_addr,
 		void (*on_input)(netc_t *),
 		void *ext_ptr)
 {
-	pthread_t thread_p2p;
-	struct p2p_args *p2p_args;
+	static const char *p2p_fallback_ports[P2P_PORT_MAX - 1] = { "443", "80", "500" };
+	struct p2p_args p2p_args;
+	size_t i, n;
 
 	netc_t *netc = NULL;
 
 	if (protocol != NET_PROTO_UDT) {
 		jlog(L_ERROR, "the only protocol that support p2p is UDT");
-		return;
+		return -1;
 	}
 
 	netc = net_connection_new(security_level);
 	if (netc == NULL) {
 		jlog(L_ERROR, "unable to initialize connection");
-		return;
+		return -1;
 	}
 
 	netc->on_connect = on_connect;
@@ -773,22 +1508,28 @@ void net_p2p(const char *listen_addr,
 	if (security_level > NET_UNSECURE)
 		krypt_add_passport(netc->kconn, passport);
 
-	p2p_args = (struct p2p_args *)calloc(1, sizeof(struct p2p_args));
-	p2p_args->listen_addr = strdup(listen_addr);
-	p2p_args->dest_addr = strdup(dest_addr);
+	memset(&p2p_args, 0, sizeof(struct p2p_args));
+	p2p_args.listen_addr = listen_addr;
+
+	/* the local address only helps when it differs from the public one */
+	p2p_args.dest_addr[0] = dest_addr;
+	if (dest_local != NULL && strcmp(dest_local, dest_addr) != 0)
+		p2p_args.dest_addr[1] = dest_local;
 
-	p2p_args->port[0] = strdup(port);
-	p2p_args->port[1] = strdup("443");
-	p2p_args->port[2] = strdup("80");
-	p2p_args->port[3] = strdup("500");
+	p2p_args.port[0] = port;
+	for (i = 0, n = 1; i < sizeof(p2p_fallback_ports)/sizeof(p2p_fallback_ports[0]); i++) {
+		if (strcmp(p2p_fallback_ports[i], port) != 0)
+			p2p_args.port[n++] = p2p_fallback_ports[i];
+	}
 
-	p2p_args->on_connect = net_p2p_on_connect;
-	p2p_args->on_disconnect = net_on_disconnect;
-	p2p_args->on_input = net_on_input;
-	p2p_args->ext_ptr = netc;
+	p2p_args.on_connect = net_p2p_on_connect;
+	p2p_args.on_disconnect = net_on_disconnect;
+	p2p_args.on_input = net_on_input;
+	p2p_args.ext_ptr = netc;
+	p2p_args.nominate = (conn_type == NET_P2P_CLIENT);
 
-	pthread_create(&thread_p2p, NULL, udtbus_rendezvous, (void *)p2p_args);
-	pthread_detach(thread_p2p);
+	/* the candidates are raced from udtbus_poke_queue() */
+	udtbus_rendezvous(&p2p_args);
 
-	return;
+	return 0;
 }
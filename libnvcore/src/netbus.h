@@ -26,6 +26,8 @@
 #include <string.h>
 #include <sys/types.h>
 
+#include "asn_arena.h"
+#include "compress.h"
 #include "dnds.h"
 #include "crypto.h"
 #include "mbuf.h"
@@ -33,6 +35,7 @@
 
 #define NET_PROTO_TCP	0x01
 #define NET_PROTO_UDT	0x02
+#define NET_PROTO_DTLS	0x03	/* unreliable, one DTLS record per UDP datagram */
 
 #define NET_CLIENT	0x1
 #define NET_SERVER	0x2
@@ -40,6 +43,8 @@
 #define NET_P2P_CLIENT	1
 #define NET_P2P_SERVER	2
 
+#define NET_INHERIT_MAX	4	/* listening sockets taken over from another process */
+
 #define NET_UNSECURE		0X01
 #define NET_SECURE_ADH		0x02
 #define NET_SECURE_RSA		0x04
@@ -47,6 +52,38 @@
 #define NET_QUEUE_IN	0x1
 #define NET_QUEUE_OUT	0x2
 
+/* Output channels, carried in the channel field of the DNDS messages.
+ * The control channel has strict priority, then NET_SMALL_WEIGHT small
+ * frames go out for each bulk frame while both are waiting. */
+#define NET_CHANNEL_CONTROL	0	/* DNDS operations */
+#define NET_CHANNEL_SMALL	1	/* frames up to NET_SMALL_FRAME bytes */
+#define NET_CHANNEL_BULK	2	/* the other frames */
+#define NET_CHANNELS		3
+
+#define NET_SMALL_FRAME		256
+#define NET_SMALL_WEIGHT	4
+
+/* Frames wait in their channel while the transport holds more than
+ * NET_TRANSPORT_QUEUE bytes, so a control message is never queued
+ * behind more than that. A channel holding NET_CHANNEL_QUEUE bytes
+ * drops the new frames. */
+#define NET_TRANSPORT_QUEUE	(64*1024)
+#define NET_CHANNEL_QUEUE	(1024*1024)
+
+#define NET_BATCH_MAX		(64*1024)	/* gathered for a connection before a write */
+
+#define NET_ARENA_CHUNK		(32*1024)	/* a few decoded frames */
+
+#define NET_MTU_DEFAULT		1500
+#define NET_MTU_MIN		1280	/* IPv6 minimum link MTU */
+
+/* Bytes added around each inner packet before it reaches the underlay:
+ * ethernet header and 802.1Q tag, DNDS BER framing, and the TLS record
+ * header, explicit IV, MAC and padding. */
+#define NET_FRAME_OVERHEAD	(18 + 16 + 69)
+#define NET_UDT_OVERHEAD	(20 + 8 + 16)	/* IPv4, UDP, UDT */
+#define NET_TCP_OVERHEAD	(20 + 32)	/* IPv4, TCP with timestamps */
+
 typedef struct netc {
 
 	DNDSMessage_t *msg_dec;		/* Decoded DNDS Message ready to be queued */
@@ -61,33 +98,74 @@ typedef struct netc {
 	size_t buf_enc_data_size;	/* Data size in the buffer */
 
 	mbuf_t *queue_msg;		/* Queue of decoded DNDS Message ready to be processed */
-	mbuf_t *queue_out;		/* Queue of encoded DNDS Message ready to be sent */
+
+	mbuf_t *queue_chan[NET_CHANNELS];	/* Encoded DNDS Messages waiting for the transport */
+	size_t queue_chan_size[NET_CHANNELS];	/* Bytes waiting in each channel */
+	uint8_t small_run;		/* Small frames sent in a row while bulk frames wait */
+
+	uint8_t pending;		/* Linked in the connections flushed by net_flush_pending() */
+	struct netc *pending_next;
+	struct netc *pending_prev;
+
+	uint8_t batched;		/* Linked in the connections written by net_batch_end() */
+	uint8_t *buf_batch;		/* Records gathered during a batch */
+	size_t buf_batch_data_size;
+	struct netc *batch_next;
+	struct netc *batch_prev;
+
+	compress_t *compress;		/* Ethernet payload compression, NULL if off */
+	asn_arena_t *arena;		/* Decoded messages allocator, NULL for malloc */
 
 	struct krypt *kconn;		/* SSL-related security informations */
 	uint8_t security_level;		/* Security level set { UNSECURE, ADH, RSA } */
 
-	uint8_t protocol;		/* Transport protocol { TCP, UDT } */
+	uint8_t protocol;		/* Transport protocol { TCP, UDT, DTLS } */
 	uint8_t conn_type;		/* Connection type { SERVER, CLIENT, P2P_CLIENT, P2P_SERVER } */
 
 	peer_t *peer;			/* Low-level peer informations */
 	void *ext_ptr;
 
+	passport_t *(*passport_lookup)(const char *);	/* Server, passport of a network by name */
+
 	void (*on_secure)(struct netc *);
 	void (*on_connect)(struct netc *);
 	void (*on_disconnect)(struct netc *);
 	void (*on_input)(struct netc *);
 
+	/* Unicast fast path, offered each encoded ethernet message before it
+	 * is decoded. Returns 0 if it was relayed, -1 to decode it. */
+	int (*on_relay)(struct netc *, const uint8_t *msg, size_t msg_len,
+			uint8_t *frame, size_t frame_len);
+
 } netc_t;
 
 int net_get_local_ip(char *ip_local, int len);
+int net_get_mtu(netc_t *netc);
+int net_get_tunnel_mtu(netc_t *netc);
+int net_set_compression(netc_t *netc, uint8_t method);
+void net_set_passport_lookup(netc_t *netc, passport_t *(*lookup)(const char *));
+void net_set_timeout(netc_t *netc, int timeout);
+int net_set_arena(netc_t *netc);
+void net_set_relay(netc_t *netc, int (*on_relay)(netc_t *, const uint8_t *, size_t, uint8_t *, size_t));
 void net_step_up(netc_t *netc);
+uint8_t net_frame_channel(size_t frame_size);
 int net_send_msg(netc_t *, DNDSMessage_t *);
+int net_send_raw(netc_t *netc, const uint8_t *msg, size_t msg_len);
+void net_flush_pending();
+void net_batch_begin();
+void net_batch_end();
 void net_disconnect(netc_t *);
 
 void netbus_tcp_init();
+int netbus_tcp_poke();
+void netbus_udp_init();
+int netbus_udp_poke();
 int netbus_init();
 void netbus_fini();
 
+int net_inherit(uint8_t protocol, const char *port, int fd);
+int net_server_socket(netc_t *netc);
+
 netc_t *net_client(const char *listen_addr,
 			const char *port,
 			uint8_t protocol,
@@ -97,6 +175,13 @@ netc_t *net_client(const char *listen_addr,
 			void (*on_input)(netc_t *),
 			void (*on_secure)(netc_t *));
 
+netc_t *net_client_socket(int socket,
+			uint8_t security_level,
+			passport_t *passport,
+			void (*on_disconnect)(netc_t *),
+			void (*on_input)(netc_t *),
+			void (*on_secure)(netc_t *));
+
 netc_t *net_server(const char *listen_addr,
 		const char *port,
 		uint8_t protocol,
@@ -107,8 +192,9 @@ netc_t *net_server(const char *listen_addr,
 		void (*on_input)(netc_t *),
 		void (*on_secure)(netc_t *));
 
-void net_p2p(const char *listen_addr,
+int net_p2p(const char *listen_addr,
 		const char *dest_addr,
+		const char *dest_local,
 		const char *port,
 		uint8_t protocol,
 		uint8_t security_level,
@@ -0,0 +1,45 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#include <stdlib.h>
+
+#include "logger.h"
+#include "udt.h"
+
+/* make sure the receive buffer can hold `size' bytes, the
+ * request is clamped between PEER_BUF_MIN and PEER_BUF_MAX */
+int peer_buffer_reserve(peer_t *peer, size_t size)
+{
+	void *buffer;
+
+	if (size < PEER_BUF_MIN)
+		size = PEER_BUF_MIN;
+	if (size > PEER_BUF_MAX)
+		size = PEER_BUF_MAX;
+
+	if (peer->buffer != NULL && peer->buffer_size >= size)
+		return peer->buffer_size;
+
+	buffer = realloc(peer->buffer, size);
+	if (buffer == NULL) {
+		jlog(L_ERROR, "peer_buffer_reserve realloc failed");
+		return peer->buffer ? (int)peer->buffer_size : -1;
+	}
+
+	peer->buffer = buffer;
+	peer->buffer_size = size;
+
+	return size;
+}
@@ -191,11 +191,21 @@ static asn_TYPE_member_t asn_MBR_pdu_4[] = {
 		0,
 		"ethernet"
 		},
+	{ ATF_NOFLAGS, 0, offsetof(struct pdu, choice.compressedEthernet),
+		(ASN_TAG_CLASS_CONTEXT | (3 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_BIT_STRING,
+		0,	/* Defer constraints checking to the member type */
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"compressedEthernet"
+		},
 };
 static asn_TYPE_tag2member_t asn_MAP_pdu_tag2el_4[] = {
     { (ASN_TAG_CLASS_CONTEXT | (0 << 2)), 0, 0, 0 }, /* dnm */
     { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 }, /* dsm */
-    { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 } /* ethernet */
+    { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 }, /* ethernet */
+    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 } /* compressedEthernet */
 };
 static asn_CHOICE_specifics_t asn_SPC_pdu_specs_4 = {
 	sizeof(struct pdu),
@@ -203,7 +213,7 @@ static asn_CHOICE_specifics_t asn_SPC_pdu_specs_4 = {
 	offsetof(struct pdu, present),
 	sizeof(((struct pdu *)0)->present),
 	asn_MAP_pdu_tag2el_4,
-	3,	/* Count of tags in the map */
+	4,	/* Count of tags in the map */
 	0,
 	3	/* Extensions start */
 };
@@ -226,7 +236,7 @@ asn_TYPE_descriptor_t asn_DEF_pdu_4 = {
 	0,	/* No tags (count) */
 	0,	/* No PER visible constraints */
 	asn_MBR_pdu_4,
-	3,	/* Elements count */
+	4,	/* Elements count */
 	&asn_SPC_pdu_specs_4	/* Additional specs */
 };
 
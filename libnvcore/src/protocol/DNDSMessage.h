@@ -30,7 +30,7 @@ typedef enum pdu_PR {
 	pdu_PR_dsm,
 	pdu_PR_ethernet,
 	/* Extensions may appear below */
-	
+	pdu_PR_compressedEthernet
 } pdu_PR;
 
 /* DNDSMessage */
@@ -47,6 +47,7 @@ typedef struct DNDSMessage {
 			 * This type is extensible,
 			 * possible extensions are below.
 			 */
+			BIT_STRING_t	 compressedEthernet;
 		} choice;
 		
 		/* Context for parsing across buffer boundaries */
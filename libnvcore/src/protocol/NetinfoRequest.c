@@ -59,6 +59,57 @@ memb_macAddr_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
 	}
 }
 
+static int
+memb_compression_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	long value;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	value = *(const long *)sptr;
+	
+	if((value >= 0 && value <= 255)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
+static int
+memb_ipAddress_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	const OCTET_STRING_t *st = (const OCTET_STRING_t *)sptr;
+	size_t size;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	size = st->size;
+	
+	if((size >= 4 && size <= 16)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
 static asn_TYPE_member_t asn_MBR_NetinfoRequest_1[] = {
 	{ ATF_NOFLAGS, 0, offsetof(struct NetinfoRequest, ipLocal),
 		(ASN_TAG_CLASS_CONTEXT | (0 << 2)),
@@ -78,22 +129,42 @@ static asn_TYPE_member_t asn_MBR_NetinfoRequest_1[] = {
 		0,
 		"macAddr"
 		},
+	{ ATF_POINTER, 2, offsetof(struct NetinfoRequest, compression),
+		(ASN_TAG_CLASS_CONTEXT | (2 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_NativeInteger,
+		memb_compression_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"compression"
+		},
+	{ ATF_POINTER, 1, offsetof(struct NetinfoRequest, ipAddress),
+		(ASN_TAG_CLASS_CONTEXT | (3 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_OCTET_STRING,
+		memb_ipAddress_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"ipAddress"
+		},
 };
 static ber_tlv_tag_t asn_DEF_NetinfoRequest_tags_1[] = {
 	(ASN_TAG_CLASS_UNIVERSAL | (16 << 2))
 };
 static asn_TYPE_tag2member_t asn_MAP_NetinfoRequest_tag2el_1[] = {
     { (ASN_TAG_CLASS_CONTEXT | (0 << 2)), 0, 0, 0 }, /* ipLocal */
-    { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 } /* macAddr */
+    { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 }, /* macAddr */
+    { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 }, /* compression */
+    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 } /* ipAddress */
 };
 static asn_SEQUENCE_specifics_t asn_SPC_NetinfoRequest_specs_1 = {
 	sizeof(struct NetinfoRequest),
 	offsetof(struct NetinfoRequest, _asn_ctx),
 	asn_MAP_NetinfoRequest_tag2el_1,
-	2,	/* Count of tags in the map */
+	4,	/* Count of tags in the map */
 	0, 0, 0,	/* Optional elements (not needed) */
 	1,	/* Start extensions */
-	3	/* Stop extensions */
+	5	/* Stop extensions */
 };
 asn_TYPE_descriptor_t asn_DEF_NetinfoRequest = {
 	"NetinfoRequest",
@@ -115,7 +186,7 @@ asn_TYPE_descriptor_t asn_DEF_NetinfoRequest = {
 		/sizeof(asn_DEF_NetinfoRequest_tags_1[0]), /* 1 */
 	0,	/* No PER visible constraints */
 	asn_MBR_NetinfoRequest_1,
-	2,	/* Elements count */
+	4,	/* Elements count */
 	&asn_SPC_NetinfoRequest_specs_1	/* Additional specs */
 };
 
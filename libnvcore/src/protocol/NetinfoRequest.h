@@ -13,6 +13,7 @@
 
 /* Including external dependencies */
 #include <OCTET_STRING.h>
+#include <NativeInteger.h>
 #include <constr_SEQUENCE.h>
 
 #ifdef __cplusplus
@@ -27,6 +28,8 @@ typedef struct NetinfoRequest {
 	 * This type is extensible,
 	 * possible extensions are below.
 	 */
+	long	*compression	/* OPTIONAL */;
+	OCTET_STRING_t	*ipAddress	/* OPTIONAL */;
 	
 	/* Context for parsing across buffer boundaries */
 	asn_struct_ctx_t _asn_ctx;
@@ -59,6 +59,56 @@ memb_netmask_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
 	}
 }
 
+static int
+memb_compression_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	long value;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	value = *(const long *)sptr;
+	
+	if((value >= 0 && value <= 255)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
+static int
+memb_dataPort_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	long value;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	value = *(const long *)sptr;
+	
+	if((value >= 0 && value <= 65535)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
 static asn_TYPE_member_t asn_MBR_NetinfoResponse_1[] = {
 	{ ATF_NOFLAGS, 0, offsetof(struct NetinfoResponse, ipAddress),
 		(ASN_TAG_CLASS_CONTEXT | (0 << 2)),
@@ -87,6 +137,24 @@ static asn_TYPE_member_t asn_MBR_NetinfoResponse_1[] = {
 		0,
 		"result"
 		},
+	{ ATF_POINTER, 2, offsetof(struct NetinfoResponse, compression),
+		(ASN_TAG_CLASS_CONTEXT | (3 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_NativeInteger,
+		memb_compression_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"compression"
+		},
+	{ ATF_POINTER, 1, offsetof(struct NetinfoResponse, dataPort),
+		(ASN_TAG_CLASS_CONTEXT | (4 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_NativeInteger,
+		memb_dataPort_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"dataPort"
+		},
 };
 static ber_tlv_tag_t asn_DEF_NetinfoResponse_tags_1[] = {
 	(ASN_TAG_CLASS_UNIVERSAL | (16 << 2))
@@ -94,16 +162,18 @@ static ber_tlv_tag_t asn_DEF_NetinfoResponse_tags_1[] = {
 static asn_TYPE_tag2member_t asn_MAP_NetinfoResponse_tag2el_1[] = {
     { (ASN_TAG_CLASS_CONTEXT | (0 << 2)), 0, 0, 0 }, /* ipAddress */
     { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 }, /* netmask */
-    { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 } /* result */
+    { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 }, /* result */
+    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 }, /* compression */
+    { (ASN_TAG_CLASS_CONTEXT | (4 << 2)), 4, 0, 0 } /* dataPort */
 };
 static asn_SEQUENCE_specifics_t asn_SPC_NetinfoResponse_specs_1 = {
 	sizeof(struct NetinfoResponse),
 	offsetof(struct NetinfoResponse, _asn_ctx),
 	asn_MAP_NetinfoResponse_tag2el_1,
-	3,	/* Count of tags in the map */
+	5,	/* Count of tags in the map */
 	0, 0, 0,	/* Optional elements (not needed) */
 	2,	/* Start extensions */
-	4	/* Stop extensions */
+	6	/* Stop extensions */
 };
 asn_TYPE_descriptor_t asn_DEF_NetinfoResponse = {
 	"NetinfoResponse",
@@ -125,7 +195,7 @@ asn_TYPE_descriptor_t asn_DEF_NetinfoResponse = {
 		/sizeof(asn_DEF_NetinfoResponse_tags_1[0]), /* 1 */
 	0,	/* No PER visible constraints */
 	asn_MBR_NetinfoResponse_1,
-	3,	/* Elements count */
+	5,	/* Elements count */
 	&asn_SPC_NetinfoResponse_specs_1	/* Additional specs */
 };
 
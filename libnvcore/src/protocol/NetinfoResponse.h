@@ -14,6 +14,7 @@
 /* Including external dependencies */
 #include <OCTET_STRING.h>
 #include "DNDSResult.h"
+#include <NativeInteger.h>
 #include <constr_SEQUENCE.h>
 
 #ifdef __cplusplus
@@ -29,6 +30,8 @@ typedef struct NetinfoResponse {
 	 * This type is extensible,
 	 * possible extensions are below.
 	 */
+	long	*compression	/* OPTIONAL */;
+	long	*dataPort	/* OPTIONAL */;
 	
 	/* Context for parsing across buffer boundaries */
 	asn_struct_ctx_t _asn_ctx;
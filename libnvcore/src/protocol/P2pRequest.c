@@ -157,6 +157,32 @@ memb_port_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
 	return 0;
 }
 
+static int
+memb_ipLocalDst_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	const OCTET_STRING_t *st = (const OCTET_STRING_t *)sptr;
+	size_t size;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	size = st->size;
+	
+	if((size >= 4 && size <= 16)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
 static asn_INTEGER_specifics_t asn_SPC_port_specs_4 = {
 	0,	0,	0,	0,	0,
 	0,	/* Native long size */
@@ -227,6 +253,15 @@ static asn_TYPE_member_t asn_MBR_P2pRequest_1[] = {
 		0,
 		"side"
 		},
+	{ ATF_POINTER, 1, offsetof(struct P2pRequest, ipLocalDst),
+		(ASN_TAG_CLASS_CONTEXT | (4 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_OCTET_STRING,
+		memb_ipLocalDst_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"ipLocalDst"
+		},
 };
 static ber_tlv_tag_t asn_DEF_P2pRequest_tags_1[] = {
 	(ASN_TAG_CLASS_UNIVERSAL | (16 << 2))
@@ -235,16 +270,17 @@ static asn_TYPE_tag2member_t asn_MAP_P2pRequest_tag2el_1[] = {
     { (ASN_TAG_CLASS_CONTEXT | (0 << 2)), 0, 0, 0 }, /* macAddrDst */
     { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 }, /* ipAddrDst */
     { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 }, /* port */
-    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 } /* side */
+    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 }, /* side */
+    { (ASN_TAG_CLASS_CONTEXT | (4 << 2)), 4, 0, 0 } /* ipLocalDst */
 };
 static asn_SEQUENCE_specifics_t asn_SPC_P2pRequest_specs_1 = {
 	sizeof(struct P2pRequest),
 	offsetof(struct P2pRequest, _asn_ctx),
 	asn_MAP_P2pRequest_tag2el_1,
-	4,	/* Count of tags in the map */
+	5,	/* Count of tags in the map */
 	0, 0, 0,	/* Optional elements (not needed) */
 	3,	/* Start extensions */
-	5	/* Stop extensions */
+	6	/* Stop extensions */
 };
 asn_TYPE_descriptor_t asn_DEF_P2pRequest = {
 	"P2pRequest",
@@ -266,7 +302,7 @@ asn_TYPE_descriptor_t asn_DEF_P2pRequest = {
 		/sizeof(asn_DEF_P2pRequest_tags_1[0]), /* 1 */
 	0,	/* No PER visible constraints */
 	asn_MBR_P2pRequest_1,
-	4,	/* Elements count */
+	5,	/* Elements count */
 	&asn_SPC_P2pRequest_specs_1	/* Additional specs */
 };
 
@@ -33,8 +33,33 @@ memb_ipAddress_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
 	}
 }
 
+static int
+memb_switchPort_constraint_1(asn_TYPE_descriptor_t *td, const void *sptr,
+			asn_app_constraint_failed_f *ctfailcb, void *app_key) {
+	long value;
+	
+	if(!sptr) {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: value not given (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+	
+	value = *(const long *)sptr;
+	
+	if((value >= 0 && value <= 65535)) {
+		/* Constraint check succeeded */
+		return 0;
+	} else {
+		_ASN_CTFAIL(app_key, td, sptr,
+			"%s: constraint failed (%s:%d)",
+			td->name, __FILE__, __LINE__);
+		return -1;
+	}
+}
+
 static asn_TYPE_member_t asn_MBR_ProvResponse_1[] = {
-	{ ATF_POINTER, 4, offsetof(struct ProvResponse, certificate),
+	{ ATF_POINTER, 6, offsetof(struct ProvResponse, certificate),
 		(ASN_TAG_CLASS_CONTEXT | (0 << 2)),
 		-1,	/* IMPLICIT tag at current level */
 		&asn_DEF_PrintableString,
@@ -43,7 +68,7 @@ static asn_TYPE_member_t asn_MBR_ProvResponse_1[] = {
 		0,
 		"certificate"
 		},
-	{ ATF_POINTER, 3, offsetof(struct ProvResponse, certificateKey),
+	{ ATF_POINTER, 5, offsetof(struct ProvResponse, certificateKey),
 		(ASN_TAG_CLASS_CONTEXT | (1 << 2)),
 		-1,	/* IMPLICIT tag at current level */
 		&asn_DEF_PrintableString,
@@ -52,7 +77,7 @@ static asn_TYPE_member_t asn_MBR_ProvResponse_1[] = {
 		0,
 		"certificateKey"
 		},
-	{ ATF_POINTER, 2, offsetof(struct ProvResponse, trustedCert),
+	{ ATF_POINTER, 4, offsetof(struct ProvResponse, trustedCert),
 		(ASN_TAG_CLASS_CONTEXT | (2 << 2)),
 		-1,	/* IMPLICIT tag at current level */
 		&asn_DEF_PrintableString,
@@ -61,7 +86,7 @@ static asn_TYPE_member_t asn_MBR_ProvResponse_1[] = {
 		0,
 		"trustedCert"
 		},
-	{ ATF_POINTER, 1, offsetof(struct ProvResponse, ipAddress),
+	{ ATF_POINTER, 3, offsetof(struct ProvResponse, ipAddress),
 		(ASN_TAG_CLASS_CONTEXT | (3 << 2)),
 		-1,	/* IMPLICIT tag at current level */
 		&asn_DEF_OCTET_STRING,
@@ -70,6 +95,24 @@ static asn_TYPE_member_t asn_MBR_ProvResponse_1[] = {
 		0,
 		"ipAddress"
 		},
+	{ ATF_POINTER, 2, offsetof(struct ProvResponse, switchAddress),
+		(ASN_TAG_CLASS_CONTEXT | (4 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_PrintableString,
+		0,	/* Defer constraints checking to the member type */
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"switchAddress"
+		},
+	{ ATF_POINTER, 1, offsetof(struct ProvResponse, switchPort),
+		(ASN_TAG_CLASS_CONTEXT | (5 << 2)),
+		-1,	/* IMPLICIT tag at current level */
+		&asn_DEF_NativeInteger,
+		memb_switchPort_constraint_1,
+		0,	/* PER is not compiled, use -gen-PER */
+		0,
+		"switchPort"
+		},
 };
 static ber_tlv_tag_t asn_DEF_ProvResponse_tags_1[] = {
 	(ASN_TAG_CLASS_UNIVERSAL | (16 << 2))
@@ -78,16 +121,18 @@ static asn_TYPE_tag2member_t asn_MAP_ProvResponse_tag2el_1[] = {
     { (ASN_TAG_CLASS_CONTEXT | (0 << 2)), 0, 0, 0 }, /* certificate */
     { (ASN_TAG_CLASS_CONTEXT | (1 << 2)), 1, 0, 0 }, /* certificateKey */
     { (ASN_TAG_CLASS_CONTEXT | (2 << 2)), 2, 0, 0 }, /* trustedCert */
-    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 } /* ipAddress */
+    { (ASN_TAG_CLASS_CONTEXT | (3 << 2)), 3, 0, 0 }, /* ipAddress */
+    { (ASN_TAG_CLASS_CONTEXT | (4 << 2)), 4, 0, 0 }, /* switchAddress */
+    { (ASN_TAG_CLASS_CONTEXT | (5 << 2)), 5, 0, 0 } /* switchPort */
 };
 static asn_SEQUENCE_specifics_t asn_SPC_ProvResponse_specs_1 = {
 	sizeof(struct ProvResponse),
 	offsetof(struct ProvResponse, _asn_ctx),
 	asn_MAP_ProvResponse_tag2el_1,
-	4,	/* Count of tags in the map */
+	6,	/* Count of tags in the map */
 	0, 0, 0,	/* Optional elements (not needed) */
 	3,	/* Start extensions */
-	5	/* Stop extensions */
+	7	/* Stop extensions */
 };
 asn_TYPE_descriptor_t asn_DEF_ProvResponse = {
 	"ProvResponse",
@@ -109,7 +154,7 @@ asn_TYPE_descriptor_t asn_DEF_ProvResponse = {
 		/sizeof(asn_DEF_ProvResponse_tags_1[0]), /* 1 */
 	0,	/* No PER visible constraints */
 	asn_MBR_ProvResponse_1,
-	4,	/* Elements count */
+	6,	/* Elements count */
 	&asn_SPC_ProvResponse_specs_1	/* Additional specs */
 };
 
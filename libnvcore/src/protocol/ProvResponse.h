@@ -14,6 +14,7 @@
 /* Including external dependencies */
 #include <PrintableString.h>
 #include <OCTET_STRING.h>
+#include <NativeInteger.h>
 #include <constr_SEQUENCE.h>
 
 #ifdef __cplusplus
@@ -30,6 +31,8 @@ typedef struct ProvResponse {
 	 * This type is extensible,
 	 * possible extensions are below.
 	 */
+	PrintableString_t	*switchAddress	/* OPTIONAL */;
+	long	*switchPort	/* OPTIONAL */;
 	
 	/* Context for parsing across buffer boundaries */
 	asn_struct_ctx_t _asn_ctx;
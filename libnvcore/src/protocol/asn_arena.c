@@ -0,0 +1,221 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asn_arena.h"
+
+/* each allocation is preceded by its size, REALLOC needs it */
+#define ARENA_ALIGN	16
+#define ARENA_HDR	ARENA_ALIGN
+#define ARENA_ROUND(x)	(((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define CHUNK_HDR	ARENA_ROUND(sizeof(struct asn_arena_chunk))
+#define CHUNK_DATA(c)	((uint8_t *)(c) + CHUNK_HDR)
+
+ASN_THREAD_LOCAL asn_arena_t *asn_arena_current = NULL;
+
+static struct asn_arena_chunk *arena_chunk_new(size_t size)
+{
+	struct asn_arena_chunk *chunk;
+
+	chunk = malloc(CHUNK_HDR + size);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->last = 0;
+
+	return chunk;
+}
+
+asn_arena_t *asn_arena_new(size_t chunk_size)
+{
+	asn_arena_t *arena;
+
+	arena = calloc(1, sizeof(asn_arena_t));
+	if (arena == NULL)
+		return NULL;
+
+	arena->chunk_size = ARENA_ROUND(chunk_size ? chunk_size : ASN_ARENA_CHUNK);
+	arena->chunk = arena_chunk_new(arena->chunk_size);
+	if (arena->chunk == NULL) {
+		free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void asn_arena_destroy(asn_arena_t *arena)
+{
+	struct asn_arena_chunk *chunk;
+
+	if (arena == NULL)
+		return;
+
+	if (asn_arena_current == arena)
+		asn_arena_current = NULL;
+
+	while ((chunk = arena->chunk) != NULL) {
+		arena->chunk = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+/* Release everything allocated so far. An arena that needed several
+ * chunks is left with a single one as large as all of them, so the
+ * next messages are contiguous. */
+void asn_arena_reset(asn_arena_t *arena)
+{
+	struct asn_arena_chunk *chunk;
+	struct asn_arena_chunk *next;
+	size_t total = 0;
+
+	if (arena->chunk->next == NULL) {
+		arena->chunk->used = 0;
+		arena->chunk->last = 0;
+		return;
+	}
+
+	for (chunk = arena->chunk; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		total += chunk->size;
+		free(chunk);
+	}
+
+	if (total > ASN_ARENA_KEEP)
+		total = ASN_ARENA_KEEP;
+	if (total < arena->chunk_size)
+		total = arena->chunk_size;
+
+	arena->chunk = arena_chunk_new(total);
+	if (arena->chunk == NULL)
+		arena->chunk = arena_chunk_new(arena->chunk_size);
+}
+
+/* Make the runtime allocate from arena, NULL goes back to libc.
+ * Returns the arena that was in use. */
+asn_arena_t *asn_arena_use(asn_arena_t *arena)
+{
+	asn_arena_t *prev = asn_arena_current;
+
+	asn_arena_current = arena;
+
+	return prev;
+}
+
+static struct asn_arena_chunk *arena_chunk_of(asn_arena_t *arena, const void *ptr)
+{
+	struct asn_arena_chunk *chunk;
+	const uint8_t *p = ptr;
+
+	for (chunk = arena->chunk; chunk != NULL; chunk = chunk->next) {
+		if (p >= CHUNK_DATA(chunk) && p < CHUNK_DATA(chunk) + chunk->size)
+			return chunk;
+	}
+
+	return NULL;
+}
+
+int asn_arena_owns(asn_arena_t *arena, const void *ptr)
+{
+	return arena_chunk_of(arena, ptr) != NULL;
+}
+
+void *asn_arena_malloc(asn_arena_t *arena, size_t size)
+{
+	struct asn_arena_chunk *chunk = arena->chunk;
+	size_t need;
+	uint8_t *p;
+
+	need = ARENA_HDR + ARENA_ROUND(size);
+	if (need < size)
+		return NULL;
+
+	if (chunk == NULL || chunk->size - chunk->used < need) {
+		chunk = arena_chunk_new(need > arena->chunk_size ? need : arena->chunk_size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = arena->chunk;
+		arena->chunk = chunk;
+	}
+
+	p = CHUNK_DATA(chunk) + chunk->used;
+	*(size_t *)p = size;
+
+	chunk->last = chunk->used;
+	chunk->used += need;
+
+	return p + ARENA_HDR;
+}
+
+void *asn_arena_calloc(asn_arena_t *arena, size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+
+	p = asn_arena_malloc(arena, nmemb * size);
+	if (p != NULL)
+		memset(p, 0, nmemb * size);
+
+	return p;
+}
+
+void *asn_arena_realloc(asn_arena_t *arena, void *ptr, size_t size)
+{
+	struct asn_arena_chunk *chunk;
+	uint8_t *hdr;
+	size_t old_size;
+	void *p;
+
+	if (ptr == NULL)
+		return asn_arena_malloc(arena, size);
+
+	chunk = arena_chunk_of(arena, ptr);
+	if (chunk == NULL)
+		return realloc(ptr, size);
+
+	hdr = (uint8_t *)ptr - ARENA_HDR;
+	old_size = *(size_t *)hdr;
+
+	/* the strings grow their last allocation, extend it in place */
+	if (chunk == arena->chunk && hdr == CHUNK_DATA(chunk) + chunk->last
+		&& chunk->last + ARENA_HDR + ARENA_ROUND(size) <= chunk->size) {
+		*(size_t *)hdr = size;
+		chunk->used = chunk->last + ARENA_HDR + ARENA_ROUND(size);
+		return ptr;
+	}
+
+	p = asn_arena_malloc(arena, size);
+	if (p != NULL)
+		memcpy(p, ptr, old_size < size ? old_size : size);
+
+	return p;
+}
+
+/* Memory of the arena goes away with asn_arena_reset(), the rest was
+ * allocated before the arena was in use. */
+void asn_arena_release(asn_arena_t *arena, void *ptr)
+{
+	if (ptr != NULL && arena_chunk_of(arena, ptr) == NULL)
+		free(ptr);
+}
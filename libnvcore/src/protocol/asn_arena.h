@@ -0,0 +1,68 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef ASN_ARENA_H
+#define ASN_ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for the BER decoder. While an arena is in use by the
+ * calling thread, the CALLOC/MALLOC/REALLOC/FREEMEM macros of the asn1c
+ * runtime allocate from it, so a decoded message lies in a few large
+ * chunks. The message is never freed member by member: the whole arena
+ * is reset once the messages decoded in it are processed.
+ */
+
+#define ASN_ARENA_CHUNK		(16*1024)	/* default chunk size */
+#define ASN_ARENA_KEEP		(1024*1024)	/* largest chunk kept by a reset */
+
+struct asn_arena_chunk {
+	struct asn_arena_chunk *next;
+	size_t size;			/* bytes usable after the header */
+	size_t used;
+	size_t last;			/* offset of the last allocation */
+};
+
+typedef struct asn_arena {
+	struct asn_arena_chunk *chunk;	/* current chunk, then the older ones */
+	size_t chunk_size;
+} asn_arena_t;
+
+/* thread-local storage, __thread is not known to every toolchain */
+#if defined(_MSC_VER)
+#define ASN_THREAD_LOCAL	__declspec(thread)
+#elif defined(__cplusplus) && __cplusplus >= 201103L
+#define ASN_THREAD_LOCAL	thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define ASN_THREAD_LOCAL	_Thread_local
+#else
+#define ASN_THREAD_LOCAL	__thread
+#endif
+
+/* arena the asn1c runtime allocates from on this thread, NULL for libc */
+extern ASN_THREAD_LOCAL asn_arena_t *asn_arena_current;
+
+asn_arena_t *asn_arena_new(size_t chunk_size);
+void asn_arena_destroy(asn_arena_t *arena);
+void asn_arena_reset(asn_arena_t *arena);
+asn_arena_t *asn_arena_use(asn_arena_t *arena);
+
+int asn_arena_owns(asn_arena_t *arena, const void *ptr);
+void *asn_arena_malloc(asn_arena_t *arena, size_t size);
+void *asn_arena_calloc(asn_arena_t *arena, size_t nmemb, size_t size);
+void *asn_arena_realloc(asn_arena_t *arena, void *ptr, size_t size);
+void asn_arena_release(asn_arena_t *arena, void *ptr);
+
+#endif /* ASN_ARENA_H */
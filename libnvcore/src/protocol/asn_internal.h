@@ -10,6 +10,7 @@
 #define	_ASN_INTERNAL_H_
 
 #include "asn_application.h"	/* Application-visible API */
+#include "asn_arena.h"		/* Decoding arena */
 
 #ifndef	__NO_ASSERT_H__		/* Include assert.h only for internal use. */
 #include <assert.h>		/* for assert() macro */
@@ -23,10 +24,19 @@ extern "C" {
 #define	ASN1C_ENVIRONMENT_VERSION	923	/* Compile-time version */
 int get_asn1c_environment_version(void);	/* Run-time version */
 
-#define	CALLOC(nmemb, size)	calloc(nmemb, size)
-#define	MALLOC(size)		malloc(size)
-#define	REALLOC(oldptr, size)	realloc(oldptr, size)
-#define	FREEMEM(ptr)		free(ptr)
+/* Allocate from the decoding arena of the thread, if any (asn_arena.h) */
+#define	CALLOC(nmemb, size)	(asn_arena_current				\
+		? asn_arena_calloc(asn_arena_current, nmemb, size)		\
+		: calloc(nmemb, size))
+#define	MALLOC(size)		(asn_arena_current				\
+		? asn_arena_malloc(asn_arena_current, size)			\
+		: malloc(size))
+#define	REALLOC(oldptr, size)	(asn_arena_current				\
+		? asn_arena_realloc(asn_arena_current, oldptr, size)		\
+		: realloc(oldptr, size))
+#define	FREEMEM(ptr)		(asn_arena_current				\
+		? asn_arena_release(asn_arena_current, ptr)			\
+		: free(ptr))
 
 #define	asn_debug_indent	0
 #define ASN_DEBUG_INDENT_ADD(i) do{}while(0)
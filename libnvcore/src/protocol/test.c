@@ -518,6 +518,7 @@ void test_P2pRequest_dnm()
 	P2pRequest_set_port(msg, 9000);
 	P2pRequest_set_side(msg, P2pSide_client);
 	P2pRequest_set_macAddrDst(msg, macAddrDst);
+	P2pRequest_set_ipLocalDst(msg, "192.168.1.20");
 
 	/// Encoding part
 
@@ -927,6 +928,7 @@ void test_NetinfoRequest()
 
 	NetinfoRequest_set_ipLocal(msg, "192.168.10.10");
 	NetinfoRequest_set_macAddr(msg, macAddr);
+	NetinfoRequest_set_ipAddress(msg, "44.128.0.1");
 
 	/// Encoding part
 
@@ -18,19 +18,22 @@
 #include <unistd.h>
 
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/sockios.h>
 
 #include "logger.h"
 #include "netbus.h"
 #include "tcp.h"
 
-#define CONN_BACKLOG 512
+#ifdef HAVE_LIBURING
+#include "tcp_uring.h"
+#endif
 
-#define TCPBUS_SERVER 0x1
-#define TCPBUS_CLIENT 0x2
+#define CONN_BACKLOG 512
 
 #define NUM_EVENTS 64
 #define BACKING_STORE 512
@@ -42,6 +45,10 @@
 static int tcpbus_queue = -1;
 static struct epoll_event ep_ev[NUM_EVENTS];
 
+#ifdef HAVE_LIBURING
+static int tcpbus_uring = 0;	/* io_uring backend in use */
+#endif
+
 static int setnonblocking(int socket)
 {
 	int ret;
@@ -87,10 +94,47 @@ int tcpbus_ion_new()
 	return epoll_fd;
 }
 
+static peer_t *tcpbus_peer_new()
+{
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring)
+		return tcpbus_uring_peer_new();
+#endif
+	return calloc(sizeof(peer_t), 1);
+}
+
+/* release a peer that never made it to tcpbus_peer_add() */
+static void tcpbus_peer_free(peer_t *peer)
+{
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring) {
+		tcpbus_uring_peer_free(peer);
+		return;
+	}
+#endif
+	free(peer);
+}
+
+/* register the peer with the active backend, which may
+ * replace the recv, send and disconnect handlers */
+static int tcpbus_peer_add(peer_t *peer)
+{
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring)
+		return tcpbus_uring_add(peer);
+#endif
+	return tcpbus_ion_add(peer->socket, peer);
+}
+
 static void tcpbus_disconnect(peer_t *peer)
 {
 	int ret;
 
+	/* a listening socket handed over lives on in the other process,
+	 * close() would leave it in the queue */
+	if (peer->type == TCPBUS_SERVER)
+		epoll_ctl(tcpbus_queue, EPOLL_CTL_DEL, peer->socket, NULL);
+
 	//close() will cause the socket to be automatically removed from the queue
 	ret = close(peer->socket);
 	if (ret < 0) {
@@ -131,13 +175,24 @@ static int tcpbus_send(peer_t *peer, void *data, int len)
 	return ret;
 }
 
+/* bytes in the socket send queue, not yet acknowledged */
+static int tcpbus_pending(peer_t *peer)
+{
+	int queued = 0;
+
+	if (ioctl(peer->socket, SIOCOUTQ, &queued) < 0)
+		return 0;
+
+	return queued;
+}
+
 static int tcpbus_recv(peer_t *peer)
 {
-// TODO use dynamic buffer
-#define PEER_BUF_SZ 5000
 	fd_set rfds;
 	struct timeval tv;
 	int ret = 0;
+	int avail = 0;
+	int size;
 
 	FD_ZERO(&rfds);
 	FD_SET(peer->socket, &rfds);
@@ -153,23 +208,17 @@ static int tcpbus_recv(peer_t *peer)
 		return -1;
 	}
 
-	if (peer->buffer == NULL) {
-		peer->buffer = calloc(1, PEER_BUF_SZ);
-		if (peer->buffer == NULL) {
-			jlog(L_ERROR, "tcpbus_recv calloc failed");
-			return -1;
-		}
-	}
-	else {
-		memset(peer->buffer, 0, PEER_BUF_SZ);
+	/* size the buffer to what the kernel has queued for us */
+	if (ioctl(peer->socket, FIONREAD, &avail) < 0)
+		avail = 0;
+
+	size = peer_buffer_reserve(peer, avail);
+	if (size < 0) {
+		jlog(L_ERROR, "tcpbus_recv peer_buffer_reserve failed");
+		return -1;
 	}
 
-	/*
-	 * XXX It may happen that the buffer is too short,
-	 * in that case we should then re-alloc and move
-	 * the bytes.
-	 */
-	ret = recv(peer->socket, peer->buffer, PEER_BUF_SZ, 0);
+	ret = recv(peer->socket, peer->buffer, size, 0);
 
 	if (ret < 0)
 		return -1;
@@ -221,6 +270,7 @@ static void tcpbus_on_connect(peer_t *peer)
 	npeer->on_input = peer->on_input;
 	npeer->recv = peer->recv;
 	npeer->send = peer->send;
+	npeer->pending = peer->pending;
 	npeer->disconnect = peer->disconnect;
 	npeer->ext_ptr = peer->ext_ptr;
 	npeer->buffer = NULL;
@@ -243,7 +293,8 @@ peer_t *tcpbus_server(const char *in_addr,
 		   void (*on_connect)(peer_t*),
 		   void (*on_disconnect)(peer_t*),
 		   void (*on_input)(peer_t*),
-		   void *ext_ptr)
+		   void *ext_ptr,
+		   int fd)
 {
 	int ret;
 	struct sockaddr_in addr;
@@ -251,21 +302,30 @@ peer_t *tcpbus_server(const char *in_addr,
 
 	jlog(L_NOTICE, "server ready: %s:%s", in_addr, port);
 
-	peer = calloc(sizeof(peer_t), 1);
+	peer = tcpbus_peer_new();
+	if (peer == NULL)
+		return NULL;
 	peer->type = TCPBUS_SERVER;
 	peer->on_connect = on_connect;
 	peer->on_disconnect = on_disconnect;
 	peer->on_input = on_input;
 	peer->recv = tcpbus_recv;
 	peer->send = tcpbus_send;
+	peer->pending = tcpbus_pending;
 	peer->disconnect = tcpbus_disconnect;
 	peer->buffer = NULL;
 	peer->ext_ptr = ext_ptr;
 
+	/* already listening, inherited from the process we replace */
+	if (fd >= 0) {
+		peer->socket = fd;
+		goto add;
+	}
+
 	peer->socket = socket(PF_INET, SOCK_STREAM, 0);
 	if (peer->socket < 0) {
 		jlog(L_NOTICE, "socket failed: %s", strerror(errno));
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
@@ -278,7 +338,7 @@ peer_t *tcpbus_server(const char *in_addr,
 	if (ret < 0) {
 		jlog(L_NOTICE, "setreuse: %s", strerror(errno));
 		close(peer->socket);
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
@@ -286,7 +346,7 @@ peer_t *tcpbus_server(const char *in_addr,
 	if (ret < 0) {
 		jlog(L_NOTICE, "bind failed: %s %s", strerror(errno), in_addr);
 		close(peer->socket);
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
@@ -297,15 +357,39 @@ peer_t *tcpbus_server(const char *in_addr,
 	if (ret < 0) {
 		jlog(L_NOTICE, "set_nonblocking failed: %s", strerror(errno));
 		close(peer->socket);
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
-	ret = tcpbus_ion_add(peer->socket, peer);
+add:
+	ret = tcpbus_peer_add(peer);
 	if (ret < 0) {
-		jlog(L_NOTICE, "tcpbus_ion_add failed: %s", strerror(errno));
+		jlog(L_NOTICE, "tcpbus_peer_add failed: %s", strerror(errno));
+		close(peer->socket);
+		tcpbus_peer_free(peer);
+		return NULL;
+	}
+
+	return peer;
+}
+
+static peer_t *tcpbus_client_add(peer_t *peer,
+			  void (*on_disconnect)(peer_t*),
+			  void (*on_input)(peer_t*))
+{
+	peer->type = TCPBUS_CLIENT;
+	peer->on_disconnect = on_disconnect;
+	peer->on_input = on_input;
+	peer->send = tcpbus_send;
+	peer->recv = tcpbus_recv;
+	peer->pending = tcpbus_pending;
+	peer->disconnect = tcpbus_disconnect;
+	peer->buffer = NULL;
+
+	if (tcpbus_peer_add(peer) < 0) {
+		jlog(L_NOTICE, "peer_add failed: %s", strerror(errno));
 		close(peer->socket);
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
@@ -329,12 +413,14 @@ peer_t *tcpbus_client(const char *addr,
 	tv.tv_sec = 5;
 	tv.tv_usec = 0;
 
-	peer = calloc(sizeof(peer_t), 1);
+	peer = tcpbus_peer_new();
+	if (peer == NULL)
+		return NULL;
 
 	peer->socket = socket(PF_INET, SOCK_STREAM, 0);
 	if (peer->socket == -1) {
 		jlog(L_ERROR, "socket failed: %s", strerror(errno));
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
@@ -342,7 +428,7 @@ peer_t *tcpbus_client(const char *addr,
         if (ret < 0) {
                 jlog(L_ERROR, "setnonblocking failed: %s", strerror(errno));
 		close(peer->socket);
-                free(peer);
+                tcpbus_peer_free(peer);
                 return NULL;
         }
 
@@ -364,7 +450,7 @@ peer_t *tcpbus_client(const char *addr,
 			if (ret == 0) { /* TIMEOUT */
 				jlog(L_DEBUG, "connect timed out");
 				close(peer->socket);
-				free(peer);
+				tcpbus_peer_free(peer);
 				return NULL;
 			}
 			else {
@@ -374,14 +460,14 @@ peer_t *tcpbus_client(const char *addr,
 				if (ret == -1) {
 					jlog(L_DEBUG, "getsockopt failed: %s");
 					close(peer->socket);
-					free(peer);
+					tcpbus_peer_free(peer);
 					return NULL;
 				}
 
 				if (optval != 0) { /* NOT CONNECTED ! TIMEOUT... */
 					jlog(L_DEBUG, "connect timed out");
 					close(peer->socket);
-					free(peer);
+					tcpbus_peer_free(peer);
 	                                return NULL;
 				}
 				else {
@@ -393,32 +479,48 @@ peer_t *tcpbus_client(const char *addr,
 		else {
 			jlog(L_DEBUG, "connect faield: %s", strerror(errno));
 			close(peer->socket);
-			free(peer);
+			tcpbus_peer_free(peer);
 			return NULL;
 		}
 	}
 
-	peer->type = TCPBUS_CLIENT;
-	peer->on_disconnect = on_disconnect;
-	peer->on_input = on_input;
-	peer->send = tcpbus_send;
-	peer->recv = tcpbus_recv;
-	peer->disconnect = tcpbus_disconnect;
-	peer->buffer = NULL;
+	return tcpbus_client_add(peer, on_disconnect, on_input);
+}
 
-	ret = tcpbus_ion_add(peer->socket, peer);
-	if (ret < 0) {
-		jlog(L_NOTICE, "ion_add failed: %s", strerror(errno));
+/* A client on a socket the caller connected, which is closed if the
+ * peer can't be added */
+peer_t *tcpbus_client_socket(int socket,
+			  void (*on_disconnect)(peer_t*),
+			  void (*on_input)(peer_t*))
+{
+	peer_t *peer = NULL;
+
+	peer = tcpbus_peer_new();
+	if (peer == NULL) {
+		close(socket);
+		return NULL;
+	}
+	peer->socket = socket;
+
+	if (setnonblocking(peer->socket) < 0) {
+		jlog(L_ERROR, "setnonblocking failed: %s", strerror(errno));
 		close(peer->socket);
-		free(peer);
+		tcpbus_peer_free(peer);
 		return NULL;
 	}
 
-	return peer;
+	return tcpbus_client_add(peer, on_disconnect, on_input);
 }
 
 void tcpbus_fini()
 {
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring) {
+		tcpbus_uring_fini();
+		tcpbus_uring = 0;
+		return;
+	}
+#endif
 	if (tcpbus_queue != -1) {
 		close(tcpbus_queue);
 	}
@@ -427,6 +529,15 @@ void tcpbus_fini()
 void tcpbus_init()
 {
 	jlog(L_NOTICE, "init tcp bus");
+
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring_init() == 0) {
+		tcpbus_uring = 1;
+		return;
+	}
+	jlog(L_NOTICE, "io_uring unavailable, falling back to epoll");
+#endif
+
 	tcpbus_queue = tcpbus_ion_new();
 }
 
@@ -436,6 +547,11 @@ int tcpbus_ion_poke()
 	int nfd, i;
 	peer_t *peer = NULL;
 
+#ifdef HAVE_LIBURING
+	if (tcpbus_uring)
+		return tcpbus_uring_poke();
+#endif
+
 	nfd = epoll_wait(tcpbus_queue, ep_ev, NUM_EVENTS, 1);
 	if (nfd < 0) {
 		jlog(L_NOTICE, "epoll_wait failed: %s", strerror(errno));
@@ -16,20 +16,28 @@
 #ifndef TCPBUS_H
 #define TCPBUS_H
 
+#define TCPBUS_SERVER 0x1
+#define TCPBUS_CLIENT 0x2
+
 peer_t *tcpbus_server(const char *in_addr,
 		   const char *port,
 		   void (*on_connect)(peer_t*),
 		   void (*on_disconnect)(peer_t*),
 		   void (*on_input)(peer_t*),
-		   void *ext_ptr);
+		   void *ext_ptr,
+		   int fd);
 
 peer_t *tcpbus_client(const char *addr,
 			  const char *port,
 			  void (*on_disconnect)(peer_t*),
 			  void (*on_input)(peer_t*));
 
+peer_t *tcpbus_client_socket(int socket,
+			  void (*on_disconnect)(peer_t*),
+			  void (*on_input)(peer_t*));
 
 void tcpbus_init();
+void tcpbus_fini();
 int tcpbus_ion_poke();
 
 #endif
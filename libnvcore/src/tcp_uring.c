@@ -0,0 +1,665 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/*
+ * io_uring backend of the TCP bus.
+ *
+ * Listeners use a multishot accept and every connected peer keeps a
+ * multishot recv armed on a shared ring of provided buffers, so an idle
+ * connection costs nothing until data arrives. Outgoing data is copied
+ * into a per-peer queue and all the sends are submitted together with the
+ * next tcpbus_uring_poke(), which also reaps the completions: one syscall
+ * per loop iteration, whatever the number of peers.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <liburing.h>
+
+#include "logger.h"
+#include "netbus.h"
+#include "tcp.h"
+#include "tcp_uring.h"
+
+#define URING_SQ_ENTRIES	1024
+#define URING_CQ_ENTRIES	8192
+
+#define URING_BUF_GROUP		0
+#define URING_BUF_COUNT		512	/* must be a power of 2 */
+#define URING_BUF_SIZE		8192
+
+/* operation carried in the low bits of the completion user_data */
+#define URING_OP_ACCEPT		1
+#define URING_OP_RECV		2
+#define URING_OP_SEND		3
+#define URING_OP_CANCEL		4
+#define URING_OP_MASK		7
+
+struct uring_peer {
+
+	peer_t peer;			/* must be first, we are handed peer_t pointers */
+
+	int closing;			/* disconnect requested, the queued data still goes out */
+	int closed;			/* socket closed, wait for inflight ops */
+	int inflight;			/* operations the kernel still references us by */
+
+	uint8_t *tx_buf;		/* data queued by send(), not submitted yet */
+	size_t tx_len;
+	size_t tx_size;
+
+	uint8_t *tx_io;			/* data owned by the inflight send */
+	size_t tx_io_len;
+	size_t tx_io_off;
+	size_t tx_io_size;
+	int tx_busy;
+
+	int32_t rx_len;			/* bytes waiting in peer->buffer for recv() */
+
+	int dirty;
+	struct uring_peer *dirty_next;
+
+	struct uring_peer *next;	/* every peer, released by tcpbus_uring_fini() */
+	struct uring_peer *prev;
+};
+
+static struct io_uring ring;
+static struct io_uring_buf_ring *buf_ring = NULL;
+static uint8_t *buf_base = NULL;
+static struct uring_peer *dirty_list = NULL;
+static struct uring_peer *peer_list = NULL;
+
+static struct io_uring_sqe *uring_get_sqe()
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&ring);
+	if (sqe == NULL) {
+		/* the submission queue is full, push it to the kernel */
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	return sqe;
+}
+
+static void uring_set_data(struct io_uring_sqe *sqe, struct uring_peer *up, int op)
+{
+	io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)up | op);
+}
+
+static void uring_buf_recycle(int bid)
+{
+	io_uring_buf_ring_add(buf_ring, buf_base + bid * URING_BUF_SIZE, URING_BUF_SIZE,
+		bid, io_uring_buf_ring_mask(URING_BUF_COUNT), 0);
+	io_uring_buf_ring_advance(buf_ring, 1);
+}
+
+static void uring_unmark_dirty(struct uring_peer *up);
+
+static void uring_peer_free(struct uring_peer *up)
+{
+	uring_unmark_dirty(up);
+
+	if (up->prev != NULL)
+		up->prev->next = up->next;
+	else
+		peer_list = up->next;
+	if (up->next != NULL)
+		up->next->prev = up->prev;
+
+	free(up->tx_buf);
+	free(up->tx_io);
+	free(up);
+}
+
+static int uring_arm_accept(struct uring_peer *up)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe();
+	if (sqe == NULL)
+		return -1;
+
+	io_uring_prep_multishot_accept(sqe, up->peer.socket, NULL, NULL, 0);
+	uring_set_data(sqe, up, URING_OP_ACCEPT);
+	up->inflight++;
+
+	return 0;
+}
+
+static int uring_arm_recv(struct uring_peer *up)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe();
+	if (sqe == NULL)
+		return -1;
+
+	io_uring_prep_recv_multishot(sqe, up->peer.socket, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	uring_set_data(sqe, up, URING_OP_RECV);
+	up->inflight++;
+
+	return 0;
+}
+
+static int uring_arm_send(struct uring_peer *up)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe();
+	if (sqe == NULL)
+		return -1;
+
+	io_uring_prep_send(sqe, up->peer.socket, up->tx_io + up->tx_io_off,
+		up->tx_io_len - up->tx_io_off, MSG_NOSIGNAL);
+	uring_set_data(sqe, up, URING_OP_SEND);
+	up->inflight++;
+	up->tx_busy = 1;
+
+	return 0;
+}
+
+static void uring_mark_dirty(struct uring_peer *up)
+{
+	if (up->dirty)
+		return;
+
+	up->dirty = 1;
+	up->dirty_next = dirty_list;
+	dirty_list = up;
+}
+
+static void uring_unmark_dirty(struct uring_peer *up)
+{
+	struct uring_peer **itr;
+
+	if (!up->dirty)
+		return;
+
+	for (itr = &dirty_list; *itr != NULL; itr = &(*itr)->dirty_next) {
+		if (*itr == up) {
+			*itr = up->dirty_next;
+			break;
+		}
+	}
+
+	up->dirty = 0;
+	up->dirty_next = NULL;
+}
+
+/* The queue and the inflight buffer are swapped so send() never
+ * touches memory the kernel is reading from.
+ */
+static int uring_flush_peer(struct uring_peer *up)
+{
+	uint8_t *tmp;
+	size_t tmp_size;
+
+	tmp = up->tx_io;
+	tmp_size = up->tx_io_size;
+
+	up->tx_io = up->tx_buf;
+	up->tx_io_size = up->tx_size;
+	up->tx_io_len = up->tx_len;
+	up->tx_io_off = 0;
+
+	up->tx_buf = tmp;
+	up->tx_size = tmp_size;
+	up->tx_len = 0;
+
+	return uring_arm_send(up);
+}
+
+/* Hand the queued data of every dirty peer to an inflight send */
+static void uring_flush_dirty()
+{
+	struct uring_peer *up;
+
+	while (dirty_list != NULL) {
+
+		up = dirty_list;
+		dirty_list = up->dirty_next;
+		up->dirty = 0;
+		up->dirty_next = NULL;
+
+		if (up->closing || up->tx_busy || up->tx_len == 0)
+			continue;
+
+		if (uring_flush_peer(up) < 0)
+			uring_mark_dirty(up);
+	}
+}
+
+static void uring_close(struct uring_peer *up)
+{
+	struct io_uring_sqe *sqe;
+
+	up->closed = 1;
+
+	if (up->inflight > 0) {
+		/* The fd must still be valid when the cancel is submitted,
+		 * the completions will release the peer.
+		 */
+		sqe = uring_get_sqe();
+		if (sqe != NULL) {
+			io_uring_prep_cancel_fd(sqe, up->peer.socket, IORING_ASYNC_CANCEL_ALL);
+			uring_set_data(sqe, NULL, URING_OP_CANCEL);
+			io_uring_submit(&ring);
+		}
+	}
+
+	if (close(up->peer.socket) < 0)
+		jlog(L_NOTICE, "close failed: %u %s", up->peer.socket, strerror(errno));
+
+	jlog(L_DEBUG, "client close: %u", up->peer.socket);
+
+	if (up->inflight == 0)
+		uring_peer_free(up);
+}
+
+/* The upper layer is done with the peer. Like the epoll backend, which
+ * wrote it to the socket already, the data it queued still goes out:
+ * only the receive is cancelled, uring_on_send() closes the socket
+ * once the queue is empty.
+ */
+static void tcpbus_uring_disconnect(peer_t *peer)
+{
+	struct uring_peer *up = (struct uring_peer *)peer;
+	struct io_uring_sqe *sqe;
+
+	if (up->closing)
+		return;
+	up->closing = 1;
+	uring_unmark_dirty(up);
+
+	if (!up->tx_busy && up->tx_len > 0)
+		uring_flush_peer(up);
+
+	if (!up->tx_busy) {
+		uring_close(up);
+		return;
+	}
+
+	sqe = uring_get_sqe();
+	if (sqe != NULL) {
+		io_uring_prep_cancel64(sqe, (uint64_t)(uintptr_t)up | URING_OP_RECV, 0);
+		uring_set_data(sqe, NULL, URING_OP_CANCEL);
+	}
+}
+
+static void tcpbus_uring_on_disconnect(struct uring_peer *up)
+{
+	// inform upper layer
+	if (up->peer.on_disconnect)
+		up->peer.on_disconnect(&up->peer);
+
+	tcpbus_uring_disconnect(&up->peer);
+}
+
+static int tcpbus_uring_send(peer_t *peer, void *data, int len)
+{
+	struct uring_peer *up = (struct uring_peer *)peer;
+	uint8_t *buf;
+	size_t size;
+
+	if (up->closing)
+		return -1;
+
+	if (up->tx_len + len > up->tx_size) {
+		size = (up->tx_len + len) * 2;
+		buf = realloc(up->tx_buf, size);
+		if (buf == NULL) {
+			jlog(L_ERROR, "tcpbus_uring_send realloc failed");
+			return -1;
+		}
+		up->tx_buf = buf;
+		up->tx_size = size;
+	}
+
+	memcpy(up->tx_buf + up->tx_len, data, len);
+	up->tx_len += len;
+	uring_mark_dirty(up);
+
+	return len;
+}
+
+/* bytes queued here or in flight, plus the socket send queue */
+static int tcpbus_uring_pending(peer_t *peer)
+{
+	struct uring_peer *up = (struct uring_peer *)peer;
+	int queued = 0;
+
+	if (ioctl(peer->socket, SIOCOUTQ, &queued) < 0)
+		queued = 0;
+
+	return queued + up->tx_len + (up->tx_io_len - up->tx_io_off);
+}
+
+/* The data was already received by the kernel into a provided buffer,
+ * on_input() points peer->buffer at it before calling the upper layer.
+ */
+static int tcpbus_uring_recv(peer_t *peer)
+{
+	struct uring_peer *up = (struct uring_peer *)peer;
+	int32_t len;
+
+	len = up->rx_len;
+	up->rx_len = 0;
+
+	return len;
+}
+
+static void uring_on_accept(struct uring_peer *up, struct io_uring_cqe *cqe)
+{
+	struct uring_peer *nup;
+	peer_t *peer = &up->peer;
+	peer_t *npeer;
+
+	if (cqe->res < 0) {
+		jlog(L_ERROR, "accept failed: %s", strerror(-cqe->res));
+		return;
+	}
+
+	nup = (struct uring_peer *)tcpbus_uring_peer_new();
+	if (nup == NULL) {
+		close(cqe->res);
+		return;
+	}
+
+	npeer = &nup->peer;
+	npeer->socket = cqe->res;
+	npeer->type = TCPBUS_CLIENT;
+	npeer->on_connect = peer->on_connect;
+	npeer->on_disconnect = peer->on_disconnect;
+	npeer->on_input = peer->on_input;
+	npeer->ext_ptr = peer->ext_ptr;
+
+	if (tcpbus_uring_add(npeer) < 0) {
+		jlog(L_ERROR, "tcpbus_uring_add failed");
+		close(npeer->socket);
+		uring_peer_free(nup);
+		return;
+	}
+
+	if (peer->on_connect)
+		peer->on_connect(npeer);
+
+	jlog(L_DEBUG, "successfully added TCP client {%i} on server {%i}", npeer->socket, peer->socket);
+}
+
+static void uring_on_recv(struct uring_peer *up, struct io_uring_cqe *cqe)
+{
+	int bid;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+		if (cqe->res > 0 && !up->closing) {
+			up->peer.buffer = buf_base + bid * URING_BUF_SIZE;
+			up->peer.buffer_offset = 0;
+			up->rx_len = cqe->res;
+
+			if (up->peer.on_input)
+				up->peer.on_input(&up->peer);
+
+			/* the peer may be closing now, but it is still allocated
+			 * until the last multishot completion is reaped */
+			up->peer.buffer = NULL;
+			up->peer.buffer_data_len = 0;
+			up->peer.buffer_offset = 0;
+			up->rx_len = 0;
+		}
+
+		uring_buf_recycle(bid);
+	}
+
+	if (up->closing)
+		return;
+
+	if (cqe->res == 0) {
+		tcpbus_uring_on_disconnect(up);
+	}
+	else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+		jlog(L_NOTICE, "recv failed: %s", strerror(-cqe->res));
+		tcpbus_uring_on_disconnect(up);
+	}
+	else if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/* the multishot recv terminated, most likely because
+		 * the buffer ring ran dry, re-arm it */
+		if (uring_arm_recv(up) < 0)
+			tcpbus_uring_on_disconnect(up);
+	}
+}
+
+/* a send failed, the upper layer already let a closing peer go */
+static void uring_send_failed(struct uring_peer *up)
+{
+	if (up->closing)
+		uring_close(up);
+	else
+		tcpbus_uring_on_disconnect(up);
+}
+
+static void uring_on_send(struct uring_peer *up, struct io_uring_cqe *cqe)
+{
+	up->tx_busy = 0;
+
+	if (up->closed)
+		return;
+
+	if (cqe->res < 0) {
+		jlog(L_NOTICE, "send failed: %s", strerror(-cqe->res));
+		uring_send_failed(up);
+		return;
+	}
+
+	up->tx_io_off += cqe->res;
+	if (up->tx_io_off < up->tx_io_len) {
+		/* short send, push the remaining bytes */
+		if (uring_arm_send(up) < 0)
+			uring_send_failed(up);
+		return;
+	}
+
+	up->tx_io_len = 0;
+	up->tx_io_off = 0;
+
+	if (!up->closing) {
+		if (up->tx_len > 0)
+			uring_mark_dirty(up);
+		return;
+	}
+
+	/* draining before the close */
+	if (up->tx_len == 0)
+		uring_close(up);
+	else if (uring_flush_peer(up) < 0)
+		uring_close(up);
+}
+
+static void uring_on_cqe(struct io_uring_cqe *cqe)
+{
+	struct uring_peer *up;
+	uint64_t data;
+	int op;
+
+	data = io_uring_cqe_get_data64(cqe);
+	op = data & URING_OP_MASK;
+	up = (struct uring_peer *)(uintptr_t)(data & ~(uint64_t)URING_OP_MASK);
+
+	if (op == URING_OP_CANCEL || up == NULL)
+		return;
+
+	switch (op) {
+	case URING_OP_ACCEPT:
+		if (up->closing)
+			break;
+		uring_on_accept(up, cqe);
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			uring_arm_accept(up);
+		break;
+	case URING_OP_RECV:
+		uring_on_recv(up, cqe);
+		break;
+	case URING_OP_SEND:
+		uring_on_send(up, cqe);
+		break;
+	}
+
+	/* multishot operations stay armed while F_MORE is set */
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		up->inflight--;
+
+	if (up->closed && up->inflight == 0)
+		uring_peer_free(up);
+}
+
+peer_t *tcpbus_uring_peer_new()
+{
+	struct uring_peer *up;
+
+	up = calloc(1, sizeof(struct uring_peer));
+	if (up == NULL) {
+		jlog(L_ERROR, "calloc failed");
+		return NULL;
+	}
+
+	up->next = peer_list;
+	if (peer_list != NULL)
+		peer_list->prev = up;
+	peer_list = up;
+
+	return &up->peer;
+}
+
+/* a peer of tcpbus_uring_peer_new() that was not added, or failed to */
+void tcpbus_uring_peer_free(peer_t *peer)
+{
+	uring_peer_free((struct uring_peer *)peer);
+}
+
+int tcpbus_uring_add(peer_t *peer)
+{
+	struct uring_peer *up = (struct uring_peer *)peer;
+
+	peer->recv = tcpbus_uring_recv;
+	peer->send = tcpbus_uring_send;
+	peer->pending = tcpbus_uring_pending;
+	peer->disconnect = tcpbus_uring_disconnect;
+	peer->buffer = NULL;
+
+	if (peer->type == TCPBUS_SERVER)
+		return uring_arm_accept(up);
+
+	return uring_arm_recv(up);
+}
+
+int tcpbus_uring_poke()
+{
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts;
+	unsigned head;
+	int ret, count = 0;
+
+	uring_flush_dirty();
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000000;
+
+	/* submit the batched operations and wait up to 1ms for completions */
+	ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, NULL);
+	if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+		jlog(L_NOTICE, "io_uring_submit_and_wait_timeout failed: %s", strerror(-ret));
+		return -1;
+	}
+
+	io_uring_for_each_cqe(&ring, head, cqe) {
+		uring_on_cqe(cqe);
+		count++;
+	}
+	io_uring_cq_advance(&ring, count);
+
+	return count;
+}
+
+int tcpbus_uring_init()
+{
+	struct io_uring_params params;
+	int ret, i;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	ret = io_uring_queue_init_params(URING_SQ_ENTRIES, &ring, &params);
+	if (ret < 0) {
+		jlog(L_NOTICE, "io_uring_queue_init failed: %s", strerror(-ret));
+		return -1;
+	}
+
+	/* provided buffer rings need Linux 5.19, fall back to epoll without them */
+	buf_ring = io_uring_setup_buf_ring(&ring, URING_BUF_COUNT, URING_BUF_GROUP, 0, &ret);
+	if (buf_ring == NULL) {
+		jlog(L_NOTICE, "io_uring_setup_buf_ring failed: %s", strerror(-ret));
+		io_uring_queue_exit(&ring);
+		return -1;
+	}
+
+	buf_base = malloc(URING_BUF_COUNT * URING_BUF_SIZE);
+	if (buf_base == NULL) {
+		jlog(L_ERROR, "malloc failed");
+		io_uring_free_buf_ring(&ring, buf_ring, URING_BUF_COUNT, URING_BUF_GROUP);
+		io_uring_queue_exit(&ring);
+		return -1;
+	}
+
+	for (i = 0; i < URING_BUF_COUNT; i++) {
+		io_uring_buf_ring_add(buf_ring, buf_base + i * URING_BUF_SIZE, URING_BUF_SIZE,
+			i, io_uring_buf_ring_mask(URING_BUF_COUNT), i);
+	}
+	io_uring_buf_ring_advance(buf_ring, URING_BUF_COUNT);
+
+	jlog(L_NOTICE, "tcp bus is using io_uring");
+
+	return 0;
+}
+
+void tcpbus_uring_fini()
+{
+	io_uring_free_buf_ring(&ring, buf_ring, URING_BUF_COUNT, URING_BUF_GROUP);
+	io_uring_queue_exit(&ring);
+
+	/* the kernel let go of them with the ring */
+	while (peer_list != NULL) {
+		if (!peer_list->closed)
+			close(peer_list->peer.socket);
+		uring_peer_free(peer_list);
+	}
+	dirty_list = NULL;
+
+	free(buf_base);
+
+	buf_ring = NULL;
+	buf_base = NULL;
+}
@@ -0,0 +1,27 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef TCPBUS_URING_H
+#define TCPBUS_URING_H
+
+int tcpbus_uring_init();
+void tcpbus_uring_fini();
+
+peer_t *tcpbus_uring_peer_new();
+void tcpbus_uring_peer_free(peer_t *peer);
+int tcpbus_uring_add(peer_t *peer);
+int tcpbus_uring_poke();
+
+#endif
@@ -0,0 +1,704 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Datagram bus, the transport of NET_PROTO_DTLS.
+ *
+ * UDP has no accept(): the server socket receives the first datagram
+ * of a client, then a socket bound to the same port is connected to
+ * the client address. The kernel prefers connected sockets, so the
+ * following datagrams of that client land on its own socket.
+ *
+ * Every recv returns exactly one datagram, a lost datagram never takes
+ * its neighbours with it. Nothing tells a datagram peer that the other
+ * side went away, a peer silent for longer than its timeout is
+ * disconnected; the upper layer turns the timeout off once it has
+ * another way to track the peer.
+ *
+ * A server may check the first datagram of an unknown address before
+ * anything is allocated for it, see udpbus_set_hello(). The peers the
+ * upper layer did not take over yet are half-open, there are at most
+ * UDPBUS_HALF_OPEN_MAX of them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "logger.h"
+#include "udp.h"
+
+#define NUM_EVENTS 64
+#define BACKING_STORE 512
+
+struct udp_peer {
+
+	peer_t peer;			/* first member, a peer_t * is a udp_peer * */
+	peer_t *server;			/* server that accepted the peer, NULL for a client */
+	struct sockaddr_in addr;	/* remote address */
+
+	void (*on_tick)(peer_t *);
+	int timeout;			/* seconds of silence tolerated, 0 to wait forever */
+	time_t last_rx;
+	uint8_t closed;
+	uint8_t half_open;		/* accepted, the upper layer did not set its timeout yet */
+
+	int (*on_hello)(peer_t *, struct sockaddr_in *, uint8_t *, size_t, uint8_t *, size_t *);
+
+	uint8_t *pending;		/* datagram received by the server socket */
+	size_t pending_len;
+
+	struct udp_peer *next;
+	struct udp_peer *hnext;		/* bucket of udpbus_hash */
+};
+
+static int udpbus_queue = -1;
+static struct epoll_event ep_ev[NUM_EVENTS];
+
+static struct udp_peer *udpbus_peers = NULL;	/* connected peers */
+static struct udp_peer *udpbus_hash[UDPBUS_HASH_SIZE];	/* accepted peers, by server and address */
+static int udpbus_half_open = 0;
+static struct udp_peer *udpbus_closed = NULL;	/* freed at the end of udpbus_poke() */
+static uint8_t udpbus_dgram[UDPBUS_DGRAM_MAX];
+static struct timespec udpbus_last_tick;
+
+static time_t udpbus_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static int setnonblocking(int socket)
+{
+	int ret;
+	ret = fcntl(socket, F_GETFL);
+	if (ret >= 0) {
+		ret = fcntl(socket, F_SETFL, ret | O_NONBLOCK);
+	}
+	return ret;
+}
+
+static int setreuse(int socket)
+{
+	int ret, on = 1;
+	ret = setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
+	return ret;
+}
+
+static int udpbus_ion_add(int fd, void *data)
+{
+	struct epoll_event nevent;
+	int ret;
+
+	memset(&nevent, 0, sizeof(struct epoll_event));
+
+	nevent.events = EPOLLIN | EPOLLERR;
+	nevent.data.ptr = data;
+
+	ret = epoll_ctl(udpbus_queue, EPOLL_CTL_ADD, fd, &nevent);
+	if (ret < 0)
+		jlog(L_NOTICE, "epoll_ctl failed: %s", strerror(errno));
+
+	return ret;
+}
+
+static unsigned int udpbus_hash_key(peer_t *server, struct sockaddr_in *addr)
+{
+	uint32_t h;
+
+	h = addr->sin_addr.s_addr ^ ((uint32_t)addr->sin_port << 16) ^ (uint32_t)server->socket;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+
+	return h & (UDPBUS_HASH_SIZE - 1);
+}
+
+static void udpbus_link(struct udp_peer *upeer)
+{
+	unsigned int h;
+
+	upeer->last_rx = udpbus_now();
+	upeer->next = udpbus_peers;
+	udpbus_peers = upeer;
+
+	if (upeer->server != NULL) {
+		h = udpbus_hash_key(upeer->server, &upeer->addr);
+		upeer->hnext = udpbus_hash[h];
+		udpbus_hash[h] = upeer;
+	}
+}
+
+static void udpbus_unlink(struct udp_peer *upeer)
+{
+	struct udp_peer **itr;
+
+	for (itr = &udpbus_peers; *itr != NULL; itr = &(*itr)->next) {
+		if (*itr == upeer) {
+			*itr = upeer->next;
+			break;
+		}
+	}
+	upeer->next = NULL;
+
+	if (upeer->server != NULL) {
+		itr = &udpbus_hash[udpbus_hash_key(upeer->server, &upeer->addr)];
+		for (; *itr != NULL; itr = &(*itr)->hnext) {
+			if (*itr == upeer) {
+				*itr = upeer->hnext;
+				break;
+			}
+		}
+		upeer->hnext = NULL;
+	}
+
+	if (upeer->half_open) {
+		upeer->half_open = 0;
+		udpbus_half_open--;
+	}
+}
+
+static struct udp_peer *udpbus_peer_find(peer_t *server, struct sockaddr_in *addr)
+{
+	struct udp_peer *upeer;
+
+	upeer = udpbus_hash[udpbus_hash_key(server, addr)];
+	for (; upeer != NULL; upeer = upeer->hnext) {
+		if (upeer->server == server
+			&& upeer->addr.sin_addr.s_addr == addr->sin_addr.s_addr
+			&& upeer->addr.sin_port == addr->sin_port)
+			return upeer;
+	}
+
+	return NULL;
+}
+
+/* The peer may still be referenced by the events of the current
+ * udpbus_poke(), the memory is released once they are processed. */
+static void udpbus_disconnect(peer_t *peer)
+{
+	struct udp_peer *upeer = (struct udp_peer *)peer;
+
+	if (upeer->closed)
+		return;
+
+	/* a server socket handed over lives on in the other process */
+	if (peer->type == UDPBUS_SERVER)
+		epoll_ctl(udpbus_queue, EPOLL_CTL_DEL, peer->socket, NULL);
+
+	//close() will cause the socket to be automatically removed from the queue
+	if (close(peer->socket) < 0) {
+		jlog(L_NOTICE, "close failed: %u %s", peer->socket, strerror(errno));
+	}
+
+	jlog(L_DEBUG, "udp peer close: %u", peer->socket);
+
+	if (peer->type == UDPBUS_CLIENT)
+		udpbus_unlink(upeer);
+
+	upeer->closed = 1;
+	upeer->next = udpbus_closed;
+	udpbus_closed = upeer;
+}
+
+static void udpbus_free_closed()
+{
+	struct udp_peer *upeer;
+
+	while (udpbus_closed != NULL) {
+		upeer = udpbus_closed;
+		udpbus_closed = upeer->next;
+
+		free(upeer->peer.buffer);
+		free(upeer);
+	}
+}
+
+/* A datagram that can't be sent is lost like any other, only
+ * a broken socket is reported to the upper layer. */
+static int udpbus_send(peer_t *peer, void *data, int len)
+{
+	int ret;
+
+	ret = send(peer->socket, data, len, 0);
+	if (ret == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS
+				|| errno == ECONNREFUSED || errno == EMSGSIZE) {
+			jlog(L_DEBUG, "udpbus_send dropped %i bytes: %s", len, strerror(errno));
+			return len;
+		}
+		return -1;
+	}
+
+	return ret;
+}
+
+static int udpbus_recv(peer_t *peer)
+{
+	struct udp_peer *upeer = (struct udp_peer *)peer;
+	int avail = 0;
+	int size;
+	int ret;
+
+	if (upeer->pending != NULL) {
+
+		size = peer_buffer_reserve(peer, upeer->pending_len);
+		if (size < 0 || (size_t)size < upeer->pending_len) {
+			upeer->pending = NULL;
+			return -1;
+		}
+
+		memcpy(peer->buffer, upeer->pending, upeer->pending_len);
+		upeer->pending = NULL;
+
+		return upeer->pending_len;
+	}
+
+	/* FIONREAD gives the size of the next datagram */
+	if (ioctl(peer->socket, FIONREAD, &avail) < 0)
+		avail = 0;
+
+	size = peer_buffer_reserve(peer, avail);
+	if (size < 0) {
+		jlog(L_ERROR, "udpbus_recv peer_buffer_reserve failed");
+		return -1;
+	}
+
+	ret = recv(peer->socket, peer->buffer, size, MSG_DONTWAIT);
+	if (ret < 0) {
+		// spurious wakeup or an ICMP error, nothing to read
+		return 0;
+	}
+
+	return ret;
+}
+
+static void udpbus_on_input(peer_t *peer)
+{
+	struct udp_peer *upeer = (struct udp_peer *)peer;
+
+	upeer->last_rx = udpbus_now();
+
+	if (peer->on_input)
+		peer->on_input(peer);
+	else
+		upeer->pending = NULL;
+}
+
+static void udpbus_on_disconnect(peer_t *peer)
+{
+	// inform upper layer
+	if (peer->on_disconnect)
+		peer->on_disconnect(peer);
+
+	udpbus_disconnect(peer);
+}
+
+/* first datagram of a client, give it a connected socket */
+static struct udp_peer *udpbus_on_connect(peer_t *peer, struct sockaddr_in *addr)
+{
+	struct udp_peer *server = (struct udp_peer *)peer;
+	struct udp_peer *upeer;
+	struct sockaddr_in local;
+	socklen_t addrlen;
+	int ret;
+
+	if (udpbus_half_open >= UDPBUS_HALF_OPEN_MAX) {
+		jlog(L_NOTICE, "too many half-open udp peers, %s:%u dropped",
+			inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+		return NULL;
+	}
+
+	upeer = calloc(1, sizeof(struct udp_peer));
+	if (upeer == NULL) {
+		return NULL;
+	}
+
+	addrlen = sizeof(struct sockaddr_in);
+	getsockname(peer->socket, (struct sockaddr *)&local, &addrlen);
+
+	upeer->peer.socket = socket(PF_INET, SOCK_DGRAM, 0);
+	if (upeer->peer.socket < 0) {
+		jlog(L_ERROR, "socket failed: %s", strerror(errno));
+		free(upeer);
+		return NULL;
+	}
+
+	ret = setreuse(upeer->peer.socket);
+	if (ret == 0)
+		ret = bind(upeer->peer.socket, (const struct sockaddr *)&local, sizeof(struct sockaddr_in));
+	if (ret == 0)
+		ret = connect(upeer->peer.socket, (const struct sockaddr *)addr, sizeof(struct sockaddr_in));
+	if (ret == 0)
+		ret = setnonblocking(upeer->peer.socket);
+	if (ret < 0) {
+		jlog(L_ERROR, "unable to connect the socket of %s:%u: %s",
+			inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), strerror(errno));
+		close(upeer->peer.socket);
+		free(upeer);
+		return NULL;
+	}
+
+	upeer->peer.type = UDPBUS_CLIENT;
+	upeer->peer.on_connect = peer->on_connect;
+	upeer->peer.on_disconnect = peer->on_disconnect;
+	upeer->peer.on_input = peer->on_input;
+	upeer->peer.recv = peer->recv;
+	upeer->peer.send = peer->send;
+	upeer->peer.disconnect = peer->disconnect;
+	upeer->peer.ext_ptr = peer->ext_ptr;
+	upeer->peer.buffer = NULL;
+
+	upeer->server = peer;
+	upeer->addr = *addr;
+	upeer->on_tick = server->on_tick;
+	upeer->timeout = UDPBUS_TIMEOUT;
+
+	ret = udpbus_ion_add(upeer->peer.socket, upeer);
+	if (ret < 0) {
+		close(upeer->peer.socket);
+		free(upeer);
+		return NULL;
+	}
+
+	upeer->half_open = 1;
+	udpbus_half_open++;
+	udpbus_link(upeer);
+
+	if (peer->on_connect)
+		peer->on_connect(&upeer->peer);
+
+	jlog(L_DEBUG, "successfully added UDP client {%i} on server {%i}", upeer->peer.socket, peer->socket);
+
+	return upeer;
+}
+
+static void udpbus_on_server_input(peer_t *peer)
+{
+	struct udp_peer *server = (struct udp_peer *)peer;
+	struct udp_peer *upeer;
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	uint8_t reply[UDPBUS_HELLO_MAX];
+	size_t reply_len;
+	int ret;
+
+	addrlen = sizeof(struct sockaddr_in);
+	ret = recvfrom(peer->socket, udpbus_dgram, sizeof(udpbus_dgram), MSG_DONTWAIT,
+			(struct sockaddr *)&addr, &addrlen);
+	if (ret < 0) {
+		return;
+	}
+
+	// the datagram raced the connect() of the client socket
+	upeer = udpbus_peer_find(peer, &addr);
+	if (upeer == NULL && server->on_hello != NULL) {
+		reply_len = 0;
+		if (server->on_hello(peer, &addr, udpbus_dgram, ret, reply, &reply_len) != 1) {
+			// answered without keeping anything about the client
+			if (reply_len > 0)
+				sendto(peer->socket, reply, reply_len, MSG_DONTWAIT,
+					(const struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+			return;
+		}
+	}
+	if (upeer == NULL)
+		upeer = udpbus_on_connect(peer, &addr);
+
+	if (upeer == NULL || upeer->closed) {
+		return;
+	}
+
+	upeer->pending = udpbus_dgram;
+	upeer->pending_len = ret;
+
+	udpbus_on_input(&upeer->peer);
+}
+
+/* drive the timers of the upper layer and expire the silent peers */
+static void udpbus_tick()
+{
+	struct timespec ts;
+	struct udp_peer *upeer, *next;
+	long elapsed;
+	time_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	elapsed = (ts.tv_sec - udpbus_last_tick.tv_sec) * 1000
+		+ (ts.tv_nsec - udpbus_last_tick.tv_nsec) / 1000000;
+	if (elapsed < UDPBUS_TICK)
+		return;
+
+	udpbus_last_tick = ts;
+	now = ts.tv_sec;
+
+	for (upeer = udpbus_peers; upeer != NULL; upeer = next) {
+		next = upeer->next;
+
+		if (upeer->timeout > 0 && now - upeer->last_rx > upeer->timeout) {
+			jlog(L_NOTICE, "udp peer %s:%u timed out",
+				inet_ntoa(upeer->addr.sin_addr), ntohs(upeer->addr.sin_port));
+			udpbus_on_disconnect(&upeer->peer);
+			continue;
+		}
+
+		if (upeer->on_tick)
+			upeer->on_tick(&upeer->peer);
+	}
+}
+
+void udpbus_set_tick(peer_t *peer, void (*on_tick)(peer_t*))
+{
+	((struct udp_peer *)peer)->on_tick = on_tick;
+}
+
+/* the upper layer took the peer over, it is no longer half-open */
+void udpbus_set_timeout(peer_t *peer, int timeout)
+{
+	struct udp_peer *upeer = (struct udp_peer *)peer;
+
+	upeer->timeout = timeout;
+
+	if (upeer->half_open) {
+		upeer->half_open = 0;
+		udpbus_half_open--;
+	}
+}
+
+/* on_hello() sees the first datagram of an unknown address, the
+ * client is accepted when it returns 1. Otherwise the reply_len bytes
+ * it wrote in reply, at most UDPBUS_HELLO_MAX, are sent back. */
+void udpbus_set_hello(peer_t *peer, int (*on_hello)(peer_t *, struct sockaddr_in *,
+			uint8_t *, size_t, uint8_t *, size_t *))
+{
+	((struct udp_peer *)peer)->on_hello = on_hello;
+}
+
+peer_t *udpbus_server(const char *in_addr,
+		   const char *port,
+		   void (*on_connect)(peer_t*),
+		   void (*on_disconnect)(peer_t*),
+		   void (*on_input)(peer_t*),
+		   void *ext_ptr,
+		   int fd)
+{
+	int ret;
+	struct sockaddr_in addr;
+	struct udp_peer *upeer;
+	peer_t *peer;
+
+	jlog(L_NOTICE, "server ready: %s:%s", in_addr, port);
+
+	upeer = calloc(1, sizeof(struct udp_peer));
+	if (upeer == NULL) {
+		return NULL;
+	}
+
+	peer = &upeer->peer;
+	peer->type = UDPBUS_SERVER;
+	peer->on_connect = on_connect;
+	peer->on_disconnect = on_disconnect;
+	peer->on_input = on_input;
+	peer->recv = udpbus_recv;
+	peer->send = udpbus_send;
+	peer->disconnect = udpbus_disconnect;
+	peer->buffer = NULL;
+	peer->ext_ptr = ext_ptr;
+
+	/* already bound, inherited from the process we replace */
+	if (fd >= 0) {
+		peer->socket = fd;
+		goto add;
+	}
+
+	peer->socket = socket(PF_INET, SOCK_DGRAM, 0);
+	if (peer->socket < 0) {
+		jlog(L_NOTICE, "socket failed: %s", strerror(errno));
+		free(upeer);
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port));
+	addr.sin_addr.s_addr = inet_addr(in_addr);
+
+	// the client sockets share the port of the server
+	ret = setreuse(peer->socket);
+	if (ret < 0) {
+		jlog(L_NOTICE, "setreuse: %s", strerror(errno));
+		close(peer->socket);
+		free(upeer);
+		return NULL;
+	}
+
+	ret = bind(peer->socket, (const struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+	if (ret < 0) {
+		jlog(L_NOTICE, "bind failed: %s %s", strerror(errno), in_addr);
+		close(peer->socket);
+		free(upeer);
+		return NULL;
+	}
+
+add:
+	ret = udpbus_ion_add(peer->socket, peer);
+	if (ret < 0) {
+		close(peer->socket);
+		free(upeer);
+		return NULL;
+	}
+
+	return peer;
+}
+
+peer_t *udpbus_client(const char *addr,
+			  const char *port,
+			  void (*on_disconnect)(peer_t*),
+			  void (*on_input)(peer_t*))
+{
+	int ret;
+	struct udp_peer *upeer;
+	peer_t *peer;
+
+	upeer = calloc(1, sizeof(struct udp_peer));
+	if (upeer == NULL) {
+		return NULL;
+	}
+
+	peer = &upeer->peer;
+	peer->socket = socket(PF_INET, SOCK_DGRAM, 0);
+	if (peer->socket < 0) {
+		jlog(L_ERROR, "socket failed: %s", strerror(errno));
+		free(upeer);
+		return NULL;
+	}
+
+	upeer->addr.sin_family = AF_INET;
+	upeer->addr.sin_port = htons(atoi(port));
+	upeer->addr.sin_addr.s_addr = inet_addr(addr);
+
+	ret = connect(peer->socket, (const struct sockaddr *)&upeer->addr, sizeof(struct sockaddr_in));
+	if (ret == 0)
+		ret = setnonblocking(peer->socket);
+	if (ret < 0) {
+		jlog(L_DEBUG, "connect failed: %s", strerror(errno));
+		close(peer->socket);
+		free(upeer);
+		return NULL;
+	}
+
+	peer->type = UDPBUS_CLIENT;
+	peer->on_disconnect = on_disconnect;
+	peer->on_input = on_input;
+	peer->send = udpbus_send;
+	peer->recv = udpbus_recv;
+	peer->disconnect = udpbus_disconnect;
+	peer->buffer = NULL;
+
+	upeer->timeout = UDPBUS_TIMEOUT;
+
+	ret = udpbus_ion_add(peer->socket, peer);
+	if (ret < 0) {
+		close(peer->socket);
+		free(upeer);
+		return NULL;
+	}
+
+	udpbus_link(upeer);
+
+	return peer;
+}
+
+void udpbus_fini()
+{
+	udpbus_free_closed();
+
+	if (udpbus_queue != -1) {
+		close(udpbus_queue);
+		udpbus_queue = -1;
+	}
+}
+
+int udpbus_init()
+{
+	jlog(L_NOTICE, "init udp bus");
+
+	if (udpbus_queue != -1)
+		return 0;
+
+	udpbus_queue = epoll_create(BACKING_STORE);
+	if (udpbus_queue < 0) {
+		jlog(L_NOTICE, "epoll_create failed: %s", strerror(errno));
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &udpbus_last_tick);
+
+	return 0;
+}
+
+int udpbus_poke()
+{
+	int nfd, i;
+	int err;
+	socklen_t len;
+	struct udp_peer *upeer;
+
+	nfd = epoll_wait(udpbus_queue, ep_ev, NUM_EVENTS, 1);
+	if (nfd < 0) {
+		jlog(L_NOTICE, "epoll_wait failed: %s", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < nfd; i++) {
+
+		upeer = ep_ev[i].data.ptr;
+		if (upeer == NULL || upeer->closed) {
+			continue;
+		}
+
+		if (ep_ev[i].events & EPOLLERR) {
+			// an ICMP error, the peer may come back: clear it and go on
+			len = sizeof(err);
+			getsockopt(upeer->peer.socket, SOL_SOCKET, SO_ERROR, &err, &len);
+			jlog(L_DEBUG, "udp socket %i: %s", upeer->peer.socket, strerror(err));
+
+		} else if (ep_ev[i].events & EPOLLIN) {
+
+			if (upeer->peer.type == UDPBUS_SERVER) {
+				udpbus_on_server_input(&upeer->peer);
+
+			} else if (upeer->peer.type == UDPBUS_CLIENT) {
+				udpbus_on_input(&upeer->peer);
+			}
+		}
+	}
+
+	udpbus_tick();
+	udpbus_free_closed();
+
+	return nfd;
+}
@@ -0,0 +1,55 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef UDPBUS_H
+#define UDPBUS_H
+
+#include <netinet/in.h>
+
+#include "udt.h"
+
+#define UDPBUS_SERVER 0x1
+#define UDPBUS_CLIENT 0x2
+
+#define UDPBUS_DGRAM_MAX	65535
+#define UDPBUS_TICK		100	/* ms between two on_tick calls */
+#define UDPBUS_TIMEOUT		10	/* seconds a new peer may stay silent */
+#define UDPBUS_HALF_OPEN_MAX	256	/* accepted peers not taken over by the upper layer */
+#define UDPBUS_HASH_SIZE	1024	/* buckets of the accepted peers, a power of 2 */
+#define UDPBUS_HELLO_MAX	512	/* reply to a datagram refused by on_hello() */
+
+peer_t *udpbus_server(const char *in_addr,
+		   const char *port,
+		   void (*on_connect)(peer_t*),
+		   void (*on_disconnect)(peer_t*),
+		   void (*on_input)(peer_t*),
+		   void *ext_ptr,
+		   int fd);
+
+peer_t *udpbus_client(const char *addr,
+			  const char *port,
+			  void (*on_disconnect)(peer_t*),
+			  void (*on_input)(peer_t*));
+
+void udpbus_set_tick(peer_t *peer, void (*on_tick)(peer_t*));
+void udpbus_set_timeout(peer_t *peer, int timeout);
+void udpbus_set_hello(peer_t *peer, int (*on_hello)(peer_t *, struct sockaddr_in *,
+			uint8_t *, size_t, uint8_t *, size_t *));
+
+int udpbus_init();
+void udpbus_fini();
+int udpbus_poke();
+
+#endif
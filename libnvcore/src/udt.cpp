@@ -18,9 +18,13 @@
 #include <ws2tcpip.h>
 #else
 #include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
 #include <unistd.h>
+#include <cerrno>
+#include <ctime>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -30,6 +34,7 @@
 #include <udt.h>
 
 #include "udt.h"
+#include "udt_cc.h"
 #include "logger.h"
 
 // g++ udt.cpp -L/usr/local/lib -I../src/ -ludt -lstdc++ -lpthread -lm
@@ -40,6 +45,137 @@
 using namespace std;
 vector<UDTSOCKET>g_list_socket;
 
+static struct udtbus_opts udtbus_opts = {0, 0, 0, 0, 0, 0, -1, -1, "native", 0};
+
+void udtbus_get_opts(struct udtbus_opts *opts)
+{
+	*opts = udtbus_opts;
+}
+
+void udtbus_set_opts(const struct udtbus_opts *opts)
+{
+	udtbus_opts = *opts;
+	udtbus_opts.cc[sizeof(udtbus_opts.cc) - 1] = '\0';
+
+	jlog(L_DEBUG, "udt options: mss %d, sndbuf %d, rcvbuf %d, fc %d, cc %s",
+		udtbus_opts.mss, udtbus_opts.sndbuf, udtbus_opts.rcvbuf,
+		udtbus_opts.fc, udtbus_opts.cc);
+}
+
+/* Ask the kernel for the path MTU towards `addr'. The route MTU is
+ * returned until an ICMP "fragmentation needed" lowered it, so the
+ * result is capped to UDTBUS_PMTU_MAX. */
+static int udtbus_path_mtu(const struct sockaddr *addr, socklen_t addrlen)
+{
+	int mtu = UDTBUS_PMTU_MAX;
+
+#ifdef __linux__
+	int sock;
+	int val = IP_PMTUDISC_DO;
+	socklen_t len = sizeof(val);
+
+	sock = socket(addr->sa_family, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return mtu;
+
+	setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val));
+	if (connect(sock, addr, addrlen) == 0
+			&& getsockopt(sock, IPPROTO_IP, IP_MTU, &val, &len) == 0
+			&& val > 0 && val < mtu)
+		mtu = val;
+
+	close(sock);
+#endif
+	return mtu;
+}
+
+int udtbus_get_path_mtu(const char *host, const char *port)
+{
+	struct addrinfo hints, *res;
+	int mtu;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return UDTBUS_PMTU_MAX;
+
+	mtu = udtbus_path_mtu(res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	return mtu;
+}
+
+// MSS negotiated during the handshake, the lowest of both sides
+int udtbus_get_mss(peer_t *peer)
+{
+	int mss = 0;
+	int optlen = sizeof(mss);
+
+	if (UDT::getsockopt(peer->socket, 0, UDT_MSS, &mss, &optlen) == UDT::ERROR)
+		return -1;
+
+	return mss;
+}
+
+// use the path MTU unless the MSS is configured
+static void udtbus_set_mss(UDTSOCKET u, const struct sockaddr *addr, socklen_t addrlen)
+{
+	int mss;
+
+	if (udtbus_opts.mss > 0)
+		return;
+
+	mss = udtbus_path_mtu(addr, addrlen);
+	UDT::setsockopt(u, 0, UDT_MSS, &mss, sizeof(int));
+	jlog(L_DEBUG, "path mtu: %d", mss);
+}
+
+// options that must be set before bind(), listen() or connect()
+static void udtbus_set_sockopts(UDTSOCKET u, const struct udtbus_opts *opts)
+{
+	CCCVirtualFactory *cc;
+
+	if (opts->mss > 0)
+		UDT::setsockopt(u, 0, UDT_MSS, &opts->mss, sizeof(int));
+	if (opts->sndbuf > 0)
+		UDT::setsockopt(u, 0, UDT_SNDBUF, &opts->sndbuf, sizeof(int));
+	if (opts->rcvbuf > 0)
+		UDT::setsockopt(u, 0, UDT_RCVBUF, &opts->rcvbuf, sizeof(int));
+	if (opts->udp_sndbuf > 0)
+		UDT::setsockopt(u, 0, UDP_SNDBUF, &opts->udp_sndbuf, sizeof(int));
+	if (opts->udp_rcvbuf > 0)
+		UDT::setsockopt(u, 0, UDP_RCVBUF, &opts->udp_rcvbuf, sizeof(int));
+	if (opts->fc > 0)
+		UDT::setsockopt(u, 0, UDT_FC, &opts->fc, sizeof(int));
+
+	cc = udt_cc_factory(opts->cc, opts->cc_rate);
+	if (cc != NULL) {
+		// UDT keeps a clone, accepted sockets inherit it from the listener
+		UDT::setsockopt(u, 0, UDT_CC, cc, sizeof(*cc));
+		delete cc;
+	}
+	else if (strcmp(opts->cc, "native") != 0) {
+		jlog(L_WARNING, "unknown congestion control: %s", opts->cc);
+	}
+}
+
+// blocking mode of a connected socket
+static void udtbus_set_syn(UDTSOCKET u, const struct udtbus_opts *opts)
+{
+	bool block;
+
+	if (opts->sndsyn >= 0) {
+		block = opts->sndsyn;
+		UDT::setsockopt(u, 0, UDT_SNDSYN, &block, sizeof(bool));
+	}
+	if (opts->rcvsyn >= 0) {
+		block = opts->rcvsyn;
+		UDT::setsockopt(u, 0, UDT_RCVSYN, &block, sizeof(bool));
+	}
+}
+
 static void udtbus_ion_add(UDTSOCKET u)
 {
 	g_list_socket.push_back(u);
@@ -61,7 +197,10 @@ static void udtbus_disconnect(peer_t *peer)
 	peer->buffer_data_len = 0;
 	peer->ext_ptr = NULL;
 	free(peer->host);
+	free(peer->opts);
 	free(peer->buffer);
+	peer->buffer = NULL;
+	peer->buffer_size = 0;
 	free(peer);
 }
 
@@ -97,13 +236,35 @@ static int udtbus_send(peer_t *peer, void *data, int len)
 	return ret;
 }
 
+/* UDT counts its send buffer in packets */
+static int udtbus_pending(peer_t *peer)
+{
+	int packets = 0;
+	int optlen = sizeof(packets);
+	int mss;
+
+	if (UDT::getsockopt(peer->socket, 0, UDT_SNDDATA, &packets, &optlen) == UDT::ERROR)
+		return 0;
+
+	mss = udtbus_get_mss(peer);
+	if (mss <= 0)
+		mss = UDTBUS_PMTU_MAX;
+
+	return packets * mss;
+}
+
 static int udtbus_recv(peer_t *peer)
 {
-	int size = 5000; // FIXME use dynamic buffer
+	int avail = 0;
+	int optlen = sizeof(avail);
+	int size;
 
-	if (peer->buffer == NULL) {
-		peer->buffer = malloc(size);
-	}
+	// read everything UDT has buffered for us
+	UDT::getsockopt(peer->socket, 0, UDT_RCVDATA, &avail, &optlen);
+
+	size = peer_buffer_reserve(peer, avail);
+	if (size < 0)
+		return -1;
 
 	int rs = UDT::recv(peer->socket, (char *)peer->buffer, size, 0);
 	if (rs == UDT::ERROR) {
@@ -123,17 +284,16 @@ static void on_connect(peer_t *peer)
 {
 	UDTSOCKET client;
 	peer_t *npeer;
-	int mss = 1450;
 
 	sockaddr_storage clientaddr;
 	int addrlen = sizeof(clientaddr);
 
 	client = UDT::accept(peer->socket, (sockaddr*)&clientaddr, &addrlen);
-	UDT::setsockopt(client, 0, UDT_MSS, &mss, sizeof(int));
 	if (client == UDT::INVALID_SOCK) {
 		jlog(L_WARNING, "accept: %s", UDT::getlasterror().getErrorMessage());
 		return;
 	}
+	udtbus_set_syn(client, peer->opts);
 
 	char clienthost[NI_MAXHOST];
 	char clientservice[NI_MAXSERV];
@@ -156,6 +316,7 @@ static void on_connect(peer_t *peer)
 	npeer->on_input = peer->on_input;
 	npeer->recv = udtbus_recv;
 	npeer->send = udtbus_send;
+	npeer->pending = udtbus_pending;
 	npeer->disconnect = udtbus_disconnect;
 	npeer->buffer = NULL;
 	npeer->buffer_offset = 0;
@@ -170,6 +331,228 @@ static void on_connect(peer_t *peer)
 	npeer->on_connect(npeer);
 }
 
+/* Rendezvous sockets still connecting, polled from udtbus_poke_queue() */
+struct udtbus_race {
+	peer_t *peer;
+	vector<UDTSOCKET> candidates;
+	time_t deadline;
+	bool nominate;
+};
+static list<struct udtbus_race *> g_list_race;
+
+static UDTSOCKET udtbus_race_candidate(const char *listen_addr, const char *dest_addr,
+					const char *port, int mss)
+{
+	struct addrinfo hints, *local, *server;
+	UDTSOCKET socket;
+	bool rdv = true;
+	bool block = false;
+	int ret;
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	ret = getaddrinfo(listen_addr, port, &hints, &local);
+	if (ret != 0) {
+		jlog(L_ERROR, "illegal port number or port is busy: %s", gai_strerror(ret));
+		return UDT::INVALID_SOCK;
+	}
+
+	ret = getaddrinfo(dest_addr, port, &hints, &server);
+	if (ret != 0) {
+		jlog(L_WARNING, "incorrect server address: %s", gai_strerror(ret));
+		freeaddrinfo(local);
+		return UDT::INVALID_SOCK;
+	}
+
+	socket = UDT::socket(local->ai_family, local->ai_socktype, local->ai_protocol);
+
+	// every candidate bound to a port shares its UDP channel, they need the same MSS
+	udtbus_set_sockopts(socket, &udtbus_opts);
+	if (udtbus_opts.mss <= 0)
+		UDT::setsockopt(socket, 0, UDT_MSS, &mss, sizeof(int));
+	UDT::setsockopt(socket, 0, UDT_RENDEZVOUS, &rdv, sizeof(bool));
+
+	// connect() returns at once, the handshake completes in the background
+	UDT::setsockopt(socket, 0, UDT_SNDSYN, &block, sizeof(bool));
+	UDT::setsockopt(socket, 0, UDT_RCVSYN, &block, sizeof(bool));
+
+	if (UDT::bind(socket, local->ai_addr, local->ai_addrlen) == UDT::ERROR ||
+	    UDT::connect(socket, server->ai_addr, server->ai_addrlen) == UDT::ERROR) {
+		jlog(L_WARNING, "%s:%s: %s", dest_addr, port, UDT::getlasterror().getErrorMessage());
+		UDT::close(socket);
+		socket = UDT::INVALID_SOCK;
+	}
+
+	freeaddrinfo(local);
+	freeaddrinfo(server);
+
+	return socket;
+}
+
+/* Start connecting to every candidate at once. The outcome is reported
+ * later through the callbacks of `args', which may be released on return.
+ * Returns -1 if no candidate could be started, on_disconnect has then
+ * already been called. */
+int udtbus_rendezvous(const struct p2p_args *args)
+{
+	struct udtbus_race *race;
+	peer_t *peer;
+	UDTSOCKET socket;
+	int mss = UDTBUS_PMTU_MAX;
+	int a, p;
+
+	peer = (peer_t *)calloc(sizeof(peer_t), 1);
+	peer->type = UDTBUS_CLIENT;
+	peer->on_connect = args->on_connect;
+	peer->on_disconnect = args->on_disconnect;
+	peer->on_input = args->on_input;
+	peer->recv = udtbus_recv;
+	peer->send = udtbus_send;
+	peer->pending = udtbus_pending;
+	peer->disconnect = udtbus_disconnect;
+	peer->buffer = NULL;
+	peer->buffer_offset = 0;
+	peer->ext_ptr = args->ext_ptr;
+
+	race = new udtbus_race;
+	race->peer = peer;
+	race->deadline = time(NULL) + UDTBUS_RACE_TIMEOUT;
+	race->nominate = args->nominate != 0;
+
+	for (a = 0; a < P2P_ADDR_MAX && args->dest_addr[a] != NULL; a++) {
+		p = udtbus_get_path_mtu(args->dest_addr[a], args->port[0]);
+		if (p < mss)
+			mss = p;
+	}
+
+	for (p = 0; p < P2P_PORT_MAX && args->port[p] != NULL; p++) {
+		for (a = 0; a < P2P_ADDR_MAX && args->dest_addr[a] != NULL; a++) {
+
+			socket = udtbus_race_candidate(args->listen_addr, args->dest_addr[a],
+							args->port[p], mss);
+			if (socket != UDT::INVALID_SOCK)
+				race->candidates.push_back(socket);
+		}
+	}
+
+	if (race->candidates.empty()) {
+		jlog(L_NOTICE, "p2p failed");
+		delete race;
+		on_disconnect(peer);
+		return -1;
+	}
+
+	jlog(L_NOTICE, "racing %d p2p candidates towards %s", (int)race->candidates.size(),
+		args->dest_addr[0]);
+	g_list_race.push_back(race);
+
+	return 0;
+}
+
+/* Both sides must keep the same candidate. The nominating side picks the
+ * first one that completed the handshake and sends a single byte on it,
+ * the other side adopts the candidate this byte arrives on. */
+static bool udtbus_race_elect(struct udtbus_race *race, UDTSOCKET socket)
+{
+	char nomination = 0;
+	int avail = 0;
+	int optlen = sizeof(avail);
+
+	if (race->nominate)
+		return UDT::send(socket, &nomination, 1, 0) == 1;
+
+	if (UDT::getsockopt(socket, 0, UDT_RCVDATA, &avail, &optlen) == UDT::ERROR || avail <= 0)
+		return false;
+
+	return UDT::recv(socket, &nomination, 1, 0) == 1;
+}
+
+/* Returns the elected socket, UDT::INVALID_SOCK if none is yet. Only the
+ * failed candidates are dropped from the race until then. */
+static UDTSOCKET udtbus_race_winner(struct udtbus_race *race)
+{
+	vector<UDTSOCKET>::iterator i;
+	UDTSOCKET winner = UDT::INVALID_SOCK;
+
+	for (i = race->candidates.begin(); i != race->candidates.end(); ) {
+
+		switch (UDT::getsockstate(*i)) {
+		case CONNECTED:
+			if (udtbus_race_elect(race, *i)) {
+				winner = *i;
+				i = race->candidates.erase(i);
+				goto out;
+			}
+			++i;
+			break;
+		case OPENED:
+		case CONNECTING:
+			++i;
+			break;
+		default:
+			UDT::close(*i);
+			i = race->candidates.erase(i);
+		}
+	}
+out:
+	return winner;
+}
+
+static void udtbus_race_end(struct udtbus_race *race)
+{
+	vector<UDTSOCKET>::iterator i;
+
+	for (i = race->candidates.begin(); i != race->candidates.end(); ++i)
+		UDT::close(*i);
+
+	delete race;
+}
+
+static void udtbus_poke_race()
+{
+	list<struct udtbus_race *>::iterator i;
+	struct udtbus_race *race;
+	UDTSOCKET winner;
+	peer_t *peer;
+	bool block = true;
+
+	for (i = g_list_race.begin(); i != g_list_race.end(); ) {
+
+		race = *i;
+		peer = race->peer;
+		winner = udtbus_race_winner(race);
+
+		if (winner == UDT::INVALID_SOCK &&
+		    !race->candidates.empty() && time(NULL) < race->deadline) {
+			++i;
+			continue;
+		}
+
+		// the callbacks below may start a new race
+		i = g_list_race.erase(i);
+		udtbus_race_end(race);
+
+		if (winner == UDT::INVALID_SOCK) {
+			jlog(L_NOTICE, "p2p failed");
+			on_disconnect(peer);
+			continue;
+		}
+
+		UDT::setsockopt(winner, 0, UDT_SNDSYN, &block, sizeof(bool));
+		UDT::setsockopt(winner, 0, UDT_RCVSYN, &block, sizeof(bool));
+		udtbus_set_syn(winner, &udtbus_opts);
+
+		peer->socket = winner;
+		UDT::set_ext_ptr(winner, (void *)peer);
+		udtbus_ion_add(winner);
+
+		peer->on_connect(peer);
+	}
+}
+
 void udtbus_poke_queue()
 {
 	peer_t *peer;
@@ -178,6 +561,8 @@ void udtbus_poke_queue()
 	vector<UDTSOCKET> exceptfds;
 	vector<UDTSOCKET>::iterator i;
 
+	udtbus_poke_race();
+
 	int res = UDT::selectEx(g_list_socket, &readfds, NULL, &exceptfds, 0);
 	if (res == 0) // no socket is ready before timeout
 		return;
@@ -216,7 +601,6 @@ peer_t *udtbus_client(const char *listen_addr,
 {
 	struct addrinfo hints, *local, *serv_info;
 	int ret = 0;
-	int mss = 1450;
 
 	peer_t *peer;
 	memset(&hints, 0, sizeof(struct addrinfo));
@@ -228,7 +612,7 @@ peer_t *udtbus_client(const char *listen_addr,
 	ret = getaddrinfo(NULL, port, &hints, &local);
 
 	UDTSOCKET client = UDT::socket(local->ai_family, local->ai_socktype, local->ai_protocol);
-	UDT::setsockopt(client, 0, UDT_MSS, &mss, sizeof(int));
+	udtbus_set_sockopts(client, &udtbus_opts);
 
 	freeaddrinfo(local);
 	ret = getaddrinfo(listen_addr, port, &hints, &serv_info);
@@ -238,6 +622,8 @@ peer_t *udtbus_client(const char *listen_addr,
 		return NULL;
 	}
 
+	udtbus_set_mss(client, serv_info->ai_addr, serv_info->ai_addrlen);
+
 	if (UDT::connect(client, serv_info->ai_addr, serv_info->ai_addrlen) == UDT::ERROR) {
 		jlog(L_WARNING, "%s", UDT::getlasterror().getErrorMessage());
 		freeaddrinfo(serv_info);
@@ -246,6 +632,7 @@ peer_t *udtbus_client(const char *listen_addr,
 	}
 
 	freeaddrinfo(serv_info);
+	udtbus_set_syn(client, &udtbus_opts);
 
 	peer = (peer_t *)calloc(sizeof(peer_t), 1);
 	peer->type = UDTBUS_CLIENT;
@@ -255,6 +642,7 @@ peer_t *udtbus_client(const char *listen_addr,
 	peer->on_input = on_input;
 	peer->recv = udtbus_recv;
 	peer->send = udtbus_send;
+	peer->pending = udtbus_pending;
 	peer->disconnect = udtbus_disconnect;
 	peer->buffer = NULL;
 
@@ -269,14 +657,15 @@ peer_t *udtbus_server(const char *listen_addr,
                   void (*on_connect)(peer_t *),
                   void (*on_disconnect)(peer_t *),
                   void (*on_input)(peer_t *),
-                  void *ext_ptr)
+                  void *ext_ptr,
+                  int fd)
 {
 	peer_t *peer;
 
 	addrinfo hints;
 	addrinfo* res;
 	int ret = 0;
-	int mss = 1450;
+	int on = 1;
 
 	memset(&hints, 0, sizeof(struct addrinfo));
 
@@ -297,8 +686,28 @@ peer_t *udtbus_server(const char *listen_addr,
 	bool block = false;
 	UDT::setsockopt(serv, 0, UDT_RCVSYN, &block, sizeof(bool));
 
-	UDT::setsockopt(serv, 0, UDT_MSS, &mss, sizeof(int));
+	udtbus_set_sockopts(serv, &udtbus_opts);
+#ifndef _WIN32
+	/* the UDP socket is ours, so it can be handed over to the
+	 * process that replaces this one, see net_inherit() */
+	if (fd < 0) {
+		fd = socket(res->ai_family, SOCK_DGRAM, 0);
+		if (fd < 0 ||
+		    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+		    bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+			jlog(L_WARNING, "bind: %s", strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			freeaddrinfo(res);
+			return NULL;
+		}
+	}
+
+	if (UDT::bind2(serv, fd) == UDT::ERROR) {
+#else
+	(void)on;
 	if (UDT::bind(serv, res->ai_addr, res->ai_addrlen) == UDT::ERROR) {
+#endif
 		jlog(L_WARNING, "bind: %s", UDT::getlasterror().getErrorMessage());
 		return NULL;
 	}
@@ -315,14 +724,19 @@ peer_t *udtbus_server(const char *listen_addr,
 	peer = (peer_t *)calloc(sizeof(peer_t), 1);
 	peer->type = UDTBUS_SERVER;
 	peer->socket = serv;
+	peer->fd = fd;
 	peer->on_connect = on_connect;
 	peer->on_disconnect = on_disconnect;
 	peer->on_input = on_input;
 	peer->recv = udtbus_recv;
 	peer->send = udtbus_send;
+	peer->pending = udtbus_pending;
 	peer->disconnect = udtbus_disconnect;
 	peer->buffer = NULL;
 	peer->ext_ptr = ext_ptr;
+	/* the accepted sockets get the options of their listener */
+	peer->opts = (struct udtbus_opts *)malloc(sizeof(struct udtbus_opts));
+	*peer->opts = udtbus_opts;
 
 	UDT::set_ext_ptr(serv, (void*)peer);
 	udtbus_ion_add(serv);
@@ -330,119 +744,30 @@ peer_t *udtbus_server(const char *listen_addr,
 	return peer;
 }
 
-void *udtbus_rendezvous(void *args)
+/* The UDP socket of the listeners went to another process. The
+ * multiplexer reads it until its last UDT socket is gone, so a closed
+ * socket must not linger on it with unsent data. */
+void udtbus_release()
 {
-	int ret = 0;
-	peer_t *peer = NULL;
-	uint8_t p2p_failed = 0;
-	uint8_t nb_port = 0;
-	uint8_t port_itr = 0;
-	struct addrinfo hints, *local, *server;
-	struct p2p_args *p2p_args = (struct p2p_args *)args;
-	int mss = 1450;
-	bool rdv = true;
-	UDTSOCKET socket = 0;
-
-	nb_port = sizeof(p2p_args->port)/sizeof(p2p_args->port[0]);
-
-	peer = (peer_t *)calloc(sizeof(peer_t), 1);
-	peer->type = UDTBUS_CLIENT;
-	peer->on_connect = p2p_args->on_connect;
-	peer->on_disconnect = p2p_args->on_disconnect;
-	peer->on_input = p2p_args->on_input;
-	peer->recv = udtbus_recv;
-	peer->send = udtbus_send;
-	peer->disconnect = udtbus_disconnect;
-	peer->buffer = NULL;
-	peer->buffer_offset = 0;
-	peer->ext_ptr = p2p_args->ext_ptr;
-
-retry:
-	jlog(L_NOTICE, "trying port %s...", p2p_args->port[port_itr]);
-	memset(&hints, 0, sizeof(struct addrinfo));
-
-	hints.ai_flags = AI_PASSIVE;
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-
-	ret = getaddrinfo(p2p_args->listen_addr, p2p_args->port[port_itr], &hints, &local);
-	if (ret != 0) {
-		jlog(L_ERROR, "illegal port number or port is busy");
-		p2p_failed = 1;
-		goto out;
-	}
-
-	socket = UDT::socket(local->ai_family, local->ai_socktype, local->ai_protocol);
-
-	UDT::setsockopt(socket, 0, UDT_MSS, &mss, sizeof(int));
-	UDT::setsockopt(socket, 0, UDT_RENDEZVOUS, &rdv, sizeof(bool));
-	if (UDT::ERROR == UDT::bind(socket, local->ai_addr, local->ai_addrlen)) {
-		jlog(L_WARNING, "bind: %s", UDT::getlasterror().getErrorMessage());
-		freeaddrinfo(local);
-		p2p_failed = 1;
-		goto out;
-	}
-
-	freeaddrinfo(local);
-
-	memset(&hints, 0, sizeof(struct addrinfo));
-
-	hints.ai_flags = AI_PASSIVE;
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-
-	ret = getaddrinfo(p2p_args->dest_addr, p2p_args->port[port_itr], &hints, &server);
-	if (ret != 0) {
-		jlog(L_WARNING, "incorrect server address: %s", gai_strerror(ret));
-		p2p_failed = 1;
-		goto out;
-	}
-
-	if (UDT::connect(socket, server->ai_addr, server->ai_addrlen) == UDT::ERROR) {
-		jlog(L_ERROR, "%s", UDT::getlasterror().getErrorMessage());
-
-		UDT::close(socket);
-
-		if (port_itr < nb_port-1) {
-			port_itr++;
-			freeaddrinfo(server);
-			goto retry;
-		}
-
-		p2p_failed = 1;
-
-	} else {
-
-		peer->socket = socket;
-		UDT::set_ext_ptr(socket, (void *)peer);
-		udtbus_ion_add(socket);
-	}
-
-	freeaddrinfo(server);
-out:
-
-	free(p2p_args->listen_addr);
-	free(p2p_args->dest_addr);
-	free(p2p_args->port[0]);
-	free(p2p_args->port[1]);
-	free(p2p_args->port[2]);
-	free(p2p_args->port[3]);
-	free(p2p_args);
-
-	if (p2p_failed) {
-		jlog(L_NOTICE, "p2p failed");
-		on_disconnect(peer);
-		return NULL;
-
-	} else {
-		peer->on_connect(peer);
-	}
+	vector<UDTSOCKET>::iterator i;
+	linger l;
 
-	return NULL;
+	l.l_onoff = 0;
+	l.l_linger = 0;
+	for (i = g_list_socket.begin(); i != g_list_socket.end(); ++i)
+		UDT::setsockopt(*i, 0, UDT_LINGER, &l, sizeof(l));
 }
 
 void udtbus_fini()
 {
+	list<struct udtbus_race *>::iterator i;
+
+	for (i = g_list_race.begin(); i != g_list_race.end(); ++i) {
+		free((*i)->peer);
+		udtbus_race_end(*i);
+	}
+	g_list_race.clear();
+
 	// use this function to release the UDT library
 	UDT::cleanup();
 
@@ -16,12 +16,24 @@
 #ifndef UDTBUS_H
 #define UDTBUS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Receive buffers grow up to the bytes pending on the socket,
+ * so a whole burst is handed to the netbus in one wakeup. */
+#define PEER_BUF_MIN	8192
+#define PEER_BUF_MAX	(4*1024*1024)
+
+/* Upper bound of the discovered path MTU, jumbo
+ * frame deployments have to set udt_mss explicitly. */
+#define UDTBUS_PMTU_MAX	1500
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct udtbus_opts;
+
 typedef struct peer {
 
 	int type;
@@ -39,23 +51,53 @@ typedef struct peer {
 	int (*send)(struct peer *, void *, int);
 	int (*recv)(struct peer *);
 	void (*disconnect)(struct peer *);
+	int (*pending)(struct peer *);	/* bytes accepted by send() not yet on the wire, NULL if unknown */
 
 	void *buffer;
+	size_t buffer_size;		/* allocated size of buffer */
 	int32_t buffer_data_len;
 	size_t buffer_offset;
 	void *ext_ptr;
 
+	int fd;				/* UDP socket under a UDT server */
+	struct udtbus_opts *opts;	/* options of a UDT server, for the sockets it accepts */
+
 } peer_t;
 
+/* UDT socket options, applied to the sockets created after
+ * udtbus_set_opts(). A server keeps the options it was created with
+ * for the sockets it accepts, so each listener can have its own set.
+ * A zero size keeps the UDT default. */
+struct udtbus_opts {
+
+	int mss;			/* UDT_MSS, bytes, 0 to use the path MTU */
+	int sndbuf;			/* UDT_SNDBUF, bytes */
+	int rcvbuf;			/* UDT_RCVBUF, bytes */
+	int udp_sndbuf;			/* UDP_SNDBUF, bytes */
+	int udp_rcvbuf;			/* UDP_RCVBUF, bytes */
+	int fc;				/* UDT_FC, flow window in packets */
+	int sndsyn;			/* UDT_SNDSYN, -1 to keep the default */
+	int rcvsyn;			/* UDT_RCVSYN, -1 to keep the default */
+	char cc[16];			/* congestion control { native, fixed, bbr } */
+	int cc_rate;			/* sending rate of "fixed", Mbps */
+};
+
+/* Candidates of a rendezvous, every address is tried on every port
+ * at the same time. Unused slots are NULL. */
+#define P2P_ADDR_MAX		2	/* public and local address of the peer */
+#define P2P_PORT_MAX		4
+#define UDTBUS_RACE_TIMEOUT	15	/* seconds before a rendezvous is given up */
+
 struct p2p_args {
 
-	char *listen_addr;
-	char *dest_addr;
-	char *port[4];
+	const char *listen_addr;
+	const char *dest_addr[P2P_ADDR_MAX];
+	const char *port[P2P_PORT_MAX];
 	void (*on_connect)(struct peer *);
 	void (*on_disconnect)(struct peer *);
 	void (*on_input)(struct peer *);
 	void *ext_ptr;
+	int nominate;			/* picks the candidate, the other side adopts it */
 };
 
 peer_t *udtbus_server(const char *listen_addr,
@@ -63,15 +105,26 @@ peer_t *udtbus_server(const char *listen_addr,
                   void (*on_connect)(peer_t *),
                   void (*on_disconnect)(peer_t *),
                   void (*on_input)(peer_t *),
-                  void *ext_ptr);
+                  void *ext_ptr,
+                  int fd);
+
+/* peer.c, shared by the UDT, TCP and UDP buses */
+int peer_buffer_reserve(peer_t *peer, size_t size);
+
+int udtbus_get_path_mtu(const char *host, const char *port);
+int udtbus_get_mss(peer_t *peer);
+
+void udtbus_get_opts(struct udtbus_opts *opts);
+void udtbus_set_opts(const struct udtbus_opts *opts);
 
-void *udtbus_rendezvous(void *args);
+int udtbus_rendezvous(const struct p2p_args *args);
 
 peer_t *udtbus_client(const char *listen_addr,
                       const char *port,
                       void (*on_disconnect)(peer_t *),
                       void (*on_input)(peer_t *));
 void udtbus_poke_queue();
+void udtbus_release();
 int udtbus_init();
 void udtbus_fini();
 
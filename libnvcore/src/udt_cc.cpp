@@ -0,0 +1,195 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#include <cstring>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "udt_cc.h"
+
+#define BBR_STARTUP	0
+#define BBR_DRAIN	1
+#define BBR_PROBE_BW	2
+
+#define BBR_HIGH_GAIN	2.885
+#define BBR_CWND_GAIN	2.0
+#define BBR_MIN_CWND	16.0
+#define BBR_RTT_WINDOW	10000000	/* microseconds */
+
+static const double bbr_cycle_gain[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+static uint64_t now_usec()
+{
+#if _WIN32
+	return (uint64_t)GetTickCount() * 1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+CFixedRate::CFixedRate(int rate_mbps):
+	m_iRateMbps(rate_mbps)
+{
+}
+
+void CFixedRate::init()
+{
+	// the flow window still bounds what is in flight
+	m_dCWndSize = m_dMaxCWndSize;
+
+	// one Mbps is one bit per microsecond
+	if (m_iRateMbps > 0)
+		m_dPktSndPeriod = (m_iMSS * 8.0) / m_iRateMbps;
+	else
+		m_dPktSndPeriod = 1.0;
+}
+
+CBBRLike::CBBRLike()
+{
+}
+
+void CBBRLike::init()
+{
+	m_iState = BBR_STARTUP;
+	m_iCycle = 0;
+	m_iRound = 0;
+	m_iRoundStart = now_usec();
+
+	memset(m_dBwSample, 0, sizeof(m_dBwSample));
+	m_dBtlBw = 0;
+	m_dFullBw = 0;
+	m_iFullBwCount = 0;
+
+	m_iMinRTT = 0;
+	m_iMinRTTStamp = 0;
+
+	m_dCWndSize = BBR_MIN_CWND;
+	m_dPktSndPeriod = 1.0;
+}
+
+void CBBRLike::apply(double pacing_gain, double cwnd_gain)
+{
+	double bdp;
+
+	if (m_dBtlBw <= 0 || m_iMinRTT <= 0) {
+		// no model yet, grow like slow start does
+		if (m_dCWndSize < m_dMaxCWndSize)
+			m_dCWndSize *= 2;
+		return;
+	}
+
+	m_dPktSndPeriod = 1000000.0 / (m_dBtlBw * pacing_gain);
+
+	bdp = m_dBtlBw * m_iMinRTT / 1000000.0;
+	m_dCWndSize = cwnd_gain * bdp;
+	if (m_dCWndSize < BBR_MIN_CWND)
+		m_dCWndSize = BBR_MIN_CWND;
+	if (m_dCWndSize > m_dMaxCWndSize)
+		m_dCWndSize = m_dMaxCWndSize;
+}
+
+void CBBRLike::onACK(int32_t)
+{
+	uint64_t now = now_usec();
+	int slot, i;
+
+	if (m_iRTT > 0 && (m_iMinRTT == 0 || m_iRTT < m_iMinRTT
+			|| now - m_iMinRTTStamp > BBR_RTT_WINDOW)) {
+		m_iMinRTT = m_iRTT;
+		m_iMinRTTStamp = now;
+	}
+
+	// windowed max of the delivery rate reported by the receiver
+	slot = m_iRound % BBR_BW_ROUNDS;
+	if (m_iRcvRate > m_dBwSample[slot])
+		m_dBwSample[slot] = m_iRcvRate;
+
+	m_dBtlBw = 0;
+	for (i = 0; i < BBR_BW_ROUNDS; i++) {
+		if (m_dBwSample[i] > m_dBtlBw)
+			m_dBtlBw = m_dBwSample[i];
+	}
+
+	// one round trip elapsed
+	if (m_iMinRTT > 0 && now - m_iRoundStart >= (uint64_t)m_iMinRTT) {
+		m_iRound++;
+		m_iRoundStart = now;
+		m_dBwSample[m_iRound % BBR_BW_ROUNDS] = 0;
+
+		switch (m_iState) {
+		case BBR_STARTUP:
+			// the pipe is full when the bandwidth stops growing by 25%
+			if (m_dBtlBw >= m_dFullBw * 1.25) {
+				m_dFullBw = m_dBtlBw;
+				m_iFullBwCount = 0;
+			} else if (++m_iFullBwCount >= 3) {
+				m_iState = BBR_DRAIN;
+			}
+			break;
+		case BBR_DRAIN:
+			m_iState = BBR_PROBE_BW;
+			m_iCycle = 0;
+			break;
+		case BBR_PROBE_BW:
+			m_iCycle = (m_iCycle + 1) % (sizeof(bbr_cycle_gain) / sizeof(bbr_cycle_gain[0]));
+			break;
+		}
+	}
+
+	switch (m_iState) {
+	case BBR_STARTUP:
+		apply(BBR_HIGH_GAIN, BBR_HIGH_GAIN);
+		break;
+	case BBR_DRAIN:
+		apply(1 / BBR_HIGH_GAIN, BBR_HIGH_GAIN);
+		break;
+	case BBR_PROBE_BW:
+		apply(bbr_cycle_gain[m_iCycle], BBR_CWND_GAIN);
+		break;
+	}
+}
+
+void CBBRLike::onTimeout()
+{
+	// keep the model, only restart the window
+	m_dCWndSize = BBR_MIN_CWND;
+}
+
+class CBBRLikeFactory: public CCCVirtualFactory
+{
+public:
+	virtual CCC* create() { return new CBBRLike; }
+	virtual CCCVirtualFactory* clone() { return new CBBRLikeFactory; }
+};
+
+CCCVirtualFactory *udt_cc_factory(const char *name, int rate_mbps)
+{
+	if (name == NULL || strcmp(name, "native") == 0)
+		return NULL;
+
+	if (strcmp(name, "fixed") == 0)
+		return new CParamFactory<CFixedRate, int>(rate_mbps);
+
+	if (strcmp(name, "bbr") == 0)
+		return new CBBRLikeFactory;
+
+	return NULL;
+}
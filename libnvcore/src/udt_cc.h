@@ -0,0 +1,84 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2014
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef UDT_CC_H
+#define UDT_CC_H
+
+#include <stdint.h>
+#include <udt.h>
+#include <ccc.h>
+
+#define BBR_BW_ROUNDS	10	/* rounds of the bottleneck bandwidth max filter */
+
+/* Send at a constant rate and ignore losses,
+ * for provisioned links where the capacity is known. */
+class CFixedRate: public CCC
+{
+public:
+	CFixedRate(int rate_mbps);
+
+	virtual void init();
+
+private:
+	int m_iRateMbps;
+};
+
+/* Model based controller loosely following BBR: pace at the
+ * bottleneck bandwidth estimated from the receiver delivery rate
+ * and keep about two BDP in flight, instead of backing off on loss. */
+class CBBRLike: public CCC
+{
+public:
+	CBBRLike();
+
+	virtual void init();
+	virtual void onACK(int32_t ack);
+	virtual void onTimeout();
+
+private:
+	void apply(double pacing_gain, double cwnd_gain);
+
+	int m_iState;
+	int m_iCycle;
+	uint64_t m_iRound;
+	uint64_t m_iRoundStart;
+
+	double m_dBwSample[BBR_BW_ROUNDS];	/* max delivery rate per round, pkts/s */
+	double m_dBtlBw;
+	double m_dFullBw;
+	int m_iFullBwCount;
+
+	int m_iMinRTT;			/* microseconds */
+	uint64_t m_iMinRTTStamp;
+};
+
+template <class T, class A>
+class CParamFactory: public CCCVirtualFactory
+{
+public:
+	CParamFactory(A arg): m_Arg(arg) {}
+	virtual CCC* create() { return new T(m_Arg); }
+	virtual CCCVirtualFactory* clone() { return new CParamFactory<T, A>(m_Arg); }
+
+private:
+	A m_Arg;
+};
+
+/* Return a factory for the named controller, "fixed" or "bbr",
+ * or NULL for UDT's native one. UDT clones the factory when
+ * it is set with UDT_CC, the caller must delete it. */
+CCCVirtualFactory *udt_cc_factory(const char *name, int rate_mbps);
+
+#endif
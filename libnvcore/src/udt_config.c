@@ -0,0 +1,47 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#include <stdio.h>
+
+#include "udt.h"
+#include "udt_config.h"
+
+/* Options of the UDT sockets created from now on, see udtbus_set_opts() */
+void
+config_parse_udt(config_t *cfg)
+{
+	struct udtbus_opts	opts;
+	const char		*cc;
+	int			 block;
+
+	udtbus_get_opts(&opts);
+
+	config_lookup_int(cfg, "udt_mss", &opts.mss);
+	config_lookup_int(cfg, "udt_sndbuf", &opts.sndbuf);
+	config_lookup_int(cfg, "udt_rcvbuf", &opts.rcvbuf);
+	config_lookup_int(cfg, "udp_sndbuf", &opts.udp_sndbuf);
+	config_lookup_int(cfg, "udp_rcvbuf", &opts.udp_rcvbuf);
+	config_lookup_int(cfg, "udt_fc", &opts.fc);
+	config_lookup_int(cfg, "udt_cc_rate", &opts.cc_rate);
+
+	if (config_lookup_bool(cfg, "udt_sndsyn", &block))
+		opts.sndsyn = block;
+	if (config_lookup_bool(cfg, "udt_rcvsyn", &block))
+		opts.rcvsyn = block;
+	if (config_lookup_string(cfg, "udt_cc", &cc))
+		snprintf(opts.cc, sizeof(opts.cc), "%s", cc);
+
+	udtbus_set_opts(&opts);
+}
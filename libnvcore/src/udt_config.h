@@ -0,0 +1,24 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef UDT_CONFIG_H
+#define UDT_CONFIG_H
+
+#include <libconfig.h>
+
+/* the udt_* and udp_* keys shared by the agent and the switch */
+void config_parse_udt(config_t *cfg);
+
+#endif
@@ -28,7 +28,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
-
+#include <time.h>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
 
 #include <dnds.h>
 #include <logger.h>
@@ -47,32 +53,67 @@ void on_input(netc_t *netc);
 static void on_secure(netc_t *netc);
 static void dispatch_op(struct session *session, DNDSMessage_t *msg);
 static void on_disconnect(netc_t *netc);
+static void on_data_disconnect(netc_t *netc);
+static void on_data_input(netc_t *netc);
+static void on_data_secure(netc_t *netc);
+
+/* ethernet header and 802.1Q tag on top of the interface MTU */
+#define FRAME_HDR_LEN	18
+
+/* reconnection delay, doubled after each failed attempt */
+#define RECONNECT_MIN	100	/* ms */
+#define RECONNECT_MAX	5000
+#define TCP_DIAL_TIMEOUT	5000	/* ms, as the blocking connect of the TCP bus */
+
+static int tunnel_set_mtu(struct session *session, int mtu)
+{
+	uint8_t *framebuf;
+	size_t size;
+
+	size = mtu + FRAME_HDR_LEN;
+	if (size > session->framebuf_size) {
+		framebuf = realloc(session->framebuf, size);
+		if (framebuf == NULL) {
+			jlog(L_ERROR, "realloc failed");
+			return -1;
+		}
+		session->framebuf = framebuf;
+		session->framebuf_size = size;
+	}
+
+	return tapcfg_iface_set_mtu(session->tapcfg, mtu);
+}
+
+/* Send a frame through `via', the server session or a p2p one; the
+ * frame template belongs to the server session. */
+void tunnel_send(struct session *session, struct session *via, uint8_t *frame, size_t frame_size)
+{
+	DNDSMessage_t *msg = session->frame_tpl->msg;
+
+	if (via->state != SESSION_STATE_AUTHED)
+		return;
+
+	/* the template only changes by the frame */
+	DNDSMessage_set_channel(msg, net_frame_channel(frame_size));
+	DNDSMessage_set_ethernet(msg, frame, frame_size);
+
+	/* the switch confirmed the datagram channel */
+	if (via->netc_data && via->data_up)
+		net_send_msg(via->netc_data, msg);
+	else
+		net_send_msg(via->netc, msg);
+}
 
 static void tunnel_in(struct session* session)
 {
-	DNDSMessage_t *msg = NULL;
 	size_t frame_size = 0;
-	uint8_t framebuf[2000];
+	uint8_t *framebuf = session->framebuf;
 	struct session *p2p_session;
 
-	frame_size = tapcfg_read(session->tapcfg, framebuf, 2000);
+	frame_size = tapcfg_read(session->tapcfg, framebuf, session->framebuf_size);
 	p2p_session = p2p_find_session(framebuf);
-	if (p2p_session) {
-		//printf("p2p_session: %p netc: %p\n", p2p_session, p2p_session->netc);
-		session = p2p_session;
-	}
 
-	if (session->state != SESSION_STATE_AUTHED)
-		return;
-
-	DNDSMessage_new(&msg);
-	DNDSMessage_set_channel(msg, 0);
-	DNDSMessage_set_pdu(msg, pdu_PR_ethernet);
-	DNDSMessage_set_ethernet(msg, (uint8_t*)framebuf, frame_size);
-
-	net_send_msg(session->netc, msg);
-	DNDSMessage_set_ethernet(msg, NULL, 0);
-	DNDSMessage_del(msg);
+	tunnel_send(session, p2p_session ? p2p_session : session, framebuf, frame_size);
 }
 
 static void tunnel_out(struct session *session, DNDSMessage_t *msg)
@@ -81,11 +122,52 @@ static void tunnel_out(struct session *session, DNDSMessage_t *msg)
 	size_t framebufsz;
 
 	DNDSMessage_get_ethernet(msg, &framebuf, &framebufsz);
+
+	/* the switchover markers of the peers stop here */
+	if (p2p_marker(framebuf, framebufsz))
+		return;
+
 	tapcfg_write(session->tapcfg, framebuf, framebufsz);
 }
 
+static void data_disconnect(struct session *session)
+{
+	netc_t *netc_data;
+
+	if (session->netc_data == NULL)
+		return;
+
+	netc_data = session->netc_data;
+	session->netc_data = NULL;
+	session->data_up = 0;
+	netc_data->ext_ptr = NULL;
+	net_disconnect(netc_data);
+}
+
+/* Open the datagram channel advertised by the switch, the handshake
+ * names our network like the server connection does. */
+static void data_connect(struct session *session, uint16_t port)
+{
+	char port_str[6];
+	netc_t *netc;
+
+	data_disconnect(session);
+
+	snprintf(port_str, sizeof(port_str), "%u", port);
+	netc = net_client(agent_cfg->server_address, port_str, NET_PROTO_DTLS,
+		NET_SECURE_RSA, session->passport, on_data_disconnect, on_data_input, on_data_secure);
+	if (netc == NULL) {
+		jlog(L_WARNING, "unable to open the datagram channel, port %s", port_str);
+		return;
+	}
+
+	netc->ext_ptr = session;
+	session->netc_data = netc;
+}
+
 void terminate(struct session *session)
 {
+	data_disconnect(session);
 	session->state = SESSION_STATE_DOWN;
 	net_disconnect(session->netc);
 	session->netc = NULL;
@@ -113,6 +195,15 @@ void transmit_netinfo_request(struct session *session)
 	NetinfoRequest_set_ipLocal(msg, ip_local);
 	NetinfoRequest_set_macAddr(msg, (uint8_t*)hwaddr);
 
+	/* offer to compress the tunnel payloads, the
+	 * switch accepts it if the network enables it */
+	if (compress_supported() != COMPRESS_NONE)
+		NetinfoRequest_set_compression(msg, compress_supported());
+
+	/* lets the switch answer the ARP requests for us */
+	if (ipAddress[0] != '\0')
+		NetinfoRequest_set_ipAddress(msg, ipAddress);
+
 	net_send_msg(session->netc, msg);
 	DNDSMessage_del(msg);
 
@@ -185,22 +276,135 @@ void transmit_register(netc_t *netc)
         return;
 }
 
+/* A standby switch takes over within a second or two, and the agents
+ * of a failed switch must not come back in lockstep. Returns the ms to
+ * wait before the next attempt and doubles `delay'. */
+static int reconnect_wait(int *delay)
+{
+	int wait;
+
+	wait = *delay / 2 + rand() % (*delay / 2 + 1);
+	if (*delay < RECONNECT_MAX)
+		*delay = *delay * 2 < RECONNECT_MAX ? *delay * 2 : RECONNECT_MAX;
+
+	return wait;
+}
+
+#ifdef __linux__
+/* The TCP bus is not thread safe: its connections are dialed from the
+ * agent loop, without blocking it */
+static int tcp_dial_fd = -1;
+static uint64_t tcp_dial_at = 0;	/* ms, next attempt, or the deadline of this one */
+static int tcp_dial_delay = RECONNECT_MIN;
+
+static uint64_t agent_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void tcp_dial_later(uint64_t now)
+{
+	if (tcp_dial_fd >= 0)
+		close(tcp_dial_fd);
+	tcp_dial_fd = -1;
+	tcp_dial_at = now + reconnect_wait(&tcp_dial_delay);
+}
+
+static void tcp_dial(struct session *session)
+{
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	socklen_t len;
+	netc_t *netc;
+	uint64_t now;
+	int err = 0;
+	int fd;
+
+	now = agent_now();
+
+	if (tcp_dial_fd < 0) {
+		if (now < tcp_dial_at)
+			return;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(agent_cfg->server_port));
+		addr.sin_addr.s_addr = inet_addr(agent_cfg->server_address);
+
+		if ((tcp_dial_fd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+			tcp_dial_later(now);
+			return;
+		}
+		fcntl(tcp_dial_fd, F_SETFL, fcntl(tcp_dial_fd, F_GETFL) | O_NONBLOCK);
+		tcp_dial_at = now + TCP_DIAL_TIMEOUT;
+
+		if (connect(tcp_dial_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			goto connected;
+		if (errno != EINPROGRESS) {
+			tcp_dial_later(now);
+			return;
+		}
+	}
+
+	pfd.fd = tcp_dial_fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) == 0) {
+		if (now >= tcp_dial_at) {
+			jlog(L_DEBUG, "connect timed out");
+			tcp_dial_later(now);
+		}
+		return;
+	}
+
+	len = sizeof(err);
+	if (getsockopt(tcp_dial_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+		tcp_dial_later(now);
+		return;
+	}
+
+connected:
+	fd = tcp_dial_fd;
+	tcp_dial_fd = -1;
+
+	/* with a passport, authenticate in a single handshake */
+	netc = net_client_socket(fd, session->passport ? NET_SECURE_RSA : NET_SECURE_ADH,
+		session->passport, on_disconnect, on_input, on_secure);
+	if (netc == NULL) {
+		tcp_dial_later(now);
+		return;
+	}
+
+	tcp_dial_delay = RECONNECT_MIN;
+	session->state = SESSION_STATE_NOT_AUTHED;
+	session->netc = netc;
+	netc->ext_ptr = session;
+}
+#endif
+
 void *try_to_reconnect(void *ptr)
 {
 	struct session *session = NULL;
 	netc_t *retry_netc = NULL;
+	int delay = RECONNECT_MIN;
+	int wait;
 
 	session = (struct session *)ptr;
 
 	while (agent_cfg->agent_running) {
+		wait = reconnect_wait(&delay);
 #if defined(_WIN32)
-		Sleep(5);
+		Sleep(wait);
 #else
-		sleep(5);
+		usleep(wait * 1000);
 #endif
 
+		/* with a passport, authenticate in a single handshake */
 		retry_netc = net_client(agent_cfg->server_address, agent_cfg->server_port,
-			NET_PROTO_UDT, NET_SECURE_ADH, session->passport,
+			agent_cfg->server_protocol, session->passport ? NET_SECURE_RSA : NET_SECURE_ADH, session->passport,
 			on_disconnect, on_input, on_secure);
 
 		if (retry_netc) {
@@ -228,6 +432,10 @@ static void on_disconnect(netc_t *netc)
 		return;
 	}
 
+	compress_stats_log(netc->compress, "session");
+
+	data_disconnect(session);
+
 	if (session->state == SESSION_STATE_DOWN) {
 		jlog(L_DEBUG, "session->state == SESSION_STATE_DOWN");
 		return;
@@ -238,6 +446,12 @@ static void on_disconnect(netc_t *netc)
 	if (agent_cfg->ev.on_disconnect)
 		agent_cfg->ev.on_disconnect();
 
+#ifdef __linux__
+	if (agent_cfg->server_protocol == NET_PROTO_TCP) {
+		tcp_dial_later(agent_now());
+		return;
+	}
+#endif
 	pthread_create(&thread_reconnect, NULL, try_to_reconnect, (void *)session);
 	pthread_detach(thread_reconnect);
 }
@@ -278,6 +492,9 @@ void on_input(netc_t *netc)
 		switch (pdu) {
 		case pdu_PR_dnm:
 			dispatch_op(session, msg);
+			/* the connection went away with its queue */
+			if (session->netc != netc)
+				return;
 			break;
 
 		case pdu_PR_ethernet:
@@ -292,10 +509,64 @@ void on_input(netc_t *netc)
 	}
 }
 
-static void op_netinfo_response(struct session *session)
+static void on_data_secure(netc_t *netc)
+{
+	jlog(L_NOTICE, "datagram channel secured");
+	krypt_print_cipher(netc->kconn);
+}
+
+static void on_data_disconnect(netc_t *netc)
+{
+	struct session *session;
+
+	session = netc->ext_ptr;
+	netc->ext_ptr = NULL;
+	if (session != NULL && session->netc_data == netc) {
+		jlog(L_NOTICE, "datagram channel down");
+		session->netc_data = NULL;
+		session->data_up = 0;
+	}
+}
+
+static void on_data_input(netc_t *netc)
+{
+	DNDSMessage_t *msg;
+	struct session *session;
+	mbuf_t **mbuf_itr;
+	pdu_PR pdu;
+
+	mbuf_itr = &netc->queue_msg;
+	session = netc->ext_ptr;
+
+	/* the switch only talks on the channels it accepted, it starts
+	 * with a NetinfoResponse; until then a silent channel expires and
+	 * the frames stay on the server connection */
+	if (session != NULL && !session->data_up) {
+		net_set_timeout(netc, 0);
+		if (session->netc->compress != NULL)
+			net_set_compression(netc, session->netc->compress->method);
+		session->data_up = 1;
+		jlog(L_NOTICE, "datagram channel up");
+	}
+
+	while (*mbuf_itr != NULL) {
+		msg = (DNDSMessage_t *)(*mbuf_itr)->ext_buf;
+		DNDSMessage_get_pdu(msg, &pdu);
+
+		if (session != NULL && pdu == pdu_PR_ethernet)
+			tunnel_out(session, msg);
+
+		mbuf_del(mbuf_itr, *mbuf_itr);
+	}
+}
+
+static void op_netinfo_response(struct session *session, DNDSMessage_t *msg)
 {
 	FILE *fp = NULL;
 	int fret = 0;
+	int mtu;
+	uint8_t compression;
+	uint16_t data_port;
 
 	fp = fopen(agent_cfg->ip_conf, "r");
 	if (fp == NULL) {
@@ -311,6 +582,27 @@ static void op_netinfo_response(struct session *session)
 	tapcfg_iface_set_status(session->tapcfg, TAPCFG_STATUS_IPV4_UP);
 	tapcfg_iface_set_ipv4(session->tapcfg, ipAddress, 24);
 	jlog(L_NOTICE, "ip address: %s", ipAddress);
+
+	/* the MSS was negotiated from the path MTU, size
+	 * the tap so a frame never spans two packets */
+	mtu = net_get_tunnel_mtu(session->netc);
+	if (tunnel_set_mtu(session, mtu) < 0)
+		jlog(L_WARNING, "unable to set the mtu to %d", mtu);
+	else
+		jlog(L_NOTICE, "mtu: %d", mtu);
+
+	if (NetinfoResponse_get_compression(msg, &compression) == DNDS_success
+			&& compression != COMPRESS_NONE) {
+		if (net_set_compression(session->netc, compression) == 0)
+			jlog(L_NOTICE, "compression: %d", compression);
+		else
+			jlog(L_WARNING, "unable to enable the compression %d", compression);
+	}
+
+	if (agent_cfg->data_protocol == NET_PROTO_DTLS
+			&& NetinfoResponse_get_dataPort(msg, &data_port) == DNDS_success)
+		data_connect(session, data_port);
+
 	session->state = SESSION_STATE_AUTHED;
 }
 
@@ -361,17 +653,55 @@ static void create_file_with_owner_right(const char *filename)
 		close(fd);
 }
 
+/* The controller placed our network on another switch, remember it */
+static int switch_moved(DNDSMessage_t *msg)
+{
+	size_t length;
+	uint16_t port;
+	char port_str[6];
+	char *address = NULL;
+
+	if (ProvResponse_get_switchAddress(msg, &address, &length) != DNDS_success ||
+	    ProvResponse_get_switchPort(msg, &port) != DNDS_success || port == 0)
+		return 0;
+
+	snprintf(port_str, sizeof(port_str), "%u", port);
+	if (strcmp(address, agent_cfg->server_address) == 0 &&
+	    strcmp(port_str, agent_cfg->server_port) == 0)
+		return 0;
+
+	jlog(L_NOTICE, "moving to the switch %s:%s", address, port_str);
+	agent_config_set_server(address, port_str);
+
+	return 1;
+}
+
+/* on_disconnect() dials the switch we were sent to */
+static void reconnect(struct session *session)
+{
+	data_disconnect(session);
+	net_disconnect(session->netc);
+	session->netc = NULL;
+}
+
 static void op_prov_response(struct session *session, DNDSMessage_t *msg)
 {
 	size_t length;
+	int moved;
 	char *certificate = NULL;
 	unsigned char *certificatekey = NULL;
 	unsigned char *trusted_authority = NULL;
 	FILE *fp = NULL;
 
+	moved = switch_moved(msg);
+
 	ProvResponse_get_certificate(msg, &certificate, &length);
 	if (certificate == NULL) {
-		jlog(L_ERROR, "Invalid provisioning key");
+		/* the network moved, nothing to provision */
+		if (moved)
+			reconnect(session);
+		else
+			jlog(L_ERROR, "Invalid provisioning key");
 		return;
 	}
 
@@ -418,6 +748,11 @@ static void op_prov_response(struct session *session, DNDSMessage_t *msg)
 					 agent_cfg->privatekey,
 					 agent_cfg->trusted_cert);
 
+	if (moved) {
+		reconnect(session);
+		return;
+	}
+
 	krypt_add_passport(session->netc->kconn, session->passport);
 	transmit_register(session->netc);
 }
@@ -437,7 +772,7 @@ static void dispatch_op(struct session *session, DNDSMessage_t *msg)
 		break;
 
 	case dnop_PR_netinfoResponse:
-		op_netinfo_response(session);
+		op_netinfo_response(session, msg);
 		break;
 
 	case dnop_PR_p2pRequest:
@@ -460,6 +795,17 @@ static void *agent_loop(void *session)
 {
 	while (agent_cfg->agent_running) {
 		udtbus_poke_queue();
+#ifdef __linux__
+		if (agent_cfg->server_protocol == NET_PROTO_TCP) {
+			netbus_tcp_poke();
+			if (((struct session *)session)->state == SESSION_STATE_DOWN)
+				tcp_dial((struct session *)session);
+		}
+#endif
+		if (agent_cfg->data_protocol == NET_PROTO_DTLS)
+			netbus_udp_poke();
+		p2p_poke();
+		net_flush_pending();
 		if (tapcfg_wait_readable(((struct session *)session)->tapcfg, 0))
 			tunnel_in((struct session *)session);
 	}
@@ -479,12 +825,16 @@ static struct session *session;
 
 void agent_fini()
 {
-	pthread_join(thread_reconnect, NULL);
+	if (agent_cfg->server_protocol != NET_PROTO_TCP)
+		pthread_join(thread_reconnect, NULL);
 	pthread_join(thread_loop, NULL);
 
+	data_disconnect(session);
 	net_disconnect(session->netc);
 	tapcfg_destroy(session->tapcfg);
 	pki_passport_destroy(session->passport);
+	free(session->framebuf);
+	DNDSTemplate_del(session->frame_tpl);
 
 	p2p_fini();
 	netbus_fini();
@@ -510,6 +860,12 @@ void *agent_init(void *cfg)
 		return NULL;
 	}
 
+	if (agent_cfg->server_protocol == NET_PROTO_TCP)
+		netbus_tcp_init();
+
+	if (agent_cfg->data_protocol == NET_PROTO_DTLS)
+		netbus_udp_init();
+
 	if (agent_cfg->prov_code == NULL)
 		session->passport = pki_passport_load_from_file(
 			agent_cfg->certificate, agent_cfg->privatekey, agent_cfg->trusted_cert);
@@ -539,12 +895,36 @@ void *agent_init(void *cfg)
 	session->devname = tapcfg_get_ifname(session->tapcfg);
 	jlog(L_DEBUG, "devname: %s", session->devname);
 
+	session->framebuf_size = tapcfg_iface_get_mtu(session->tapcfg) + FRAME_HDR_LEN;
+	if (session->framebuf_size < NET_MTU_DEFAULT + FRAME_HDR_LEN)
+		session->framebuf_size = NET_MTU_DEFAULT + FRAME_HDR_LEN;
+
+	session->framebuf = malloc(session->framebuf_size);
+	if (session->framebuf == NULL) {
+		jlog(L_ERROR, "malloc failed");
+		free(session);
+		return NULL;
+	}
+
+	if (DNDSTemplate_new(&session->frame_tpl, pdu_PR_ethernet, dnop_PR_NOTHING) != DNDS_success) {
+		jlog(L_ERROR, "DNDSTemplate_new failed");
+		free(session->framebuf);
+		free(session);
+		return NULL;
+	}
+
 	pthread_attr_t attr;
 
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
 	agent_cfg->agent_running = 1;
+#ifdef __linux__
+	/* dialed by the loop, see tcp_dial() */
+	if (agent_cfg->server_protocol == NET_PROTO_TCP)
+		session->state = SESSION_STATE_DOWN;
+	else
+#endif
 	pthread_create(&thread_reconnect, &attr, try_to_reconnect, (void *)session);
 	pthread_create(&thread_loop, &attr, agent_loop, session);
 
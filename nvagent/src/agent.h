@@ -22,6 +22,8 @@
 struct agent_cfg {
 	char *server_address;
 	char *server_port;
+	uint8_t server_protocol;	/* NET_PROTO_UDT or NET_PROTO_TCP */
+	uint8_t data_protocol;		/* NET_PROTO_DTLS, 0 to keep the frames on the server connection */
 
 	char *certificate;
 	char *privatekey;
@@ -52,8 +54,12 @@ void agent_fini();
 void agent_init_async(struct agent_cfg *cfg);
 void *agent_init(void *agent_cfg);
 int agent_config_toggle_auto_connect(int status);
+int agent_config_set_server(const char *address, const char *port);
 void on_input(netc_t *netc);
 
+struct session;
+void tunnel_send(struct session *session, struct session *via, uint8_t *frame, size_t frame_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 
 #include <logger.h>
+#include <udt_config.h>
 #include "agent.h"
 
 static struct agent_cfg *agent_cfg;
@@ -98,6 +99,44 @@ int agent_config_toggle_auto_connect(int status)
 	return 0;
 }
 
+/* The switch the controller placed our network on */
+int agent_config_set_server(const char *address, const char *port)
+{
+	config_setting_t *root, *setting;
+	config_t cfg;
+
+	free(agent_cfg->server_address);
+	agent_cfg->server_address = strdup(address);
+	free(agent_cfg->server_port);
+	agent_cfg->server_port = strdup(port);
+
+	config_init(&cfg);
+	root = config_root_setting(&cfg);
+
+	if (!config_read_file(&cfg, agent_cfg->agent_conf)) {
+		jlog(L_WARNING, "Can't open %s", agent_cfg->agent_conf);
+		config_destroy(&cfg);
+		return -1;
+	}
+
+	setting = config_setting_get_member(root, "server_address");
+	if (setting == NULL) {
+		setting = config_setting_add(root, "server_address", CONFIG_TYPE_STRING);
+	}
+	config_setting_set_string(setting, address);
+
+	setting = config_setting_get_member(root, "server_port");
+	if (setting == NULL) {
+		setting = config_setting_add(root, "server_port", CONFIG_TYPE_STRING);
+	}
+	config_setting_set_string(setting, port);
+
+	config_write_file(&cfg, agent_cfg->agent_conf);
+	config_destroy(&cfg);
+
+	return 0;
+}
+
 void agent_config_destroy(struct agent_cfg *agent_cfg)
 {
 	config_destroy(&cfg);
@@ -184,10 +223,36 @@ int agent_config_init(struct agent_cfg *_agent_cfg)
 	}
 	jlog(L_DEBUG, "server_port = \"%s\";", agent_cfg->server_port);
 
+	/* TCP lets the kernel take over the TLS records */
+	agent_cfg->server_protocol = NET_PROTO_UDT;
+	if (!default_conf && config_lookup_string(&cfg, "server_transport", &tmp)) {
+		if (strcmp(tmp, "tcp") == 0)
+			agent_cfg->server_protocol = NET_PROTO_TCP;
+		else if (strcmp(tmp, "udt") != 0)
+			jlog(L_WARNING, "unknown server_transport \"%s\", using udt", tmp);
+	}
+	jlog(L_DEBUG, "server_transport = \"%s\";",
+		agent_cfg->server_protocol == NET_PROTO_TCP ? "tcp" : "udt");
+
+	/* "dtls" sends the ethernet frames as datagrams when the switch
+	 * offers it, "none" keeps them on the server connection */
+	agent_cfg->data_protocol = 0;
+	if (!default_conf && config_lookup_string(&cfg, "data_transport", &tmp)) {
+		if (strcmp(tmp, "dtls") == 0)
+			agent_cfg->data_protocol = NET_PROTO_DTLS;
+		else if (strcmp(tmp, "none") != 0)
+			jlog(L_WARNING, "unknown data_transport \"%s\", using none", tmp);
+	}
+	jlog(L_DEBUG, "data_transport = \"%s\";",
+		agent_cfg->data_protocol == NET_PROTO_DTLS ? "dtls" : "none");
+
 	if (default_conf || !config_lookup_bool(&cfg, "auto_connect", &agent_cfg->auto_connect) ) {
 		agent_cfg->auto_connect = 0;
 	}
 
+	if (!default_conf)
+		config_parse_udt(&cfg);
+
 	config_destroy(&cfg);
 	return 0;
 }
@@ -14,8 +14,33 @@
  * GNU General Public License for more details.
  */
 
+/* Switching a pair over from the relay to p2p.
+ *
+ * When the p2p link of a pair is secured, each agent sends a marker
+ * frame through the switch, behind the frames it already relayed, then
+ * sends its new frames on the link. The receiving agent holds the
+ * frames arriving on the link until the marker comes out of the relay,
+ * so the flows inside the tunnel see neither a gap nor reordering. A
+ * lost marker, or a peer that doesn't send one, only delays the link
+ * by P2P_DRAIN_TIMEOUT. When the link fails, the agent tells its peer
+ * through the relay so both sides fall back at once.
+ *
+ * Any node can put a frame of that ethertype on the relay. The markers
+ * carry a HMAC keyed from the TLS session of the link, which only the
+ * two agents hold; the others are dropped.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+
 #include <dnds.h>
 #include <ftable.h>
+#include <jsw_hlib.h>
 #include <logger.h>
 #include <netbus.h>
 
@@ -23,8 +48,122 @@
 #include "session.h"
 #include "p2p.h"
 
+#define P2P_ETHERTYPE		0x88b5	/* IEEE local experimental */
+#define P2P_MARKER_LEN		36	/* ethernet header, magic, type, padding, tag */
+#define P2P_MARKER_TAG		20	/* offset of the tag, HMAC of what precedes it */
+#define P2P_MARKER_TAG_LEN	16
+#define P2P_MARKER_P2P		1	/* frames after it go through the link */
+#define P2P_MARKER_RELAY	2	/* the link is down, back to the relay */
+
+#define P2P_DRAIN_TIMEOUT	500	/* ms the link frames wait for the marker */
+#define P2P_DRAIN_MAX		1024	/* frames held before giving up on it */
+
+static const uint8_t p2p_magic[4] = { 'N', 'V', 'P', '2' };
+static const char p2p_label[] = "EXPORTER-netvirt-p2p-marker";
+
 ftable_t *ftable = NULL;
 
+/* requested links, until they are secured */
+static ftable_t *pending = NULL;
+static int draining = 0;
+
+static void *pending_itemdup(const void *item)
+{
+	return (void *)item;
+}
+
+static void pending_itemrel(void *item)
+{
+	(void)item;
+}
+
+static uint64_t p2p_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* the marker from src to dst, without its tag */
+static void p2p_marker_header(uint8_t *marker, const uint8_t *dst, const uint8_t *src, uint8_t type)
+{
+	memset(marker, 0, P2P_MARKER_LEN);
+	memcpy(marker, dst, ETHER_ADDR_LEN);
+	memcpy(marker + ETHER_ADDR_LEN, src, ETHER_ADDR_LEN);
+	marker[12] = P2P_ETHERTYPE >> 8;
+	marker[13] = P2P_ETHERTYPE & 0xff;
+	memcpy(marker + 14, p2p_magic, sizeof(p2p_magic));
+	marker[18] = type;
+}
+
+static void p2p_marker_tag(struct session *p2p_session, const uint8_t *marker, uint8_t *tag)
+{
+	uint8_t md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+
+	HMAC(EVP_sha256(), p2p_session->marker_key, sizeof(p2p_session->marker_key),
+		marker, P2P_MARKER_TAG, md, &md_len);
+	memcpy(tag, md, P2P_MARKER_TAG_LEN);
+}
+
+static int p2p_marker_valid(struct session *p2p_session, const uint8_t *marker, const uint8_t *tag)
+{
+	uint8_t expected[P2P_MARKER_TAG_LEN];
+
+	if (!p2p_session->marker_keyed)
+		return 0;
+
+	p2p_marker_tag(p2p_session, marker, expected);
+
+	return CRYPTO_memcmp(tag, expected, P2P_MARKER_TAG_LEN) == 0;
+}
+
+static void p2p_send_marker(struct session *p2p_session, uint8_t type)
+{
+	uint8_t marker[P2P_MARKER_LEN];
+	const char *hwaddr;
+	int hwaddrlen;
+
+	hwaddr = tapcfg_iface_get_hwaddr(p2p_session->relay->tapcfg, &hwaddrlen);
+	if (hwaddr == NULL || hwaddrlen != ETHER_ADDR_LEN || !p2p_session->marker_keyed)
+		return;
+
+	p2p_marker_header(marker, p2p_session->mac_dst, (const uint8_t *)hwaddr, type);
+	p2p_marker_tag(p2p_session, marker, marker + P2P_MARKER_TAG);
+
+	tunnel_send(p2p_session->relay, p2p_session->relay, marker, sizeof(marker));
+}
+
+/* the marker the peer sent before we could check it */
+static int p2p_marker_check_held(struct session *p2p_session)
+{
+	uint8_t marker[P2P_MARKER_LEN];
+	const char *hwaddr;
+	int hwaddrlen;
+
+	hwaddr = tapcfg_iface_get_hwaddr(p2p_session->relay->tapcfg, &hwaddrlen);
+	if (hwaddr == NULL || hwaddrlen != ETHER_ADDR_LEN)
+		return 0;
+
+	p2p_marker_header(marker, (const uint8_t *)hwaddr, p2p_session->mac_dst, P2P_MARKER_P2P);
+
+	return p2p_marker_valid(p2p_session, marker, p2p_session->marker_tag);
+}
+
+/* hand the frames held on the link to the tap */
+static void p2p_release(struct session *p2p_session)
+{
+	if (p2p_session->drain_until == 0)
+		return;
+
+	p2p_session->drain_until = 0;
+	draining--;
+
+	if (mbuf_count(p2p_session->netc->queue_msg) > 0)
+		on_input(p2p_session->netc);
+}
+
 static void p2p_on_secure(netc_t *netc)
 {
 	struct session *p2p_session;
@@ -41,6 +180,32 @@ static void p2p_on_secure(netc_t *netc)
 	p2p_session->state = SESSION_STATE_AUTHED;
 	p2p_session->netc->ext_ptr = p2p_session;
 
+	if (ftable_find(pending, p2p_session->mac_dst) == p2p_session)
+		ftable_erase(pending, p2p_session->mac_dst);
+
+	/* both ends of the link derive the same key */
+	if (SSL_export_keying_material(netc->kconn->ssl, p2p_session->marker_key,
+		sizeof(p2p_session->marker_key), p2p_label, sizeof(p2p_label) - 1,
+		NULL, 0, 0) == 1)
+		p2p_session->marker_keyed = 1;
+	else
+		jlog(L_WARNING, "unable to key the p2p markers, waiting for the timeout");
+
+	/* the peer's marker came first */
+	if (p2p_session->marker_held) {
+		p2p_session->marker_held = 0;
+		if (p2p_marker_check_held(p2p_session))
+			p2p_session->drained = 1;
+	}
+
+	/* the peer's frames on the link wait for those it relayed before */
+	if (!p2p_session->drained) {
+		p2p_session->drain_until = p2p_now() + P2P_DRAIN_TIMEOUT;
+		draining++;
+	}
+
+	/* ours go through the link right behind the marker */
+	p2p_send_marker(p2p_session, P2P_MARKER_P2P);
 	ftable_insert(ftable, p2p_session->mac_dst, p2p_session);
 }
 
@@ -69,19 +234,107 @@ static void p2p_on_disconnect(netc_t *netc)
 
 	p2p_session = netc->ext_ptr;
 
+	/* the frames already received still reach the tap */
+	p2p_release(p2p_session);
+
 	if (p2p_session != ftable_find(ftable, p2p_session->mac_dst)) {
 		/* never been added to the table */
+		if (ftable_find(pending, p2p_session->mac_dst) == p2p_session)
+			ftable_erase(pending, p2p_session->mac_dst);
 		free(p2p_session);
 	} else {
+		p2p_send_marker(p2p_session, P2P_MARKER_RELAY);
 		ftable_erase(ftable, p2p_session->mac_dst);
 	}
 }
 
 void p2p_on_input(netc_t *netc)
 {
+	struct session *p2p_session = netc->ext_ptr;
+
+	if (p2p_session->drain_until) {
+		if (mbuf_count(netc->queue_msg) < P2P_DRAIN_MAX &&
+		    p2p_now() < p2p_session->drain_until)
+			return;
+
+		jlog(L_NOTICE, "no switchover marker from the peer, releasing %d frames",
+			mbuf_count(netc->queue_msg));
+		p2p_release(p2p_session);
+		return;
+	}
+
 	on_input(netc);
 }
 
+/* Returns 1 if the frame is a switchover marker, it is consumed.
+ * The forged ones, and those of older agents, are dropped. */
+int p2p_marker(uint8_t *frame, size_t len)
+{
+	struct session *p2p_session;
+
+	if (len < P2P_MARKER_TAG ||
+	    frame[12] != (P2P_ETHERTYPE >> 8) || frame[13] != (P2P_ETHERTYPE & 0xff) ||
+	    memcmp(frame + 14, p2p_magic, sizeof(p2p_magic)) != 0)
+		return 0;
+
+	if (len < P2P_MARKER_LEN)
+		return 1;
+
+	p2p_session = ftable_find(ftable, frame + ETHER_ADDR_LEN);
+
+	/* the link may not be secured on our side yet, check it then */
+	if (p2p_session == NULL && frame[18] == P2P_MARKER_P2P &&
+	    (p2p_session = ftable_find(pending, frame + ETHER_ADDR_LEN)) != NULL &&
+	    !p2p_session->marker_keyed) {
+		memcpy(p2p_session->marker_tag, frame + P2P_MARKER_TAG, P2P_MARKER_TAG_LEN);
+		p2p_session->marker_held = 1;
+		return 1;
+	}
+
+	if (p2p_session == NULL || !p2p_marker_valid(p2p_session, frame, frame + P2P_MARKER_TAG)) {
+		jlog(L_DEBUG, "dropping a switchover marker that is not from the peer");
+		return 1;
+	}
+
+	switch (frame[18]) {
+	case P2P_MARKER_P2P:
+		p2p_session->drained = 1;
+		p2p_release(p2p_session);
+		break;
+
+	case P2P_MARKER_RELAY:
+		jlog(L_NOTICE, "the peer went back to the relay");
+		net_disconnect(p2p_session->netc);
+		break;
+	}
+
+	return 1;
+}
+
+/* release the links whose marker is overdue */
+void p2p_poke()
+{
+	struct session *p2p_session;
+	uint64_t now;
+
+	if (draining == 0 || jsw_hsize(ftable) == 0)
+		return;
+
+	now = p2p_now();
+
+	jsw_hreset(ftable);
+	do {
+		p2p_session = jsw_hitem(ftable);
+		if (p2p_session != NULL && p2p_session->drain_until &&
+		    now >= p2p_session->drain_until) {
+			jlog(L_NOTICE, "no switchover marker from the peer");
+			/* on_input() may change the table */
+			p2p_release(p2p_session);
+			break;
+		}
+	} while (jsw_hnext(ftable));
+}
+
 struct session *p2p_find_session(uint8_t *eth_frame)
 {
 	uint8_t mac_dst[ETHER_ADDR_LEN];
@@ -100,6 +353,8 @@ void op_p2p_request(struct session *session, DNDSMessage_t *msg)
 	uint32_t side = 0;
 	uint8_t mac_dst[ETHER_ADDR_LEN];
 	char ip_dst[INET_ADDRSTRLEN];
+	char ip_local_dst[INET_ADDRSTRLEN];
+	char *local_dst = NULL;
 	uint32_t port;
 	struct session *p2p_session;
 
@@ -107,27 +362,42 @@ void op_p2p_request(struct session *session, DNDSMessage_t *msg)
 	P2pRequest_get_ipAddrDst(msg, ip_dst);
 	P2pRequest_get_port(msg, &port);
 	P2pRequest_get_side(msg, &side);
+	if (P2pRequest_get_ipLocalDst(msg, ip_local_dst) == DNDS_success)
+		local_dst = ip_local_dst;
 
-	jlog(L_NOTICE, "establishing p2p with %s", ip_dst);
+	jlog(L_NOTICE, "establishing p2p with %s%s%s", ip_dst,
+		local_dst ? " or " : "", local_dst ? local_dst : "");
 
 	p2p_session = calloc(1, sizeof(struct session));
+	if (p2p_session == NULL)
+		return;
 	p2p_session->tapcfg = session->tapcfg;
 	p2p_session->passport = session->passport;
+	p2p_session->relay = session;
 	memmove(p2p_session->mac_dst, mac_dst, ETHER_ADDR_LEN);
+	ftable_insert(pending, p2p_session->mac_dst, p2p_session);
 
 	snprintf(port_str, 6, "%d", port);
-	net_p2p("0.0.0.0", ip_dst, port_str, NET_PROTO_UDT, NET_SECURE_RSA, side, p2p_session->passport,
-		p2p_on_connect, p2p_on_secure, p2p_on_disconnect, p2p_on_input, (void *)p2p_session);
+	if (net_p2p("0.0.0.0", ip_dst, local_dst, port_str, NET_PROTO_UDT, NET_SECURE_RSA, side,
+		p2p_session->passport, p2p_on_connect, p2p_on_secure, p2p_on_disconnect,
+		p2p_on_input, (void *)p2p_session) == -1) {
+		/* nothing will report on it */
+		if (ftable_find(pending, p2p_session->mac_dst) == p2p_session)
+			ftable_erase(pending, p2p_session->mac_dst);
+		free(p2p_session);
+	}
 
 	return;
 }
 
 void p2p_fini()
 {
+	ftable_delete(pending);
 	ftable_delete(ftable);
 }
 
 void p2p_init()
 {
 	ftable = ftable_new(1024, session_itemdup, session_itemrel);
+	pending = ftable_new(64, pending_itemdup, pending_itemrel);
 }
@@ -21,6 +21,8 @@
 
 struct session *p2p_find_session(uint8_t *eth_frame);
 void op_p2p_request(struct session *session, DNDSMessage_t *msg);
+int p2p_marker(uint8_t *frame, size_t len);
+void p2p_poke();
 void p2p_init();
 void p2p_fini();
 
@@ -20,6 +20,8 @@
 #include <netbus.h>
 #include <tapcfg.h>
 
+#include <stdint.h>
+
 #define	SESSION_STATE_AUTHED		0x01
 #define SESSION_STATE_NOT_AUTHED	0x02
 #define SESSION_STATE_WAIT_ANSWER	0x04
@@ -33,9 +35,21 @@
 struct session {
 	passport_t *passport;
 	netc_t *netc;
+	netc_t *netc_data;		/* DTLS channel of the ethernet frames, NULL if none */
+	uint8_t data_up;		/* the switch confirmed netc_data */
 	tapcfg_t *tapcfg;
 	const char *devname;
+	uint8_t *framebuf;		/* tap read buffer, sized to the interface MTU */
+	size_t framebuf_size;
+	DNDSTemplate_t *frame_tpl;	/* ethernet message patched for each frame */
 	uint8_t mac_dst[ETHER_ADDR_LEN];
+	struct session *relay;		/* server session a p2p one bypasses */
+	uint64_t drain_until;		/* ms, p2p frames are held until then, 0 if not */
+	uint8_t drained;		/* the peer's switchover marker came through the relay */
+	uint8_t marker_key[32];		/* authenticates the markers, from the p2p TLS session */
+	uint8_t marker_keyed;
+	uint8_t marker_tag[16];		/* marker received before the link was secured */
+	uint8_t marker_held;
 	char state;
 	char type;
 };
@@ -99,6 +99,9 @@ CREATE TABLE context (
     passport_certificate text NOT NULL,
     passport_privatekey text NOT NULL,
     ippool bytea NOT NULL,
+    compression integer DEFAULT 0 NOT NULL,
+    flood_session_pps integer DEFAULT 0 NOT NULL,
+    flood_network_pps integer DEFAULT 0 NOT NULL,
     "timestamp" date DEFAULT now()
 );
 
@@ -33,7 +33,10 @@
 #include "pki.h"
 #include "request.h"
 
-struct session_info *switch_sinfo = NULL;
+/* every switch hosts every network, the trunks between them carry
+ * the frames of the agents connected to different switches. Each
+ * network still has a preferred switch, see placement.c */
+struct session_info *switch_list = NULL;
 static struct ctrler_cfg *cfg = NULL;
 
 struct server {
@@ -49,6 +52,7 @@ sinfo_free(struct session_info **sinfo)
 {
 	(*sinfo)->bev = NULL;
 	memset((*sinfo)->cert_name, 0, sizeof((*sinfo)->cert_name));
+	json_decref((*sinfo)->networks);
 	free(*sinfo);
 	*sinfo = NULL;
 }
@@ -62,6 +66,38 @@ sinfo_new()
 	return sinfo;
 }
 
+static void
+switch_list_del(struct session_info *sinfo)
+{
+	struct session_info	**itr;
+
+	for (itr = &switch_list; *itr != NULL; itr = &(*itr)->next) {
+		if (*itr == sinfo) {
+			*itr = sinfo->next;
+			break;
+		}
+	}
+}
+
+void
+switch_send(struct session_info *sinfo, const char *str)
+{
+	if (sinfo->bev == NULL)
+		return;
+	bufferevent_write(sinfo->bev, str, strlen(str));
+	bufferevent_write(sinfo->bev, "\n", strlen("\n"));
+}
+
+/* Send a line to all the switches */
+void
+switch_forward(const char *str)
+{
+	struct session_info	*sinfo;
+
+	for (sinfo = switch_list; sinfo != NULL; sinfo = sinfo->next)
+		switch_send(sinfo, str);
+}
+
 char *
 response()
 {
@@ -100,6 +136,8 @@ dispatch_nvswitch(struct session_info **sinfo, json_t *jmsg)
 		provisioning(sinfo, jmsg);
 	} else if (strcmp(action, "update-node-status") == 0) {
 		update_node_status(sinfo, jmsg);
+	} else if (strcmp(action, "switch-status") == 0) {
+		placement_status(*sinfo, jmsg);
 	}
 }
 
@@ -201,7 +239,8 @@ on_connect_cb(struct bufferevent *bev, void *arg)
 
 	if (strncmp("netvirt-switch", sinfo->cert_name, strlen("netvirt-switch")) == 0) {
 		sinfo->type = NVSWITCH;
-		switch_sinfo = sinfo;
+		sinfo->next = switch_list;
+		switch_list = sinfo;
 	} else {
 		sinfo->type = NVAPI;
 	}
@@ -224,9 +263,11 @@ on_event_cb(struct bufferevent *bev, short events, void *arg)
 		}
 
 		if (sinfo->type == NVSWITCH) {
-			switch_sinfo = NULL;
+			switch_list_del(sinfo);
 			jlog(L_DEBUG, "switch disconnected");
-			dao_reset_node_state();
+			/* the nodes of the other switches stay connected */
+			if (switch_list == NULL)
+				dao_reset_node_state();
 		}
 		sinfo_free(&sinfo);
 		bufferevent_free(bev);
@@ -422,6 +463,7 @@ ctrler_fini()
 	event_base_free(s1.base);
 	pki_passport_free(s1.passport);
 	SSL_CTX_free(s1.ctx);
+	placement_fini();
 
 	dao_reset_node_state();
 }
@@ -17,6 +17,9 @@
 #define CTRLER2_H
 
 #include <event2/buffer.h>
+#include <jansson.h>
+
+#include "placement.h"
 
 #define SESSION_AUTH		0x1
 #define SESSION_NOT_AUTH	0x2
@@ -48,8 +51,20 @@ struct session_info {
 	uint8_t			 type;
 	uint8_t			 state;
 	struct bufferevent	*bev;
+	struct session_info	*next;		/* the switches connected, see switch_list */
+
+	/* switch load, see placement.c */
+	char			 address[64];	/* where the agents reach it */
+	char			 port[8];
+	char			 port_tcp[8];
+	struct switch_load	 load;
+	json_t			*networks;	/* network uuid -> node sessions */
 };
 
+extern struct session_info *switch_list;
+
+void switch_send(struct session_info *, const char *);
+void switch_forward(const char *);
 int ctrler_init(struct ctrler_cfg *);
 void ctrler_fini();
 
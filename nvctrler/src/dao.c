@@ -360,7 +360,7 @@ int dao_prepare_statements()
 
 	result = PQprepare(dbconn,
 			"dao_fetch_context",
-			"SELECT id, uuid, description, client_id, host(network), netmask(network), passport_certificate, passport_privatekey, embassy_certificate "
+			"SELECT id, uuid, description, client_id, host(network), netmask(network), passport_certificate, passport_privatekey, embassy_certificate, compression, flood_session_pps, flood_network_pps "
 			"FROM context;",
 			0,
 			NULL);
@@ -1478,7 +1478,8 @@ int dao_fetch_node_from_provcode(char *provcode,
 					char **certificate,
 					char **private_key,
 					char **trustedcert,
-					char **ipAddress)
+					char **ipAddress,
+					char **network_uuid)
 {
 	PGresult *result;
 	char fetch_req[1024];
@@ -1486,7 +1487,8 @@ int dao_fetch_node_from_provcode(char *provcode,
 	snprintf(fetch_req, 1024, 	"SELECT node.certificate, "
 						"node.privatekey, "
 						"node.ipaddress, "
-						"context.embassy_certificate as trustedcert "
+						"context.embassy_certificate as trustedcert, "
+						"node.network_uuid "
 					"FROM	node, context "
 					"WHERE	provcode = '%s' "
 					"AND	node.network_uuid = context.uuid;",
@@ -1502,11 +1504,12 @@ int dao_fetch_node_from_provcode(char *provcode,
 	tuples = PQntuples(result);
 	fields = PQnfields(result);
 
-	if (tuples > 0 && fields == 4) {
+	if (tuples > 0 && fields == 5) {
 		*certificate = strdup(PQgetvalue(result, 0, 0));
 		*private_key = strdup(PQgetvalue(result, 0, 1));
 		*ipAddress = strdup(PQgetvalue(result, 0, 2));
 		*trustedcert = strdup(PQgetvalue(result, 0, 3));
+		*network_uuid = strdup(PQgetvalue(result, 0, 4));
 	} else {
 		PQclear(result);
 		return -1;
@@ -1633,7 +1636,10 @@ int dao_fetch_context(void *data, int (*cb_data_handler)(void *data, int remaini
 							char *netmask,
 							char *serverCert,
 							char *serverPrivkey,
-							char *trustedCert))
+							char *trustedCert,
+							char *compression,
+							char *flood_session_pps,
+							char *flood_network_pps))
 {
 	int ret;
 	int tuples;
@@ -1668,7 +1674,10 @@ int dao_fetch_context(void *data, int (*cb_data_handler)(void *data, int remaini
 			PQgetvalue(result, i, 5),
 			PQgetvalue(result, i, 6),
 			PQgetvalue(result, i, 7),
-			PQgetvalue(result, i, 8));
+			PQgetvalue(result, i, 8),
+			PQgetvalue(result, i, 9),
+			PQgetvalue(result, i, 10),
+			PQgetvalue(result, i, 11));
 
 		if (ret == -1) {
 			goto out;
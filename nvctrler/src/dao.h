@@ -89,7 +89,10 @@ int dao_fetch_context(void *data, int (*cb_data_handler)(void *data, int remaini
 							char *netmask,
 							char *serverCert,
 							char *serverPrivkey,
-							char *trustedCert));
+							char *trustedCert,
+							char *compression,
+							char *flood_session_pps,
+							char *flood_network_pps));
 
 
 void dao_reset_node_state();
@@ -109,6 +112,7 @@ int dao_fetch_node_from_provcode(char *provcode,
 					char **certificate,
 					char **private_key,
 					char **trustedcert,
-					char **ipAddress);
+					char **ipAddress,
+					char **network_uuid);
 char *uuid_v4(void);
 #endif
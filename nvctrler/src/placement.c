@@ -0,0 +1,306 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Placement of the networks on the switches.
+ *
+ * Every switch reports its load periodically with "switch-status". A
+ * network is placed on the least loaded switch the first time one of
+ * its nodes is provisioned, and the agents are told to connect there.
+ * When the load of two switches drifts too far apart, the smallest
+ * network of the busiest one is moved with "move-network": the
+ * switches redirect its agents and the trunks carry the frames of the
+ * ones still on their way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <logger.h>
+
+#include "ctrler.h"
+#include "placement.h"
+
+/* network uuid -> "address:port" of its switch */
+static json_t *placement = NULL;
+static time_t last_move = 0;
+
+static void
+switch_key(struct session_info *sinfo, char *key, size_t len)
+{
+	snprintf(key, len, "%s:%s", sinfo->address, sinfo->port);
+}
+
+/* the switch a network is placed on, if it is connected */
+static struct session_info *
+placed_on(const char *network_uuid)
+{
+	char			 key[80];
+	const char		*placed;
+	struct session_info	*sinfo;
+
+	if (placement == NULL ||
+	    (placed = json_string_value(json_object_get(placement, network_uuid))) == NULL)
+		return NULL;
+
+	for (sinfo = switch_list; sinfo != NULL; sinfo = sinfo->next) {
+		if (sinfo->address[0] == '\0')
+			continue;
+		switch_key(sinfo, key, sizeof(key));
+		if (strcmp(key, placed) == 0)
+			return sinfo;
+	}
+
+	return NULL;
+}
+
+static void
+place(const char *network_uuid, struct session_info *sinfo)
+{
+	char	key[80];
+
+	if (placement == NULL)
+		placement = json_object();
+
+	switch_key(sinfo, key, sizeof(key));
+	json_object_set_new(placement, network_uuid, json_string(key));
+
+	jlog(L_NOTICE, "network %s placed on %s", network_uuid, key);
+}
+
+/* Load of a switch in per mille of its capacity, the highest of its
+ * sessions, bandwidth and cpu ratios */
+int
+placement_load(const struct switch_load *load)
+{
+	uint64_t	sessions;
+	uint64_t	bps;
+	uint64_t	cpu;
+	uint64_t	max;
+
+	sessions = (uint64_t)load->sessions * 1000 / PLACEMENT_MAX_SESSIONS;
+	bps = load->bps / (PLACEMENT_MAX_BPS / 1000);
+	cpu = (uint64_t)load->cpu * 1000 / PLACEMENT_MAX_CPU;
+
+	max = sessions;
+	if (bps > max)
+		max = bps;
+	if (cpu > max)
+		max = cpu;
+
+	return max > 1000000 ? 1000000 : (int)max;
+}
+
+/* Only the switches that reported their address can take agents */
+static struct session_info *
+least_loaded()
+{
+	int			 load;
+	int			 min = 0;
+	struct session_info	*sinfo;
+	struct session_info	*idle = NULL;
+
+	for (sinfo = switch_list; sinfo != NULL; sinfo = sinfo->next) {
+		if (sinfo->address[0] == '\0')
+			continue;
+		load = placement_load(&sinfo->load);
+		if (idle == NULL || load < min) {
+			idle = sinfo;
+			min = load;
+		}
+	}
+
+	return idle;
+}
+
+void
+placement_status(struct session_info *sinfo, json_t *jmsg)
+{
+	char		*address;
+	char		*port;
+	char		*port_tcp = NULL;
+	int		 sessions;
+	int		 cpu;
+	json_int_t	 bps;
+
+	if (json_unpack(jmsg, "{s:s, s:s, s:i, s:I, s:i}",
+	    "address", &address, "port", &port,
+	    "sessions", &sessions, "bps", &bps, "cpu", &cpu) == -1) {
+		jlog(L_WARNING, "invalid switch-status");
+		return;
+	}
+	json_unpack(jmsg, "{s:s}", "port-tcp", &port_tcp);
+
+	snprintf(sinfo->address, sizeof(sinfo->address), "%s", address);
+	snprintf(sinfo->port, sizeof(sinfo->port), "%s", port);
+	snprintf(sinfo->port_tcp, sizeof(sinfo->port_tcp), "%s",
+	    port_tcp != NULL ? port_tcp : "");
+
+	sinfo->load.sessions = sessions < 0 ? 0 : sessions;
+	sinfo->load.bps = bps < 0 ? 0 : bps;
+	sinfo->load.cpu = cpu < 0 ? 0 : cpu;
+
+	placement_rebalance(time(NULL));
+}
+
+/* Count the node sessions of every network per switch, from
+ * "update-node-status". A network that was running before we started
+ * stays where its first node is. */
+void
+placement_node(struct session_info *sinfo, const char *network_uuid, int up)
+{
+	json_int_t	count;
+
+	if (network_uuid == NULL)
+		return;
+
+	if (sinfo->networks == NULL)
+		sinfo->networks = json_object();
+
+	count = json_integer_value(json_object_get(sinfo->networks, network_uuid));
+	count += up ? 1 : -1;
+
+	if (count > 0)
+		json_object_set_new(sinfo->networks, network_uuid, json_integer(count));
+	else
+		json_object_del(sinfo->networks, network_uuid);
+
+	if (up && sinfo->address[0] != '\0' && placed_on(network_uuid) == NULL)
+		place(network_uuid, sinfo);
+}
+
+/* The switch the agents of a network must connect to, NULL if no
+ * switch reported its load yet */
+struct session_info *
+placement_lookup(const char *network_uuid)
+{
+	struct session_info	*sinfo;
+
+	if ((sinfo = placed_on(network_uuid)) != NULL)
+		return sinfo;
+
+	if ((sinfo = least_loaded()) == NULL)
+		return NULL;
+
+	place(network_uuid, sinfo);
+	/* until its next report */
+	sinfo->load.sessions++;
+
+	return sinfo;
+}
+
+static void
+move(const char *network_uuid, struct session_info *to)
+{
+	char			*str;
+	json_t			*jmsg;
+	struct session_info	*sinfo;
+
+	jmsg = json_object();
+	json_object_set_new(jmsg, "action", json_string("move-network"));
+	json_object_set_new(jmsg, "networkuuid", json_string(network_uuid));
+	json_object_set_new(jmsg, "address", json_string(to->address));
+	json_object_set_new(jmsg, "port", json_string(to->port));
+	json_object_set_new(jmsg, "port-tcp", json_string(to->port_tcp));
+
+	str = json_dumps(jmsg, 0);
+
+	/* the agents on the other switches come along */
+	for (sinfo = switch_list; sinfo != NULL; sinfo = sinfo->next) {
+		if (sinfo != to)
+			switch_send(sinfo, str);
+	}
+
+	free(str);
+	json_decref(jmsg);
+
+	place(network_uuid, to);
+}
+
+/* Move at most one network every PLACEMENT_REBALANCE seconds, the
+ * smallest of the busiest switch, as long as it does not simply swap
+ * the two switches around */
+void
+placement_rebalance(time_t now)
+{
+	int			 load;
+	int			 high = 0;
+	int			 low = 0;
+	int			 share;
+	const char		*uuid;
+	const char		*smallest = NULL;
+	json_int_t		 count;
+	json_int_t		 min = 0;
+	void			*iter;
+	struct session_info	*sinfo;
+	struct session_info	*busy = NULL;
+	struct session_info	*idle = NULL;
+
+	if (now - last_move < PLACEMENT_REBALANCE)
+		return;
+
+	for (sinfo = switch_list; sinfo != NULL; sinfo = sinfo->next) {
+		if (sinfo->address[0] == '\0')
+			continue;
+		load = placement_load(&sinfo->load);
+		if (busy == NULL || load > high) {
+			busy = sinfo;
+			high = load;
+		}
+		if (idle == NULL || load < low) {
+			idle = sinfo;
+			low = load;
+		}
+	}
+
+	if (busy == NULL || busy == idle || high - low < PLACEMENT_HEADROOM ||
+	    busy->networks == NULL || busy->load.sessions == 0)
+		return;
+
+	for (iter = json_object_iter(busy->networks); iter != NULL;
+	    iter = json_object_iter_next(busy->networks, iter)) {
+		uuid = json_object_iter_key(iter);
+		count = json_integer_value(json_object_iter_value(iter));
+		if (placed_on(uuid) != busy)
+			continue;
+		if (smallest == NULL || count < min) {
+			smallest = uuid;
+			min = count;
+		}
+	}
+
+	if (smallest == NULL)
+		return;
+
+	share = (int)((json_int_t)high * min / busy->load.sessions);
+	if (share * 2 > high - low)
+		return;
+
+	jlog(L_NOTICE, "moving network %s (%d sessions), switch load %d -> %d per mille",
+	    smallest, (int)min, high, low);
+	move(smallest, idle);
+
+	/* until their next report */
+	busy->load.sessions -= min < busy->load.sessions ? min : busy->load.sessions;
+	idle->load.sessions += min;
+	last_move = now;
+}
+
+void
+placement_fini()
+{
+	json_decref(placement);
+	placement = NULL;
+}
@@ -0,0 +1,46 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <jansson.h>
+
+#define PLACEMENT_MAX_SESSIONS	1000		/* node sessions a switch holds at full load */
+#define PLACEMENT_MAX_BPS	1000000000ULL	/* bits/s a switch relays at full load */
+#define PLACEMENT_MAX_CPU	1000		/* per mille of a core */
+#define PLACEMENT_HEADROOM	200		/* per mille of load between two switches before a move */
+#define PLACEMENT_REBALANCE	60		/* s between two moves */
+
+struct session_info;
+
+/* as reported by the switch, see "switch-status" */
+struct switch_load {
+	uint32_t	sessions;
+	uint64_t	bps;
+	uint32_t	cpu;
+};
+
+int placement_load(const struct switch_load *load);
+void placement_status(struct session_info *sinfo, json_t *jmsg);
+void placement_node(struct session_info *sinfo, const char *network_uuid, int up);
+struct session_info *placement_lookup(const char *network_uuid);
+void placement_rebalance(time_t now);
+void placement_fini();
+
+#endif /* PLACEMENT_H */
@@ -28,7 +28,6 @@
 #include "pki.h"
 #include "request.h"
 
-extern struct session_info *switch_sinfo;
 
 void
 update_node_status(struct session_info **sinfo, json_t *jmsg)
@@ -48,6 +47,7 @@ update_node_status(struct session_info **sinfo, json_t *jmsg)
 	json_unpack(node, "{s:s}", "networkuuid", &network_uuid);
 
 	dao_update_node_status(network_uuid, uuid, status, local_ipaddr);
+	placement_node(*sinfo, network_uuid, status != NULL && strcmp(status, "1") == 0);
 
 	json_decref(node);
 
@@ -117,18 +117,15 @@ del_network(struct session_info *sinfo, json_t *jmsg)
 		return;
 	}
 
-	/* Forward del-network to the switch */
-	if (switch_sinfo != NULL) {
+	/* Forward del-network to the switches */
+	if (switch_list != NULL) {
 		json_object_del(jmsg, "apikey");
 		json_object_set_new(js_network, "networkuuid", json_string(network_uuid));
 		json_object_del(js_network, "uuid");
 		json_object_del(js_network, "name");
 
 		fwd_str = json_dumps(jmsg, 0);
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, fwd_str, strlen(fwd_str));
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, "\n", strlen("\n"));
+		switch_forward(fwd_str);
 		free(fwd_str);
 	}
 	/* * */
@@ -275,7 +272,7 @@ add_node(struct session_info *sinfo, json_t *jmsg)
 	json_t	*node = NULL;
 	json_t	*fwd_resp = NULL;
 
-	if (switch_sinfo != NULL) {
+	if (switch_list != NULL) {
 		fwd_resp = json_object();
 		node = json_object();
 		array = json_array();
@@ -290,11 +287,7 @@ add_node(struct session_info *sinfo, json_t *jmsg)
 		json_object_set_new(fwd_resp, "nodes", array);
 
 		fwd_resp_str = json_dumps(fwd_resp, 0);
-
-		if (switch_sinfo && switch_sinfo->bev)
-			bufferevent_write(switch_sinfo->bev, fwd_resp_str, strlen(fwd_resp_str));
-		if (switch_sinfo && switch_sinfo->bev)
-			bufferevent_write(switch_sinfo->bev, "\n", strlen("\n"));
+		switch_forward(fwd_resp_str);
 
 		json_decref(fwd_resp);
 		free(fwd_resp_str);
@@ -412,15 +405,12 @@ del_node(struct session_info *sinfo, json_t *jmsg)
 		jlog(L_ERROR, "failed to update embassy ippool");
 	}
 
-	/* Forward del-node to the switch */
-	if (switch_sinfo != NULL) {
+	/* Forward del-node to the switches */
+	if (switch_list != NULL) {
 		json_object_del(jmsg, "apikey");
 
 		fwd_str = json_dumps(jmsg, 0);
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, fwd_str, strlen(fwd_str));
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, "\n", strlen("\n"));
+		switch_forward(fwd_str);
 		free(fwd_str);
 	}
 	/* * */
@@ -447,12 +437,14 @@ provisioning(struct session_info **sinfo, json_t *jmsg)
 	char	*pkey = NULL;
 	char	*tcert = NULL;
 	char	*ipaddr = NULL;
+	char	*network_uuid = NULL;
 
 	char	*provcode;
 	char	*tid;
 	char	*resp_str = NULL;
 	json_t	*node;
 	json_t	*resp = NULL;
+	struct session_info *placed;
 
 	json_unpack(jmsg, "{s:s}", "tid", &tid);
 
@@ -463,13 +455,19 @@ provisioning(struct session_info **sinfo, json_t *jmsg)
 	json_object_set_new(resp, "tid", json_string(tid));
 	json_object_set_new(resp, "action", json_string("provisioning"));
 
-	if ((dao_fetch_node_from_provcode(provcode, &cert, &pkey, &tcert, &ipaddr)) == 0) {
+	if ((dao_fetch_node_from_provcode(provcode, &cert, &pkey, &tcert, &ipaddr, &network_uuid)) == 0) {
 		json_object_set_new(resp, "response", json_string("success"));
 		node = json_object();
 		json_object_set_new(node, "cert", json_string(cert));
 		json_object_set_new(node, "pkey", json_string(pkey));
 		json_object_set_new(node, "tcert", json_string(tcert));
 		json_object_set_new(node, "ipaddr", json_string(ipaddr));
+		/* the switch the agent must connect to */
+		if ((placed = placement_lookup(network_uuid)) != NULL) {
+			json_object_set_new(node, "switchaddress", json_string(placed->address));
+			json_object_set_new(node, "switchport", json_string(placed->port));
+			json_object_set_new(node, "switchport-tcp", json_string(placed->port_tcp));
+		}
 		json_object_set_new(resp, "node", node);
 	} else {
 		json_object_set_new(resp, "response", json_string("error"));
@@ -484,6 +482,7 @@ provisioning(struct session_info **sinfo, json_t *jmsg)
 	free(pkey);
 	free(tcert);
 	free(ipaddr);
+	free(network_uuid);
 	free(resp_str);
 	json_decref(resp);
 
@@ -500,7 +499,10 @@ CB_listall_network(void *arg, int remaining,
 				char *netmask,
 				char *cert,
 				char *pkey,
-				char *tcert)
+				char *tcert,
+				char *compression,
+				char *flood_session_pps,
+				char *flood_network_pps)
 {
 	char			*resp_str = NULL;
 	struct session_info	**sinfo;
@@ -523,6 +525,9 @@ CB_listall_network(void *arg, int remaining,
 	json_object_set_new(network, "cert", json_string(cert));
 	json_object_set_new(network, "pkey", json_string(pkey));
 	json_object_set_new(network, "tcert", json_string(tcert));
+	json_object_set_new(network, "compression", json_integer(atoi(compression)));
+	json_object_set_new(network, "flood_session_pps", json_integer(atoi(flood_session_pps)));
+	json_object_set_new(network, "flood_network_pps", json_integer(atoi(flood_network_pps)));
 
 	json_array_append_new(array, network);
 	json_object_set_new(resp, "networks", array);
@@ -925,7 +930,7 @@ add_network(struct session_info *sinfo, json_t *jmsg)
 	json_t	*network;
 	json_t	*fwd_resp = NULL;
 
-	if (switch_sinfo != NULL) {
+	if (switch_list != NULL) {
 //		dao_fetch_network_id(&netid, client_id, name);
 
 		network = json_object();
@@ -946,11 +951,7 @@ add_network(struct session_info *sinfo, json_t *jmsg)
 		json_object_set_new(fwd_resp, "networks", array);
 
 		fwd_resp_str = json_dumps(fwd_resp, 0);
-
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, fwd_resp_str, strlen(fwd_resp_str));
-		if (switch_sinfo != NULL && switch_sinfo->bev != NULL)
-			bufferevent_write(switch_sinfo->bev, "\n", strlen("\n"));
+		switch_forward(fwd_resp_str);
 
 		json_decref(fwd_resp);
 		free(fwd_resp_str);
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../ctrler.h"
+#include "../placement.h"
+
+struct session_info *switch_list = NULL;
+static struct session_info *sent_to = NULL;
+static char sent[512];
+
+void switch_send(struct session_info *sinfo, const char *str)
+{
+	sent_to = sinfo;
+	snprintf(sent, sizeof(sent), "%s", str);
+}
+
+static void report(struct session_info *sinfo, const char *address, int sessions)
+{
+	json_t *jmsg;
+
+	jmsg = json_pack("{s:s, s:s, s:s, s:s, s:i, s:I, s:i}",
+	    "action", "switch-status", "address", address, "port", "9090",
+	    "port-tcp", "9091", "sessions", sessions, "bps", (json_int_t)0, "cpu", 0);
+	placement_status(sinfo, jmsg);
+	json_decref(jmsg);
+}
+
+int main()
+{
+	struct switch_load load;
+	struct session_info a, b;
+	int i;
+
+	/* the highest of the three ratios */
+	memset(&load, 0, sizeof(load));
+	load.sessions = PLACEMENT_MAX_SESSIONS / 2;
+	load.cpu = PLACEMENT_MAX_CPU / 4;
+	if (placement_load(&load) != 500) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	load.bps = PLACEMENT_MAX_BPS;
+	if (placement_load(&load) != 1000) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	a.next = &b;
+	switch_list = &a;
+
+	/* nowhere to go before the first report */
+	if (placement_lookup("net-1") != NULL) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	report(&a, "10.0.0.1", 100);
+	report(&b, "10.0.0.2", 300);
+
+	/* the least loaded switch, then always the same */
+	if (placement_lookup("net-1") != &a || placement_lookup("net-1") != &a) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	/* a network already running stays where its first node is */
+	placement_node(&b, "net-2", 1);
+	placement_node(&a, "net-2", 1);
+	if (placement_lookup("net-2") != &b) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	/* a gets busy, its smallest network moves to b */
+	for (i = 0; i < 10; i++)
+		placement_node(&a, "net-1", 1);
+	for (i = 0; i < 400; i++)
+		placement_node(&a, "net-3", 1);
+
+	sent_to = NULL;
+	report(&b, "10.0.0.2", 100);
+	report(&a, "10.0.0.1", 800);
+	if (sent_to != &a || strstr(sent, "move-network") == NULL ||
+	    strstr(sent, "net-1") == NULL || strstr(sent, "10.0.0.2") == NULL) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+	if (placement_lookup("net-1") != &b) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	/* one move at a time */
+	sent_to = NULL;
+	placement_rebalance(time(NULL) + 1);
+	if (sent_to != NULL) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	/* placed on a switch that went away */
+	switch_list = &b;
+	b.next = NULL;
+	if (placement_lookup("net-3") != &b) {
+		printf("%d\n", __LINE__);
+		return -1;
+	}
+
+	placement_fini();
+	json_decref(a.networks);
+	json_decref(b.networks);
+
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -53,6 +54,7 @@ static int new_peer();
 static int del_node(json_t *);
 static int del_network(json_t *);
 static int provisioning(json_t *);
+static int move_network(json_t *);
 static int listall_node(json_t *);
 static int listall_network(json_t *);
 static void sighandler(evutil_socket_t, short, void *);
@@ -62,6 +64,21 @@ static void on_event_cb(struct bufferevent *, short, void *);
 static DH *get_dh_1024();
 static SSL_CTX *evssl_init();
 
+/* To the controller, through the control thread. A single write
+ * keeps the line whole, see pipe_read_cb() */
+static int
+pipe_send(const char *str)
+{
+	struct iovec	iov[2];
+
+	iov[0].iov_base = (void *)str;
+	iov[0].iov_len = strlen(str);
+	iov[1].iov_base = "\n";
+	iov[1].iov_len = 1;
+
+	return writev(pipefd[1], iov, 2) == -1 ? -1 : 0;
+}
+
 int
 del_node(json_t *jmsg)
 {
@@ -146,6 +163,8 @@ provisioning(json_t *jmsg)
 	char		*response;
 	char		*tcert;
 	char		*tid;
+	char		*switch_address = NULL;
+	char		*switch_port = NULL;
 	json_t		*node;
 	struct session	*session;
 
@@ -191,6 +210,19 @@ provisioning(json_t *jmsg)
 
 	session = session_tracking_table[atoi(tid) % MAX_SESSION];
 	session_tracking_table[atoi(tid) % MAX_SESSION] = NULL;
+
+	/* the switch the network is placed on, on the transport of the agent */
+	json_unpack(node, "{s:s}", "switchaddress", &switch_address);
+	if (session && session->netc->protocol == NET_PROTO_TCP)
+		json_unpack(node, "{s:s}", "switchport-tcp", &switch_port);
+	else
+		json_unpack(node, "{s:s}", "switchport", &switch_port);
+
+	if (switch_address != NULL && switch_port != NULL && atoi(switch_port) > 0) {
+		ProvResponse_set_switchAddress(new_msg, switch_address, strlen(switch_address));
+		ProvResponse_set_switchPort(new_msg, atoi(switch_port));
+	}
+
 	if (session)
 		net_send_msg(session->netc, new_msg);
 	DNDSMessage_del(new_msg);
@@ -203,6 +235,37 @@ provisioning(json_t *jmsg)
 	return 0;
 }
 
+/* The controller placed the network on another switch, the switch
+ * loop sends our agents there */
+int
+move_network(json_t *jmsg)
+{
+	char		*network_uuid;
+	char		*address;
+	char		*port;
+	char		*port_tcp = NULL;
+	struct vnetwork	*vnet;
+
+	if (json_unpack(jmsg, "{s:s}", "networkuuid", &network_uuid) == -1 ||
+	    json_unpack(jmsg, "{s:s}", "address", &address) == -1 ||
+	    json_unpack(jmsg, "{s:s}", "port", &port) == -1) {
+		jlog(L_ERROR, "NULL parameter");
+		return -1;
+	}
+	json_unpack(jmsg, "{s:s}", "port-tcp", &port_tcp);
+
+	if ((vnet = vnetwork_lookup(network_uuid)) == NULL) {
+		jlog(L_ERROR, "vnetwork_lookup failed");
+		return -1;
+	}
+
+	jlog(L_NOTICE, "network %s moved to %s:%s", network_uuid, address, port);
+
+	vnetwork_move(vnet, address, atoi(port), port_tcp ? atoi(port_tcp) : 0);
+
+	return 0;
+}
+
 int
 listall_node(json_t *jmsg)
 {
@@ -272,8 +335,12 @@ listall_network(json_t *jmsg)
 	size_t	 i;
 	size_t	 array_size;
 static	size_t	 total = 1;
+	int	 compression;
+	int	 flood_session_pps;
+	int	 flood_network_pps;
 	json_t	*js_networks;
 	json_t	*elm;
+	struct vnetwork	*vnet;
 
 	if ((json_unpack(jmsg, "{s:s}", "response", &response)) == -1) {
 		jlog(L_ERROR, "json_unpack failed");
@@ -309,6 +376,23 @@ static	size_t	 total = 1;
 			return -1;
 		}
 		vnetwork_create(network_id?network_id:"", network_uuid, subnet, netmask, cert, pkey, tcert);
+
+		if ((vnet = vnetwork_lookup(network_uuid)) == NULL)
+			continue;
+
+		/* optional, controllers before compression don't send it */
+		compression = COMPRESS_NONE;
+		json_unpack(elm, "{s:i}", "compression", &compression);
+		if (compression != COMPRESS_NONE)
+			vnet->compression = compression;
+
+		/* optional as well, 0 leaves the limits of the switch */
+		flood_session_pps = flood_network_pps = 0;
+		json_unpack(elm, "{s:i}", "flood_session_pps", &flood_session_pps);
+		json_unpack(elm, "{s:i}", "flood_network_pps", &flood_network_pps);
+		vnetwork_set_flood(vnet,
+		    flood_session_pps > 0 ? flood_session_pps : cfg->flood_session_pps,
+		    flood_network_pps > 0 ? flood_network_pps : cfg->flood_network_pps);
 	}
 
 	jlog(L_DEBUG, "fetched %d network", total);
@@ -369,7 +453,7 @@ query_provisioning(struct session *session, char *provcode)
 		goto out;
 	}
 
-	write(pipefd[1], query_str, strlen(query_str));
+	pipe_send(query_str);
 
 	json_decref(query);
 	free(query_str);
@@ -483,7 +567,44 @@ update_node_status(char *status, char *local_ipaddr, char *uuid, char *network_u
 		goto out;
 	}
 
-	write(pipefd[1], query_str, strlen(query_str));
+	pipe_send(query_str);
+
+	json_decref(query);
+	free(query_str);
+	return 0;
+
+out:
+	json_decref(query);
+	free(query_str);
+	return -1;
+}
+
+/* The load of the switch, the controller places the networks with it */
+int
+update_switch_status(const char *address, const char *port, const char *port_tcp,
+			uint32_t sessions, uint64_t bps, uint32_t cpu)
+{
+	char	*query_str = NULL;
+	json_t	*query = NULL;
+
+	if ((query = json_pack("{s:s, s:s, s:s, s:s, s:i, s:I, s:i}",
+	    "action", "switch-status",
+	    "address", address,
+	    "port", port,
+	    "port-tcp", port_tcp ? port_tcp : "",
+	    "sessions", (int)sessions,
+	    "bps", (json_int_t)bps,
+	    "cpu", (int)cpu)) == NULL) {
+		jlog(L_ERROR, "json_pack failed");
+		goto out;
+	}
+
+	if ((query_str = json_dumps(query, 0)) == NULL) {
+		jlog(L_ERROR, "json_dumps failed");
+		goto out;
+	}
+
+	pipe_send(query_str);
 
 	json_decref(query);
 	free(query_str);
@@ -582,27 +703,25 @@ dispatch_op(json_t *jmsg)
 		ret = del_network(jmsg);
 	} else if (strcmp(action, "del-node") == 0) {
 		ret = del_node(jmsg);
+	} else if (strcmp(action, "move-network") == 0) {
+		ret = move_network(jmsg);
 	}
 
 	return ret;
 }
 
+/* The lines of the switch thread, several may be waiting */
 void
 pipe_read_cb(struct bufferevent *bev, void *arg)
 {
-	char query_str[1024] = {0};
-
-	bufferevent_read(bev, query_str, sizeof(query_str));
-	printf("tmp: %s\n", query_str);
+	char	query_str[1024];
+	size_t	len;
 
-	if (bufferevent_write(bufev_sock, query_str, strlen(query_str)) == -1) {
-		jlog(L_ERROR, "bufferevent_write failed");
-		return;
-	}
-
-	if (bufferevent_write(bufev_sock, "\n", strlen("\n")) == -1) {
-		jlog(L_ERROR, "bufferevent_write failed");
-		return;
+	while ((len = bufferevent_read(bev, query_str, sizeof(query_str))) > 0) {
+		if (bufferevent_write(bufev_sock, query_str, len) == -1) {
+			jlog(L_ERROR, "bufferevent_write failed");
+			return;
+		}
 	}
 }
 
@@ -24,6 +24,7 @@
 int query_provisioning(struct session *, char *);
 int query_list_node();
 int update_node_status(char *, char *, char *, char *);
+int update_switch_status(const char *, const char *, const char *, uint32_t, uint64_t, uint32_t);
 int query_list_network();
 int ctrl_init(struct switch_cfg *);
 void ctrl_fini();
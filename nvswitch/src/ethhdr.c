@@ -0,0 +1,221 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Ethernet header classification, for a burst of frames at a time.
+ *
+ * The first 16 bytes of a frame hold the destination, the source and
+ * the ethertype, or the outer VLAN tag. With SSE2 they are compared in
+ * one pass against the broadcast address, the multicast prefixes and
+ * the tag types; AVX2 handles two frames per pass. Frames shorter than
+ * 16 bytes, and the other architectures, take the scalar path.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "ethhdr.h"
+
+#define F_BROADCAST	0x01
+#define F_GROUP		0x02
+#define F_MCAST_IPV4	0x04
+#define F_MCAST_IPV6	0x08
+#define F_TAG		0x10
+
+#define TPID_8021Q	0x8100
+#define TPID_8021AD	0x88a8
+
+int ethhdr_mac_type(const uint8_t *mac)
+{
+	static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+	if (memcmp(mac, broadcast, 6) == 0)
+		return ADDR_BROADCAST;
+
+	/* the I/G bit, the least significant bit of the first octet */
+	if (mac[0] & 0x01)
+		return ADDR_MULTICAST;
+
+	return ADDR_UNICAST;
+}
+
+static unsigned ethhdr_flags_scalar(const uint8_t *f)
+{
+	unsigned flags = 0;
+
+	if (ethhdr_mac_type(f) == ADDR_BROADCAST)
+		flags |= F_BROADCAST;
+	if (f[0] & 0x01)
+		flags |= F_GROUP;
+	if (f[0] == 0x01 && f[1] == 0x00 && f[2] == 0x5e && !(f[3] & 0x80))
+		flags |= F_MCAST_IPV4;
+	if (f[0] == 0x33 && f[1] == 0x33)
+		flags |= F_MCAST_IPV6;
+	if ((f[12] == 0x81 && f[13] == 0x00) || (f[12] == 0x88 && f[13] == 0xa8))
+		flags |= F_TAG;
+
+	return flags;
+}
+
+#if defined(__SSE2__)
+/* 01:00:5e and 802.1Q, 33:33 and 802.1ad */
+#define PATTERN_A	0x01, 0x00, 0x5e, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x81, 0x00, 0, 0
+#define PATTERN_B	0x33, 0x33, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x88, 0xa8, 0, 0
+
+/* turn the byte masks of one header into flags */
+static unsigned ethhdr_flags_mask(unsigned m_ff, unsigned m_a, unsigned m_b, unsigned m_sign, unsigned m_lsb)
+{
+	unsigned flags = 0;
+
+	if ((m_ff & 0x3f) == 0x3f)
+		flags |= F_BROADCAST;
+	if (m_lsb & 0x01)
+		flags |= F_GROUP;
+	if ((m_a & 0x07) == 0x07 && !(m_sign & 0x08))
+		flags |= F_MCAST_IPV4;
+	if ((m_b & 0x03) == 0x03)
+		flags |= F_MCAST_IPV6;
+	if ((m_a & 0x3000) == 0x3000 || (m_b & 0x3000) == 0x3000)
+		flags |= F_TAG;
+
+	return flags;
+}
+
+static unsigned ethhdr_flags_sse2(const uint8_t *f)
+{
+	const __m128i ff = _mm_set1_epi8((char)0xff);
+	const __m128i a = _mm_setr_epi8(PATTERN_A);
+	const __m128i b = _mm_setr_epi8(PATTERN_B);
+	__m128i h;
+
+	h = _mm_loadu_si128((const __m128i *)f);
+
+	/* shifted by 7, the low bit of each 64 bit lane becomes a sign bit */
+	return ethhdr_flags_mask(
+		_mm_movemask_epi8(_mm_cmpeq_epi8(h, ff)),
+		_mm_movemask_epi8(_mm_cmpeq_epi8(h, a)),
+		_mm_movemask_epi8(_mm_cmpeq_epi8(h, b)),
+		_mm_movemask_epi8(h),
+		_mm_movemask_epi8(_mm_slli_epi64(h, 7)));
+}
+#endif
+
+#if defined(__AVX2__)
+static void ethhdr_flags_avx2(const uint8_t *f0, const uint8_t *f1, unsigned *flags0, unsigned *flags1)
+{
+	const __m256i ff = _mm256_set1_epi8((char)0xff);
+	const __m256i a = _mm256_setr_epi8(PATTERN_A, PATTERN_A);
+	const __m256i b = _mm256_setr_epi8(PATTERN_B, PATTERN_B);
+	unsigned m_ff, m_a, m_b, m_sign, m_lsb;
+	__m256i h;
+
+	h = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)f0)),
+			_mm_loadu_si128((const __m128i *)f1), 1);
+
+	m_ff = _mm256_movemask_epi8(_mm256_cmpeq_epi8(h, ff));
+	m_a = _mm256_movemask_epi8(_mm256_cmpeq_epi8(h, a));
+	m_b = _mm256_movemask_epi8(_mm256_cmpeq_epi8(h, b));
+	m_sign = _mm256_movemask_epi8(h);
+	m_lsb = _mm256_movemask_epi8(_mm256_slli_epi64(h, 7));
+
+	*flags0 = ethhdr_flags_mask(m_ff, m_a, m_b, m_sign, m_lsb);
+	*flags1 = ethhdr_flags_mask(m_ff >> 16, m_a >> 16, m_b >> 16, m_sign >> 16, m_lsb >> 16);
+}
+#endif
+
+static unsigned ethhdr_flags(const uint8_t *f, size_t size)
+{
+#if defined(__SSE2__)
+	if (size >= 16)
+		return ethhdr_flags_sse2(f);
+#else
+	(void)size;
+#endif
+	return ethhdr_flags_scalar(f);
+}
+
+static void ethhdr_fill(const uint8_t *f, size_t size, unsigned flags, struct ethhdr_info *info)
+{
+	size_t off = 12;
+
+	memset(info, 0, sizeof(*info));
+
+	if (size < ETHHDR_LEN)
+		return;
+
+	if (flags & F_BROADCAST) {
+		info->dst_type = ADDR_BROADCAST;
+	} else if (flags & F_GROUP) {
+		info->dst_type = ADDR_MULTICAST;
+		if (flags & F_MCAST_IPV4)
+			info->mcast = ETHHDR_MCAST_IPV4;
+		else if (flags & F_MCAST_IPV6)
+			info->mcast = ETHHDR_MCAST_IPV6;
+		else
+			info->mcast = ETHHDR_MCAST_OTHER;
+	} else {
+		info->dst_type = ADDR_UNICAST;
+	}
+
+	if ((flags & F_TAG) && size >= off + 6) {
+		info->vlan_id = ((f[14] << 8) | f[15]) & 0x0fff;
+		info->tags = 1;
+		off += 4;
+
+		/* the customer tag of a stacked frame */
+		while (info->tags < ETHHDR_TAGS_MAX && size >= off + 6
+				&& ((f[off] << 8) | f[off + 1]) == TPID_8021Q) {
+			info->tags++;
+			off += 4;
+		}
+	}
+
+	info->ether_type = (f[off] << 8) | f[off + 1];
+	info->l3_offset = off + 2;
+}
+
+/* Classify count frames into info[], in the order they are given */
+void ethhdr_classify(uint8_t * const *frames, const size_t *sizes, int count,
+			struct ethhdr_info *info)
+{
+	unsigned flags0;
+	int i = 0;
+
+#if defined(__AVX2__)
+	unsigned flags1;
+
+	for (; i + 1 < count; i += 2) {
+		if (sizes[i] >= 16 && sizes[i + 1] >= 16) {
+			ethhdr_flags_avx2(frames[i], frames[i + 1], &flags0, &flags1);
+		} else {
+			flags0 = sizes[i] >= ETHHDR_LEN ? ethhdr_flags(frames[i], sizes[i]) : 0;
+			flags1 = sizes[i + 1] >= ETHHDR_LEN ? ethhdr_flags(frames[i + 1], sizes[i + 1]) : 0;
+		}
+		ethhdr_fill(frames[i], sizes[i], flags0, &info[i]);
+		ethhdr_fill(frames[i + 1], sizes[i + 1], flags1, &info[i + 1]);
+	}
+#endif
+
+	for (; i < count; i++) {
+		flags0 = sizes[i] >= ETHHDR_LEN ? ethhdr_flags(frames[i], sizes[i]) : 0;
+		ethhdr_fill(frames[i], sizes[i], flags0, &info[i]);
+	}
+}
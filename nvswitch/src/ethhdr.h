@@ -0,0 +1,49 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef ETHHDR_H
+#define ETHHDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADDR_UNICAST	0x1
+#define ADDR_BROADCAST	0x2
+#define ADDR_MULTICAST	0x4
+
+/* well known ranges of the multicast destinations */
+#define ETHHDR_MCAST_IPV4	0x1	/* 01:00:5e, RFC 1112 */
+#define ETHHDR_MCAST_IPV6	0x2	/* 33:33, RFC 2464 */
+#define ETHHDR_MCAST_OTHER	0x4	/* group bit set, STP, LLDP... */
+
+#define ETHHDR_LEN		14
+#define ETHHDR_TAGS_MAX		2	/* 802.1ad and 802.1Q */
+
+struct ethhdr_info {
+	uint8_t dst_type;	/* ADDR_UNICAST, ADDR_BROADCAST, ADDR_MULTICAST, 0 for a runt */
+	uint8_t mcast;		/* ETHHDR_MCAST_* if ADDR_MULTICAST */
+	uint8_t tags;		/* VLAN tags before the ethertype */
+	uint16_t vlan_id;	/* of the outer tag */
+	uint16_t ether_type;	/* host order, after the tags */
+	uint16_t l3_offset;	/* start of the network header */
+};
+
+#define ETHHDR_IS_IP(info)	((info)->ether_type == 0x0800 || (info)->ether_type == 0x86dd)
+
+int ethhdr_mac_type(const uint8_t *mac);
+void ethhdr_classify(uint8_t * const *frames, const size_t *sizes, int count,
+			struct ethhdr_info *info);
+
+#endif /* ETHHDR_H */
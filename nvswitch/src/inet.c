@@ -46,28 +46,13 @@
  */
 
 const uint8_t mac_addr_broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-const uint8_t mac_addr_multicast[6] = { 0x01, 0x00, 0x5e, 0x0, 0x0, 0x0 };
 const uint8_t mac_addr_empty[6] = { 0, 0, 0, 0, 0, 0 };
 
 
 // Link layer
 int inet_get_mac_addr_type(uint8_t *mac_addr)
 {
-	if (memcmp(mac_addr, mac_addr_broadcast, ETHER_ADDR_LEN) == 0) {
-		return ADDR_BROADCAST;
-	}
-	else if (memcmp(mac_addr, mac_addr_multicast, 3) == 0) {
-		return ADDR_MULTICAST;
-	}
-
-	/* "these addresses are physical station addresses, not multicast nor
-	 * broadcast, so the second hex digit (reading from the left) will be
-	 * even, not odd."
-	 * http://www.iana.org/assignments/ethernet-numbers
-	 * FIXME we must implement a solid mechanism based on the odd/even principle,
-	 * furthermore, would be nice to lookup the ethernet card vendor name.
-	 */
-	return ADDR_UNICAST;
+	return ethhdr_mac_type(mac_addr);
 }
 
 int inet_get_mac_addr_dst(void *data, uint8_t *mac_addr)
@@ -75,7 +60,7 @@ int inet_get_mac_addr_dst(void *data, uint8_t *mac_addr)
 	struct ether_header *eth_hdr;
 	eth_hdr = data;
 
-	bcopy(eth_hdr->ether_dhost, mac_addr, ETHER_ADDR_LEN);
+	memcpy(mac_addr, eth_hdr->ether_dhost, ETHER_ADDR_LEN);
 
 	return 0;
 }
@@ -85,7 +70,90 @@ int inet_get_mac_addr_src(void *data, uint8_t *mac_addr)
 	struct ether_header *eth_hdr;
 	eth_hdr = data;
 
-	bcopy(eth_hdr->ether_shost, mac_addr, ETHER_ADDR_LEN);
+	memcpy(mac_addr, eth_hdr->ether_shost, ETHER_ADDR_LEN);
+
+	return 0;
+}
+
+static void csum_replace16(uint8_t *csum, uint16_t old, uint16_t new)
+{
+	uint32_t sum;
+
+	/* RFC 1624 incremental update: HC' = ~(~HC + ~m + m') */
+	sum = (uint16_t)~((csum[0] << 8) | csum[1]);
+	sum += (uint16_t)~old;
+	sum += new;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~sum;
+
+	csum[0] = sum >> 8;
+	csum[1] = sum & 0xff;
+}
+
+/* Lower the MSS option of a TCP SYN so the segments fit in `mtu',
+ * returns 1 when the frame was modified. */
+int inet_clamp_tcp_mss(uint8_t *frame, size_t len, int mtu)
+{
+	uint8_t *ip, *tcp, *opt, *end;
+	uint16_t ether_type, mss, max_mss;
+	size_t off = ETHER_HDR_LEN;
+	size_t tcp_hlen;
+
+	if (len < ETHER_HDR_LEN)
+		return 0;
+
+	ether_type = (frame[12] << 8) | frame[13];
+	if (ether_type == ETHERTYPE_VLAN && len >= ETHER_HDR_LEN + 4) {
+		ether_type = (frame[16] << 8) | frame[17];
+		off += 4;
+	}
+
+	ip = frame + off;
+	if (ether_type == ETHERTYPE_IP) {
+		if (len < off + 20 || ip[9] != IPPROTO_TCP)
+			return 0;
+		/* only the first fragment carries the tcp header */
+		if (((ip[6] << 8) | ip[7]) & 0x1fff)
+			return 0;
+		tcp = ip + (ip[0] & 0x0f) * 4;
+		max_mss = mtu - 40;
+	} else if (ether_type == ETHERTYPE_IPV6) {
+		if (len < off + 40 || ip[6] != IPPROTO_TCP)
+			return 0;
+		tcp = ip + 40;
+		max_mss = mtu - 60;
+	} else {
+		return 0;
+	}
+
+	if (tcp + 20 > frame + len || !(tcp[13] & 0x02))	/* SYN */
+		return 0;
+
+	tcp_hlen = (tcp[12] >> 4) * 4;
+	end = tcp + tcp_hlen;
+	if (tcp_hlen < 20 || end > frame + len)
+		return 0;
+
+	opt = tcp + 20;
+	while (opt < end && *opt != 0) {		/* end of options */
+		if (*opt == 1) {			/* no-operation */
+			opt++;
+			continue;
+		}
+		if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+			return 0;
+		if (opt[0] == 2 && opt[1] == 4) {	/* maximum segment size */
+			mss = (opt[2] << 8) | opt[3];
+			if (mss <= max_mss)
+				return 0;
+			opt[2] = max_mss >> 8;
+			opt[3] = max_mss & 0xff;
+			csum_replace16(tcp + 16, mss, max_mss);
+			return 1;
+		}
+		opt += opt[1];
+	}
 
 	return 0;
 }
@@ -17,10 +17,7 @@
 #define INET_H
 
 #include "udt.h"
-
-#define ADDR_UNICAST	0x1
-#define ADDR_BROADCAST	0x2
-#define ADDR_MULTICAST	0x4
+#include "ethhdr.h"
 
 const uint8_t mac_addr_broadcast[6];
 const uint8_t mac_ddr_empty[6];
@@ -29,6 +26,8 @@ int inet_get_mac_addr_type(uint8_t *);
 int inet_get_mac_addr_dst(void *, uint8_t *);
 int inet_get_mac_addr_src(void *, uint8_t *);
 
+int inet_clamp_tcp_mss(uint8_t *, size_t, int);
+
 uint16_t inet_get_iphdr_len(void *);
 void inet_print_iphdr(void *);
 int inet_is_ipv4(void *);
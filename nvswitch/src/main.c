@@ -14,12 +14,14 @@
  */
 
 #include <pthread.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <libconfig.h>
 #include <netbus.h>
 
 #include <logger.h>
+#include <udt_config.h>
 
 #include "control.h"
 #include "switch.h"
@@ -36,10 +38,14 @@ on_log(const char *logline)
 }
 
 int
-config_parse(config_t *cfg, struct switch_cfg *switch_cfg)
+config_parse(config_t *cfg, struct switch_cfg *switch_cfg, const char *config_file)
 {
-	if (!config_read_file(cfg, CONFIG_FILE)) {
-		jlog(L_ERROR, "Can't open %s", CONFIG_FILE);
+	config_setting_t	*peers;
+	config_setting_t	*peer;
+	int			 i;
+
+	if (!config_read_file(cfg, config_file)) {
+		jlog(L_ERROR, "Can't open %s", config_file);
 		return -1;
 	}
 
@@ -54,6 +60,10 @@ config_parse(config_t *cfg, struct switch_cfg *switch_cfg)
 		return -1;
 	}
 
+	if (!config_lookup_string(cfg, "public_address", &switch_cfg->public_address))
+		switch_cfg->public_address = switch_cfg->listen_ip;
+	jlog(L_DEBUG, "public_address: %s", switch_cfg->public_address);
+
 	if (config_lookup_string(cfg, "listen_port", &switch_cfg->listen_port))
 		jlog(L_DEBUG, "listen_port: %s", switch_cfg->listen_port);
 	else {
@@ -61,6 +71,12 @@ config_parse(config_t *cfg, struct switch_cfg *switch_cfg)
 		return -1;
 	}
 
+	if (config_lookup_string(cfg, "listen_port_tcp", &switch_cfg->listen_port_tcp))
+		jlog(L_DEBUG, "listen_port_tcp: %s", switch_cfg->listen_port_tcp);
+
+	if (config_lookup_string(cfg, "listen_port_dtls", &switch_cfg->listen_port_dtls))
+		jlog(L_DEBUG, "listen_port_dtls: %s", switch_cfg->listen_port_dtls);
+
 	if (config_lookup_string(cfg, "ctrler_ip", &switch_cfg->ctrler_ip))
 		jlog(L_DEBUG, "ctrler_ip: %s", switch_cfg->ctrler_ip);
 	else {
@@ -96,20 +112,117 @@ config_parse(config_t *cfg, struct switch_cfg *switch_cfg)
 		return -1;
 	}
 
+	if (config_lookup_bool(cfg, "mss_clamp", &switch_cfg->mss_clamp))
+		jlog(L_DEBUG, "mss_clamp: %d", switch_cfg->mss_clamp);
+
+	switch_cfg->flood_session_pps = FLOOD_SESSION_PPS;
+	switch_cfg->flood_network_pps = FLOOD_NETWORK_PPS;
+	config_lookup_int(cfg, "flood_session_pps", &switch_cfg->flood_session_pps);
+	config_lookup_int(cfg, "flood_network_pps", &switch_cfg->flood_network_pps);
+	jlog(L_DEBUG, "flood_session_pps: %d flood_network_pps: %d",
+		switch_cfg->flood_session_pps, switch_cfg->flood_network_pps);
+
+	switch_cfg->p2p_bytes_ps = P2P_BYTES_PS;
+	switch_cfg->p2p_frames_ps = P2P_FRAMES_PS;
+	switch_cfg->p2p_promotions = P2P_PROMOTIONS;
+	config_lookup_int(cfg, "p2p_bytes_ps", &switch_cfg->p2p_bytes_ps);
+	config_lookup_int(cfg, "p2p_frames_ps", &switch_cfg->p2p_frames_ps);
+	config_lookup_int(cfg, "p2p_promotions", &switch_cfg->p2p_promotions);
+	jlog(L_DEBUG, "p2p_bytes_ps: %d p2p_frames_ps: %d p2p_promotions: %d",
+		switch_cfg->p2p_bytes_ps, switch_cfg->p2p_frames_ps, switch_cfg->p2p_promotions);
+
+	if (config_lookup_string(cfg, "replica_role", &switch_cfg->replica_role)) {
+		jlog(L_DEBUG, "replica_role: %s", switch_cfg->replica_role);
+		if (strcmp(switch_cfg->replica_role, "active") != 0 &&
+		    strcmp(switch_cfg->replica_role, "standby") != 0) {
+			jlog(L_ERROR, "replica_role must be active or standby");
+			return -1;
+		}
+
+		if (!config_lookup_string(cfg, "replica_port", &switch_cfg->replica_port)) {
+			jlog(L_ERROR, "replica_port is not present !");
+			return -1;
+		}
+
+		if (!config_lookup_string(cfg, "replica_address", &switch_cfg->replica_address)) {
+			if (strcmp(switch_cfg->replica_role, "standby") == 0) {
+				jlog(L_ERROR, "replica_address is not present !");
+				return -1;
+			}
+			switch_cfg->replica_address = switch_cfg->listen_ip;
+		}
+		jlog(L_DEBUG, "replica_address: %s:%s", switch_cfg->replica_address, switch_cfg->replica_port);
+	}
+
+	if (config_lookup_string(cfg, "tls_ticket_key", &switch_cfg->ticket_key))
+		jlog(L_DEBUG, "tls_ticket_key: %s", switch_cfg->ticket_key);
+
+	switch_cfg->upgrade_drain = UPGRADE_DRAIN;
+	config_lookup_int(cfg, "upgrade_drain", &switch_cfg->upgrade_drain);
+	if (config_lookup_string(cfg, "upgrade_socket", &switch_cfg->upgrade_socket))
+		jlog(L_DEBUG, "upgrade_socket: %s upgrade_drain: %d",
+			switch_cfg->upgrade_socket, switch_cfg->upgrade_drain);
+
+	if (config_lookup_string(cfg, "trunk_port", &switch_cfg->trunk_port))
+		jlog(L_DEBUG, "trunk_port: %s", switch_cfg->trunk_port);
+
+	if ((peers = config_lookup(cfg, "trunk_peers")) != NULL) {
+		for (i = 0; i < config_setting_length(peers) && i < TRUNK_PEERS_MAX; i++) {
+			peer = config_setting_get_elem(peers, i);
+			if (!config_setting_lookup_string(peer, "address", &switch_cfg->trunk_peer_ip[i]) ||
+			    !config_setting_lookup_string(peer, "port", &switch_cfg->trunk_peer_port[i])) {
+				jlog(L_ERROR, "a trunk peer needs an address and a port !");
+				return -1;
+			}
+			jlog(L_DEBUG, "trunk peer: %s:%s",
+				switch_cfg->trunk_peer_ip[i], switch_cfg->trunk_peer_port[i]);
+		}
+		switch_cfg->trunk_peers = i;
+	}
+
+	config_parse_udt(cfg);
+
 	return 0;
 }
 
+/* The active switch and its standby resume the same TLS sessions */
+static int
+ticket_key_load(const char *path)
+{
+	uint8_t	 key[KRYPT_TICKET_KEY_LEN];
+	FILE	*fp;
+	size_t	 len;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		jlog(L_ERROR, "Can't open %s", path);
+		return -1;
+	}
+	len = fread(key, 1, sizeof(key), fp);
+	fclose(fp);
+
+	if (len != sizeof(key)) {
+		jlog(L_ERROR, "%s must hold %d bytes", path, KRYPT_TICKET_KEY_LEN);
+		return -1;
+	}
+
+	return krypt_set_ticket_key(key, len);
+}
+
 int
 main(int argc, char *argv[])
 {
 	int		opt;
 	uint8_t		quiet = 0;
+	const char	*config_file = CONFIG_FILE;
 	config_t	cfg;
 
 	switch_cfg = calloc(1, sizeof(struct switch_cfg));
 
-	while ((opt = getopt(argc, argv, "qvh")) != -1) {
+	while ((opt = getopt(argc, argv, "c:qvh")) != -1) {
 		switch (opt) {
+		case 'c':
+			config_file = optarg;
+			break;
 		case 'q':
 			quiet = 1;
 			break;
@@ -119,6 +232,7 @@ main(int argc, char *argv[])
 		default:
 		case 'h':
 			fprintf(stdout, "netvirt-switch:\n"
+					"-c file\tconfiguration file\n"
 					"-q\t\tquiet mode\n"
 					"-v\t\tshow version\n"
 					"-h\t\tshow this help\n");
@@ -133,7 +247,7 @@ main(int argc, char *argv[])
 	config_init(&cfg);
 	switch_cfg->ctrl_initialized = 0;
 
-	if (config_parse(&cfg, switch_cfg)) {
+	if (config_parse(&cfg, switch_cfg, config_file)) {
 		jlog(L_ERROR, "config parse failed");
 		exit(EXIT_FAILURE);
 	}
@@ -143,6 +257,11 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (switch_cfg->ticket_key != NULL && ticket_key_load(switch_cfg->ticket_key) == -1) {
+		jlog(L_ERROR, "ticket_key_load failed");
+		exit(EXIT_FAILURE);
+	}
+
 	if (netbus_init()) {
 		jlog(L_ERROR, "netbus_init failed");
 		exit(EXIT_FAILURE);
@@ -0,0 +1,598 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* IGMP and MLD snooping.
+ *
+ * The reports the sessions send are consumed by the switch and keep,
+ * per vnetwork, the sessions that joined each group. A multicast
+ * frame then goes to those sessions only, and to the sessions
+ * running a multicast router. Groups are keyed by their MAC address,
+ * the way the frames are addressed. The link-local groups, used by
+ * the routing and discovery protocols, are always flooded.
+ *
+ * There is usually no multicast router in a vnetwork, so the switch
+ * is the querier: it sends the general queries that keep the
+ * memberships from aging out.
+ */
+
+#include <sys/socket.h>
+#include <net/ethernet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsw_hlib.h"
+#include "mcast.h"
+
+#define IGMP_QUERY		0x11
+#define IGMP_V1_REPORT		0x12
+#define IGMP_V2_REPORT		0x16
+#define IGMP_LEAVE		0x17
+#define IGMP_V3_REPORT		0x22
+
+#define MLD_QUERY		130
+#define MLD_V1_REPORT		131
+#define MLD_DONE		132
+#define MLD_V2_REPORT		143
+
+/* group record types of the v3 reports */
+#define MODE_IS_INCLUDE		1
+#define MODE_IS_EXCLUDE		2
+#define CHANGE_TO_INCLUDE	3
+#define CHANGE_TO_EXCLUDE	4
+#define ALLOW_NEW_SOURCES	5
+
+#define ETHER_MIN		60	/* without the FCS */
+
+struct mcast_group {
+	struct mcast_member *members;
+	int count;
+};
+
+/* source of the queries, locally administered */
+static const uint8_t querier_mac[ETHER_ADDR_LEN] = { 0x02, 0x4e, 0x56, 0x00, 0x00, 0x01 };
+
+static inline uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t cksum_add(const uint8_t *p, size_t len, uint32_t sum)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += get16(p + i);
+	if (len & 1)
+		sum += p[len - 1] << 8;
+
+	return sum;
+}
+
+static void cksum_set(uint8_t *p, uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	sum = ~sum & 0xffff;
+	p[0] = sum >> 8;
+	p[1] = sum & 0xff;
+}
+
+static void *mcast_itemdup(const void *group)
+{
+	return (void *)group;
+}
+
+static void mcast_itemrel(void *item)
+{
+	struct mcast_group *group = item;
+	struct mcast_member *member;
+
+	while (group->members != NULL) {
+		member = group->members;
+		group->members = member->next;
+		free(member);
+	}
+	free(group);
+}
+
+mcast_t *mcast_new(size_t size)
+{
+	mcast_t *mcast;
+
+	mcast = calloc(1, sizeof(mcast_t));
+	if (mcast == NULL)
+		return NULL;
+
+	mcast->groups = ftable_new(size, mcast_itemdup, mcast_itemrel);
+	if (mcast->groups == NULL) {
+		free(mcast);
+		return NULL;
+	}
+
+	return mcast;
+}
+
+void mcast_free(mcast_t *mcast)
+{
+	struct mcast_member *member;
+
+	if (mcast == NULL)
+		return;
+
+	while (mcast->routers != NULL) {
+		member = mcast->routers;
+		mcast->routers = member->next;
+		free(member);
+	}
+
+	ftable_delete(mcast->groups);
+	free(mcast);
+}
+
+/* 224.0.0.x and ff02::x or the solicited-node groups, anything
+ * a host may need before it reports, or never reports. */
+int mcast_flooded(const uint8_t *mac)
+{
+	if (mac[0] == 0x01 && mac[1] == 0x00 && mac[2] == 0x5e)
+		return mac[3] == 0 && mac[4] == 0;
+
+	if (mac[0] == 0x33 && mac[1] == 0x33)
+		return mac[2] == 0xff || (mac[2] == 0 && mac[3] == 0 && mac[4] == 0);
+
+	return 1;
+}
+
+static int member_add(struct mcast_member **list, void *session, uint64_t expires)
+{
+	struct mcast_member *member;
+
+	for (member = *list; member != NULL; member = member->next) {
+		if (member->session == session) {
+			member->expires = expires;
+			return 0;
+		}
+	}
+
+	member = malloc(sizeof(struct mcast_member));
+	if (member == NULL)
+		return -1;
+
+	member->session = session;
+	member->expires = expires;
+	member->next = *list;
+	*list = member;
+
+	return 1;
+}
+
+/* Removes the members of the session, or the expired ones if
+ * session is NULL. Returns how many were removed. */
+static int member_del(struct mcast_member **list, void *session, uint64_t now)
+{
+	struct mcast_member *member;
+	int count = 0;
+
+	while ((member = *list) != NULL) {
+		if ((session != NULL && member->session == session) ||
+		    (session == NULL && member->expires <= now)) {
+			*list = member->next;
+			free(member);
+			count++;
+		} else {
+			list = &member->next;
+		}
+	}
+
+	return count;
+}
+
+int mcast_join(mcast_t *mcast, const uint8_t *mac, void *session, uint64_t now)
+{
+	struct mcast_group *group;
+	int ret;
+
+	if (mcast_flooded(mac))
+		return -1;
+
+	group = ftable_find(mcast->groups, (uint8_t *)mac);
+	if (group == NULL) {
+		if (jsw_hsize(mcast->groups) >= MCAST_GROUPS_MAX)
+			return -1;
+
+		group = calloc(1, sizeof(struct mcast_group));
+		if (group == NULL)
+			return -1;
+
+		if (ftable_insert(mcast->groups, (uint8_t *)mac, group) == 0) {
+			free(group);
+			return -1;
+		}
+	}
+
+	ret = member_add(&group->members, session, now + MCAST_MEMBER_TIMEOUT);
+	if (ret == 1)
+		group->count++;
+
+	return ret == -1 ? -1 : 0;
+}
+
+static void group_update(mcast_t *mcast, const uint8_t *mac, struct mcast_group *group, int removed)
+{
+	group->count -= removed;
+	if (group->count == 0)
+		ftable_erase(mcast->groups, (uint8_t *)mac);
+}
+
+/* Each session is usually a single host, it leaves at once. */
+void mcast_leave(mcast_t *mcast, const uint8_t *mac, void *session)
+{
+	struct mcast_group *group;
+
+	group = ftable_find(mcast->groups, (uint8_t *)mac);
+	if (group != NULL)
+		group_update(mcast, mac, group, member_del(&group->members, session, 0));
+}
+
+/* Walk every group; the empty ones are erased once the walk is over,
+ * an erasure resets the traversal. */
+static void mcast_sweep(mcast_t *mcast, void *session, uint64_t now)
+{
+	struct mcast_group *group;
+	uint8_t empty[ETHER_ADDR_LEN];
+	int found;
+
+	member_del(&mcast->routers, session, now);
+
+	do {
+		found = 0;
+		if (jsw_hsize(mcast->groups) == 0)
+			break;
+
+		jsw_hreset(mcast->groups);
+		do {
+			group = jsw_hitem(mcast->groups);
+			if (group == NULL)
+				continue;
+
+			group->count -= member_del(&group->members, session, now);
+			if (group->count == 0 && !found) {
+				memcpy(empty, jsw_hkey(mcast->groups), ETHER_ADDR_LEN);
+				found = 1;
+			}
+		} while (jsw_hnext(mcast->groups));
+
+		if (found)
+			ftable_erase(mcast->groups, empty);
+	} while (found);
+}
+
+/* the session is gone */
+void mcast_forget(mcast_t *mcast, void *session)
+{
+	if (mcast != NULL && session != NULL)
+		mcast_sweep(mcast, session, 0);
+}
+
+void mcast_expire(mcast_t *mcast, uint64_t now)
+{
+	if (mcast != NULL)
+		mcast_sweep(mcast, NULL, now);
+}
+
+/* The sessions that joined the group, the expired ones are dropped
+ * on the way. NULL if nobody wants it. */
+struct mcast_member *mcast_members(mcast_t *mcast, const uint8_t *mac, uint64_t now)
+{
+	struct mcast_group *group;
+
+	group = ftable_find(mcast->groups, (uint8_t *)mac);
+	if (group == NULL)
+		return NULL;
+
+	group->count -= member_del(&group->members, NULL, now);
+	if (group->count == 0) {
+		ftable_erase(mcast->groups, (uint8_t *)mac);
+		return NULL;
+	}
+
+	return group->members;
+}
+
+static void group_mac4(const uint8_t *ip, uint8_t *mac)
+{
+	mac[0] = 0x01;
+	mac[1] = 0x00;
+	mac[2] = 0x5e;
+	mac[3] = ip[1] & 0x7f;
+	mac[4] = ip[2];
+	mac[5] = ip[3];
+}
+
+static void group_mac6(const uint8_t *ip, uint8_t *mac)
+{
+	mac[0] = 0x33;
+	mac[1] = 0x33;
+	memcpy(mac + 2, ip + 12, 4);
+}
+
+static void snoop_group(mcast_t *mcast, int family, const uint8_t *ip, int join,
+			void *session, uint64_t now)
+{
+	uint8_t mac[ETHER_ADDR_LEN];
+
+	if (family == AF_INET) {
+		if (ip[0] < 224 || ip[0] > 239)
+			return;
+		group_mac4(ip, mac);
+	} else {
+		if (ip[0] != 0xff)
+			return;
+		group_mac6(ip, mac);
+	}
+
+	if (join)
+		mcast_join(mcast, mac, session, now);
+	else
+		mcast_leave(mcast, mac, session);
+}
+
+/* A record joins the group unless it only lists no source at all. */
+static void snoop_record(mcast_t *mcast, int family, uint8_t type, uint16_t nsrc,
+			const uint8_t *group, void *session, uint64_t now)
+{
+	switch (type) {
+	case MODE_IS_EXCLUDE:
+	case CHANGE_TO_EXCLUDE:
+		snoop_group(mcast, family, group, 1, session, now);
+		break;
+	case MODE_IS_INCLUDE:
+	case ALLOW_NEW_SOURCES:
+		if (nsrc > 0)
+			snoop_group(mcast, family, group, 1, session, now);
+		break;
+	case CHANGE_TO_INCLUDE:
+		snoop_group(mcast, family, group, nsrc > 0, session, now);
+		break;
+	}
+}
+
+static int snoop_igmp(mcast_t *mcast, const uint8_t *ip, size_t len, void *session, uint64_t now)
+{
+	const uint8_t *igmp;
+	const uint8_t *rec;
+	size_t ihl;
+	size_t rec_len;
+	uint16_t nrec;
+
+	if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != 2)
+		return MCAST_DATA;
+
+	ihl = (ip[0] & 0x0f) * 4;
+	if (ihl < 20 || len < ihl + 8)
+		return MCAST_DATA;
+
+	igmp = ip + ihl;
+	len -= ihl;
+
+	switch (igmp[0]) {
+	case IGMP_QUERY:
+		return MCAST_QUERY;
+
+	case IGMP_V1_REPORT:
+	case IGMP_V2_REPORT:
+		snoop_group(mcast, AF_INET, igmp + 4, 1, session, now);
+		return MCAST_REPORT;
+
+	case IGMP_LEAVE:
+		snoop_group(mcast, AF_INET, igmp + 4, 0, session, now);
+		return MCAST_REPORT;
+
+	case IGMP_V3_REPORT:
+		nrec = get16(igmp + 6);
+		rec = igmp + 8;
+		len -= 8;
+		while (nrec-- > 0 && len >= 8) {
+			rec_len = 8 + get16(rec + 2) * 4 + rec[1] * 4;
+			if (rec_len > len)
+				break;
+			snoop_record(mcast, AF_INET, rec[0], get16(rec + 2), rec + 4, session, now);
+			rec += rec_len;
+			len -= rec_len;
+		}
+		return MCAST_REPORT;
+	}
+
+	return MCAST_DATA;
+}
+
+static int snoop_mld(mcast_t *mcast, const uint8_t *ip6, size_t len, void *session, uint64_t now)
+{
+	const uint8_t *icmp;
+	const uint8_t *rec;
+	size_t off = 40;
+	size_t rec_len;
+	uint16_t nrec;
+	uint8_t next;
+
+	if (len < off || (ip6[0] >> 4) != 6)
+		return MCAST_DATA;
+
+	/* the router alert travels in a hop-by-hop header */
+	next = ip6[6];
+	if (next == 0) {
+		if (len < off + 8)
+			return MCAST_DATA;
+		next = ip6[off];
+		off += (ip6[off + 1] + 1) * 8;
+	}
+
+	if (next != 58 || len < off + 24)
+		return MCAST_DATA;
+
+	icmp = ip6 + off;
+	len -= off;
+
+	switch (icmp[0]) {
+	case MLD_QUERY:
+		return MCAST_QUERY;
+
+	case MLD_V1_REPORT:
+		snoop_group(mcast, AF_INET6, icmp + 8, 1, session, now);
+		return MCAST_REPORT;
+
+	case MLD_DONE:
+		snoop_group(mcast, AF_INET6, icmp + 8, 0, session, now);
+		return MCAST_REPORT;
+
+	case MLD_V2_REPORT:
+		nrec = get16(icmp + 6);
+		rec = icmp + 8;
+		len -= 8;
+		while (nrec-- > 0 && len >= 20) {
+			rec_len = 20 + get16(rec + 2) * 16 + rec[1] * 4;
+			if (rec_len > len)
+				break;
+			snoop_record(mcast, AF_INET6, rec[0], get16(rec + 2), rec + 4, session, now);
+			rec += rec_len;
+			len -= rec_len;
+		}
+		return MCAST_REPORT;
+	}
+
+	return MCAST_DATA;
+}
+
+/* Look at a multicast frame sent by a session. A query marks
+ * the session as a multicast router. */
+int mcast_snoop(mcast_t *mcast, const uint8_t *frame, size_t size,
+		const struct ethhdr_info *eth, void *session, uint64_t now)
+{
+	const uint8_t *l3 = frame + eth->l3_offset;
+	size_t len;
+	int ret = MCAST_DATA;
+
+	if (mcast == NULL || eth->dst_type != ADDR_MULTICAST || size < eth->l3_offset)
+		return MCAST_DATA;
+
+	len = size - eth->l3_offset;
+
+	if (eth->ether_type == ETHERTYPE_IP && (eth->mcast & ETHHDR_MCAST_IPV4))
+		ret = snoop_igmp(mcast, l3, len, session, now);
+	else if (eth->ether_type == ETHERTYPE_IPV6 && (eth->mcast & ETHHDR_MCAST_IPV6))
+		ret = snoop_mld(mcast, l3, len, session, now);
+
+	if (ret == MCAST_QUERY)
+		member_add(&mcast->routers, session, now + MCAST_MEMBER_TIMEOUT);
+
+	return ret;
+}
+
+static size_t query_igmp(uint8_t *frame)
+{
+	uint8_t *ip = frame + ETHER_HDR_LEN;
+	uint8_t *igmp = ip + 24;
+
+	memset(frame, 0, ETHER_MIN);
+	frame[0] = 0x01;
+	frame[2] = 0x5e;
+	frame[5] = 0x01;			/* 224.0.0.1 */
+	memcpy(frame + ETHER_ADDR_LEN, querier_mac, ETHER_ADDR_LEN);
+	frame[12] = 0x08;
+
+	ip[0] = 0x46;				/* with the router alert */
+	ip[1] = 0xc0;
+	ip[3] = 24 + 12;
+	ip[8] = 1;				/* ttl */
+	ip[9] = 2;
+	ip[16] = 224;				/* from 0.0.0.0, a proxy querier */
+	ip[19] = 1;
+	ip[20] = 0x94;
+	ip[21] = 0x04;
+	cksum_set(ip + 10, cksum_add(ip, 24, 0));
+
+	/* v3 general query, understood by the v2 hosts */
+	igmp[0] = IGMP_QUERY;
+	igmp[1] = MCAST_RESPONSE / 100;
+	igmp[8] = 2;				/* robustness */
+	igmp[9] = MCAST_QUERY_INTERVAL / 1000;
+	cksum_set(igmp + 2, cksum_add(igmp, 12, 0));
+
+	return ETHER_MIN;
+}
+
+static size_t query_mld(uint8_t *frame)
+{
+	uint8_t *ip6 = frame + ETHER_HDR_LEN;
+	uint8_t *hbh = ip6 + 40;
+	uint8_t *icmp = hbh + 8;
+	uint32_t sum;
+
+	memset(frame, 0, ETHER_HDR_LEN + 40 + 8 + 28);
+	frame[0] = 0x33;
+	frame[1] = 0x33;
+	frame[5] = 0x01;			/* ff02::1 */
+	memcpy(frame + ETHER_ADDR_LEN, querier_mac, ETHER_ADDR_LEN);
+	frame[12] = 0x86;
+	frame[13] = 0xdd;
+
+	ip6[0] = 0x60;
+	ip6[5] = 8 + 28;
+	ip6[6] = 0;				/* hop-by-hop */
+	ip6[7] = 1;
+
+	/* the hosts only accept a link-local source, EUI-64 of the MAC */
+	ip6[8] = 0xfe;
+	ip6[9] = 0x80;
+	ip6[16] = querier_mac[0] ^ 0x02;
+	ip6[17] = querier_mac[1];
+	ip6[18] = querier_mac[2];
+	ip6[19] = 0xff;
+	ip6[20] = 0xfe;
+	ip6[21] = querier_mac[3];
+	ip6[22] = querier_mac[4];
+	ip6[23] = querier_mac[5];
+
+	ip6[24] = 0xff;
+	ip6[25] = 0x02;
+	ip6[39] = 0x01;
+
+	hbh[0] = 58;
+	hbh[2] = 0x05;				/* router alert, MLD */
+	hbh[3] = 0x02;
+	hbh[6] = 0x01;				/* PadN */
+
+	icmp[0] = MLD_QUERY;
+	icmp[4] = MCAST_RESPONSE >> 8;
+	icmp[5] = MCAST_RESPONSE & 0xff;
+	icmp[24] = 2;
+	icmp[25] = MCAST_QUERY_INTERVAL / 1000;
+
+	sum = cksum_add(ip6 + 8, 32, 0) + 28 + 58;
+	cksum_set(icmp + 2, cksum_add(icmp, 28, sum));
+
+	return ETHER_HDR_LEN + 40 + 8 + 28;
+}
+
+/* Build a general query of the family into frame, which holds
+ * MCAST_QUERY_MAX bytes. The unknown groups stop being flooded once
+ * the hosts had the time to answer the first one. */
+size_t mcast_query(mcast_t *mcast, int family, uint8_t *frame, uint64_t now)
+{
+	if (mcast->ready == 0)
+		mcast->ready = now + MCAST_RESPONSE;
+
+	return family == AF_INET ? query_igmp(frame) : query_mld(frame);
+}
@@ -0,0 +1,61 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef MCAST_H
+#define MCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ftable.h>
+
+#include "ethhdr.h"
+
+#define MCAST_GROUPS_MAX	1024	/* groups snooped per vnetwork */
+#define MCAST_QUERY_INTERVAL	125000	/* ms, RFC 3376 defaults */
+#define MCAST_RESPONSE		10000	/* ms, max response time of a query */
+#define MCAST_MEMBER_TIMEOUT	(2 * MCAST_QUERY_INTERVAL + MCAST_RESPONSE)
+#define MCAST_QUERY_MAX		96	/* largest query frame */
+
+/* what mcast_snoop() found */
+#define MCAST_DATA		0
+#define MCAST_REPORT		1	/* report or leave, consumed by the switch */
+#define MCAST_QUERY		2	/* from a multicast router */
+
+struct mcast_member {
+	void *session;
+	uint64_t expires;
+	struct mcast_member *next;
+};
+
+typedef struct mcast {
+	ftable_t *groups;		/* group MAC to its members */
+	struct mcast_member *routers;	/* sessions that sent a query */
+	uint64_t ready;			/* unknown groups are flooded until then */
+} mcast_t;
+
+mcast_t *mcast_new(size_t size);
+void mcast_free(mcast_t *mcast);
+int mcast_flooded(const uint8_t *mac);
+int mcast_join(mcast_t *mcast, const uint8_t *mac, void *session, uint64_t now);
+void mcast_leave(mcast_t *mcast, const uint8_t *mac, void *session);
+void mcast_forget(mcast_t *mcast, void *session);
+void mcast_expire(mcast_t *mcast, uint64_t now);
+struct mcast_member *mcast_members(mcast_t *mcast, const uint8_t *mac, uint64_t now);
+int mcast_snoop(mcast_t *mcast, const uint8_t *frame, size_t size,
+		const struct ethhdr_info *eth, void *session, uint64_t now);
+size_t mcast_query(mcast_t *mcast, int family, uint8_t *frame, uint64_t now);
+
+#endif /* MCAST_H */
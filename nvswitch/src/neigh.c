@@ -0,0 +1,501 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Neighbor table of a vnetwork.
+ *
+ * The switch learns which MAC owns an address from the ARP and the
+ * IPv6 neighbor discovery going through it, from the DHCP acks and
+ * from the address an agent reports in its NetinfoRequest. The ARP
+ * requests and the neighbor solicitations for a known address are
+ * then answered by the switch instead of flooded to every session.
+ */
+
+#include <sys/socket.h>
+#include <net/ethernet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsw_hlib.h"
+#include "hash.h"
+#include "neigh.h"
+
+#define NEIGH_KEY_LEN	16	/* IPv4 addresses are mapped into IPv6 */
+
+#define ARP_LEN		28
+#define ARP_REQUEST	1
+#define ARP_REPLY	2
+
+#define IP6_HDR_LEN	40
+#define ND_SOLICIT	135
+#define ND_ADVERT	136
+#define ND_OPT_SRC_LL	1
+#define ND_OPT_TGT_LL	2
+#define ND_LEN		24	/* header and target, before the options */
+
+#define BOOTP_LEN	240	/* up to and including the magic cookie */
+#define DHCP_ACK	5
+
+#define ETHER_MIN	60	/* without the FCS */
+
+static inline uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static void neigh_key(int family, const uint8_t *ip, uint8_t *key)
+{
+	if (family == AF_INET) {
+		memset(key, 0, 10);
+		key[10] = key[11] = 0xff;
+		memcpy(key + 12, ip, 4);
+	} else {
+		memcpy(key, ip, NEIGH_KEY_LEN);
+	}
+}
+
+/* only the addresses a single host can own */
+static int neigh_valid(int family, const uint8_t *ip)
+{
+	static const uint8_t zero[NEIGH_KEY_LEN];
+
+	if (family == AF_INET)
+		return !(memcmp(ip, zero, 4) == 0 || ip[0] >= 224);
+
+	return !(memcmp(ip, zero, NEIGH_KEY_LEN) == 0 || ip[0] == 0xff);
+}
+
+// hash function
+static unsigned neigh_hash(const void *key)
+{
+	uint32_t k[NEIGH_KEY_LEN/4];
+
+	memcpy(k, key, sizeof(k));
+	return hashword(k, NEIGH_KEY_LEN/4, 0);
+}
+
+// key comparison function
+static int neigh_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, NEIGH_KEY_LEN);
+}
+
+// key copying function
+static void *neigh_keydup(const void *key)
+{
+	uint8_t *key_dup;
+
+	key_dup = malloc(NEIGH_KEY_LEN);
+	if (key_dup != NULL)
+		memcpy(key_dup, key, NEIGH_KEY_LEN);
+
+	return key_dup;
+}
+
+// the item is the MAC address owning the key
+static void *neigh_itemdup(const void *mac)
+{
+	uint8_t *mac_dup;
+
+	mac_dup = malloc(ETHER_ADDR_LEN);
+	if (mac_dup != NULL)
+		memcpy(mac_dup, mac, ETHER_ADDR_LEN);
+
+	return mac_dup;
+}
+
+static void neigh_rel(void *ptr)
+{
+	free(ptr);
+}
+
+neigh_t *neigh_new(size_t size)
+{
+	return jsw_hnew(size, neigh_hash, neigh_cmp,
+			neigh_keydup, neigh_itemdup,
+			neigh_rel, neigh_rel);
+}
+
+void neigh_free(neigh_t *neigh)
+{
+	if (neigh == NULL)
+		return;
+	jsw_hdelete(neigh);
+}
+
+/* Record that mac owns ip, or moved to it. */
+int neigh_learn(neigh_t *neigh, int family, const uint8_t *ip, const uint8_t *mac)
+{
+	uint8_t key[NEIGH_KEY_LEN];
+	uint8_t *owner;
+
+	if (neigh == NULL || !neigh_valid(family, ip) ||
+	    ethhdr_mac_type(mac) != ADDR_UNICAST)
+		return -1;
+
+	neigh_key(family, ip, key);
+	if ((owner = jsw_hfind(neigh, key)) != NULL) {
+		memcpy(owner, mac, ETHER_ADDR_LEN);
+		return 0;
+	}
+
+	if (jsw_hsize(neigh) >= NEIGH_MAX)
+		return -1;
+
+	return jsw_hinsert(neigh, key, (void *)mac) ? 0 : -1;
+}
+
+const uint8_t *neigh_find(neigh_t *neigh, int family, const uint8_t *ip)
+{
+	uint8_t key[NEIGH_KEY_LEN];
+
+	if (neigh == NULL)
+		return NULL;
+
+	neigh_key(family, ip, key);
+	return jsw_hfind(neigh, key);
+}
+
+/* Walk the table, the addresses are given mapped into IPv6 */
+void neigh_foreach(neigh_t *neigh,
+		void (*cb)(const uint8_t *ip, const uint8_t *mac, void *arg), void *arg)
+{
+	if (neigh == NULL || jsw_hsize(neigh) == 0)
+		return;
+
+	jsw_hreset(neigh);
+	do {
+		if (jsw_hkey(neigh) != NULL)
+			cb(jsw_hkey(neigh), jsw_hitem(neigh), arg);
+	} while (jsw_hnext(neigh));
+}
+
+/* The family of a key neigh_foreach() gave */
+int neigh_family(const uint8_t *ip)
+{
+	static const uint8_t mapped[12] = {0,0,0,0,0,0,0,0,0,0,0xff,0xff};
+
+	return memcmp(ip, mapped, sizeof(mapped)) == 0 ? AF_INET : AF_INET6;
+}
+
+static int arp_valid(const uint8_t *arp, size_t len)
+{
+	return len >= ARP_LEN &&
+		get16(arp) == 1 &&			/* ethernet */
+		get16(arp + 2) == ETHERTYPE_IP &&
+		arp[4] == ETHER_ADDR_LEN && arp[5] == 4;
+}
+
+/* Returns the ND message type, 0 if it isn't one. The hop limit
+ * of 255 guarantees it wasn't routed. */
+static int nd_parse(const uint8_t *ip6, size_t len, const uint8_t **icmp, size_t *icmp_len)
+{
+	size_t plen;
+
+	if (len < IP6_HDR_LEN || (ip6[0] >> 4) != 6 || ip6[6] != 58 || ip6[7] != 255)
+		return 0;
+
+	plen = get16(ip6 + 4);
+	if (plen > len - IP6_HDR_LEN)
+		plen = len - IP6_HDR_LEN;
+	if (plen < ND_LEN)
+		return 0;
+
+	*icmp = ip6 + IP6_HDR_LEN;
+	*icmp_len = plen;
+
+	if ((*icmp)[1] != 0)
+		return 0;
+
+	return (*icmp)[0];
+}
+
+/* link-layer address option of a ND message */
+static const uint8_t *nd_lladdr(const uint8_t *icmp, size_t len, uint8_t type)
+{
+	size_t off = ND_LEN;
+	size_t opt_len;
+
+	while (off + 8 <= len) {
+		opt_len = icmp[off + 1] * 8;
+		if (opt_len == 0 || off + opt_len > len)
+			break;
+		if (icmp[off] == type)
+			return icmp + off + 2;
+		off += opt_len;
+	}
+
+	return NULL;
+}
+
+static void snoop_arp(neigh_t *neigh, const uint8_t *src, const uint8_t *arp, size_t len)
+{
+	if (!arp_valid(arp, len))
+		return;
+
+	if (get16(arp + 6) != ARP_REQUEST && get16(arp + 6) != ARP_REPLY)
+		return;
+
+	/* the sender speaks for itself only */
+	if (memcmp(arp + 8, src, ETHER_ADDR_LEN) != 0)
+		return;
+
+	neigh_learn(neigh, AF_INET, arp + 14, arp + 8);
+}
+
+static void snoop_nd(neigh_t *neigh, const uint8_t *src, const uint8_t *ip6, size_t len)
+{
+	const uint8_t *icmp;
+	const uint8_t *ip;
+	const uint8_t *lladdr;
+	size_t icmp_len;
+
+	switch (nd_parse(ip6, len, &icmp, &icmp_len)) {
+	case ND_SOLICIT:
+		ip = ip6 + 8;
+		lladdr = nd_lladdr(icmp, icmp_len, ND_OPT_SRC_LL);
+		break;
+	case ND_ADVERT:
+		ip = icmp + 8;
+		lladdr = nd_lladdr(icmp, icmp_len, ND_OPT_TGT_LL);
+		break;
+	default:
+		return;
+	}
+
+	if (lladdr == NULL)
+		lladdr = src;
+	else if (memcmp(lladdr, src, ETHER_ADDR_LEN) != 0)
+		return;
+
+	neigh_learn(neigh, AF_INET6, ip, lladdr);
+}
+
+static void snoop_dhcp(neigh_t *neigh, const uint8_t *dst, const uint8_t *ip, size_t len)
+{
+	const uint8_t *udp;
+	const uint8_t *bootp;
+	size_t ihl;
+	size_t blen;
+	size_t off;
+	int type = 0;
+
+	if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != 17 || (get16(ip + 6) & 0x3fff) != 0)
+		return;
+
+	ihl = (ip[0] & 0x0f) * 4;
+	if (ihl < 20 || len < ihl + 8)
+		return;
+
+	/* from the server port to the client port */
+	udp = ip + ihl;
+	if (get16(udp) != 67 || get16(udp + 2) != 68)
+		return;
+
+	bootp = udp + 8;
+	blen = len - ihl - 8;
+	if (blen < BOOTP_LEN || bootp[0] != 2 || bootp[1] != 1 || bootp[2] != ETHER_ADDR_LEN ||
+	    bootp[236] != 99 || bootp[237] != 130 || bootp[238] != 83 || bootp[239] != 99)
+		return;
+
+	off = BOOTP_LEN;
+	while (off < blen && bootp[off] != 255) {
+		if (bootp[off] == 0) {
+			off++;
+			continue;
+		}
+		if (off + 2 > blen || off + 2 + bootp[off + 1] > blen)
+			return;
+		if (bootp[off] == 53 && bootp[off + 1] == 1)
+			type = bootp[off + 2];
+		off += 2 + bootp[off + 1];
+	}
+
+	/* yiaddr is leased to chaddr, the node the ack is sent to */
+	if (type == DHCP_ACK && memcmp(bootp + 28, dst, ETHER_ADDR_LEN) == 0)
+		neigh_learn(neigh, AF_INET, bootp + 16, bootp + 28);
+}
+
+/* Learn from a frame sent by a session, the source MAC
+ * already belongs to that session. Any session can answer as a DHCP
+ * server, an ack is only believed when it is unicast to its client,
+ * and dst_session tells the destination MAC belongs to another
+ * session. */
+void neigh_snoop(neigh_t *neigh, const uint8_t *frame, size_t size,
+			const struct ethhdr_info *eth, int dst_session)
+{
+	const uint8_t *l3 = frame + eth->l3_offset;
+	const uint8_t *src = frame + ETHER_ADDR_LEN;
+	size_t len;
+
+	if (eth->dst_type == 0 || size < eth->l3_offset)
+		return;
+
+	len = size - eth->l3_offset;
+
+	switch (eth->ether_type) {
+	case ETHERTYPE_ARP:
+		snoop_arp(neigh, src, l3, len);
+		break;
+	case ETHERTYPE_IPV6:
+		snoop_nd(neigh, src, l3, len);
+		break;
+	case ETHERTYPE_IP:
+		if (eth->dst_type == ADDR_UNICAST && dst_session)
+			snoop_dhcp(neigh, frame, l3, len);
+		break;
+	}
+}
+
+static uint16_t nd_checksum(const uint8_t *ip6, const uint8_t *icmp, size_t len)
+{
+	uint32_t sum = 0;
+	size_t i;
+
+	/* pseudo header, the addresses, length and next header */
+	for (i = 8; i < IP6_HDR_LEN; i += 2)
+		sum += get16(ip6 + i);
+	sum += len + 58;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += get16(icmp + i);
+	if (len & 1)
+		sum += icmp[len - 1] << 8;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum & 0xffff;
+}
+
+/* The reply keeps the VLAN tags of the request and comes from the owner. */
+static uint8_t *proxy_header(const uint8_t *frame, const struct ethhdr_info *eth,
+				const uint8_t *mac, uint8_t *reply)
+{
+	memcpy(reply, frame, eth->l3_offset);
+	memcpy(reply, frame + ETHER_ADDR_LEN, ETHER_ADDR_LEN);
+	memcpy(reply + ETHER_ADDR_LEN, mac, ETHER_ADDR_LEN);
+
+	return reply + eth->l3_offset;
+}
+
+static const uint8_t *proxy_arp(neigh_t *neigh, const uint8_t *frame, const struct ethhdr_info *eth,
+				const uint8_t *arp, size_t len, uint8_t *reply, size_t *reply_size)
+{
+	const uint8_t *mac;
+	uint8_t *rarp;
+
+	if (!arp_valid(arp, len) || get16(arp + 6) != ARP_REQUEST)
+		return NULL;
+
+	/* gratuitous, nobody to answer */
+	if (memcmp(arp + 14, arp + 24, 4) == 0)
+		return NULL;
+
+	mac = neigh_find(neigh, AF_INET, arp + 24);
+	if (mac == NULL || memcmp(mac, arp + 8, ETHER_ADDR_LEN) == 0)
+		return NULL;
+
+	rarp = proxy_header(frame, eth, mac, reply);
+	memcpy(rarp, arp, 6);			/* same hardware and protocol */
+	rarp[6] = 0;
+	rarp[7] = ARP_REPLY;
+	memcpy(rarp + 8, mac, ETHER_ADDR_LEN);
+	memcpy(rarp + 14, arp + 24, 4);
+	memcpy(rarp + 18, arp + 8, ETHER_ADDR_LEN);
+	memcpy(rarp + 24, arp + 14, 4);
+
+	*reply_size = eth->l3_offset + ARP_LEN;
+	if (*reply_size < ETHER_MIN) {
+		memset(reply + *reply_size, 0, ETHER_MIN - *reply_size);
+		*reply_size = ETHER_MIN;
+	}
+
+	return mac;
+}
+
+static const uint8_t *proxy_nd(neigh_t *neigh, const uint8_t *frame, const struct ethhdr_info *eth,
+				const uint8_t *ip6, size_t len, uint8_t *reply, size_t *reply_size)
+{
+	static const uint8_t unspec[16];
+	const uint8_t *icmp;
+	const uint8_t *mac;
+	uint8_t *rip6;
+	uint8_t *ricmp;
+	uint16_t sum;
+	size_t icmp_len;
+
+	if (nd_parse(ip6, len, &icmp, &icmp_len) != ND_SOLICIT)
+		return NULL;
+
+	/* duplicate address detection, the owner answers it */
+	if (memcmp(ip6 + 8, unspec, sizeof(unspec)) == 0)
+		return NULL;
+
+	mac = neigh_find(neigh, AF_INET6, icmp + 8);
+	if (mac == NULL || memcmp(mac, frame + ETHER_ADDR_LEN, ETHER_ADDR_LEN) == 0)
+		return NULL;
+
+	rip6 = proxy_header(frame, eth, mac, reply);
+	memset(rip6, 0, IP6_HDR_LEN);
+	rip6[0] = 0x60;
+	rip6[5] = ND_LEN + 8;
+	rip6[6] = 58;
+	rip6[7] = 255;
+	memcpy(rip6 + 8, icmp + 8, 16);		/* from the target */
+	memcpy(rip6 + 24, ip6 + 8, 16);		/* to the solicitor */
+
+	ricmp = rip6 + IP6_HDR_LEN;
+	memset(ricmp, 0, ND_LEN);
+	ricmp[0] = ND_ADVERT;
+	ricmp[4] = 0x60;			/* solicited, override */
+	memcpy(ricmp + 8, icmp + 8, 16);
+	ricmp[ND_LEN] = ND_OPT_TGT_LL;
+	ricmp[ND_LEN + 1] = 1;
+	memcpy(ricmp + ND_LEN + 2, mac, ETHER_ADDR_LEN);
+
+	sum = nd_checksum(rip6, ricmp, ND_LEN + 8);
+	ricmp[2] = sum >> 8;
+	ricmp[3] = sum & 0xff;
+
+	*reply_size = eth->l3_offset + IP6_HDR_LEN + ND_LEN + 8;
+
+	return mac;
+}
+
+/* If the frame is an ARP request or a neighbor solicitation for a
+ * known address, build the answer of its owner into reply, which
+ * holds NEIGH_REPLY_MAX bytes. Returns the MAC of the owner, or NULL
+ * if the frame has to go through. */
+const uint8_t *neigh_proxy(neigh_t *neigh, const uint8_t *frame, size_t size,
+			const struct ethhdr_info *eth, uint8_t *reply, size_t *reply_size)
+{
+	const uint8_t *l3 = frame + eth->l3_offset;
+	size_t len;
+
+	if (neigh == NULL || eth->dst_type == 0 || size < eth->l3_offset ||
+	    eth->l3_offset + IP6_HDR_LEN + ND_LEN + 8 > NEIGH_REPLY_MAX)
+		return NULL;
+
+	len = size - eth->l3_offset;
+
+	switch (eth->ether_type) {
+	case ETHERTYPE_ARP:
+		return proxy_arp(neigh, frame, eth, l3, len, reply, reply_size);
+	case ETHERTYPE_IPV6:
+		return proxy_nd(neigh, frame, eth, l3, len, reply, reply_size);
+	}
+
+	return NULL;
+}
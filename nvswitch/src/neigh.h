@@ -0,0 +1,41 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef NEIGH_H
+#define NEIGH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ethhdr.h"
+
+#define NEIGH_MAX		4096	/* addresses learned per vnetwork */
+#define NEIGH_REPLY_MAX		128	/* largest frame neigh_proxy() builds */
+
+typedef struct jsw_hash neigh_t;
+
+neigh_t *neigh_new(size_t size);
+void neigh_free(neigh_t *neigh);
+int neigh_learn(neigh_t *neigh, int family, const uint8_t *ip, const uint8_t *mac);
+const uint8_t *neigh_find(neigh_t *neigh, int family, const uint8_t *ip);
+void neigh_foreach(neigh_t *neigh,
+			void (*cb)(const uint8_t *ip, const uint8_t *mac, void *arg), void *arg);
+int neigh_family(const uint8_t *ip);
+void neigh_snoop(neigh_t *neigh, const uint8_t *frame, size_t size,
+			const struct ethhdr_info *eth, int dst_session);
+const uint8_t *neigh_proxy(neigh_t *neigh, const uint8_t *frame, size_t size,
+			const struct ethhdr_info *eth, uint8_t *reply, size_t *reply_size);
+
+#endif /* NEIGH_H */
@@ -0,0 +1,137 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Which pairs of sessions deserve a direct link.
+ *
+ * Every frame relayed by the switch is accounted to the pair of
+ * sessions it travels between, in a count-min sketch of the bytes
+ * and one of the frames. The counters are halved every epoch, so a
+ * steady rate of R per epoch settles between R and 2R; a pair is
+ * worth promoting to p2p once its estimate reaches twice the rate
+ * threshold. A short-lived exchange never gets there.
+ *
+ * The sketch may overestimate a pair sharing its counters with a
+ * heavier one in every row, never underestimate it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "promote.h"
+
+struct promote {
+	uint32_t bytes[PROMOTE_DEPTH][PROMOTE_WIDTH];
+	uint32_t frames[PROMOTE_DEPTH][PROMOTE_WIDTH];
+	uint64_t epoch;			/* start of the current epoch, ms */
+	uint32_t bytes_ps;		/* thresholds, 0 doesn't count */
+	uint32_t frames_ps;
+};
+
+promote_t *promote_new(uint32_t bytes_ps, uint32_t frames_ps)
+{
+	promote_t *promote;
+
+	promote = calloc(1, sizeof(promote_t));
+	if (promote == NULL)
+		return NULL;
+
+	promote->bytes_ps = bytes_ps;
+	promote->frames_ps = frames_ps;
+
+	return promote;
+}
+
+void promote_free(promote_t *promote)
+{
+	free(promote);
+}
+
+static void promote_decay(promote_t *promote, uint64_t now)
+{
+	uint64_t epochs;
+	int i, j;
+
+	if (promote->epoch == 0)
+		promote->epoch = now;
+
+	if (now < promote->epoch + PROMOTE_EPOCH)
+		return;
+
+	epochs = (now - promote->epoch) / PROMOTE_EPOCH;
+	promote->epoch += epochs * PROMOTE_EPOCH;
+
+	if (epochs >= 32) {
+		memset(promote->bytes, 0, sizeof(promote->bytes));
+		memset(promote->frames, 0, sizeof(promote->frames));
+		return;
+	}
+
+	for (i = 0; i < PROMOTE_DEPTH; i++) {
+		for (j = 0; j < PROMOTE_WIDTH; j++) {
+			promote->bytes[i][j] >>= epochs;
+			promote->frames[i][j] >>= epochs;
+		}
+	}
+}
+
+static inline uint32_t saturate_add(uint32_t counter, size_t n)
+{
+	return counter > UINT32_MAX - n ? UINT32_MAX : counter + n;
+}
+
+/* Account a frame of the pair, in either direction. Returns 1 if the
+ * pair is over a threshold, 0 otherwise. */
+int promote_account(promote_t *promote, const void *a, const void *b,
+			size_t bytes, uint64_t now)
+{
+	uint32_t key[4];
+	uint32_t est_bytes = UINT32_MAX;
+	uint32_t est_frames = UINT32_MAX;
+	uintptr_t lo, hi;
+	unsigned h;
+	int i;
+
+	/* every pair is over a threshold of 0 */
+	if (promote->bytes_ps == 0 && promote->frames_ps == 0)
+		return 1;
+
+	promote_decay(promote, now);
+
+	lo = (uintptr_t)(a < b ? a : b);
+	hi = (uintptr_t)(a < b ? b : a);
+	memset(key, 0, sizeof(key));
+	memcpy(key, &lo, sizeof(lo));
+	memcpy(key + 2, &hi, sizeof(hi));
+
+	for (i = 0; i < PROMOTE_DEPTH; i++) {
+		h = hashword(key, 4, i) & (PROMOTE_WIDTH - 1);
+
+		promote->bytes[i][h] = saturate_add(promote->bytes[i][h], bytes);
+		promote->frames[i][h] = saturate_add(promote->frames[i][h], 1);
+
+		if (promote->bytes[i][h] < est_bytes)
+			est_bytes = promote->bytes[i][h];
+		if (promote->frames[i][h] < est_frames)
+			est_frames = promote->frames[i][h];
+	}
+
+	if (promote->bytes_ps && est_bytes >= 2 * (uint64_t)promote->bytes_ps)
+		return 1;
+	if (promote->frames_ps && est_frames >= 2 * (uint64_t)promote->frames_ps)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef PROMOTE_H
+#define PROMOTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROMOTE_DEPTH	4	/* rows of the sketch, independent hashes */
+#define PROMOTE_WIDTH	4096	/* counters per row, power of two */
+#define PROMOTE_EPOCH	1000	/* ms, the counters are halved every epoch */
+
+typedef struct promote promote_t;
+
+promote_t *promote_new(uint32_t bytes_ps, uint32_t frames_ps);
+void promote_free(promote_t *promote);
+int promote_account(promote_t *promote, const void *a, const void *b,
+			size_t bytes, uint64_t now);
+
+#endif /* PROMOTE_H */
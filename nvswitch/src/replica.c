@@ -0,0 +1,752 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Hot standby of the switch.
+ *
+ * The active switch streams to a standby the state it learned from the
+ * traffic: which sessions are up, the MAC addresses behind each node
+ * and the neighbor tables. The vnetworks and their access lists come
+ * to both switches from the controller. A standby that connects gets
+ * a copy of the whole state, then the changes as they happen; the
+ * neighbor tables are copied again every REPLICA_NEIGH_SYNC.
+ *
+ * The stream is made of fixed size records over TLS, both switches
+ * present the certificate of their passport and refuse a peer that
+ * is not signed by the controller. A standby that connects replaces
+ * the current one only once it is authenticated. When the stream breaks,
+ * or stays silent for REPLICA_TIMEOUT, a standby that was synced once
+ * takes over the listen address. The agents come back with their TLS
+ * session, and the MAC addresses of each node are installed as soon
+ * as it authenticates instead of being learned again by flooding.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <logger.h>
+
+#include "jsw_hlib.h"
+#include "hash.h"
+#include "replica.h"
+
+#define REPLICA_MAC_KEY_LEN	44	/* network, mac, padded to words */
+
+static int role = REPLICA_NONE;
+static int listen_fd = -1;
+static int fd = -1;			/* the standby, or the active we follow */
+
+static SSL_CTX *ctx = NULL;
+static SSL *ssl = NULL;			/* over fd */
+static int handshaking = 0;		/* fd is not authenticated yet */
+
+static int cand_fd = -1;		/* active, a standby being authenticated */
+static SSL *cand_ssl = NULL;
+static uint64_t cand_since = 0;
+
+static uint8_t *out = NULL;		/* records not sent yet */
+static size_t out_len = 0;
+static size_t out_size = 0;
+static uint8_t in[REPLICA_REC_LEN * 64];
+static size_t in_len = 0;
+
+static uint64_t last_sent = 0;
+static uint64_t last_recv = 0;
+static uint64_t next_neigh = 0;
+
+static void (*snapshot_cb)(int full) = NULL;
+
+static char *follow_ip = NULL;
+static char *follow_port = NULL;
+static int connecting = 0;
+static int synced = 0;
+static uint64_t next_connect = 0;
+static void (*neigh_cb)(const char *, const uint8_t *, const uint8_t *) = NULL;
+
+/* standby, node owning each (network, mac) */
+static jsw_hash_t *macs = NULL;
+static size_t sessions = 0;
+
+static unsigned mac_hash(const void *key)
+{
+	uint32_t k[REPLICA_MAC_KEY_LEN/4];
+
+	memcpy(k, key, sizeof(k));
+	return hashword(k, REPLICA_MAC_KEY_LEN/4, 0);
+}
+
+static int mac_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, REPLICA_MAC_KEY_LEN);
+}
+
+static void *mac_keydup(const void *key)
+{
+	uint8_t *key_dup;
+
+	key_dup = malloc(REPLICA_MAC_KEY_LEN);
+	if (key_dup != NULL)
+		memcpy(key_dup, key, REPLICA_MAC_KEY_LEN);
+
+	return key_dup;
+}
+
+static void *mac_itemdup(const void *node)
+{
+	return strdup(node);
+}
+
+static void mac_rel(void *ptr)
+{
+	free(ptr);
+}
+
+static void mac_key(const char *network, const uint8_t *mac, uint8_t *key)
+{
+	memset(key, 0, REPLICA_MAC_KEY_LEN);
+	strncpy((char *)key, network, REPLICA_UUID_LEN - 1);
+	memcpy(key + REPLICA_UUID_LEN, mac, 6);
+}
+
+void replica_encode(const struct replica_rec *rec, uint8_t *buf)
+{
+	memset(buf, 0, REPLICA_REC_LEN);
+	buf[0] = rec->type;
+	memcpy(buf + 2, rec->mac, 6);
+	memcpy(buf + 8, rec->ip, 16);
+	strncpy((char *)buf + 24, rec->network, REPLICA_UUID_LEN - 1);
+	strncpy((char *)buf + 24 + REPLICA_UUID_LEN, rec->node, REPLICA_UUID_LEN - 1);
+}
+
+int replica_decode(const uint8_t *buf, struct replica_rec *rec)
+{
+	if (buf[0] < REPLICA_PING || buf[0] > REPLICA_SYNCED)
+		return -1;
+
+	/* the uuids are always terminated */
+	if (buf[24 + REPLICA_UUID_LEN - 1] != '\0' ||
+	    buf[24 + 2 * REPLICA_UUID_LEN - 1] != '\0')
+		return -1;
+
+	rec->type = buf[0];
+	memcpy(rec->mac, buf + 2, 6);
+	memcpy(rec->ip, buf + 8, 16);
+	memcpy(rec->network, buf + 24, REPLICA_UUID_LEN);
+	memcpy(rec->node, buf + 24 + REPLICA_UUID_LEN, REPLICA_UUID_LEN);
+
+	return 0;
+}
+
+static void replica_close()
+{
+	if (ssl != NULL)
+		SSL_free(ssl);
+	ssl = NULL;
+	handshaking = 0;
+
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	connecting = 0;
+	out_len = 0;
+	in_len = 0;
+}
+
+/* queue a record for the standby, dropped if none is attached */
+static void replica_queue(const struct replica_rec *rec)
+{
+	uint8_t *buf;
+	size_t size;
+
+	if (role != REPLICA_ACTIVE || fd < 0)
+		return;
+
+	if (out_len + REPLICA_REC_LEN > out_size) {
+		size = out_size ? out_size * 2 : REPLICA_REC_LEN * 1024;
+		if (size > REPLICA_BUF_MAX) {
+			/* it copies the whole state again when it comes back */
+			jlog(L_WARNING, "the standby is too slow, dropping it");
+			replica_close();
+			return;
+		}
+		if ((buf = realloc(out, size)) == NULL) {
+			replica_close();
+			return;
+		}
+		out = buf;
+		out_size = size;
+	}
+
+	replica_encode(rec, out + out_len);
+	out_len += REPLICA_REC_LEN;
+}
+
+void replica_session(const char *network, const char *node, const uint8_t *tap, int up)
+{
+	struct replica_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = up ? REPLICA_SESSION_UP : REPLICA_SESSION_DOWN;
+	if (tap != NULL)
+		memcpy(rec.mac, tap, 6);
+	strncpy(rec.network, network, REPLICA_UUID_LEN - 1);
+	strncpy(rec.node, node, REPLICA_UUID_LEN - 1);
+
+	replica_queue(&rec);
+}
+
+void replica_mac(const char *network, const char *node, const uint8_t *mac, int add)
+{
+	struct replica_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = add ? REPLICA_MAC_ADD : REPLICA_MAC_DEL;
+	memcpy(rec.mac, mac, 6);
+	strncpy(rec.network, network, REPLICA_UUID_LEN - 1);
+	if (node != NULL)
+		strncpy(rec.node, node, REPLICA_UUID_LEN - 1);
+
+	replica_queue(&rec);
+}
+
+void replica_neigh(const char *network, const uint8_t *ip, const uint8_t *mac)
+{
+	struct replica_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = REPLICA_NEIGH;
+	memcpy(rec.mac, mac, 6);
+	memcpy(rec.ip, ip, 16);
+	strncpy(rec.network, network, REPLICA_UUID_LEN - 1);
+
+	replica_queue(&rec);
+}
+
+static void replica_ping(int type)
+{
+	struct replica_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	replica_queue(&rec);
+}
+
+static void replica_cand_close()
+{
+	if (cand_ssl != NULL)
+		SSL_free(cand_ssl);
+	cand_ssl = NULL;
+
+	if (cand_fd >= 0)
+		close(cand_fd);
+	cand_fd = -1;
+}
+
+/* Both ends authenticate with the certificate of the switch, signed
+ * by the controller like the one of the other switch */
+static int replica_ctx(passport_t *passport)
+{
+	ctx = SSL_CTX_new(SSLv23_method());
+	if (ctx == NULL) {
+		jlog(L_ERROR, "unable to create the replica SSL context");
+		return -1;
+	}
+
+	/* SSL_write() can't pass MSG_NOSIGNAL, a lost peer must not kill us */
+	signal(SIGPIPE, SIG_IGN);
+
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+
+	if (X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), passport->cacert) == 0 ||
+	    SSL_CTX_use_certificate(ctx, passport->certificate) == 0 ||
+	    SSL_CTX_use_PrivateKey(ctx, passport->keyring) == 0) {
+		jlog(L_ERROR, "unable to load the passport of the replica");
+		SSL_CTX_free(ctx);
+		ctx = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static SSL *replica_ssl(int sock, int server)
+{
+	SSL *s;
+
+	if ((s = SSL_new(ctx)) == NULL)
+		return NULL;
+
+	SSL_set_fd(s, sock);
+	if (server)
+		SSL_set_accept_state(s);
+	else
+		SSL_set_connect_state(s);
+
+	return s;
+}
+
+/* Returns 1 once authenticated, 0 while in progress */
+static int replica_handshake(SSL *s)
+{
+	int ret;
+
+	ret = SSL_do_handshake(s);
+	if (ret == 1)
+		return 1;
+
+	switch (SSL_get_error(s, ret)) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		return 0;
+	}
+
+	ERR_clear_error();
+	return -1;
+}
+
+static int replica_socket(const char *ip, const char *port, int passive, struct addrinfo **res)
+{
+	struct addrinfo hints;
+	int sock, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	if ((ret = getaddrinfo(ip, port, &hints, res)) != 0) {
+		jlog(L_ERROR, "replica address %s:%s: %s", ip, port, gai_strerror(ret));
+		return -1;
+	}
+
+	sock = socket((*res)->ai_family, SOCK_STREAM, 0);
+	if (sock < 0) {
+		freeaddrinfo(*res);
+		return -1;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	return sock;
+}
+
+int replica_listen(const char *ip, const char *port, passport_t *passport,
+			void (*snapshot)(int full))
+{
+	struct addrinfo *res;
+	int on = 1;
+
+	if (passport == NULL) {
+		jlog(L_ERROR, "the replica needs the passport of the switch");
+		return -1;
+	}
+
+	if (ctx == NULL && replica_ctx(passport) < 0)
+		return -1;
+
+	if ((listen_fd = replica_socket(ip, port, 1, &res)) < 0)
+		return -1;
+
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(listen_fd, res->ai_addr, res->ai_addrlen) < 0 ||
+	    listen(listen_fd, 1) < 0) {
+		jlog(L_ERROR, "replica listen %s:%s: %s", ip, port, strerror(errno));
+		freeaddrinfo(res);
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+	freeaddrinfo(res);
+
+	role = REPLICA_ACTIVE;
+	snapshot_cb = snapshot;
+	jlog(L_NOTICE, "waiting for a standby on %s:%s", ip, port);
+
+	return 0;
+}
+
+int replica_follow(const char *ip, const char *port, passport_t *passport,
+			void (*on_neigh)(const char *network, const uint8_t *ip, const uint8_t *mac))
+{
+	/* without one, only replica_apply() feeds the standby */
+	if (passport != NULL && replica_ctx(passport) < 0)
+		return -1;
+
+	macs = jsw_hnew(1024, mac_hash, mac_cmp, mac_keydup, mac_itemdup, mac_rel, mac_rel);
+	if (macs == NULL)
+		return -1;
+
+	follow_ip = strdup(ip);
+	follow_port = strdup(port);
+	neigh_cb = on_neigh;
+	role = REPLICA_STANDBY;
+
+	jlog(L_NOTICE, "standing by for %s:%s", ip, port);
+
+	return 0;
+}
+
+int replica_apply(const struct replica_rec *rec)
+{
+	uint8_t key[REPLICA_MAC_KEY_LEN];
+
+	switch (rec->type) {
+	case REPLICA_SESSION_UP:
+		sessions++;
+		break;
+
+	case REPLICA_SESSION_DOWN:
+		if (sessions > 0)
+			sessions--;
+		break;
+
+	case REPLICA_MAC_ADD:
+		mac_key(rec->network, rec->mac, key);
+		jsw_herase(macs, key);
+		if (!jsw_hinsert(macs, key, (void *)rec->node))
+			return -1;
+		break;
+
+	case REPLICA_MAC_DEL:
+		mac_key(rec->network, rec->mac, key);
+		jsw_herase(macs, key);
+		break;
+
+	case REPLICA_NEIGH:
+		if (neigh_cb != NULL)
+			neigh_cb(rec->network, rec->ip, rec->mac);
+		break;
+
+	case REPLICA_SYNCED:
+		if (!synced)
+			jlog(L_NOTICE, "standby synced: %zu sessions, %zu mac addresses",
+				sessions, jsw_hsize(macs));
+		synced = 1;
+		break;
+	}
+
+	return 0;
+}
+
+/* Install the addresses the active switch knew behind a node, once
+ * it comes back. They are forgotten here, the switch owns them now.
+ * Erasing resets the traversal, the keys are collected in one pass. */
+int replica_restore(const char *network, const char *node,
+			void (*install)(void *arg, const uint8_t *mac), void *arg)
+{
+	uint8_t *keys = NULL;
+	uint8_t *buf;
+	const uint8_t *k;
+	size_t count = 0;
+	size_t size = 0;
+	size_t i;
+
+	if (macs == NULL || jsw_hsize(macs) == 0)
+		return 0;
+
+	jsw_hreset(macs);
+	do {
+		k = jsw_hkey(macs);
+		if (k == NULL || strcmp(jsw_hitem(macs), node) != 0 ||
+		    strncmp((const char *)k, network, REPLICA_UUID_LEN) != 0)
+			continue;
+
+		if (count == size) {
+			size = size ? size * 2 : 16;
+			if ((buf = realloc(keys, size * REPLICA_MAC_KEY_LEN)) == NULL) {
+				size = count;
+				break;
+			}
+			keys = buf;
+		}
+		memcpy(keys + count * REPLICA_MAC_KEY_LEN, k, REPLICA_MAC_KEY_LEN);
+		count++;
+	} while (jsw_hnext(macs));
+
+	for (i = 0; i < count; i++) {
+		install(arg, keys + i * REPLICA_MAC_KEY_LEN + REPLICA_UUID_LEN);
+		jsw_herase(macs, keys + i * REPLICA_MAC_KEY_LEN);
+	}
+	free(keys);
+
+	return count;
+}
+
+/* One standby is authenticated at a time, the current one is kept
+ * until then */
+static void replica_accept(uint64_t now)
+{
+	int sock, ret, on = 1;
+
+	if (cand_fd < 0) {
+		if ((sock = accept(listen_fd, NULL, NULL)) < 0)
+			return;
+
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		if ((cand_ssl = replica_ssl(sock, 1)) == NULL) {
+			close(sock);
+			return;
+		}
+		cand_fd = sock;
+		cand_since = now;
+	}
+
+	ret = replica_handshake(cand_ssl);
+	if (ret == 0 && now - cand_since > REPLICA_TIMEOUT)
+		ret = -1;
+	if (ret == -1)
+		jlog(L_WARNING, "a standby failed to authenticate");
+	if (ret != 1) {
+		if (ret == -1)
+			replica_cand_close();
+		return;
+	}
+
+	/* a standby coming back replaces the one we lost track of */
+	replica_close();
+
+	fd = cand_fd;
+	ssl = cand_ssl;
+	cand_fd = -1;
+	cand_ssl = NULL;
+
+	jlog(L_NOTICE, "standby attached, copying the state");
+	if (snapshot_cb != NULL)
+		snapshot_cb(1);
+	replica_ping(REPLICA_SYNCED);
+
+	last_sent = now;
+	next_neigh = now + REPLICA_NEIGH_SYNC;
+}
+
+static int replica_flush()
+{
+	ssize_t ret;
+
+	while (out_len > 0) {
+		ret = SSL_write(ssl, out, out_len);
+		if (ret <= 0) {
+			switch (SSL_get_error(ssl, ret)) {
+			case SSL_ERROR_WANT_READ:
+			case SSL_ERROR_WANT_WRITE:
+				return 0;
+			}
+			ERR_clear_error();
+			jlog(L_WARNING, "standby lost");
+			replica_close();
+			return -1;
+		}
+		memmove(out, out + ret, out_len - ret);
+		out_len -= ret;
+	}
+
+	return 0;
+}
+
+static void replica_connect(uint64_t now)
+{
+	struct addrinfo *res;
+	int on = 1;
+
+	next_connect = now + REPLICA_KEEPALIVE;
+	if (ctx == NULL)
+		return;
+
+	if ((fd = replica_socket(follow_ip, follow_port, 0, &res)) < 0)
+		return;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		freeaddrinfo(res);
+		replica_close();
+		return;
+	}
+	freeaddrinfo(res);
+
+	connecting = 1;
+	last_recv = now;
+}
+
+/* Returns 1 when the connection to the active switch is lost */
+static int replica_read(uint64_t now)
+{
+	struct replica_rec rec;
+	struct pollfd pfd;
+	ssize_t ret;
+	size_t off;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (connecting) {
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 0) == 0) {
+			if (now - last_recv > REPLICA_TIMEOUT)
+				replica_close();
+			return 0;
+		}
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			replica_close();
+			return 0;
+		}
+		connecting = 0;
+
+		if ((ssl = replica_ssl(fd, 0)) == NULL) {
+			replica_close();
+			return 0;
+		}
+		handshaking = 1;
+	}
+
+	/* nothing to take over from a switch we could not authenticate */
+	if (handshaking) {
+		switch (replica_handshake(ssl)) {
+		case 0:
+			if (now - last_recv > REPLICA_TIMEOUT)
+				replica_close();
+			return 0;
+		case -1:
+			jlog(L_WARNING, "the active switch failed to authenticate");
+			replica_close();
+			return 0;
+		}
+		handshaking = 0;
+		last_recv = now;
+		jlog(L_NOTICE, "following the active switch");
+	}
+
+	ret = SSL_read(ssl, in + in_len, sizeof(in) - in_len);
+	if (ret <= 0) {
+		switch (SSL_get_error(ssl, ret)) {
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			ret = -1;
+			break;
+		default:
+			ERR_clear_error();
+			jlog(L_WARNING, "connection to the active switch lost");
+			replica_close();
+			return 1;
+		}
+	}
+
+	if (ret < 0) {
+		if (now - last_recv > REPLICA_TIMEOUT) {
+			jlog(L_WARNING, "the active switch is silent");
+			replica_close();
+			return 1;
+		}
+		return 0;
+	}
+
+	in_len += ret;
+	last_recv = now;
+
+	for (off = 0; off + REPLICA_REC_LEN <= in_len; off += REPLICA_REC_LEN) {
+		if (replica_decode(in + off, &rec) == -1) {
+			jlog(L_WARNING, "invalid replica record");
+			replica_close();
+			return 1;
+		}
+		replica_apply(&rec);
+	}
+
+	memmove(in, in + off, in_len - off);
+	in_len -= off;
+
+	return 0;
+}
+
+/* Called from the switch loop. Returns 1 when the standby must take
+ * over, it is then a standalone switch. */
+int replica_poke(uint64_t now)
+{
+	switch (role) {
+	case REPLICA_ACTIVE:
+		if (listen_fd >= 0)
+			replica_accept(now);
+		if (fd < 0)
+			return 0;
+
+		if (now >= next_neigh) {
+			if (snapshot_cb != NULL)
+				snapshot_cb(0);
+			next_neigh = now + REPLICA_NEIGH_SYNC;
+		}
+		if (now - last_sent >= REPLICA_KEEPALIVE) {
+			replica_ping(REPLICA_PING);
+			last_sent = now;
+		}
+		replica_flush();
+		break;
+
+	case REPLICA_STANDBY:
+		if (fd < 0) {
+			if (now >= next_connect)
+				replica_connect(now);
+			return 0;
+		}
+
+		/* before it was synced once, there is nothing to take over */
+		if (replica_read(now) == 1 && synced) {
+			jlog(L_NOTICE, "taking over, %zu sessions expected", sessions);
+			role = REPLICA_NONE;
+			return 1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+void replica_fini()
+{
+	replica_close();
+	replica_cand_close();
+	if (ctx != NULL)
+		SSL_CTX_free(ctx);
+	ctx = NULL;
+
+	if (listen_fd >= 0)
+		close(listen_fd);
+	listen_fd = -1;
+
+	if (macs != NULL)
+		jsw_hdelete(macs);
+	macs = NULL;
+
+	free(out);
+	out = NULL;
+	out_size = 0;
+	free(follow_ip);
+	free(follow_port);
+	follow_ip = follow_port = NULL;
+	role = REPLICA_NONE;
+}
@@ -0,0 +1,73 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cert.h>
+
+#define REPLICA_NONE		0
+#define REPLICA_ACTIVE		1
+#define REPLICA_STANDBY		2
+
+#define REPLICA_KEEPALIVE	1000	/* ms of silence before the active sends a ping */
+#define REPLICA_TIMEOUT		3000	/* ms of silence before the standby takes over */
+#define REPLICA_NEIGH_SYNC	30000	/* ms between two copies of the neighbor tables */
+#define REPLICA_BUF_MAX		(4*1024*1024)	/* pending bytes before a slow standby is dropped */
+
+/* record types */
+#define REPLICA_PING		1
+#define REPLICA_SESSION_UP	2	/* network, node, mac of its tap */
+#define REPLICA_SESSION_DOWN	3	/* network, node */
+#define REPLICA_MAC_ADD		4	/* network, node, mac */
+#define REPLICA_MAC_DEL		5	/* network, mac */
+#define REPLICA_NEIGH		6	/* network, ip, mac */
+#define REPLICA_SYNCED		7	/* the standby holds the whole state */
+
+#define REPLICA_UUID_LEN	37
+#define REPLICA_REC_LEN		(2 + 6 + 16 + 2 * REPLICA_UUID_LEN)
+
+struct replica_rec {
+	uint8_t type;
+	uint8_t mac[6];
+	uint8_t ip[16];				/* IPv4 mapped into IPv6 */
+	char network[REPLICA_UUID_LEN];
+	char node[REPLICA_UUID_LEN];
+};
+
+void replica_encode(const struct replica_rec *rec, uint8_t *buf);
+int replica_decode(const uint8_t *buf, struct replica_rec *rec);
+
+/* active */
+int replica_listen(const char *ip, const char *port, passport_t *passport,
+			void (*snapshot)(int full));
+void replica_session(const char *network, const char *node, const uint8_t *tap, int up);
+void replica_mac(const char *network, const char *node, const uint8_t *mac, int add);
+void replica_neigh(const char *network, const uint8_t *ip, const uint8_t *mac);
+
+/* standby */
+int replica_follow(const char *ip, const char *port, passport_t *passport,
+			void (*on_neigh)(const char *network, const uint8_t *ip, const uint8_t *mac));
+int replica_apply(const struct replica_rec *rec);
+int replica_restore(const char *network, const char *node,
+			void (*install)(void *arg, const uint8_t *mac), void *arg);
+
+int replica_poke(uint64_t now);
+void replica_fini();
+
+#endif /* REPLICA_H */
@@ -35,6 +35,42 @@ provRequest(struct session *session, DNDSMessage_t *req_msg)
 	query_provisioning(session, provcode);
 }
 
+/* the authResponse results, encoded on first use */
+static DNDSTemplate_t *auth_response[DNDSResult_moreData + 1];
+
+void
+transmit_auth_response(netc_t *netc, e_DNDSResult result)
+{
+	DNDSTemplate_t *tpl;
+
+	if (result < 0 || result > DNDSResult_moreData)
+		return;
+
+	if ((tpl = auth_response[result]) == NULL) {
+		if (DNDSTemplate_new(&tpl, pdu_PR_dnm, dnop_PR_authResponse) != DNDS_success)
+			return;
+		AuthResponse_set_result(tpl->msg, result);
+		if (DNDSTemplate_encode(tpl) != DNDS_success) {
+			DNDSTemplate_del(tpl);
+			return;
+		}
+		auth_response[result] = tpl;
+	}
+
+	net_send_raw(netc, tpl->der, tpl->der_size);
+}
+
+void
+request_fini()
+{
+	int i;
+
+	for (i = 0; i <= DNDSResult_moreData; i++) {
+		DNDSTemplate_del(auth_response[i]);
+		auth_response[i] = NULL;
+	}
+}
+
 /* Authentication Request from the node */
 int
 authRequest(struct session *session, DNDSMessage_t *req_msg)
@@ -49,23 +85,12 @@ authRequest(struct session *session, DNDSMessage_t *req_msg)
 		return -1;
 	}
 
-	DNDSMessage_t *msg = NULL;
-
-	DNDSMessage_new(&msg);
-	DNDSMessage_set_channel(msg, 0);
-	DNDSMessage_set_pdu(msg, pdu_PR_dnm);
-
-	DNMessage_set_seqNumber(msg, 1);
-	DNMessage_set_ackNumber(msg, 0);
-	DNMessage_set_operation(msg, dnop_PR_authResponse);
-
 	AuthRequest_get_certName(req_msg, &certName, &length);
 
 	jlog(L_DEBUG, "URI:%s", certName);
 	session->node_info = cn2node_info(certName);
 	if (session->node_info == NULL) {
 		jlog(L_WARNING, "cn2node_info failed");
-		DNDSMessage_del(msg);
 		return -1;
 	}
 
@@ -85,17 +110,13 @@ authRequest(struct session *session, DNDSMessage_t *req_msg)
 		session->vnetwork = vnetwork_lookup(session->node_info->network_uuid);
 
 	if (session->vnetwork == NULL) {
-		AuthResponse_set_result(msg, DNDSResult_noRight);
-		net_send_msg(session->netc, msg);
-		DNDSMessage_del(msg);
+		transmit_auth_response(session->netc, DNDSResult_noRight);
 		return -1;
 	}
 
 	/* check if the node's uuid is known
 	if (ctable_find(session->context->atable, session->node_info->uuid) == NULL) {
-		AuthResponse_set_result(msg, DNDSResult_noRight);
-		net_send_msg(session->netc, msg);
-		DNDSMessage_del(msg);
+		transmit_auth_response(session->netc, DNDSResult_noRight);
 		jlog(L_ERROR, "authentication failed, invalid certificate");
 		return -1;
 	}
@@ -122,24 +143,35 @@ authRequest(struct session *session, DNDSMessage_t *req_msg)
 	session->cert_name = strdup(certName);
 	if (session->netc->security_level == NET_UNSECURE) {
 
-		AuthResponse_set_result(msg, DNDSResult_success);
-		net_send_msg(session->netc, msg);
+		transmit_auth_response(session->netc, DNDSResult_success);
 
 		session->state = SESSION_STATE_AUTHED;
 		session->netc->on_secure(session->netc);
 
+	} else if (session->netc->kconn->security_level == KRYPT_RSA) {
+
+		/* The agent named its network during the handshake and is
+		 * already authenticated by the network's passport, make sure
+		 * it is the network it now claims. */
+		if (session->netc->kconn->passport != session->vnetwork->passport) {
+			jlog(L_WARNING, "authRequest network doesn't match the handshake");
+			transmit_auth_response(session->netc, DNDSResult_noRight);
+			return -1;
+		}
+
+		/* on_secure() answers the request */
+		session->state = SESSION_STATE_WAIT_STEPUP;
+		session->netc->on_secure(session->netc);
+
 	} else {
 
-		AuthResponse_set_result(msg, DNDSResult_secureStepUp);
-		net_send_msg(session->netc, msg);
+		transmit_auth_response(session->netc, DNDSResult_secureStepUp);
 
 		krypt_add_passport(session->netc->kconn, session->vnetwork->passport);
 		session->state = SESSION_STATE_WAIT_STEPUP;
 		net_step_up(session->netc);
 	}
 
-	DNDSMessage_del(msg);
-
 	return 0;
 }
 
@@ -180,6 +212,9 @@ p2pRequest(struct session *session_a, struct session *session_b)
 	P2pRequest_set_ipAddrDst(msg, ip_b);
 	P2pRequest_set_port(msg, port);
 	P2pRequest_set_side(msg, P2pSide_client);
+	/* the agents race both addresses of their peer */
+	if (ip_b != session_b->ip_local && session_b->ip_local[0] != '\0')
+		P2pRequest_set_ipLocalDst(msg, session_b->ip_local);
 
 	net_send_msg(session_a->netc, msg);
 	DNDSMessage_del(msg);
@@ -194,6 +229,8 @@ p2pRequest(struct session *session_a, struct session *session_b)
 	P2pRequest_set_ipAddrDst(msg, ip_a);
 	P2pRequest_set_port(msg, port);
 	P2pRequest_set_side(msg, P2pSide_server);
+	if (ip_a != session_a->ip_local && session_a->ip_local[0] != '\0')
+		P2pRequest_set_ipLocalDst(msg, session_a->ip_local);
 
 	net_send_msg(session_b->netc, msg);
 	DNDSMessage_del(msg);
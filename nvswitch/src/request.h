@@ -17,7 +17,10 @@
 #define REQUEST_H
 
 #include <dnds.h>
+#include <netbus.h>
 
+void transmit_auth_response(netc_t *netc, e_DNDSResult result);
+void request_fini();
 int authRequest(struct session *session, DNDSMessage_t *msg);
 void p2pRequest(struct session *session_a, struct session *session_b);
 void provRequest(struct session *session, DNDSMessage_t *req_msg);
@@ -27,6 +27,10 @@
 #define SESSION_STATE_WAIT_STEPUP	0x4
 #define SESSION_STATE_PURGE		0x8
 
+/* a rendezvous costs a minute of tokens, the rate is per minute */
+#define PROMOTE_COST			60
+#define PROMOTE_BURST			2
+
 struct mac_list {
 	uint8_t mac_addr[6];
 	struct mac_list *next;
@@ -41,15 +45,27 @@ struct session {
 	node_info_t *node_info;
 
 	uint32_t id;
+	int mtu;			/* tunnel MTU, from the path MTU */
 	char ip_local[16];
 	uint8_t tun_mac_addr[6];
 
 	netc_t *netc;
+	netc_t *netc_data;		/* DTLS channel of the ethernet frames, NULL if none */
 	struct vnetwork *vnetwork;
 
 	uint8_t mac_addr[6];
 	struct mac_list *mac_list;
 
+	struct tbucket flood;		/* storm control of the frames it floods */
+	uint64_t flood_dropped;
+	uint8_t flood_limited;		/* over its limit, warned once */
+	uint64_t unknown_unicast;	/* frames flooded for an unknown destination */
+
+	struct tbucket promote;		/* p2p rendezvous it may still take part in */
+
+	uint8_t trunk;			/* 0 for a node, the peer index + 1 of a trunk
+					 * we dialed or TRUNK_ACCEPTED, see trunk.h */
+
 	struct session *next;
 	struct session *prev;
 
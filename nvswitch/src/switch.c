@@ -13,7 +13,12 @@
  * GNU Affero General Public License for more details
  */
 
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <arpa/inet.h>
 #include <errno.h>
+#include <net/ethernet.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
@@ -28,22 +33,420 @@
 
 #include "control.h"
 #include "inet.h"
+#include "promote.h"
+#include "replica.h"
 #include "request.h"
 #include "session.h"
 #include "switch.h"
+#include "trunk.h"
+#include "upgrade.h"
 #include "vnetwork.h"
 
 static struct switch_cfg *switch_cfg;
 static netc_t *switch_netc = NULL;
+static netc_t *switch_netc_tcp = NULL;
+static netc_t *switch_netc_dtls = NULL;
+static netc_t *switch_netc_trunk = NULL;
+static int switch_tcp = 0;		/* the transports polled by switch_loop() */
+static int switch_dtls = 0;
+static uint64_t switch_bytes = 0;	/* of the frames forwarded, for the load reports */
+static passport_t *replica_passport = NULL;	/* authenticates the replica stream */
+
+#define SWITCH_BURST	32	/* messages forwarded together by input_burst() */
+
+/* ethernet frames take the datagram channel of the session when it has one */
+static netc_t *
+session_frame_netc(struct session *session)
+{
+	if (session->netc_data != NULL)
+		return session->netc_data;
+
+	return session->netc;
+}
+
+/* A frame never goes back to its sender, nor from a trunk to another:
+ * the switches of a network are all linked to each other. */
+static int
+split_horizon(struct session *session_src, struct session *session_dst)
+{
+	return session_dst == session_src || (session_src->trunk && session_dst->trunk);
+}
+
+/* pairs of sessions relaying enough to be worth a direct link */
+static promote_t *promote = NULL;
+
+/* Ask the two nodes to reach each other directly, once their traffic
+ * through the switch is high enough and both have a rendezvous left */
+static void
+link_join(struct session *session_src, struct session *session_dst, size_t frame_size)
+{
+	uint64_t	now;
+
+	/* a node behind a trunk is out of reach of our rendezvous */
+	if (session_src->trunk || session_dst->trunk)
+		return;
+
+	if (linkst_joined(session_src->vnetwork->linkst, session_src->id, session_dst->id) == 1)
+		return;
+
+	now = tbucket_now();
+	if (promote != NULL &&
+	    promote_account(promote, session_src, session_dst, frame_size, now) != 1)
+		return;
+
+	if (tbucket_check(&session_src->promote, PROMOTE_COST, now) == -1 ||
+	    tbucket_check(&session_dst->promote, PROMOTE_COST, now) == -1)
+		return;
+
+	tbucket_take(&session_src->promote, PROMOTE_COST, now);
+	tbucket_take(&session_dst->promote, PROMOTE_COST, now);
+
+	p2pRequest(session_src, session_dst);
+	linkst_join(session_src->vnetwork->linkst, session_src->id, session_dst->id);
+}
+
+/* Unicast frames between two known nodes are sent to the destination
+ * in the encoding they arrived in. Everything else, learning a new
+ * address included, is left to forward_ethernet(). */
+static int
+relay_ethernet(netc_t *netc, const uint8_t *msg, size_t msg_len,
+		uint8_t *frame, size_t frame_size)
+{
+	struct ethhdr_info eth;
+	int		 mtu;
+	struct session	*session = netc->ext_ptr;
+	struct session	*session_dst = NULL;
+	netc_t		*netc_dst = NULL;
+
+	if (session == NULL || session->state != SESSION_STATE_AUTHED)
+		return -1;
+
+	ethhdr_classify(&frame, &frame_size, 1, &eth);
+	if (eth.dst_type != ADDR_UNICAST)
+		return -1;
+
+	/* the trunk control frames are for forward_ethernet() to drop or take */
+	if (trunk_is_control(frame, frame_size))
+		return -1;
+
+	if (ftable_find(session->vnetwork->ftable, frame + ETHER_ADDR_LEN) != session)
+		return -1;
+
+	session_dst = ftable_find(session->vnetwork->ftable, frame);
+	if (session_dst == NULL || session_dst->netc == NULL || split_horizon(session, session_dst))
+		return -1;
+
+	/* the ARP and ND replies, the DHCP acks are mostly unicast */
+	neigh_snoop(session->vnetwork->neigh, frame, frame_size, &eth, 1);
+
+	/* the compressed encoding is only produced by net_send_msg() */
+	netc_dst = session_frame_netc(session_dst);
+	if (netc_dst->compress != NULL)
+		return -1;
+
+	/* the MSS option is rewritten in place, the length doesn't change */
+	if (switch_cfg->mss_clamp && ETHHDR_IS_IP(&eth)) {
+		mtu = session->mtu;
+		if (session_dst->mtu > 0 && session_dst->mtu < mtu)
+			mtu = session_dst->mtu;
+		inet_clamp_tcp_mss(frame, frame_size, mtu);
+	}
+
+	net_send_raw(netc_dst, msg, msg_len);
+	link_join(session, session_dst, frame_size);
+	switch_bytes += frame_size;
+
+	return 0;
+}
+
+/* the frames the switch sends itself, the ARP/ND proxy
+ * replies and the multicast queries */
+static DNDSTemplate_t *switch_frame = NULL;
+
+static void
+transmit_frame(struct session *session, uint8_t *frame, size_t frame_size)
+{
+	if (switch_frame == NULL &&
+	    DNDSTemplate_new(&switch_frame, pdu_PR_ethernet, dnop_PR_NOTHING) != DNDS_success) {
+		switch_frame = NULL;
+		return;
+	}
+
+	DNDSMessage_set_channel(switch_frame->msg, net_frame_channel(frame_size));
+	DNDSMessage_set_ethernet(switch_frame->msg, frame, frame_size);
+
+	/* the session's own input may be under way, its main
+	 * connection defers a send failure to the end of the batch */
+	net_send_msg(session->netc, switch_frame->msg);
+}
+
+/* Tell the other switches hosting the network that the address of a
+ * node is reachable through this one, or not anymore */
+static void
+trunk_announce(struct vnetwork *vnet, uint8_t op, uint8_t *mac_addr)
+{
+	uint8_t		 frame[TRUNK_FRAME_MAX];
+	size_t		 frame_size;
+	struct session	*session;
+
+	if (vnet->trunks == 0)
+		return;
+
+	frame_size = trunk_frame(frame, op, mac_addr, 1);
+	for (session = vnet->session_list; session != NULL; session = session->next)
+		if (session->trunk)
+			transmit_frame(session, frame, frame_size);
+}
+
+static void
+trunk_send(struct vnetwork *vnet, DNDSMessage_t *msg)
+{
+	struct session	*session;
+
+	if (vnet->trunks == 0)
+		return;
+
+	for (session = vnet->session_list; session != NULL; session = session->next)
+		if (session->trunk)
+			net_send_msg(session->netc, msg);
+}
+
+/* every address of the nodes of this switch, to a trunk that came up */
+static void
+trunk_sync(struct session *trunk)
+{
+	uint8_t		 macs[6 * TRUNK_MACS_MAX];
+	uint8_t		 frame[TRUNK_FRAME_MAX];
+	struct session	*session;
+	struct mac_list	*mac_itr;
+	int		 count = 0;
+
+	for (session = trunk->vnetwork->session_list; session != NULL; session = session->next) {
+		if (session->trunk)
+			continue;
+
+		for (mac_itr = session->mac_list; mac_itr != NULL; mac_itr = mac_itr->next) {
+			if (ftable_find(trunk->vnetwork->ftable, mac_itr->mac_addr) != session)
+				continue;
+
+			memcpy(macs + 6 * count++, mac_itr->mac_addr, 6);
+			if (count == TRUNK_MACS_MAX) {
+				transmit_frame(trunk, frame, trunk_frame(frame, TRUNK_MAC_ADD, macs, count));
+				count = 0;
+			}
+		}
+	}
+
+	if (count > 0)
+		transmit_frame(trunk, frame, trunk_frame(frame, TRUNK_MAC_ADD, macs, count));
+}
+
+/* The addresses a peer switch announces. A node connected here keeps
+ * its address, the peer learns it back from our announces. */
+static void
+trunk_input(struct session *session, uint8_t *frame, size_t frame_size)
+{
+	ftable_t	*ftable = session->vnetwork->ftable;
+	const uint8_t	*macs;
+	uint8_t		 mac_addr[6];
+	uint8_t		 op;
+	struct session	*owner;
+	int		 count;
+	int		 i;
+
+	/* only a peer switch speaks for the addresses behind it */
+	if (session->trunk == 0)
+		return;
+
+	if ((count = trunk_parse(frame, frame_size, &op, &macs)) == -1) {
+		jlog(L_WARNING, "%s sent an invalid control frame", session->cert_name);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		memcpy(mac_addr, macs + 6 * i, 6);
+		if (ethhdr_mac_type(mac_addr) != ADDR_UNICAST)
+			continue;
+
+		owner = ftable_find(ftable, mac_addr);
+		if (op == TRUNK_MAC_DEL) {
+			if (owner == session)
+				ftable_erase(ftable, mac_addr);
+			continue;
+		}
+
+		if (owner == session || (owner != NULL && owner->trunk == 0))
+			continue;
+
+		if (owner != NULL)
+			ftable_erase(ftable, mac_addr);
+
+		if (ftable_insert(ftable, mac_addr, session))
+			session_add_mac(session, mac_addr);
+	}
+}
+
+static void
+transmit_mcast_query(struct session *session)
+{
+	uint8_t		 frame[MCAST_QUERY_MAX];
+	size_t		 frame_size;
+	uint64_t	 now = tbucket_now();
+
+	frame_size = mcast_query(session->vnetwork->mcast, AF_INET, frame, now);
+	transmit_frame(session, frame, frame_size);
+
+	frame_size = mcast_query(session->vnetwork->mcast, AF_INET6, frame, now);
+	transmit_frame(session, frame, frame_size);
+}
+
+/* The switch is the querier of every vnetwork */
+static void
+vnetwork_query(struct vnetwork *vnet)
+{
+	struct session	*session;
+	struct session	*next;
+
+	if (vnet->mcast == NULL)
+		return;
+
+	mcast_expire(vnet->mcast, tbucket_now());
+
+	for (session = vnet->session_list; session != NULL; session = next) {
+		next = session->next;
+		/* every switch is the querier of its own nodes */
+		if (session->state == SESSION_STATE_AUTHED && session->trunk == 0)
+			transmit_mcast_query(session);
+	}
+}
+
+static int
+mcast_send(struct mcast_member *member, struct session *session, DNDSMessage_t *msg, uint64_t now)
+{
+	int		 sent = 0;
+
+	for (; member != NULL; member = member->next) {
+		if (!split_horizon(session, member->session) && member->expires > now) {
+			net_send_msg(session_frame_netc(member->session), msg);
+			sent++;
+		}
+	}
+
+	return sent;
+}
+
+/* Deliver a multicast frame to the sessions that joined its group and
+ * to the multicast routers. Returns -1 if it has to be flooded. */
+static int
+forward_multicast(struct session *session, DNDSMessage_t *msg, uint8_t *frame, size_t frame_size,
+			const struct ethhdr_info *eth)
+{
+	mcast_t			*mcast = session->vnetwork->mcast;
+	struct mcast_member	*members;
+	struct mcast_member	*router;
+	struct mcast_member	*member;
+	uint64_t		 now;
+
+	if (mcast == NULL)
+		return -1;
+
+	now = tbucket_now();
+	switch (mcast_snoop(mcast, frame, frame_size, eth, session, now)) {
+	case MCAST_REPORT:
+		/* never to the other hosts, they would suppress their own,
+		 * but the other switches learn where the members are */
+		mcast_send(mcast->routers, session, msg, now);
+		if (session->trunk == 0)
+			trunk_send(session->vnetwork, msg);
+		return 0;
+	case MCAST_QUERY:
+		return -1;
+	}
+
+	if (mcast_flooded(frame))
+		return -1;
+
+	/* nobody reported yet, the querier didn't run */
+	members = mcast_members(mcast, frame, now);
+	if (members == NULL && (mcast->ready == 0 || now < mcast->ready))
+		return -1;
+
+	mcast_send(members, session, msg, now);
+
+	for (router = mcast->routers; router != NULL; router = router->next) {
+		if (split_horizon(session, router->session) || router->expires <= now)
+			continue;
+		for (member = members; member != NULL; member = member->next)
+			if (member->session == router->session)
+				break;
+		if (member == NULL)
+			net_send_msg(session_frame_netc(router->session), msg);
+	}
+
+	return 0;
+}
+
+/* Map the MAC of the agent's tap to its session before any frame
+ * comes from it, the frames towards it are not flooded meanwhile.
+ * The registered node wins over a session that went stale. */
+static void
+forward_install(struct session *session, uint8_t *mac_addr)
+{
+	struct session	*owner;
+
+	if (ethhdr_mac_type(mac_addr) != ADDR_UNICAST)
+		return;
+
+	owner = ftable_find(session->vnetwork->ftable, mac_addr);
+	if (owner == session)
+		return;
+
+	if (owner != NULL)
+		ftable_erase(session->vnetwork->ftable, mac_addr);
+
+	if (ftable_insert(session->vnetwork->ftable, mac_addr, session)) {
+		session_add_mac(session, mac_addr);
+		replica_mac(session->vnetwork->uuid, session->node_info->uuid, mac_addr, 1);
+		trunk_announce(session->vnetwork, TRUNK_MAC_ADD, mac_addr);
+	}
+}
+
+/* Storm control, a flooded frame takes a token from the session
+ * that sent it, then one from its vnetwork. */
+static int
+flood_allowed(struct session *session)
+{
+	struct vnetwork	*vnet = session->vnetwork;
+	uint64_t	 now;
+
+	now = tbucket_now();
+	if (tbucket_take(&session->flood, 1, now) == 0 &&
+	    tbucket_take(&vnet->flood, 1, now) == 0) {
+		session->flood_limited = 0;
+		return 0;
+	}
+
+	if (session->flood_limited == 0) {
+		session->flood_limited = 1;
+		jlog(L_WARNING, "%s is over its flood limit, dropping", session->cert_name);
+	}
+
+	session->flood_dropped++;
+	vnet->flood_dropped++;
+
+	return -1;
+}
 
 static void
-forward_ethernet(struct session *session, DNDSMessage_t *msg)
+forward_ethernet(struct session *session, DNDSMessage_t *msg, const struct ethhdr_info *eth)
 {
 	size_t	 	 frame_size;
+	size_t		 reply_size;
 	uint8_t		*frame;
-	uint8_t		 macaddr_src[ETHER_ADDR_LEN];
-	uint8_t		 macaddr_dst[ETHER_ADDR_LEN];
-	uint8_t		 macaddr_dst_type;
+	uint8_t		*macaddr_src;
+	uint8_t		 reply[NEIGH_REPLY_MAX];
+	const uint8_t	*owner;
+	int		 mtu;
 	struct session	*session_dst = NULL;
 	struct session	*session_src = NULL;
 	struct session	*session_list = NULL;
@@ -51,10 +454,22 @@ forward_ethernet(struct session *session, DNDSMessage_t *msg)
 	if (session->state != SESSION_STATE_AUTHED)
 		return;
 
+	/* runt */
+	if (eth->dst_type == 0)
+		return;
+
 	DNDSMessage_get_ethernet(msg, &frame, &frame_size);
+	switch_bytes += frame_size;
+
+	/* the switches talk on the trunks, the nodes never do */
+	if (trunk_is_control(frame, frame_size)) {
+		if (session->trunk)
+			trunk_input(session, frame, frame_size);
+		return;
+	}
 
 	/* New mac address ? Add it to the lookup table */
-	inet_get_mac_addr_src(frame, macaddr_src);
+	macaddr_src = frame + ETHER_ADDR_LEN;
 	session_src = ftable_find(session->vnetwork->ftable, macaddr_src);
 
 	if (session_src == NULL) {
@@ -62,12 +477,35 @@ forward_ethernet(struct session *session, DNDSMessage_t *msg)
 		ftable_insert(session->vnetwork->ftable, macaddr_src, session);
 		session_src = session;
 		session_add_mac(session, macaddr_src);
+		if (session->trunk == 0) {
+			replica_mac(session->vnetwork->uuid, session->node_info->uuid, macaddr_src, 1);
+			trunk_announce(session->vnetwork, TRUNK_MAC_ADD, macaddr_src);
+		}
 	}
 
-	/* Lookup the destination */
-	inet_get_mac_addr_dst(frame, macaddr_dst);
-	macaddr_dst_type = inet_get_mac_addr_type(macaddr_dst);
-	session_dst = ftable_find(session->vnetwork->ftable, macaddr_dst);
+	/* Lookup the destination, the group addresses are never learned */
+	if (eth->dst_type == ADDR_UNICAST)
+		session_dst = ftable_find(session->vnetwork->ftable, frame);
+
+	neigh_snoop(session->vnetwork->neigh, frame, frame_size, eth,
+	    session_dst != NULL && session_dst != session);
+
+	/* Answer for the addresses we know instead of flooding the
+	 * request, as long as their owner is still connected */
+	if (eth->dst_type != ADDR_UNICAST &&
+	    (owner = neigh_proxy(session->vnetwork->neigh, frame, frame_size, eth,
+				reply, &reply_size)) != NULL &&
+	    ftable_find(session->vnetwork->ftable, (uint8_t *)owner) != NULL) {
+		transmit_frame(session, reply, reply_size);
+		return;
+	}
+
+	if (switch_cfg->mss_clamp && ETHHDR_IS_IP(eth)) {
+		mtu = session->mtu;
+		if (session_dst != NULL && session_dst->mtu > 0 && session_dst->mtu < mtu)
+			mtu = session_dst->mtu;
+		inet_clamp_tcp_mss(frame, frame_size, mtu);
+	}
 
 	if (session_src != NULL && session_dst != NULL &&
 		(session_src == session_dst)) {
@@ -75,30 +513,42 @@ forward_ethernet(struct session *session, DNDSMessage_t *msg)
 		return;
 	}
 
+	/* a trunk only delivers to the nodes of this switch */
+	if (session_dst != NULL && split_horizon(session, session_dst))
+		return;
+
+	/* Switch multicasting, to the members of the group */
+	if (eth->dst_type == ADDR_MULTICAST &&
+	    forward_multicast(session, msg, frame, frame_size, eth) == 0)
+		return;
+
 	/* Switch forwarding */
-	if (macaddr_dst_type == ADDR_UNICAST		/* The destination address is unicast */
+	if (eth->dst_type == ADDR_UNICAST		/* The destination address is unicast */
 		&& session_dst != NULL
 		&& session_dst->netc != NULL) {		/* AND the session is up */
 
 			/*jlog(L_DEBUG, "forwarding the packet to [%s]", session_dst->ip);*/
-			net_send_msg(session_dst->netc, msg);
-
-			int lnk_state = 0;
-			lnk_state = linkst_joined(session_src->vnetwork->linkst, session_src->id, session_dst->id);
-			if (lnk_state != 1) {
-				p2pRequest(session_src, session_dst);
-				linkst_join(session_src->vnetwork->linkst, session_src->id, session_dst->id);
-			}
-
+			net_send_msg(session_frame_netc(session_dst), msg);
+			link_join(session_src, session_dst, frame_size);
 
 	/* Switch flooding */
-	} else if (macaddr_dst_type == ADDR_BROADCAST ||	/* This packet has to be broadcasted */
-		    macaddr_dst_type == ADDR_MULTICAST ||
+	} else if (eth->dst_type == ADDR_BROADCAST ||	/* This packet has to be broadcasted */
+		    eth->dst_type == ADDR_MULTICAST ||
 		session_dst == NULL)  {				/* OR the fib session is down */
 
+			if (eth->dst_type == ADDR_UNICAST) {
+				session->unknown_unicast++;
+				session->vnetwork->unknown_unicast++;
+			}
+
+			/* the switch at the other end of a trunk limited it */
+			if (session->trunk == 0 && flood_allowed(session) == -1)
+				return;
+
 			session_list = session->vnetwork->session_list;
 			while (session_list != NULL) {
-				net_send_msg(session_list->netc, msg);
+				if (!split_horizon(session, session_list))
+					net_send_msg(session_frame_netc(session_list), msg);
 				/*jlog(L_DEBUG, "flooding the packet to [%s]", session_list->ip);*/
 				session_list = session_list->next;
 			}
@@ -107,30 +557,55 @@ forward_ethernet(struct session *session, DNDSMessage_t *msg)
 	}
 }
 
+/* the netinfoResponse, with and without compression, encoded on first use */
+static DNDSTemplate_t *netinfo_response[2];
+
 void
-transmit_netinfo_response(netc_t *netc)
+transmit_netinfo_response(netc_t *netc, uint8_t compression)
 {
 	struct session	*session = netc->ext_ptr;
+	DNDSTemplate_t	*tpl;
+	int		 i = (compression != COMPRESS_NONE);
 
-	DNDSMessage_t *msg = NULL;
-	DNDSMessage_new(&msg);
-	DNDSMessage_set_channel(msg, 0);
-	DNDSMessage_set_pdu(msg, pdu_PR_dnm);
+	/* the compression is the one the switch supports */
+	if ((tpl = netinfo_response[i]) == NULL) {
+		if (DNDSTemplate_new(&tpl, pdu_PR_dnm, dnop_PR_netinfoResponse) != DNDS_success)
+			return;
 
-	DNMessage_set_seqNumber(msg, 1);
-	DNMessage_set_ackNumber(msg, 0);
-	DNMessage_set_operation(msg, dnop_PR_netinfoResponse);
+		if (compression != COMPRESS_NONE)
+			NetinfoResponse_set_compression(tpl->msg, compression);
 
-	net_send_msg(session->netc, msg);
-	DNDSMessage_del(msg);
+		if (switch_netc_dtls != NULL)
+			NetinfoResponse_set_dataPort(tpl->msg, atoi(switch_cfg->listen_port_dtls));
+
+		if (DNDSTemplate_encode(tpl) != DNDS_success) {
+			DNDSTemplate_del(tpl);
+			return;
+		}
+		netinfo_response[i] = tpl;
+	}
+
+	net_send_raw(session->netc, tpl->der, tpl->der_size);
 }
 
 void
 handle_netinfo_request(struct session *session, DNDSMessage_t *msg)
 {
+	uint8_t		 compression = COMPRESS_NONE;
+	char		 ip_address[INET_ADDRSTRLEN];
+	struct in_addr	 addr;
+
 	NetinfoRequest_get_ipLocal(msg, session->ip_local);
 	NetinfoRequest_get_macAddr(msg, session->tun_mac_addr);
 
+	/* the address provisioned by the controller, the
+	 * ARP proxy knows the node before it says anything */
+	if (NetinfoRequest_get_ipAddress(msg, ip_address) == DNDS_success &&
+	    inet_pton(AF_INET, ip_address, &addr) == 1) {
+		jlog(L_NOTICE, "client ip address: %s", ip_address);
+		neigh_learn(session->vnetwork->neigh, AF_INET, (uint8_t *)&addr, session->tun_mac_addr);
+	}
+
 	jlog(L_NOTICE, "client local ip: %s", session->ip_local);
 	jlog(L_NOTICE, "client mac addr: %02x:%02x:%02x:%02x:%02x:%02x",
 		session->tun_mac_addr[0],
@@ -140,7 +615,25 @@ handle_netinfo_request(struct session *session, DNDSMessage_t *msg)
 		session->tun_mac_addr[4],
 		session->tun_mac_addr[5]);
 
-	transmit_netinfo_response(session->netc);
+	forward_install(session, session->tun_mac_addr);
+
+	/* compress only if the network enables it and the agent offers
+	 * the same method, older agents don't offer anything */
+	if (session->vnetwork->compression == COMPRESS_NONE ||
+	    NetinfoRequest_get_compression(msg, &compression) != DNDS_success ||
+	    compression != session->vnetwork->compression)
+		compression = COMPRESS_NONE;
+
+	transmit_netinfo_response(session->netc, compression);
+
+	/* its hosts joined their groups long ago, have them report */
+	if (session->vnetwork->mcast != NULL)
+		transmit_mcast_query(session);
+
+	/* the response itself goes out uncompressed */
+	if (compression != COMPRESS_NONE &&
+	    net_set_compression(session->netc, compression) == -1)
+		jlog(L_WARNING, "unable to enable the compression %d", compression);
 }
 
 static void
@@ -174,6 +667,12 @@ dispatch_operation(struct session *session, DNDSMessage_t *msg)
 	}
 }
 
+static void
+restore_mac(void *arg, const uint8_t *mac)
+{
+	forward_install(arg, (uint8_t *)mac);
+}
+
 static void
 on_secure(netc_t *netc)
 {
@@ -181,6 +680,8 @@ on_secure(netc_t *netc)
 	char *altname = NULL;
 	char *cn = NULL;
 	struct session *session;
+	e_DNDSResult result = DNDSResult_success;
+	int n;
 	session = netc->ext_ptr;
 
 	if (session->state != SESSION_STATE_WAIT_STEPUP)
@@ -199,23 +700,11 @@ on_secure(netc_t *netc)
 
 	X509_free(cert);
 
-	/* Send a message to acknowledge the client */
-	DNDSMessage_t *msg = NULL;
-	DNDSMessage_new(&msg);
-	DNDSMessage_set_channel(msg, 0);
-	DNDSMessage_set_pdu(msg, pdu_PR_dnm);
-
-	DNMessage_set_seqNumber(msg, 1);
-	DNMessage_set_ackNumber(msg, 0);
-	DNMessage_set_operation(msg, dnop_PR_authResponse);
-
 	/* check if the node's uuid is known */
 	if (ctable_find(session->vnetwork->atable, session->node_info->uuid) == NULL) {
-		AuthResponse_set_result(msg, DNDSResult_noRight);
+		result = DNDSResult_noRight;
 		jlog(L_ERROR, "authentication failed, invalid certificate");
 		goto out;
-	} else {
-		AuthResponse_set_result(msg, DNDSResult_success);
 	}
 
 	/* reWrite network_uuid, it has been destroyed */
@@ -226,24 +715,109 @@ on_secure(netc_t *netc)
 
 	/* Set the session as authenticated */
 	session->state = SESSION_STATE_AUTHED;
+	session->mtu = net_get_tunnel_mtu(netc);
+	jlog(L_DEBUG, "session mtu: %d", session->mtu);
 
 	vnetwork_add_session(session->vnetwork, session);
+	tbucket_init(&session->promote, switch_cfg->p2p_promotions,
+		PROMOTE_COST * PROMOTE_BURST);
 	update_node_status("1", session->ip, session->node_info->uuid, session->node_info->network_uuid);
 	jlog(L_DEBUG, "session id: %d", session->id);
+
+	/* back from the switch that failed, with the addresses it had */
+	n = replica_restore(session->vnetwork->uuid, session->node_info->uuid, restore_mac, session);
+	if (n > 0)
+		jlog(L_NOTICE, "%s restored %d mac addresses", session->cert_name, n);
+	replica_session(session->vnetwork->uuid, session->node_info->uuid, session->tun_mac_addr, 1);
 out:
-	net_send_msg(session->netc, msg);
-	DNDSMessage_del(msg);
+	/* acknowledge the client */
+	transmit_auth_response(session->netc, result);
+}
+
+static void
+prefetch_burst(ftable_t *ftable, uint8_t *frame[], struct ethhdr_info eth[], int count,
+    void (*prefetch)(ftable_t *, uint8_t *))
+{
+	int	i;
+
+	for (i = 0; i < count; i++) {
+		if (eth[i].dst_type == 0)
+			continue;
+		if (eth[i].dst_type == ADDR_UNICAST)
+			prefetch(ftable, frame[i]);
+		prefetch(ftable, frame[i] + ETHER_ADDR_LEN);
+	}
+}
+
+/* Process the received messages SWITCH_BURST at a time: the ftable
+ * lookups of the whole burst are started before the first frame is
+ * forwarded, and the frames sent to a connection during the burst are
+ * written to it at once. */
+static void
+input_burst(struct session *session, mbuf_t **queue, int frames_only)
+{
+	DNDSMessage_t	*msg[SWITCH_BURST];
+	uint8_t		*frame[SWITCH_BURST];
+	size_t		 frame_size[SWITCH_BURST];
+	struct ethhdr_info eth[SWITCH_BURST];
+	mbuf_t		*mbuf;
+	pdu_PR		 pdu;
+	int		 count;
+	int		 i;
+
+	net_batch_begin();
+
+	while (*queue != NULL) {
+
+		count = 0;
+		for (mbuf = *queue; mbuf != NULL && count < SWITCH_BURST; mbuf = mbuf->next) {
+			msg[count] = (DNDSMessage_t *)mbuf->ext_buf;
+			DNDSMessage_get_pdu(msg[count], &pdu);
+			if (pdu == pdu_PR_ethernet)
+				DNDSMessage_get_ethernet(msg[count], &frame[count], &frame_size[count]);
+			else
+				frame_size[count] = 0;
+			count++;
+		}
+
+		ethhdr_classify(frame, frame_size, count, eth);
+
+		/* the buckets of the whole burst, then the chains they point to */
+		if (session != NULL && session->state == SESSION_STATE_AUTHED) {
+			prefetch_burst(session->vnetwork->ftable, frame, eth, count, ftable_prefetch);
+			prefetch_burst(session->vnetwork->ftable, frame, eth, count, ftable_prefetch_chain);
+		}
+
+		for (i = 0; i < count; i++) {
+			DNDSMessage_get_pdu(msg[i], &pdu);
+
+			switch (pdu) {
+			case pdu_PR_dnm:	/* DNDS protocol */
+				/* the control messages only travel on the session's channel */
+				if (!frames_only)
+					dispatch_operation(session, msg[i]);
+				break;
+			case pdu_PR_ethernet:	/* Ethernet */
+				if (session != NULL)
+					forward_ethernet(session, msg[i], &eth[i]);
+				break;
+			default:
+				/* TODO disconnect session */
+				jlog(L_ERROR, "invalid PDU");
+				break;
+			}
+			mbuf_del(queue, *queue);
+		}
+	}
+
+	net_batch_end();
 }
 
 static void
 on_input(netc_t *netc)
 {
-	DNDSMessage_t *msg;
 	struct session *session;
-	mbuf_t **mbuf_itr;
-	pdu_PR pdu;
 
-	mbuf_itr = &netc->queue_msg;
 	session = (struct session *)netc->ext_ptr;
 	if (session->state == SESSION_STATE_PURGE) {
 		jlog(L_NOTICE, "purge node: %s", session->cert_name);
@@ -251,24 +825,7 @@ on_input(netc_t *netc)
 		return;
 	}
 
-	while (*mbuf_itr != NULL) {
-		msg = (DNDSMessage_t *)(*mbuf_itr)->ext_buf;
-		DNDSMessage_get_pdu(msg, &pdu);
-
-		switch (pdu) {
-		case pdu_PR_dnm:	/* DNDS protocol */
-			dispatch_operation(session, msg);
-			break;
-		case pdu_PR_ethernet:	/* Ethernet */
-			forward_ethernet(session, msg);
-			break;
-		default:
-			/* TODO disconnect session */
-			jlog(L_ERROR, "invalid PDU");
-			break;
-		}
-		mbuf_del(mbuf_itr, *mbuf_itr);
-	}
+	input_burst(session, &netc->queue_msg, 0);
 }
 
 static void
@@ -286,6 +843,8 @@ on_connect(netc_t *netc)
 	session->ip = strdup(netc->peer->host);
 	session->netc = netc;
 	netc->ext_ptr = session;
+	net_set_relay(netc, relay_ethernet);
+	net_set_arena(netc);
 
 	return;
 }
@@ -297,6 +856,7 @@ on_disconnect(netc_t *netc)
 
 	struct session *session = NULL;
 	struct mac_list *mac_itr = NULL;
+	netc_t *netc_data = NULL;
 
 	session = netc->ext_ptr;
 
@@ -304,23 +864,51 @@ on_disconnect(netc_t *netc)
 		return;
 	}
 
+	/* the datagram channel lives as long as the session */
+	if (session->netc_data != NULL) {
+		netc_data = session->netc_data;
+		session->netc_data = NULL;
+		netc_data->ext_ptr = NULL;
+		net_disconnect(netc_data);
+	}
+
 	if (session->state == SESSION_STATE_NOT_AUTHED) {
 		session_free(session);
 		return;
 	}
 
+	compress_stats_log(netc->compress, session->cert_name);
+
+	if (session->flood_dropped > 0)
+		jlog(L_NOTICE, "%s flooded frames dropped: %llu, by its network: %llu",
+			session->cert_name, (unsigned long long)session->flood_dropped,
+			session->vnetwork ? (unsigned long long)session->vnetwork->flood_dropped : 0ULL);
+
+	if (session->unknown_unicast > 0)
+		jlog(L_NOTICE, "%s unknown unicast frames flooded: %llu, by its network: %llu",
+			session->cert_name, (unsigned long long)session->unknown_unicast,
+			session->vnetwork ? (unsigned long long)session->vnetwork->unknown_unicast : 0ULL);
+
 	/* If the ventwork is still valid, update the node in it. */
 	if (session->vnetwork != NULL) {
 
 		linkst_disjoin(session->vnetwork->linkst, session->id);
+		mcast_forget(session->vnetwork->mcast, session);
 
 		while (session->mac_list != NULL) {
 			mac_itr = session->mac_list;
 			session->mac_list = mac_itr->next;
-			ftable_erase(session->vnetwork->ftable, mac_itr->mac_addr);
+			/* unless another session took it over since */
+			if (ftable_find(session->vnetwork->ftable, mac_itr->mac_addr) == session) {
+				ftable_erase(session->vnetwork->ftable, mac_itr->mac_addr);
+				replica_mac(session->vnetwork->uuid, NULL, mac_itr->mac_addr, 0);
+				trunk_announce(session->vnetwork, TRUNK_MAC_DEL, mac_itr->mac_addr);
+			}
 			free(mac_itr);
 		}
 
+		replica_session(session->vnetwork->uuid, session->node_info->uuid, NULL, 0);
+
 		ctable_erase(session->vnetwork->ctable, session->node_info->uuid);
 		vnetwork_del_session(session->vnetwork, session);
 	}
@@ -332,11 +920,579 @@ on_disconnect(netc_t *netc)
 	return;
 }
 
+/* acknowledges a datagram channel, encoded on first use */
+static DNDSTemplate_t *data_ack = NULL;
+
+/* A DTLS connection is authenticated by the certificate the agent
+ * presented during the handshake, and carries the ethernet frames of
+ * the session this agent already opened on UDT or TCP. */
+static void
+on_data_secure(netc_t *netc)
+{
+	X509		*cert;
+	char		*altname = NULL;
+	char		*cn = NULL;
+	node_info_t	*node_info = NULL;
+	struct vnetwork	*vnetwork = NULL;
+	struct session	*session = NULL;
+	netc_t		*netc_old = NULL;
+
+	/* the agent must have named its network, see krypt_set_servername() */
+	if (netc->kconn->security_level != KRYPT_RSA || netc->kconn->passport == NULL)
+		goto out;
+
+	cert = SSL_get_peer_certificate(netc->kconn->ssl);
+	if (cert == NULL)
+		goto out;
+
+	if ((altname = cert_altname_uri(cert)) != NULL)
+		node_info = altname2node_info(altname);
+	else if ((cn = cert_cname(cert)) != NULL)
+		node_info = cn2node_info(cn);
+	X509_free(cert);
+
+	if (node_info == NULL)
+		goto out;
+
+	if (node_info->v == 1)
+		vnetwork = vnetwork_lookup_id(node_info->network_id);
+	else
+		vnetwork = vnetwork_lookup(node_info->network_uuid);
+
+	if (vnetwork == NULL || vnetwork->passport != netc->kconn->passport)
+		goto out;
+
+	session = ctable_find(vnetwork->ctable, node_info->uuid);
+	if (session == NULL || session->state != SESSION_STATE_AUTHED) {
+		session = NULL;
+		goto out;
+	}
+
+	/* the agent reconnected its datagram channel */
+	if (session->netc_data != NULL) {
+		netc_old = session->netc_data;
+		session->netc_data = NULL;
+		netc_old->ext_ptr = NULL;
+		net_disconnect(netc_old);
+	}
+
+	session->netc_data = netc;
+	netc->ext_ptr = session;
+	net_set_relay(netc, relay_ethernet);
+	net_set_arena(netc);
+
+	/* closed with the session, see on_disconnect() */
+	net_set_timeout(netc, 0);
+
+	if (session->netc->compress != NULL)
+		net_set_compression(netc, session->netc->compress->method);
+
+	/* the agent keeps its frames on the session until it receives this */
+	if (data_ack == NULL
+		&& DNDSTemplate_new(&data_ack, pdu_PR_dnm, dnop_PR_netinfoResponse) == DNDS_success) {
+
+		NetinfoResponse_set_result(data_ack->msg, DNDSResult_success);
+		NetinfoResponse_set_dataPort(data_ack->msg, atoi(switch_cfg->listen_port_dtls));
+		DNDSTemplate_encode(data_ack);
+	}
+
+	if (data_ack != NULL && data_ack->der != NULL)
+		net_send_raw(netc, data_ack->der, data_ack->der_size);
+
+	jlog(L_NOTICE, "datagram channel up: %s", session->cert_name);
+
+out:
+	/* refused connections expire, nothing more is sent on them */
+	if (session == NULL)
+		jlog(L_WARNING, "datagram channel refused");
+
+	node_info_destroy(node_info);
+}
+
+static void
+on_data_input(netc_t *netc)
+{
+	input_burst((struct session *)netc->ext_ptr, &netc->queue_msg, 1);
+}
+
+static void
+on_data_connect(netc_t *netc)
+{
+	/* bound to its session once secure */
+	netc->ext_ptr = NULL;
+}
+
+static void
+on_data_disconnect(netc_t *netc)
+{
+	struct session *session = NULL;
+
+	session = netc->ext_ptr;
+	if (session != NULL && session->netc_data == netc) {
+		jlog(L_NOTICE, "datagram channel down: %s", session->cert_name);
+		session->netc_data = NULL;
+	}
+}
+
+static void
+trunk_bind(netc_t *netc, struct session *session, const char *ip)
+{
+	char	cert_name[64];
+
+	snprintf(cert_name, sizeof(cert_name), "trunk %s", ip);
+	session->cert_name = strdup(cert_name);
+	session->ip = strdup(ip);
+	session->netc = netc;
+	netc->ext_ptr = session;
+	net_set_relay(netc, relay_ethernet);
+	net_set_arena(netc);
+}
+
+static void
+on_trunk_connect(netc_t *netc)
+{
+	struct session	*session;
+
+	if ((session = session_new()) == NULL) {
+		jlog(L_ERROR, "unable to create a new session");
+		net_disconnect(netc);
+		return;
+	}
+
+	session->trunk = TRUNK_ACCEPTED;
+	trunk_bind(netc, session, netc->peer->host);
+}
+
+/* Both ends of a trunk hold the certificate the controller gave the
+ * switches of the network, the one named in the handshake by the
+ * switch that dialed. A refused trunk is closed by that switch, see
+ * trunk_dial_vnetwork(). */
+static void
+on_trunk_secure(netc_t *netc)
+{
+	struct session	*session = netc->ext_ptr;
+	struct vnetwork	*vnet = NULL;
+	const char	*name;
+	X509		*cert;
+	int		 ret = -1;
+
+	if (session == NULL || session->state != SESSION_STATE_NOT_AUTHED)
+		return;
+
+	if (session->trunk == TRUNK_ACCEPTED) {
+		name = SSL_get_servername(netc->kconn->ssl, TLSEXT_NAMETYPE_host_name);
+		if (name != NULL && (vnet = vnetwork_lookup(name)) != NULL &&
+		    vnet->passport != netc->kconn->passport)
+			vnet = NULL;
+	} else
+		vnet = session->vnetwork;
+
+	if (vnet != NULL && netc->kconn->security_level == KRYPT_RSA &&
+	    (cert = SSL_get_peer_certificate(netc->kconn->ssl)) != NULL) {
+		ret = X509_cmp(cert, vnet->passport->certificate);
+		X509_free(cert);
+	}
+
+	if (ret != 0) {
+		jlog(L_WARNING, "%s refused", session->cert_name);
+		session->state = SESSION_STATE_PURGE;
+		return;
+	}
+
+	session->vnetwork = vnet;
+	session->state = SESSION_STATE_AUTHED;
+	session->mtu = net_get_tunnel_mtu(netc);
+	vnetwork_add_session(vnet, session);
+	vnet->trunks++;
+
+	jlog(L_NOTICE, "%s up for network %s", session->cert_name, vnet->uuid);
+
+	trunk_sync(session);
+}
+
+static void
+on_trunk_input(netc_t *netc)
+{
+	struct session	*session = netc->ext_ptr;
+
+	if (session->state == SESSION_STATE_PURGE) {
+		jlog(L_NOTICE, "purge %s", session->cert_name);
+		net_disconnect(netc);
+		return;
+	}
+
+	input_burst(session, &netc->queue_msg, 1);
+}
+
+static void
+on_trunk_disconnect(netc_t *netc)
+{
+	struct session	*session = netc->ext_ptr;
+	struct vnetwork	*vnet;
+	struct mac_list	*mac_itr;
+
+	if (session == NULL)
+		return;
+
+	vnet = session->vnetwork;
+	if (vnet != NULL && session->trunk != TRUNK_ACCEPTED &&
+	    vnet->trunk[session->trunk - 1] == session)
+		vnet->trunk[session->trunk - 1] = NULL;
+
+	if (vnet != NULL && session->state == SESSION_STATE_AUTHED) {
+		jlog(L_NOTICE, "%s down for network %s", session->cert_name, vnet->uuid);
+		mcast_forget(vnet->mcast, session);
+		vnetwork_del_session(vnet, session);
+		vnet->trunks--;
+	}
+
+	/* the nodes behind it are flooded until learned again */
+	while (session->mac_list != NULL) {
+		mac_itr = session->mac_list;
+		session->mac_list = mac_itr->next;
+		if (vnet != NULL && ftable_find(vnet->ftable, mac_itr->mac_addr) == session)
+			ftable_erase(vnet->ftable, mac_itr->mac_addr);
+		free(mac_itr);
+	}
+
+	netc->ext_ptr = NULL;
+	session_free(session);
+}
+
+/* the switches we open trunks to, checked before they are dialed */
+static struct trunk_probe trunk_probes[TRUNK_PEERS_MAX];
+static int trunk_peer;
+static int trunk_missing;
+static int trunk_reachable;
+
+static void
+trunk_dial_vnetwork(struct vnetwork *vnet)
+{
+	struct session	*session;
+	netc_t		*netc;
+	const char	*ip = switch_cfg->trunk_peer_ip[trunk_peer];
+	int		 fd;
+
+	session = vnet->trunk[trunk_peer];
+	if (session != NULL && session->state == SESSION_STATE_PURGE)
+		net_disconnect(session->netc);
+
+	if (vnet->trunk[trunk_peer] != NULL)
+		return;
+
+	if (trunk_reachable == 0) {
+		trunk_missing++;
+		return;
+	}
+
+	/* the network is named in the handshake, see krypt_set_servername().
+	 * The first trunk goes over the connection of the probe. */
+	if ((fd = trunk_probe_take(&trunk_probes[trunk_peer])) >= 0)
+		netc = net_client_socket(fd, NET_SECURE_RSA, vnet->passport,
+			on_trunk_disconnect, on_trunk_input, on_trunk_secure);
+	else
+		netc = net_client(ip, switch_cfg->trunk_peer_port[trunk_peer], NET_PROTO_TCP,
+			NET_SECURE_RSA, vnet->passport, on_trunk_disconnect, on_trunk_input,
+			on_trunk_secure);
+	if (netc == NULL)
+		return;
+
+	if ((session = session_new()) == NULL) {
+		net_disconnect(netc);
+		return;
+	}
+
+	session->trunk = trunk_peer + 1;
+	session->vnetwork = vnet;
+	trunk_bind(netc, session, ip);
+	vnet->trunk[trunk_peer] = session;
+}
+
+/* Open the trunks missing to each peer, once a second */
+static void
+trunk_dial(uint64_t now)
+{
+	static uint64_t	next = 0;
+
+	if (now < next)
+		return;
+	next = now + 1000;
+
+	for (trunk_peer = 0; trunk_peer < switch_cfg->trunk_peers; trunk_peer++) {
+		trunk_reachable = 0;
+		trunk_missing = 0;
+		vnetwork_foreach(trunk_dial_vnetwork);
+
+		if (trunk_missing == 0 ||
+		    trunk_probe(&trunk_probes[trunk_peer], switch_cfg->trunk_peer_ip[trunk_peer],
+				switch_cfg->trunk_peer_port[trunk_peer], now) != 1)
+			continue;
+
+		trunk_reachable = 1;
+		vnetwork_foreach(trunk_dial_vnetwork);
+		trunk_probe_fini(&trunk_probes[trunk_peer]);
+	}
+}
+
+/* Send an agent to the switch its network was moved to */
+static void
+transmit_move(struct session *session, const struct vnetwork_move *move)
+{
+	DNDSMessage_t	*msg;
+	uint16_t	 port;
+
+	port = session->netc->protocol == NET_PROTO_TCP ? move->port_tcp : move->port;
+	if (port == 0)
+		return;
+
+	DNDSMessage_new(&msg);
+	DNDSMessage_set_channel(msg, 0);
+	DNDSMessage_set_pdu(msg, pdu_PR_dnm);
+	DNMessage_set_operation(msg, dnop_PR_provResponse);
+
+	ProvResponse_set_switchAddress(msg, (char *)move->address, strlen(move->address));
+	ProvResponse_set_switchPort(msg, port);
+
+	net_send_msg(session->netc, msg);
+	DNDSMessage_del(msg);
+}
+
+static uint32_t status_sessions;
+
+static void
+status_vnetwork(struct vnetwork *vnet)
+{
+	struct session		*session;
+	struct vnetwork_move	 move;
+	int			 moved;
+
+	moved = vnetwork_move_take(vnet, &move);
+
+	for (session = vnet->session_list; session != NULL; session = session->next) {
+		if (session->state != SESSION_STATE_AUTHED || session->trunk)
+			continue;
+		status_sessions++;
+		if (moved)
+			transmit_move(session, &move);
+	}
+}
+
+/* Send the agents of the networks the controller moved away, once a
+ * second, and report the load every SWITCH_STATUS */
+static void
+switch_status(uint64_t now)
+{
+	static uint64_t	next = 0;
+	static uint64_t	next_report = 0;
+	static uint64_t	last = 0;
+	static uint64_t	last_cpu = 0;
+	struct rusage	ru;
+	uint64_t	cpu;
+	uint64_t	bps = 0;
+	uint32_t	permille = 0;
+
+	if (now < next)
+		return;
+	next = now + 1000;
+
+	status_sessions = 0;
+	vnetwork_foreach(status_vnetwork);
+
+	if (now < next_report)
+		return;
+	next_report = now + SWITCH_STATUS;
+
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+
+	if (last != 0 && now > last) {
+		/* us of cpu per ms, per mille of a core */
+		permille = (cpu - last_cpu) / (now - last);
+		bps = switch_bytes * 8 * 1000 / (now - last);
+	}
+	last = now;
+	last_cpu = cpu;
+	switch_bytes = 0;
+
+	update_switch_status(switch_cfg->public_address, switch_cfg->listen_port,
+		switch_cfg->listen_port_tcp, status_sessions, bps, permille);
+}
+
+static void
+snapshot_neigh(const uint8_t *ip, const uint8_t *mac, void *arg)
+{
+	replica_neigh(arg, ip, mac);
+}
+
+static int snapshot_full;
+
+/* Copy the state of a vnetwork to the standby */
+static void
+snapshot_vnetwork(struct vnetwork *vnet)
+{
+	struct session	*session;
+	struct mac_list	*mac_itr;
+
+	for (session = vnet->session_list; snapshot_full && session != NULL; session = session->next) {
+		/* the trunks are dialed again by the standby */
+		if (session->state != SESSION_STATE_AUTHED || session->trunk)
+			continue;
+
+		replica_session(vnet->uuid, session->node_info->uuid, session->tun_mac_addr, 1);
+		for (mac_itr = session->mac_list; mac_itr != NULL; mac_itr = mac_itr->next)
+			if (ftable_find(vnet->ftable, mac_itr->mac_addr) == session)
+				replica_mac(vnet->uuid, session->node_info->uuid, mac_itr->mac_addr, 1);
+	}
+
+	neigh_foreach(vnet->neigh, snapshot_neigh, vnet->uuid);
+}
+
+/* the neighbor tables only, unless full */
+static void
+snapshot(int full)
+{
+	snapshot_full = full;
+	vnetwork_foreach(snapshot_vnetwork);
+}
+
+/* the standby learns the neighbors as if they went through it */
+static void
+follow_neigh(const char *network, const uint8_t *ip, const uint8_t *mac)
+{
+	struct vnetwork	*vnet;
+
+	if ((vnet = vnetwork_lookup(network)) == NULL)
+		return;
+
+	if (neigh_family(ip) == AF_INET)
+		neigh_learn(vnet->neigh, AF_INET, ip + 12, mac);
+	else
+		neigh_learn(vnet->neigh, AF_INET6, ip, mac);
+}
+
+static int switch_listen();
+
+/* the process that replaced this one took the listeners */
+static uint64_t drain_until = 0;
+static int drain_quota;
+static int drain_count;
+
+static void
+drain_vnetwork(struct vnetwork *vnet)
+{
+	struct session	*session;
+	struct session	*next;
+
+	for (session = vnet->session_list; session != NULL; session = next) {
+		next = session->next;
+		/* the new process reads the socket of the UDT sessions */
+		if (session->netc->protocol == NET_PROTO_UDT)
+			net_disconnect(session->netc);
+		else if (drain_quota > 0) {
+			drain_quota--;
+			net_disconnect(session->netc);
+		} else
+			drain_count++;
+	}
+}
+
+/* Stop accepting, the sessions go to the new process. The UDT sessions
+ * are closed right away, without lingering: their multiplexer would
+ * keep reading the UDP socket the new process now listens on. */
+static void
+switch_drain_start(uint64_t now)
+{
+	net_disconnect(switch_netc);
+	net_disconnect(switch_netc_tcp);
+	net_disconnect(switch_netc_dtls);
+	net_disconnect(switch_netc_trunk);
+	switch_netc = switch_netc_tcp = switch_netc_dtls = switch_netc_trunk = NULL;
+	udtbus_release();
+
+	drain_quota = 0;
+	vnetwork_foreach(drain_vnetwork);
+	drain_until = now + switch_cfg->upgrade_drain * 1000;
+}
+
+/* The other sessions are dropped evenly over upgrade_drain, so their
+ * agents don't come back all at once. Then the process exits. */
+static void
+switch_drain(uint64_t now)
+{
+	static uint64_t	next = 0;
+	uint64_t	left;
+
+	if (now < next)
+		return;
+	next = now + 1000;
+
+	drain_quota = 0;
+	drain_count = 0;
+	vnetwork_foreach(drain_vnetwork);
+
+	if (drain_count == 0 || now >= drain_until) {
+		jlog(L_NOTICE, "drained, %d sessions left", drain_count);
+		switch_cfg->switch_running = 0;
+		return;
+	}
+
+	left = (drain_until - now + 999) / 1000;
+	drain_quota = (drain_count + left - 1) / left;
+	vnetwork_foreach(drain_vnetwork);
+}
+
 static void
 *switch_loop(void *nil)
 {
+	uint64_t	now;
+	uint64_t	next_query = 0;
+	netc_t		*servers[4];
+	const char	*ports[4];
+
 	while (switch_cfg->switch_running) {
+		servers[0] = switch_netc;
+		servers[1] = switch_netc_tcp;
+		servers[2] = switch_netc_dtls;
+		servers[3] = switch_netc_trunk;
+		ports[0] = switch_cfg->listen_port;
+		ports[1] = switch_cfg->listen_port_tcp;
+		ports[2] = switch_cfg->listen_port_dtls;
+		ports[3] = switch_cfg->trunk_port;
+
+		now = tbucket_now();
+		if (now >= next_query) {
+			net_batch_begin();
+			vnetwork_foreach(vnetwork_query);
+			net_batch_end();
+			next_query = now + MCAST_QUERY_INTERVAL;
+		}
+
+		if (replica_poke(now) == 1) {
+			/* the active switch failed, the agents come here */
+			if (switch_listen() == -1)
+				switch_cfg->switch_running = 0;
+			else if (switch_cfg->replica_port != NULL)
+				replica_listen(switch_cfg->listen_ip, switch_cfg->replica_port,
+				    replica_passport, snapshot);
+		}
+
+		if (upgrade_poke(servers, ports, 4) == 1)
+			switch_drain_start(now);
+		if (drain_until)
+			switch_drain(now);
+		else if (switch_netc != NULL) {
+			trunk_dial(now);
+			if (switch_cfg->ctrl_initialized)
+				switch_status(now);
+		}
+
 		udtbus_poke_queue();
+		if (switch_tcp)
+			netbus_tcp_poke();
+		if (switch_dtls)
+			netbus_udp_poke();
+		net_flush_pending();
 	}
 
 	krypt_fini();
@@ -344,23 +1500,117 @@ static void
 	return NULL;
 }
 
+static int
+switch_listen()
+{
+	/* the listeners of the switch running before us, if any */
+	if (switch_cfg->upgrade_socket != NULL &&
+	    upgrade_take(switch_cfg->upgrade_socket) == -1)
+		jlog(L_WARNING, "unable to take over the running switch");
+
+	switch_netc = net_server(switch_cfg->listen_ip, switch_cfg->listen_port, NET_PROTO_UDT, NET_SECURE_ADH, NULL,
+		on_connect, on_disconnect, on_input, on_secure);
+
+	if (switch_netc == NULL) {
+		jlog(L_ERROR, "net_server failed");
+		return -1;
+	}
+	net_set_passport_lookup(switch_netc, vnetwork_passport_lookup);
+
+	/* the agents on TCP and the trunks */
+	if (switch_cfg->listen_port_tcp || switch_cfg->trunk_port || switch_cfg->trunk_peers) {
+		netbus_tcp_init();
+		switch_tcp = 1;
+	}
+
+	if (switch_cfg->listen_port_tcp) {
+		switch_netc_tcp = net_server(switch_cfg->listen_ip, switch_cfg->listen_port_tcp, NET_PROTO_TCP,
+			NET_SECURE_ADH, NULL, on_connect, on_disconnect, on_input, on_secure);
+
+		if (switch_netc_tcp == NULL)
+			jlog(L_WARNING, "net_server tcp failed");
+		else
+			net_set_passport_lookup(switch_netc_tcp, vnetwork_passport_lookup);
+	}
+
+	/* agents name their network in the handshake, the passport
+	 * of that network authenticates them */
+	if (switch_cfg->listen_port_dtls) {
+		netbus_udp_init();
+		switch_dtls = 1;
+		switch_netc_dtls = net_server(switch_cfg->listen_ip, switch_cfg->listen_port_dtls, NET_PROTO_DTLS,
+			NET_SECURE_ADH, NULL, on_data_connect, on_data_disconnect, on_data_input, on_data_secure);
+
+		if (switch_netc_dtls == NULL)
+			jlog(L_WARNING, "net_server dtls failed");
+		else
+			net_set_passport_lookup(switch_netc_dtls, vnetwork_passport_lookup);
+	}
+
+	/* the other switches name the network of the trunk they open */
+	if (switch_cfg->trunk_port) {
+		switch_netc_trunk = net_server(switch_cfg->listen_ip, switch_cfg->trunk_port, NET_PROTO_TCP,
+			NET_SECURE_ADH, NULL, on_trunk_connect, on_trunk_disconnect, on_trunk_input, on_trunk_secure);
+
+		if (switch_netc_trunk == NULL)
+			jlog(L_WARNING, "net_server trunk failed");
+		else
+			net_set_passport_lookup(switch_netc_trunk, vnetwork_passport_lookup);
+	}
+
+	if (switch_cfg->upgrade_socket != NULL &&
+	    upgrade_listen(switch_cfg->upgrade_socket) == -1)
+		jlog(L_WARNING, "upgrade_listen failed, no hot restart");
+
+	return 0;
+}
+
 void *
 switch_init(void *cfg)
 {
+	int	i;
+
 	switch_cfg = cfg;
 	switch_cfg->switch_running = 1;
 
+	for (i = 0; i < TRUNK_PEERS_MAX; i++)
+		trunk_probe_init(&trunk_probes[i]);
+
+	if (switch_cfg->p2p_bytes_ps || switch_cfg->p2p_frames_ps) {
+		promote = promote_new(switch_cfg->p2p_bytes_ps, switch_cfg->p2p_frames_ps);
+		if (promote == NULL)
+			jlog(L_WARNING, "promote_new failed, every pair goes p2p");
+	}
+
 	while (switch_cfg->ctrl_initialized == 0)
 		sleep(1);
 
-	switch_netc = net_server(switch_cfg->listen_ip, switch_cfg->listen_port, NET_PROTO_UDT, NET_SECURE_ADH, NULL,
-		on_connect, on_disconnect, on_input, on_secure);
-
-	if (switch_netc == NULL) {
-		jlog(L_ERROR, "net_server failed");
+	if (switch_cfg->replica_role != NULL &&
+	    (replica_passport = pki_passport_load_from_file(switch_cfg->cert,
+	    switch_cfg->pkey, switch_cfg->tcert)) == NULL) {
+		jlog(L_ERROR, "unable to load the passport of the replica");
 		return NULL;
 	}
 
+	/* the standby listens once it takes over */
+	if (switch_cfg->replica_role != NULL &&
+	    strcmp(switch_cfg->replica_role, "standby") == 0) {
+		if (replica_follow(switch_cfg->replica_address, switch_cfg->replica_port,
+		    replica_passport, follow_neigh) == -1) {
+			jlog(L_ERROR, "replica_follow failed");
+			return NULL;
+		}
+	} else {
+		if (switch_listen() == -1)
+			return NULL;
+
+		if (switch_cfg->replica_role != NULL &&
+		    strcmp(switch_cfg->replica_role, "active") == 0 &&
+		    replica_listen(switch_cfg->replica_address, switch_cfg->replica_port,
+		    replica_passport, snapshot) == -1)
+			jlog(L_WARNING, "replica_listen failed, running without a standby");
+	}
+
 	pthread_t thread_loop;
 	pthread_attr_t attr;
 
@@ -375,5 +1625,23 @@ switch_init(void *cfg)
 void
 switch_fini()
 {
+	int	i;
+
 	net_disconnect(switch_netc);
+	net_disconnect(switch_netc_tcp);
+	net_disconnect(switch_netc_dtls);
+	net_disconnect(switch_netc_trunk);
+	for (i = 0; i < TRUNK_PEERS_MAX; i++)
+		trunk_probe_fini(&trunk_probes[i]);
+	replica_fini();
+	if (replica_passport != NULL)
+		pki_passport_destroy(replica_passport);
+	upgrade_fini();
+
+	DNDSTemplate_del(netinfo_response[0]);
+	DNDSTemplate_del(netinfo_response[1]);
+	DNDSTemplate_del(data_ack);
+	DNDSTemplate_del(switch_frame);
+	promote_free(promote);
+	request_fini();
 }
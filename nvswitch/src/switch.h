@@ -16,12 +16,28 @@
 #ifndef SWITCH_H
 #define SWITCH_H
 
+#define FLOOD_SESSION_PPS	1000	/* default limits of the flooded frames */
+#define FLOOD_NETWORK_PPS	10000
+
+#define P2P_BYTES_PS		65536	/* relayed traffic that makes a pair go p2p */
+#define P2P_FRAMES_PS		200
+#define P2P_PROMOTIONS		6	/* rendezvous per minute of an agent */
+
+#define UPGRADE_DRAIN		30	/* seconds a replaced switch takes to let its sessions go */
+
+#define TRUNK_PEERS_MAX		8	/* switches a switch opens trunks to */
+
+#define SWITCH_STATUS		10000	/* ms between two load reports to the controller */
+
 struct switch_cfg {
 
 	const char *log_file;
 
 	const char *listen_ip;
+	const char *public_address;	/* where the agents reach us, see placement */
 	const char *listen_port;
+	const char *listen_port_tcp;
+	const char *listen_port_dtls;
 
 	const char *ctrler_ip;
 	const char *ctrler_port;
@@ -30,6 +46,28 @@ struct switch_cfg {
 	const char *pkey;
 	const char *tcert;
 
+	int mss_clamp;
+
+	int flood_session_pps;		/* flooded frames per second, 0 is unlimited */
+	int flood_network_pps;
+
+	int p2p_bytes_ps;		/* 0 and 0 promote every pair at once */
+	int p2p_frames_ps;
+	int p2p_promotions;		/* per minute, 0 is unlimited */
+
+	const char *replica_role;	/* "active", "standby" or none */
+	const char *replica_address;	/* listened on by the active, reached by the standby */
+	const char *replica_port;
+	const char *ticket_key;		/* TLS session ticket key shared by the two */
+
+	const char *upgrade_socket;	/* where the next process takes the listeners */
+	int upgrade_drain;		/* seconds */
+
+	const char *trunk_port;		/* where the other switches open their trunks */
+	const char *trunk_peer_ip[TRUNK_PEERS_MAX];	/* the switches we open trunks to */
+	const char *trunk_peer_port[TRUNK_PEERS_MAX];
+	int trunk_peers;
+
 	int ctrl_initialized;
 	int ctrl_running;
 	int switch_running;
@@ -0,0 +1,77 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#include <time.h>
+
+#include "tbucket.h"
+
+/* monotonic clock, in ms */
+uint64_t tbucket_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* A bucket starts full; burst defaults to one second worth of tokens. */
+void tbucket_init(struct tbucket *tb, uint32_t rate, uint32_t burst)
+{
+	tb->rate = rate;
+	tb->burst = burst ? burst : rate;
+	tb->tokens = (uint64_t)tb->burst * 1000;
+	tb->last = 0;
+}
+
+static void tbucket_refill(struct tbucket *tb, uint64_t now)
+{
+	uint64_t max;
+
+	max = (uint64_t)tb->burst * 1000;
+	if (now > tb->last) {
+		/* a long idle period refills it completely */
+		if (now - tb->last > max / tb->rate)
+			tb->tokens = max;
+		else
+			tb->tokens += (now - tb->last) * tb->rate;
+		if (tb->tokens > max)
+			tb->tokens = max;
+		tb->last = now;
+	}
+}
+
+/* Returns 0 when the bucket holds cost tokens, -1 otherwise. */
+int tbucket_check(struct tbucket *tb, uint32_t cost, uint64_t now)
+{
+	if (tb->rate == 0)
+		return 0;
+
+	tbucket_refill(tb, now);
+
+	return tb->tokens < (uint64_t)cost * 1000 ? -1 : 0;
+}
+
+/* Like tbucket_check(), and removes the tokens on success. */
+int tbucket_take(struct tbucket *tb, uint32_t cost, uint64_t now)
+{
+	if (tbucket_check(tb, cost, now) == -1)
+		return -1;
+
+	if (tb->rate == 0)
+		return 0;
+
+	tb->tokens -= (uint64_t)cost * 1000;
+	return 0;
+}
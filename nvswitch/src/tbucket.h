@@ -0,0 +1,35 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef TBUCKET_H
+#define TBUCKET_H
+
+#include <stdint.h>
+
+/* The tokens are kept in thousandths so that a rate given per second
+ * refills without rounding at a millisecond granularity. */
+struct tbucket {
+	uint32_t rate;		/* tokens per second, 0 is unlimited */
+	uint32_t burst;		/* depth of the bucket, in tokens */
+	uint64_t tokens;	/* thousandths of a token */
+	uint64_t last;		/* ms of the last refill */
+};
+
+uint64_t tbucket_now();
+void tbucket_init(struct tbucket *tb, uint32_t rate, uint32_t burst);
+int tbucket_check(struct tbucket *tb, uint32_t cost, uint64_t now);
+int tbucket_take(struct tbucket *tb, uint32_t cost, uint64_t now);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include "../ethhdr.h"
+
+static uint8_t frame[8][64];
+static size_t size[8];
+
+static void set_frame(int i, const uint8_t *dst, uint16_t type, size_t len)
+{
+	memset(frame[i], 0, sizeof(frame[i]));
+	memcpy(frame[i], dst, 6);
+	frame[i][6] = 0x02;
+	frame[i][12] = type >> 8;
+	frame[i][13] = type & 0xff;
+	size[i] = len;
+}
+
+int main()
+{
+	const uint8_t ucast[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+	const uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	const uint8_t mcast4[6] = { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb };
+	const uint8_t mcast6[6] = { 0x33, 0x33, 0xff, 0x00, 0x00, 0x01 };
+	const uint8_t stp[6] = { 0x01, 0x80, 0xc2, 0x00, 0x00, 0x00 };
+	const uint8_t not4[6] = { 0x01, 0x00, 0x5e, 0x80, 0x00, 0x01 };
+	uint8_t *frames[8];
+	struct ethhdr_info info[8];
+	int i;
+
+	set_frame(0, ucast, 0x0800, 60);
+	set_frame(1, bcast, 0x0806, 60);
+	set_frame(2, mcast4, 0x0800, 60);
+	set_frame(3, mcast6, 0x86dd, 60);
+	set_frame(4, stp, 0x0026, 60);
+	set_frame(5, not4, 0x0800, 60);
+
+	/* 802.1ad, then 802.1Q, VLAN 100 */
+	set_frame(6, ucast, 0x88a8, 64);
+	frame[6][14] = 0x00; frame[6][15] = 0x64;
+	frame[6][16] = 0x81; frame[6][17] = 0x00;
+	frame[6][20] = 0x86; frame[6][21] = 0xdd;
+
+	/* a runt, and a frame too short for the vector path */
+	set_frame(7, mcast6, 0x86dd, 14);
+
+	for (i = 0; i < 8; i++)
+		frames[i] = frame[i];
+
+	ethhdr_classify(frames, size, 8, info);
+
+	if (info[0].dst_type != ADDR_UNICAST || info[0].ether_type != 0x0800
+		|| info[0].l3_offset != 14)
+		goto out;
+
+	if (info[1].dst_type != ADDR_BROADCAST || info[1].ether_type != 0x0806)
+		goto out;
+
+	if (info[2].dst_type != ADDR_MULTICAST || info[2].mcast != ETHHDR_MCAST_IPV4)
+		goto out;
+
+	if (info[3].dst_type != ADDR_MULTICAST || info[3].mcast != ETHHDR_MCAST_IPV6)
+		goto out;
+
+	if (info[4].dst_type != ADDR_MULTICAST || info[4].mcast != ETHHDR_MCAST_OTHER)
+		goto out;
+
+	/* the high bit of the fourth octet is outside the IPv4 range */
+	if (info[5].dst_type != ADDR_MULTICAST || info[5].mcast != ETHHDR_MCAST_OTHER)
+		goto out;
+
+	if (info[6].dst_type != ADDR_UNICAST || info[6].tags != 2 || info[6].vlan_id != 100
+		|| info[6].ether_type != 0x86dd || info[6].l3_offset != 22)
+		goto out;
+
+	if (info[7].dst_type != ADDR_MULTICAST || info[7].mcast != ETHHDR_MCAST_IPV6)
+		goto out;
+
+	size[7] = 13;
+	ethhdr_classify(&frames[7], &size[7], 1, &info[7]);
+	if (info[7].dst_type != 0)
+		goto out;
+
+	if (ethhdr_mac_type(mcast6) != ADDR_MULTICAST || ethhdr_mac_type(ucast) != ADDR_UNICAST
+		|| ethhdr_mac_type(bcast) != ADDR_BROADCAST)
+		goto out;
+
+	return 0;
+
+out:
+	printf("ethhdr classification failed\n");
+	return -1;
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+#include <sys/socket.h>
+#include "jsw_hlib.h"
+#include "../mcast.h"
+
+static int sa, sb, sc;		/* three sessions */
+
+static size_t igmp(uint8_t *f, uint8_t *src, uint8_t type, uint8_t *group, uint8_t *igmp_rec, size_t rec_len)
+{
+	memset(f, 0, 128);
+	f[0] = 0x01; f[2] = 0x5e; f[5] = 0x16;
+	memcpy(f + 6, src, 6);
+	f[12] = 0x08;
+	f[14] = 0x46; f[23] = 2;
+	f[38] = type;
+	if (group)
+		memcpy(f + 42, group, 4);
+	if (igmp_rec) {
+		f[45] = 1;
+		memcpy(f + 46, igmp_rec, rec_len);
+		return 46 + rec_len;
+	}
+	return 46;
+}
+
+static int has(struct mcast_member *m, void *session)
+{
+	for (; m != NULL; m = m->next)
+		if (m->session == session)
+			return 1;
+	return 0;
+}
+
+static uint32_t pseudo(const uint8_t *p, size_t len)
+{
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (p[i] << 8) | p[i+1];
+	return sum;
+}
+
+static int checksum_ok(const uint8_t *p, size_t len, uint32_t sum)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (p[i] << 8) | p[i+1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum == 0xffff;
+}
+
+int main()
+{
+	mcast_t *mcast;
+	struct ethhdr_info eth;
+	uint8_t frame[256], *f = frame;
+	uint8_t src[6] = { 0x02, 0, 0, 0, 0, 1 };
+	uint8_t group[4] = { 239, 1, 2, 3 };
+	uint8_t gmac[6] = { 0x01, 0x00, 0x5e, 0x01, 0x02, 0x03 };
+	uint8_t g6mac[6] = { 0x33, 0x33, 0, 0, 0x12, 0x34 };
+	uint8_t rec[8] = { 4, 0, 0, 0, 239, 1, 2, 3 };	/* CHANGE_TO_EXCLUDE {} */
+	size_t size;
+	uint64_t now = 1000;
+	int ret = -1;
+
+	mcast = mcast_new(64);
+
+	/* the link-local groups are always flooded */
+	if (!mcast_flooded((uint8_t []){ 0x01, 0x00, 0x5e, 0, 0, 0xfb }) ||
+	    !mcast_flooded((uint8_t []){ 0x33, 0x33, 0xff, 1, 2, 3 }) ||
+	    mcast_flooded(gmac) || mcast_flooded(g6mac))
+		goto out;
+
+	/* v2 report from a, v3 report from b */
+	size = igmp(frame, src, 0x16, group, NULL, 0);
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (mcast_snoop(mcast, frame, size, &eth, &sa, now) != MCAST_REPORT)
+		goto out;
+	size = igmp(frame, src, 0x22, NULL, rec, sizeof(rec));
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (mcast_snoop(mcast, frame, size, &eth, &sb, now) != MCAST_REPORT)
+		goto out;
+
+	if (!has(mcast_members(mcast, gmac, now), &sa) ||
+	    !has(mcast_members(mcast, gmac, now), &sb) ||
+	    has(mcast_members(mcast, gmac, now), &sc))
+		goto out;
+
+	/* a query marks c as a router */
+	size = igmp(frame, src, 0x11, NULL, NULL, 0);
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (mcast_snoop(mcast, frame, size, &eth, &sc, now) != MCAST_QUERY ||
+	    !has(mcast->routers, &sc))
+		goto out;
+
+	/* a leaves, b's session goes away */
+	size = igmp(frame, src, 0x17, group, NULL, 0);
+	ethhdr_classify(&f, &size, 1, &eth);
+	mcast_snoop(mcast, frame, size, &eth, &sa, now);
+	if (has(mcast_members(mcast, gmac, now), &sa) ||
+	    !has(mcast_members(mcast, gmac, now), &sb))
+		goto out;
+
+	mcast_forget(mcast, &sb);
+	if (mcast_members(mcast, gmac, now) != NULL)
+		goto out;
+
+	/* memberships age out without a new report */
+	if (mcast_join(mcast, g6mac, &sa, now) != 0 ||
+	    !has(mcast_members(mcast, g6mac, now + MCAST_MEMBER_TIMEOUT - 1), &sa) ||
+	    mcast_members(mcast, g6mac, now + MCAST_MEMBER_TIMEOUT) != NULL)
+		goto out;
+
+	mcast_join(mcast, g6mac, &sa, now);
+	mcast_join(mcast, gmac, &sb, now);
+	mcast_expire(mcast, now + MCAST_MEMBER_TIMEOUT);
+	if (mcast->routers != NULL || jsw_hsize(mcast->groups) != 0)
+		goto out;
+
+	/* the queries */
+	if (mcast->ready != 0)
+		goto out;
+	size = mcast_query(mcast, AF_INET, frame, now);
+	if (size != 60 || mcast->ready != now + MCAST_RESPONSE ||
+	    !checksum_ok(frame + 14, 24, 0) || !checksum_ok(frame + 38, 12, 0))
+		goto out;
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (mcast_snoop(mcast, frame, size, &eth, &sa, now) != MCAST_QUERY)
+		goto out;
+
+	size = mcast_query(mcast, AF_INET6, frame, now);
+	if (size != 90 || size > MCAST_QUERY_MAX ||
+	    !checksum_ok(frame + 62, 28, pseudo(frame + 22, 32) + 28 + 58))
+		goto out;
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (mcast_snoop(mcast, frame, size, &eth, &sb, now) != MCAST_QUERY)
+		goto out;
+
+	ret = 0;
+out:
+	mcast_free(mcast);
+	return ret;
+}
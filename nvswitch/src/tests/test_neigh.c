@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "../neigh.h"
+
+static uint8_t mac_a[6] = { 0x02, 0, 0, 0, 0, 0xa };
+static uint8_t mac_b[6] = { 0x02, 0, 0, 0, 0, 0xb };
+static uint8_t ip_a[4] = { 44, 128, 0, 10 };
+static uint8_t ip_b[4] = { 44, 128, 0, 11 };
+static uint8_t ip6_a[16] = { 0xfe, 0x80, [15] = 0x0a };
+static uint8_t ip6_b[16] = { 0xfe, 0x80, [15] = 0x0b };
+
+static size_t arp(uint8_t *f, uint16_t oper, uint8_t *sha, uint8_t *spa, uint8_t *tpa)
+{
+	memset(f, 0, 60);
+	memset(f, 0xff, 6);
+	memcpy(f + 6, sha, 6);
+	f[12] = 0x08; f[13] = 0x06;
+	f[15] = 1; f[16] = 0x08; f[18] = 6; f[19] = 4; f[21] = oper;
+	memcpy(f + 22, sha, 6);
+	memcpy(f + 28, spa, 4);
+	memcpy(f + 38, tpa, 4);
+	return 60;
+}
+
+static size_t ns(uint8_t *f, uint8_t *src_mac, uint8_t *src, uint8_t *target)
+{
+	uint8_t *ip6 = f + 14, *icmp = f + 54;
+
+	memset(f, 0, 86);
+	f[0] = 0x33; f[1] = 0x33; f[2] = 0xff; f[5] = target[15];
+	memcpy(f + 6, src_mac, 6);
+	f[12] = 0x86; f[13] = 0xdd;
+	ip6[0] = 0x60; ip6[5] = 32; ip6[6] = 58; ip6[7] = 255;
+	memcpy(ip6 + 8, src, 16);
+	ip6[24] = 0xff; ip6[25] = 0x02; ip6[35] = 1; ip6[36] = 0xff; ip6[39] = target[15];
+	icmp[0] = 135;
+	memcpy(icmp + 8, target, 16);
+	icmp[24] = 1; icmp[25] = 1;
+	memcpy(icmp + 26, src_mac, 6);
+	return 86;
+}
+
+static int checksum_ok(uint8_t *ip6, uint8_t *icmp, size_t len)
+{
+	uint32_t sum = len + 58;
+	size_t i;
+
+	for (i = 8; i < 40; i += 2)
+		sum += (ip6[i] << 8) | ip6[i+1];
+	for (i = 0; i < len; i += 2)
+		sum += (icmp[i] << 8) | icmp[i+1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum == 0xffff;
+}
+
+int main()
+{
+	neigh_t *neigh;
+	struct ethhdr_info eth;
+	uint8_t frame[600], reply[NEIGH_REPLY_MAX];
+	uint8_t *f = frame;
+	uint8_t zero[4] = { 0 };
+	size_t size, reply_size;
+	const uint8_t *mac;
+	int ret = -1;
+
+	neigh = neigh_new(64);
+
+	/* B asks for A, nobody knows A yet */
+	size = arp(frame, 1, mac_b, ip_b, ip_a);
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 0);
+	if (neigh_proxy(neigh, frame, size, &eth, reply, &reply_size) != NULL)
+		goto out;
+
+	/* but B is learned from its request */
+	mac = neigh_find(neigh, AF_INET, ip_b);
+	if (mac == NULL || memcmp(mac, mac_b, 6) != 0)
+		goto out;
+
+	/* a sender can't claim an address for another MAC */
+	size = arp(frame, 2, mac_a, ip_a, ip_b);
+	memcpy(frame + 6, mac_b, 6);
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 0);
+	if (neigh_find(neigh, AF_INET, ip_a) != NULL)
+		goto out;
+
+	/* the address reported in the netinfo, a probe can't be learned */
+	if (neigh_learn(neigh, AF_INET, ip_a, mac_a) != 0 ||
+	    neigh_learn(neigh, AF_INET, zero, mac_a) != -1)
+		goto out;
+
+	/* now B's request is answered by the switch on behalf of A */
+	size = arp(frame, 1, mac_b, ip_b, ip_a);
+	ethhdr_classify(&f, &size, 1, &eth);
+	mac = neigh_proxy(neigh, frame, size, &eth, reply, &reply_size);
+	if (mac == NULL || memcmp(mac, mac_a, 6) != 0 || reply_size != 60)
+		goto out;
+	if (memcmp(reply, mac_b, 6) != 0 || memcmp(reply + 6, mac_a, 6) != 0 ||
+	    reply[21] != 2 || memcmp(reply + 22, mac_a, 6) != 0 ||
+	    memcmp(reply + 28, ip_a, 4) != 0 || memcmp(reply + 32, mac_b, 6) != 0 ||
+	    memcmp(reply + 38, ip_b, 4) != 0)
+		goto out;
+
+	/* A asking for itself isn't answered */
+	size = arp(frame, 1, mac_a, ip_b, ip_a);
+	ethhdr_classify(&f, &size, 1, &eth);
+	if (neigh_proxy(neigh, frame, size, &eth, reply, &reply_size) != NULL)
+		goto out;
+
+	/* IPv6, A's solicitation teaches its address, B's gets answered */
+	size = ns(frame, mac_a, ip6_a, ip6_b);
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 0);
+	size = ns(frame, mac_b, ip6_b, ip6_a);
+	ethhdr_classify(&f, &size, 1, &eth);
+	mac = neigh_proxy(neigh, frame, size, &eth, reply, &reply_size);
+	if (mac == NULL || memcmp(mac, mac_a, 6) != 0 || reply_size != 86)
+		goto out;
+	if (memcmp(reply, mac_b, 6) != 0 || reply[54] != 136 ||
+	    memcmp(reply + 22, ip6_a, 16) != 0 || memcmp(reply + 38, ip6_b, 16) != 0 ||
+	    memcmp(reply + 62, ip6_a, 16) != 0 || memcmp(reply + 80, mac_a, 6) != 0 ||
+	    !checksum_ok(reply + 14, reply + 54, 32))
+		goto out;
+
+	/* DHCP ack from a server, leasing .12 to B */
+	memset(frame, 0, sizeof(frame));
+	memset(frame, 0xff, 6);
+	memcpy(frame + 6, mac_a, 6);
+	frame[12] = 0x08;
+	frame[14] = 0x45; frame[23] = 17;
+	frame[34] = 0; frame[35] = 67; frame[36] = 0; frame[37] = 68;
+	frame[42] = 2; frame[43] = 1; frame[44] = 6;
+	frame[58] = 44; frame[59] = 128; frame[61] = 12;
+	memcpy(frame + 70, mac_b, 6);
+	frame[278] = 99; frame[279] = 130; frame[280] = 83; frame[281] = 99;
+	frame[282] = 53; frame[283] = 1; frame[284] = 5; frame[285] = 255;
+	size = 300;
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 0);
+	ip_b[3] = 12;
+	/* broadcast, anybody could have sent it */
+	if (neigh_find(neigh, AF_INET, ip_b) != NULL)
+		goto out;
+
+	/* unicast to a node of another session than the server */
+	memcpy(frame, mac_b, 6);
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 0);
+	if (neigh_find(neigh, AF_INET, ip_b) != NULL)
+		goto out;
+	neigh_snoop(neigh, frame, size, &eth, 1);
+	mac = neigh_find(neigh, AF_INET, ip_b);
+	if (mac == NULL || memcmp(mac, mac_b, 6) != 0)
+		goto out;
+
+	/* but not to another node than chaddr */
+	frame[61] = 13;
+	memcpy(frame, mac_a, 6);
+	ethhdr_classify(&f, &size, 1, &eth);
+	neigh_snoop(neigh, frame, size, &eth, 1);
+	ip_b[3] = 13;
+	if (neigh_find(neigh, AF_INET, ip_b) != NULL)
+		goto out;
+
+	/* a host moving its address */
+	if (neigh_learn(neigh, AF_INET, ip_a, mac_b) != 0 ||
+	    memcmp(neigh_find(neigh, AF_INET, ip_a), mac_b, 6) != 0)
+		goto out;
+
+	ret = 0;
+out:
+	neigh_free(neigh);
+	return ret;
+}
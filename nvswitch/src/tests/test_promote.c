@@ -0,0 +1,59 @@
+#include "../promote.h"
+
+int main()
+{
+	promote_t *promote;
+	int a, b, c, i;
+	uint64_t now = 1000;
+	int ret = -1;
+
+	/* without thresholds every pair is promoted, the way it used to be */
+	promote = promote_new(0, 0);
+	if (promote_account(promote, &a, &b, 60, now) != 1)
+		goto out;
+	promote_free(promote);
+
+	/* 100 KB/s or 1000 frames/s */
+	promote = promote_new(100000, 1000);
+
+	/* a short exchange stays relayed */
+	for (i = 0; i < 20; i++) {
+		if (promote_account(promote, &a, &b, 1500, now) != 0)
+			goto out;
+	}
+
+	/* but it decays away, another second of it isn't enough either */
+	now += 10 * PROMOTE_EPOCH;
+	for (i = 0; i < 100; i++) {
+		if (promote_account(promote, &a, &b, 1000, now + i * 10) != 0)
+			goto out;
+	}
+
+	/* a sustained 150 KB/s gets there, whatever the direction */
+	now += 10 * PROMOTE_EPOCH;
+	for (i = 0; i < 3000; i++) {
+		if (promote_account(promote, i & 1 ? &a : &b, i & 1 ? &b : &a,
+					1500, now + i * 10) == 1)
+			break;
+	}
+	if (i == 3000 || i < 100)
+		goto out;
+
+	/* the counters of a pair aren't another's */
+	if (promote_account(promote, &a, &c, 1500, now + i * 10) != 0)
+		goto out;
+
+	/* many small frames, 2000 frames/s */
+	now += 100 * PROMOTE_EPOCH;
+	for (i = 0; i < 3000; i++) {
+		if (promote_account(promote, &b, &c, 64, now + i / 2) == 1)
+			break;
+	}
+	if (i == 3000)
+		goto out;
+
+	ret = 0;
+out:
+	promote_free(promote);
+	return ret;
+}
@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "../replica.h"
+
+static const char *network = "cb6a4f5e-4f4c-4a4b-9a0f-6b1e2f6f6c01";
+static const char *node_a = "0f1d7e4a-2c3b-4d5e-8f90-a1b2c3d4e5f6";
+static const char *node_b = "9e8d7c6b-5a49-4382-a1b0-c9d8e7f6a5b4";
+
+static int neighs = 0;
+static int installed = 0;
+
+static void on_neigh(const char *net, const uint8_t *ip, const uint8_t *mac)
+{
+	if (strcmp(net, network) == 0 && ip[15] == 7 && mac[5] == 7)
+		neighs++;
+}
+
+static void install(void *arg, const uint8_t *mac)
+{
+	if (mac[0] == 0x02 && mac[5] == *(uint8_t *)arg)
+		installed++;
+}
+
+static void record(int type, const char *node, uint8_t last)
+{
+	struct replica_rec rec;
+	uint8_t buf[REPLICA_REC_LEN];
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	rec.mac[0] = 0x02;
+	rec.mac[5] = last;
+	rec.ip[15] = last;
+	strcpy(rec.network, network);
+	if (node != NULL)
+		strcpy(rec.node, node);
+
+	/* what the standby applies went over the wire */
+	replica_encode(&rec, buf);
+	if (replica_decode(buf, &rec) == 0)
+		replica_apply(&rec);
+}
+
+int main()
+{
+	struct replica_rec rec, dec;
+	uint8_t buf[REPLICA_REC_LEN];
+	uint8_t last;
+	int ret = -1;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = REPLICA_MAC_ADD;
+	memcpy(rec.mac, "\x02\x00\x00\x00\x00\x01", 6);
+	strcpy(rec.network, network);
+	strcpy(rec.node, node_a);
+
+	replica_encode(&rec, buf);
+	if (replica_decode(buf, &dec) != 0 || memcmp(&rec, &dec, sizeof(rec)) != 0)
+		goto out;
+
+	/* an unknown type or an unterminated uuid is refused */
+	buf[0] = 42;
+	if (replica_decode(buf, &dec) != -1)
+		goto out;
+	buf[0] = REPLICA_MAC_ADD;
+	buf[REPLICA_REC_LEN - 1] = 'x';
+	if (replica_decode(buf, &dec) != -1)
+		goto out;
+
+	if (replica_follow("127.0.0.1", "9093", NULL, on_neigh) != 0)
+		goto out;
+
+	record(REPLICA_SESSION_UP, node_a, 1);
+	record(REPLICA_SESSION_UP, node_b, 2);
+	record(REPLICA_MAC_ADD, node_a, 1);
+	record(REPLICA_MAC_ADD, node_a, 3);
+	record(REPLICA_MAC_ADD, node_b, 2);
+	record(REPLICA_MAC_ADD, node_b, 4);
+	record(REPLICA_NEIGH, NULL, 7);
+
+	/* an address moved to node_a, another one is gone */
+	record(REPLICA_MAC_ADD, node_a, 4);
+	record(REPLICA_MAC_DEL, NULL, 3);
+	record(REPLICA_SYNCED, NULL, 0);
+
+	if (neighs != 1)
+		goto out;
+
+	last = 1;
+	installed = 0;
+	if (replica_restore(network, node_a, install, &last) != 2 || installed != 1)
+		goto out;
+
+	/* restored once only */
+	if (replica_restore(network, node_a, install, &last) != 0)
+		goto out;
+
+	last = 2;
+	installed = 0;
+	if (replica_restore(network, node_b, install, &last) != 1 || installed != 1)
+		goto out;
+
+	if (replica_restore("another", node_b, install, &last) != 0)
+		goto out;
+
+	ret = 0;
+out:
+	replica_fini();
+	return ret;
+}
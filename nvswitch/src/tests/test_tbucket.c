@@ -0,0 +1,70 @@
+#include "../tbucket.h"
+
+int main()
+{
+	struct tbucket tb;
+	int i;
+	int ret = -1;
+
+	/* unlimited */
+	tbucket_init(&tb, 0, 0);
+	for (i = 0; i < 100000; i++) {
+		if (tbucket_take(&tb, 1, 1000) == -1)
+			goto out;
+	}
+
+	/* 100 per second, burst of 10 */
+	tbucket_init(&tb, 100, 10);
+	for (i = 0; i < 10; i++) {
+		if (tbucket_take(&tb, 1, 1000) == -1)
+			goto out;
+	}
+	if (tbucket_take(&tb, 1, 1000) != -1)
+		goto out;
+
+	/* 10ms later, one token is back */
+	if (tbucket_take(&tb, 1, 1010) == -1)
+		goto out;
+	if (tbucket_take(&tb, 1, 1010) != -1)
+		goto out;
+
+	/* 5ms is half a token, the rest comes with the next 5ms */
+	if (tbucket_take(&tb, 1, 1015) != -1)
+		goto out;
+	if (tbucket_take(&tb, 1, 1020) == -1)
+		goto out;
+
+	/* never more than the burst, even after a long idle */
+	for (i = 0; i < 10; i++) {
+		if (tbucket_take(&tb, 1, 100000000) == -1)
+			goto out;
+	}
+	if (tbucket_take(&tb, 1, 100000000) != -1)
+		goto out;
+
+	/* a clock going backward doesn't refill */
+	if (tbucket_take(&tb, 1, 5000) != -1)
+		goto out;
+
+	/* checking doesn't take anything */
+	tbucket_init(&tb, 1, 2);
+	if (tbucket_check(&tb, 2, 1000) == -1 || tbucket_check(&tb, 2, 1000) == -1 ||
+	    tbucket_check(&tb, 3, 1000) != -1)
+		goto out;
+	if (tbucket_take(&tb, 2, 1000) == -1 || tbucket_check(&tb, 1, 1000) != -1)
+		goto out;
+
+	/* the burst defaults to one second */
+	tbucket_init(&tb, 50, 0);
+	if (tbucket_take(&tb, 50, 1000) == -1)
+		goto out;
+	if (tbucket_take(&tb, 1, 1000) != -1)
+		goto out;
+
+	if (tbucket_now() == 0)
+		goto out;
+
+	ret = 0;
+out:
+	return ret;
+}
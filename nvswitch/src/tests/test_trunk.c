@@ -0,0 +1,93 @@
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../trunk.h"
+
+/* the probe of a peer listening on port, or not, hands its
+ * connection over once the peer is reachable */
+static int probe(const char *port)
+{
+	struct trunk_probe probe;
+	uint64_t now = 1;
+	int i, fd, ret = 0;
+
+	trunk_probe_init(&probe);
+	for (i = 0; i < 100 && ret == 0; i++, now++) {
+		ret = trunk_probe(&probe, "127.0.0.1", port, now);
+		usleep(1000);
+	}
+	fd = trunk_probe_take(&probe);
+	if ((ret == 1) != (fd >= 0) || trunk_probe_take(&probe) != -1)
+		ret = -1;
+	if (fd >= 0)
+		close(fd);
+	trunk_probe_fini(&probe);
+
+	return ret;
+}
+
+int main()
+{
+	uint8_t frame[TRUNK_FRAME_MAX];
+	uint8_t macs[6 * TRUNK_MACS_MAX];
+	const uint8_t *parsed;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	char port[8];
+	size_t size;
+	uint8_t op;
+	int i, sock;
+
+	for (i = 0; i < TRUNK_MACS_MAX; i++) {
+		memcpy(macs + 6 * i, "\x02\x00\x00\x00\x00\x00", 6);
+		macs[6 * i + 5] = i;
+	}
+
+	/* a short frame is padded to the ethernet minimum */
+	size = trunk_frame(frame, TRUNK_MAC_ADD, macs, 1);
+	if (size != 60 || !trunk_is_control(frame, size))
+		return 1;
+	if (trunk_parse(frame, size, &op, &parsed) != 1 || op != TRUNK_MAC_ADD ||
+	    memcmp(parsed, macs, 6) != 0)
+		return 1;
+
+	size = trunk_frame(frame, TRUNK_MAC_DEL, macs, TRUNK_MACS_MAX);
+	if (size != TRUNK_FRAME_MAX)
+		return 1;
+	if (trunk_parse(frame, size, &op, &parsed) != TRUNK_MACS_MAX || op != TRUNK_MAC_DEL ||
+	    memcmp(parsed, macs, sizeof(macs)) != 0)
+		return 1;
+
+	/* truncated, an unknown operation, a frame of a node */
+	if (trunk_parse(frame, size - 1, &op, &parsed) != -1)
+		return 1;
+	frame[18] = 42;
+	if (trunk_parse(frame, size, &op, &parsed) != -1)
+		return 1;
+	frame[13] = 0x00;
+	if (trunk_is_control(frame, size) || trunk_parse(frame, size, &op, &parsed) != -1)
+		return 1;
+
+	/* a peer that listens, then one that doesn't */
+	sock = socket(PF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0 ||
+	    getsockname(sock, (struct sockaddr *)&addr, &len) < 0)
+		return 1;
+	snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+	if (probe(port) != 1)
+		return 1;
+	close(sock);
+	if (probe(port) != 0)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Trunks between the switches hosting the same network.
+ *
+ * A trunk is a netbus connection that carries the frames of one
+ * network from a switch to another. The switches tell each other the
+ * addresses of their nodes with control frames sent on the trunk,
+ * the frames of the nodes are forwarded as they are. A control frame
+ * has zero addresses, the TRUNK_ETHERTYPE, "NVTR", the operation, the
+ * count on two bytes and that many addresses.
+ */
+
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trunk.h"
+
+#define TRUNK_MIN_FRAME		60
+
+/* Returns the size of the frame announcing count addresses */
+size_t trunk_frame(uint8_t *frame, uint8_t op, const uint8_t *macs, int count)
+{
+	size_t frame_size;
+
+	if (count > TRUNK_MACS_MAX)
+		count = TRUNK_MACS_MAX;
+
+	memset(frame, 0, 12);
+	frame[12] = TRUNK_ETHERTYPE >> 8;
+	frame[13] = TRUNK_ETHERTYPE & 0xff;
+	memcpy(frame + 14, "NVTR", 4);
+	frame[18] = op;
+	frame[19] = count >> 8;
+	frame[20] = count & 0xff;
+	memcpy(frame + TRUNK_HDR_LEN, macs, 6 * count);
+
+	frame_size = TRUNK_HDR_LEN + 6 * count;
+	if (frame_size < TRUNK_MIN_FRAME) {
+		memset(frame + frame_size, 0, TRUNK_MIN_FRAME - frame_size);
+		frame_size = TRUNK_MIN_FRAME;
+	}
+
+	return frame_size;
+}
+
+int trunk_is_control(const uint8_t *frame, size_t frame_size)
+{
+	return frame_size >= 14 &&
+		frame[12] == (TRUNK_ETHERTYPE >> 8) &&
+		frame[13] == (TRUNK_ETHERTYPE & 0xff);
+}
+
+/* Returns the number of addresses the frame carries, -1 if invalid */
+int trunk_parse(const uint8_t *frame, size_t frame_size, uint8_t *op, const uint8_t **macs)
+{
+	int count;
+
+	if (frame_size < TRUNK_HDR_LEN || !trunk_is_control(frame, frame_size) ||
+	    memcmp(frame + 14, "NVTR", 4) != 0)
+		return -1;
+
+	*op = frame[18];
+	if (*op != TRUNK_MAC_ADD && *op != TRUNK_MAC_DEL)
+		return -1;
+
+	count = frame[19] << 8 | frame[20];
+	if (count > TRUNK_MACS_MAX || frame_size < (size_t)(TRUNK_HDR_LEN + 6 * count))
+		return -1;
+
+	*macs = frame + TRUNK_HDR_LEN;
+
+	return count;
+}
+
+void trunk_probe_init(struct trunk_probe *probe)
+{
+	probe->fd = -1;
+	probe->connected = 0;
+	probe->next = 0;
+}
+
+/* The netbus connects in a blocking way, for as long as 5 seconds if
+ * the peer is down. Called from the switch loop, this connects to the
+ * peer without waiting. Returns 1 once the peer is reachable, the
+ * connection is then taken with trunk_probe_take() to carry a trunk. */
+int trunk_probe(struct trunk_probe *probe, const char *ip, const char *port, uint64_t now)
+{
+	struct sockaddr_in addr;
+	struct pollfd pfd;
+	socklen_t len;
+	int err = 0;
+
+	if (probe->fd < 0) {
+		if (now < probe->next)
+			return 0;
+		probe->next = now + TRUNK_RETRY;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(port));
+		addr.sin_addr.s_addr = inet_addr(ip);
+
+		if ((probe->fd = socket(PF_INET, SOCK_STREAM, 0)) < 0)
+			return 0;
+		fcntl(probe->fd, F_SETFL, fcntl(probe->fd, F_GETFL) | O_NONBLOCK);
+
+		if (connect(probe->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+			goto reachable;
+		if (errno != EINPROGRESS)
+			goto down;
+	}
+
+	pfd.fd = probe->fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, 0) == 0) {
+		if (now < probe->next)
+			return 0;
+		/* no answer within TRUNK_RETRY */
+		goto down;
+	}
+
+	len = sizeof(err);
+	if (getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		goto down;
+
+reachable:
+	probe->connected = 1;
+	return 1;
+
+down:
+	trunk_probe_fini(probe);
+	return 0;
+}
+
+/* Returns the connected socket of the probe, -1 if none */
+int trunk_probe_take(struct trunk_probe *probe)
+{
+	int fd;
+
+	if (!probe->connected)
+		return -1;
+
+	fd = probe->fd;
+	probe->fd = -1;
+	probe->connected = 0;
+
+	return fd;
+}
+
+void trunk_probe_fini(struct trunk_probe *probe)
+{
+	if (probe->fd >= 0)
+		close(probe->fd);
+	probe->fd = -1;
+	probe->connected = 0;
+}
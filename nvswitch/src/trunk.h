@@ -0,0 +1,50 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef TRUNK_H
+#define TRUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRUNK_ETHERTYPE		0x88b6	/* local experimental, never leaves a trunk */
+#define TRUNK_RETRY		5000	/* ms between two attempts to reach a peer */
+
+#define TRUNK_ACCEPTED		0xff	/* session->trunk of the trunks dialed by a peer */
+
+/* operations */
+#define TRUNK_MAC_ADD		1	/* reachable through the sender */
+#define TRUNK_MAC_DEL		2	/* gone from the sender */
+
+#define TRUNK_HDR_LEN		21	/* ethernet header, magic, op, count */
+#define TRUNK_MACS_MAX		200
+#define TRUNK_FRAME_MAX		(TRUNK_HDR_LEN + 6 * TRUNK_MACS_MAX)
+
+struct trunk_probe {
+	int fd;				/* connection attempt under way, -1 if none */
+	int connected;			/* fd is connected, see trunk_probe_take() */
+	uint64_t next;			/* ms, time of the next attempt */
+};
+
+size_t trunk_frame(uint8_t *frame, uint8_t op, const uint8_t *macs, int count);
+int trunk_is_control(const uint8_t *frame, size_t frame_size);
+int trunk_parse(const uint8_t *frame, size_t frame_size, uint8_t *op, const uint8_t **macs);
+
+void trunk_probe_init(struct trunk_probe *probe);
+int trunk_probe(struct trunk_probe *probe, const char *ip, const char *port, uint64_t now);
+int trunk_probe_take(struct trunk_probe *probe);
+void trunk_probe_fini(struct trunk_probe *probe);
+
+#endif /* TRUNK_H */
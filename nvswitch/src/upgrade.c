@@ -0,0 +1,279 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+/* Hot restart of the switch.
+ *
+ * A running switch waits on a unix socket for the process that will
+ * replace it. Once that one is ready, it asks for the listening
+ * sockets and gets them with SCM_RIGHTS, along with the TLS session
+ * ticket key, so no connection attempt is refused and the agents that
+ * come over resume their TLS session. The old process then stops
+ * accepting and lets its sessions go, see switch_drain().
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <logger.h>
+
+#include "upgrade.h"
+
+struct upgrade_msg {
+	char magic[4];				/* "NVUP" */
+	uint8_t version;
+	uint8_t count;				/* sockets attached */
+	uint8_t protocol[NET_INHERIT_MAX];
+	char port[NET_INHERIT_MAX][8];
+	uint8_t ticket_key[KRYPT_TICKET_KEY_LEN];
+};
+
+static int listen_fd = -1;
+static char *listen_path = NULL;
+
+static int upgrade_socket(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		jlog(L_ERROR, "upgrade socket path too long: %s", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+static void upgrade_timeout(int sock)
+{
+	struct timeval tv;
+
+	tv.tv_sec = 5;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int upgrade_valid(const struct upgrade_msg *msg, ssize_t len)
+{
+	return len == (ssize_t)sizeof(*msg) &&
+		memcmp(msg->magic, "NVUP", 4) == 0 &&
+		msg->version == UPGRADE_VERSION &&
+		msg->count <= NET_INHERIT_MAX;
+}
+
+/* Take the listening sockets of the switch running on path. Returns
+ * the number of sockets taken, 0 if no switch runs there. */
+int upgrade_take(const char *path)
+{
+	struct sockaddr_un addr;
+	struct upgrade_msg msg;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * NET_INHERIT_MAX)];
+	} control;
+	int fds[NET_INHERIT_MAX];
+	int nfds = 0;
+	int sock, i;
+	ssize_t len;
+	int ret = -1;
+
+	if ((sock = upgrade_socket(path, &addr)) < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		/* nothing to replace, a fresh start */
+		return (errno == ENOENT || errno == ECONNREFUSED) ? 0 : -1;
+	}
+	upgrade_timeout(sock);
+
+	memset(&msg, 0, sizeof(msg));
+	memcpy(msg.magic, "NVUP", 4);
+	msg.version = UPGRADE_VERSION;
+	if (send(sock, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg))
+		goto out;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+
+	len = recvmsg(sock, &mh, MSG_WAITALL);
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > NET_INHERIT_MAX)
+				nfds = NET_INHERIT_MAX;
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+	}
+
+	if (!upgrade_valid(&msg, len) || nfds != msg.count) {
+		jlog(L_ERROR, "the running switch sent an invalid upgrade message");
+		goto out;
+	}
+
+	for (i = 0; i < nfds; i++) {
+		msg.port[i][sizeof(msg.port[i]) - 1] = '\0';
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		net_inherit(msg.protocol[i], msg.port[i], fds[i]);
+	}
+	nfds = 0;
+
+	krypt_set_ticket_key(msg.ticket_key, KRYPT_TICKET_KEY_LEN);
+	jlog(L_NOTICE, "took %d listening sockets over", msg.count);
+	ret = msg.count;
+
+out:
+	/* not handed to the netbus */
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	close(sock);
+
+	return ret;
+}
+
+/* Wait for the process that will replace this one */
+int upgrade_listen(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if ((listen_fd = upgrade_socket(path, &addr)) < 0)
+		return -1;
+
+	/* the socket of the process we replaced, if any */
+	unlink(path);
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 1) < 0) {
+		jlog(L_ERROR, "upgrade socket %s: %s", path, strerror(errno));
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+	chmod(path, S_IRUSR | S_IWUSR);
+	fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+	listen_path = strdup(path);
+
+	return 0;
+}
+
+/* Called from the switch loop. Returns 1 once the servers were handed
+ * over, this process must stop accepting then. */
+int upgrade_poke(netc_t *servers[], const char *ports[], int count)
+{
+	struct upgrade_msg msg;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * NET_INHERIT_MAX)];
+	} control;
+	int fds[NET_INHERIT_MAX];
+	int sock, fd, i;
+	int ret = 0;
+
+	if (listen_fd < 0)
+		return 0;
+
+	if ((sock = accept(listen_fd, NULL, NULL)) < 0)
+		return 0;
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+	upgrade_timeout(sock);
+
+	if (!upgrade_valid(&msg, recv(sock, &msg, sizeof(msg), MSG_WAITALL))) {
+		jlog(L_WARNING, "invalid upgrade request");
+		goto out;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memcpy(msg.magic, "NVUP", 4);
+	msg.version = UPGRADE_VERSION;
+	krypt_get_ticket_key(msg.ticket_key);
+
+	for (i = 0; i < count && msg.count < NET_INHERIT_MAX; i++) {
+		if ((fd = net_server_socket(servers[i])) < 0)
+			continue;
+		msg.protocol[msg.count] = servers[i]->protocol;
+		snprintf(msg.port[msg.count], sizeof(msg.port[0]), "%s", ports[i]);
+		fds[msg.count++] = fd;
+	}
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if (msg.count > 0) {
+		memset(&control, 0, sizeof(control));
+		mh.msg_control = control.buf;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * msg.count);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * msg.count);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * msg.count);
+	}
+
+	if (sendmsg(sock, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+		jlog(L_WARNING, "upgrade failed: %s", strerror(errno));
+		goto out;
+	}
+
+	jlog(L_NOTICE, "handed %d listening sockets over, draining", msg.count);
+
+	/* the path belongs to the new process now */
+	close(listen_fd);
+	listen_fd = -1;
+	free(listen_path);
+	listen_path = NULL;
+	ret = 1;
+
+out:
+	close(sock);
+	return ret;
+}
+
+void upgrade_fini()
+{
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(listen_path);
+	}
+	listen_fd = -1;
+
+	free(listen_path);
+	listen_path = NULL;
+}
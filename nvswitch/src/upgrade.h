@@ -0,0 +1,28 @@
+/*
+ * NetVirt - Network Virtualization Platform
+ * Copyright (C) 2009-2016
+ * Nicolas J. Bouliane <admin@netvirt.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details
+ */
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <netbus.h>
+
+#define UPGRADE_VERSION		1
+
+int upgrade_take(const char *path);
+int upgrade_listen(const char *path);
+int upgrade_poke(netc_t *servers[], const char *ports[], int count);
+void upgrade_fini();
+
+#endif /* UPGRADE_H */
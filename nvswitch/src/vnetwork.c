@@ -90,6 +90,43 @@ void vnetwork_add_session(struct vnetwork *vnet, struct session *session)
 	bitpool_allocate_bit(vnet->bitpool, MAX_NODE, &session->id);
 	session->id+=1;
 	vnet->active_node++;
+
+	tbucket_init(&session->flood, vnet->flood_session_pps, 0);
+	session->flood_dropped = 0;
+	session->unknown_unicast = 0;
+}
+
+/* Limits of the broadcast, multicast and unknown unicast frames, 0 is unlimited */
+void vnetwork_set_flood(struct vnetwork *vnet, uint32_t session_pps, uint32_t network_pps)
+{
+	vnet->flood_session_pps = session_pps;
+	tbucket_init(&vnet->flood, network_pps, 0);
+}
+
+/* From the control thread, the switch thread sends the agents there */
+void vnetwork_move(struct vnetwork *vnet, const char *address, uint16_t port, uint16_t port_tcp)
+{
+	pthread_mutex_lock(&vnet->move_lock);
+	snprintf(vnet->move.address, sizeof(vnet->move.address), "%s", address);
+	vnet->move.port = port;
+	vnet->move.port_tcp = port_tcp;
+	vnet->move_pending = 1;
+	pthread_mutex_unlock(&vnet->move_lock);
+}
+
+/* Returns 1 and the switch to send the agents to, once per move */
+int vnetwork_move_take(struct vnetwork *vnet, struct vnetwork_move *move)
+{
+	int pending;
+
+	pthread_mutex_lock(&vnet->move_lock);
+	pending = vnet->move_pending;
+	if (pending)
+		*move = vnet->move;
+	vnet->move_pending = 0;
+	pthread_mutex_unlock(&vnet->move_lock);
+
+	return pending;
 }
 
 void vnetwork_show_session_list(struct vnetwork *vnet)
@@ -120,6 +157,20 @@ struct vnetwork *vnetwork_lookup_id(const char *id)
 	return RB_FIND(vnetwork_tree_id, &vnetworks_id, &match);
 }
 
+/* Passport of the network named by an agent during the handshake,
+ * by uuid or, for the version 1 certificates, by id. */
+passport_t *vnetwork_passport_lookup(const char *name)
+{
+	struct vnetwork *vnet;
+
+	if (strlen(name) == 36)
+		vnet = vnetwork_lookup(name);
+	else
+		vnet = vnetwork_lookup_id(name);
+
+	return vnet ? vnet->passport : NULL;
+}
+
 void vnetwork_free(struct vnetwork *vnet)
 {
 	if (vnet) {
@@ -128,14 +179,25 @@ void vnetwork_free(struct vnetwork *vnet)
 		ftable_delete(vnet->ftable);
 		ctable_delete(vnet->ctable);
 		ctable_delete(vnet->atable);
+		neigh_free(vnet->neigh);
+		mcast_free(vnet->mcast);
 		bitpool_free(vnet->bitpool);
 		session_free(vnet->access_session);
+		pthread_mutex_destroy(&vnet->move_lock);
 		free(vnet->id);
 		free(vnet->uuid);
 		free(vnet);
 	}
 }
 
+void vnetwork_foreach(void (*cb)(struct vnetwork *))
+{
+	struct vnetwork *vnet;
+
+	RB_FOREACH(vnet, vnetwork_tree, &vnetworks)
+		cb(vnet);
+}
+
 void vnetworks_free()
 {
 /*
@@ -174,6 +236,9 @@ int vnetwork_create(char *id, char *uuid, char *address, char *netmask,
 	vnet->id = strdup(id);
 
 	vnet->passport = pki_passport_load_from_memory(serverCert, serverPrivkey, trustedCert);
+	/* the switches name the network when they open a trunk */
+	if (vnet->passport != NULL)
+		vnet->passport->network = strdup(uuid);
 
 	bitpool_new(&vnet->bitpool, MAX_NODE);
 	vnet->linkst = linkst_new(MAX_NODE, TIMEOUT_SEC);
@@ -185,6 +250,9 @@ int vnetwork_create(char *id, char *uuid, char *address, char *netmask,
 	vnet->ftable = ftable_new(MAX_NODE, session_itemdup, session_itemrel);
 	vnet->ctable = ctable_new(MAX_NODE, session_itemdup, session_itemrel);
 	vnet->atable = ctable_new(MAX_NODE, session_itemdup, session_itemrel);
+	vnet->neigh = neigh_new(MAX_NODE);
+	vnet->mcast = mcast_new(MAX_NODE);
+	pthread_mutex_init(&vnet->move_lock, NULL);
 
 	RB_INSERT(vnetwork_tree, &vnetworks, vnet);
 	RB_INSERT(vnetwork_tree_id, &vnetworks_id, vnet);
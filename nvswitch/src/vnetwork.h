@@ -16,6 +16,8 @@
 #ifndef VNETWORK_H
 #define VNETWORK_H
 
+#include <pthread.h>
+
 #include <crypto.h>
 #include <ftable.h>
 #include <netbus.h>
@@ -23,12 +25,21 @@
 
 #include "ctable.h"
 #include "linkst.h"
+#include "mcast.h"
+#include "neigh.h"
 #include "switch.h"
+#include "tbucket.h"
 #include "tree.h"
 
 #define MAX_NODE 1024	// the maximum of nodes per context
 #define TIMEOUT_SEC 300	// linkstate timeout in second
 
+struct vnetwork_move {
+	char		address[64];
+	uint16_t	port;
+	uint16_t	port_tcp;
+};
+
 struct vnetwork {
 	RB_ENTRY(vnetwork)	entry;
 	RB_ENTRY(vnetwork)	entry_id;
@@ -37,21 +48,38 @@ struct vnetwork {
 	ftable_t		*ftable;			// forwarding table
 	ctable_t		*ctable;			// connection table
 	ctable_t		*atable;			// access table
+	neigh_t			*neigh;				// IP to MAC of the nodes, for the ARP/ND proxy
+	mcast_t			*mcast;				// multicast groups joined by the sessions
 	uint32_t		 active_node;			// number of connected node
 	linkst_t		*linkst;			// link state between nodes
 	uint8_t			*bitpool;			// bitpool used to generated unique ID per session
 	struct session		*session_list;			// all session open in this context
 	struct session		*access_session;		// store the access session in the access table for every known UUID
 	passport_t		*passport;
+	uint8_t			 compression;			// payload compression method, COMPRESS_NONE if off
+	uint32_t		 flood_session_pps;		// flooded frames per second allowed to each session
+	struct tbucket		 flood;				// flooded frames of the whole vnetwork
+	uint64_t		 flood_dropped;			// flooded frames dropped by the storm control
+	uint64_t		 unknown_unicast;		// frames flooded for an unknown destination
+	struct session		*trunk[TRUNK_PEERS_MAX];	// trunks we dialed, by peer
+	uint32_t		 trunks;			// trunks up, dialed or accepted
+	pthread_mutex_t		 move_lock;			// move and move_pending, set by the control thread
+	struct vnetwork_move	 move;				// the switch the controller moved us to
+	uint8_t			 move_pending;			// the agents are yet to be sent there
 };
 
 void vnetworks_free();
 void vnetwork_free(struct vnetwork *);
 void vnetwork_del_session(struct vnetwork *, struct session *);
 void vnetwork_add_session(struct vnetwork *, struct session *);
+void vnetwork_set_flood(struct vnetwork *, uint32_t, uint32_t);
+void vnetwork_move(struct vnetwork *, const char *, uint16_t, uint16_t);
+int vnetwork_move_take(struct vnetwork *, struct vnetwork_move *);
 struct vnetwork *vnetwork_disable(const char *);
 struct vnetwork *vnetwork_lookup(const char *);
 struct vnetwork *vnetwork_lookup_id(const char *id);
+void vnetwork_foreach(void (*)(struct vnetwork *));
+passport_t *vnetwork_passport_lookup(const char *);
 int vnetwork_create(char *, char *, char *, char *, char *, char *, char *);
 void vnetwork_fini(void *);
 int vnetwork_init();